@@ -1,8 +1,8 @@
 win32{
 	BOOST_INCLUDE_DIR = "D:/boost_1_55_0/"
 	BOOST_LIB_DIR = "D:/boost_1_55_0/stage/lib/"
-	BOOST_LIBRARIES_DEBUG = boost_system-vc100-mt-gd-1_55.lib
-	BOOST_LIBRARIES_RELEASE = boost_system-vc100-mt-1_55.lib
+	BOOST_LIBRARIES_DEBUG = boost_system-vc100-mt-gd-1_55.lib boost_filesystem-vc100-mt-gd-1_55.lib
+	BOOST_LIBRARIES_RELEASE = boost_system-vc100-mt-1_55.lib boost_filesystem-vc100-mt-1_55.lib
 
 	EIGEN3_INCLUDE_DIR = "C:/Program Files/Eigen3/include/eigen3/"
 
@@ -46,7 +46,7 @@ unix{
 	INCLUDEPATH += . /usr/include/vtk-5.8/ /usr/local/include/pcl-1.8/ /usr/include/eigen3/
 	LIBS += -L/usr/lib/ \
 			-lQVTK -lvtkCommon -lQVTK -lvtkRendering -lvtkFiltering -lvtkGraphics \
-			-lboost_system \
+			-lboost_system -lboost_filesystem \
 		-L/usr/lib/gcc/x85_64-linux-gnu/ \
 			-lgomp \
 		-L/usr/local/lib/ \
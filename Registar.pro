@@ -24,6 +24,20 @@ HEADERS += include/mainwindow.h \
 			include/boundaryestimation.h \
 			include/outliersremovaldialog.h \
 			include/outliersremoval.h \
+			include/neighbourtable.h \
+			include/warmstartsearch.h \
+			include/voxelhashsearch.h \
+			include/nearestsearch.h \
+			include/flatkdtree.h \
+			include/projectivesearch.h \
+			include/mortonorder.h \
+			include/correspondencekernel.h \
+			include/bulktransform.h \
+			include/umeyama.h \
+			include/planeicp.h \
+			include/pointsampling.h \
+			include/robustweights.h \
+			include/coarsealignment.h \
 			include/normalfielddialog.h \
 			include/normalfield.h \
 			include/pairwiseregistrationdialog.h \
@@ -36,6 +50,7 @@ HEADERS += include/mainwindow.h \
 			diagram/propertiesdialog.h \
 			include/globalregistrationdialog.h \
 			include/globalregistration.h \
+			include/posegraph.h \
 			manual_registration/manual_registration.h \
 			include/utilities.h \
 			include/registrationdatamanager.h \
@@ -74,6 +89,19 @@ SOURCES += src/main.cpp \
 			src/boundaryestimation.cpp \
 			src/outliersremovaldialog.cpp \
 			src/outliersremoval.cpp \
+			src/neighbourtable.cpp \
+			src/warmstartsearch.cpp \
+			src/voxelhashsearch.cpp \
+			src/nearestsearch.cpp \
+			src/flatkdtree.cpp \
+			src/projectivesearch.cpp \
+			src/mortonorder.cpp \
+			src/bulktransform.cpp \
+			src/umeyama.cpp \
+			src/planeicp.cpp \
+			src/pointsampling.cpp \
+			src/robustweights.cpp \
+			src/coarsealignment.cpp \
 			src/normalfielddialog.cpp \
 			src/normalfield.cpp \
 			src/pairwiseregistrationdialog.cpp \
@@ -84,6 +112,7 @@ SOURCES += src/main.cpp \
 			diagram/propertiesdialog.cpp \
 			src/globalregistrationdialog.cpp \
 			src/globalregistration.cpp \
+			src/posegraph.cpp \
 			manual_registration/manual_registration.cpp \
 			src/utilities.cpp \
 			src/registrationdatamanager.cpp \
@@ -104,7 +133,11 @@ SOURCES += src/main.cpp \
 			src/tang2014.cpp \
 			src/args_converter.cpp \
 			../Tang2014/pairregistration.cpp \
+			../Tang2014/pointpairs.cpp \
 			../Tang2014/tang2014_globalregistration.cpp \
+			../Tang2014/checkpoint.cpp \
+			../Tang2014/scan.cpp \
+			../Tang2014/scancache.cpp \
 			../Tang2014/graph.cpp \
 			../Williams2001/SRoMCPS.cpp \
 			src/backgroundcolordialog.cpp
@@ -43,20 +43,52 @@ unix{
 HEADERS += graph.h \
 			common.h \
 			pairregistration.h \
+			pointpairs.h \
 			globalregistration.h \
 			scan.h \
+			scancache.h \
 			loop.h \
 			link.h \
-			../Williams2001/SRoMCPS.h
+			../Williams2001/SRoMCPS.h \
+			../include/posegraph.h \
+			../include/neighbourtable.h \
+			../include/warmstartsearch.h \
+			../include/voxelhashsearch.h \
+			../include/nearestsearch.h \
+			../include/flatkdtree.h \
+			../include/mortonorder.h \
+			../include/correspondencekernel.h \
+			../include/bulktransform.h \
+			../include/umeyama.h \
+			../include/planeicp.h \
+			../include/pointsampling.h \
+			../include/robustweights.h \
+			../include/coarsealignment.h
 
 SOURCES += graph.cpp \
 			pairregistration.cpp \
+			pointpairs.cpp \
 			tang2014_globalregistration.cpp \
+			checkpoint.cpp \
 			main.cpp \
 			scan.cpp \
+			scancache.cpp \
 			loop.cpp \
 			link.cpp \
-			../Williams2001/SRoMCPS.cpp
+			../Williams2001/SRoMCPS.cpp \
+			../src/posegraph.cpp \
+			../src/neighbourtable.cpp \
+			../src/warmstartsearch.cpp \
+			../src/voxelhashsearch.cpp \
+			../src/nearestsearch.cpp \
+			../src/flatkdtree.cpp \
+			../src/mortonorder.cpp \
+			../src/bulktransform.cpp \
+			../src/umeyama.cpp \
+			../src/planeicp.cpp \
+			../src/pointsampling.cpp \
+			../src/robustweights.cpp \
+			../src/coarsealignment.cpp
 
 
 
@@ -0,0 +1,270 @@
+#include "globalregistration.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+
+namespace tang2014
+{
+	namespace
+	{
+		const char checkpointMagic[8] = {'T', 'A', 'N', 'G', 'C', 'K', 'P', 'T'};
+		const unsigned int checkpointVersion = 5;
+
+		// FNV-1a over the fields that decide the result of a stage
+		struct CheckpointHash
+		{
+			unsigned long long value;
+			CheckpointHash() : value(14695981039346656037ULL) {}
+			void add(const void *_data, size_t _size)
+			{
+				const unsigned char *bytes = static_cast<const unsigned char*>(_data);
+				for (size_t i = 0; i < _size; ++i)
+				{
+					value ^= bytes[i];
+					value *= 1099511628211ULL;
+				}
+			}
+			void add(unsigned int _value) { add(&_value, sizeof(_value)); }
+			void add(float _value) { add(&_value, sizeof(_value)); }
+			void add(bool _value) { unsigned char c = _value ? 1 : 0; add(&c, 1); }
+			void add(const std::string &_value) { add(static_cast<unsigned int>(_value.size())); add(_value.data(), _value.size()); }
+			void add(const Transformation &_value) { add(_value.data(), 16 * sizeof(float)); }
+		};
+
+		struct CheckpointHeader
+		{
+			char magic[8];
+			unsigned int version;
+			unsigned int stage;
+			unsigned long long hash;
+			unsigned int scanNum;
+			unsigned int linkNum;
+		};
+
+		template <typename T> inline void writeValue(std::ofstream &_out, const T &_value) { _out.write(reinterpret_cast<const char*>(&_value), sizeof(T)); }
+		template <typename T> inline bool readValue(std::ifstream &_in, T &_value) { return _in.read(reinterpret_cast<char*>(&_value), sizeof(T)).good(); }
+
+		inline void writeTransformation(std::ofstream &_out, const Transformation &_transformation) 
+		{
+			_out.write(reinterpret_cast<const char*>(_transformation.data()), 16 * sizeof(float));
+		}
+		inline bool readTransformation(std::ifstream &_in, Transformation &_transformation) 
+		{
+			return _in.read(reinterpret_cast<char*>(_transformation.data()), 16 * sizeof(float)).good();
+		}
+
+		template <typename T> inline void writeArray(std::ofstream &_out, const std::vector<T> &_array)
+		{
+			if (!_array.empty()) _out.write(reinterpret_cast<const char*>(&_array[0]), _array.size() * sizeof(T));
+		}
+		template <typename T> inline bool readArray(std::ifstream &_in, std::vector<T> &_array, size_t _size)
+		{
+			_array.resize(_size);
+			return _array.empty() || _in.read(reinterpret_cast<char*>(&_array[0]), _size * sizeof(T)).good();
+		}
+
+		bool readHeader(std::ifstream &_in, CheckpointHeader &_header)
+		{
+			return _in.read(_header.magic, 8).good() && readValue(_in, _header.version) && readValue(_in, _header.stage) && 
+				readValue(_in, _header.hash) && readValue(_in, _header.scanNum) && readValue(_in, _header.linkNum);
+		}
+	}
+
+	std::string GlobalRegistration::checkpointFileName(Stage _stage) const
+	{
+		switch(_stage)
+		{
+			case PAIR_STAGE: return para.checkpointPath + ".pair.ckpt";
+			case LOOP_STAGE: return para.checkpointPath + ".loop.ckpt";
+			case GLOBAL_STAGE: return para.checkpointPath + ".global.ckpt";
+			default: return std::string();
+		}
+	}
+
+	unsigned long long GlobalRegistration::checkpointHash(Stage _stage) const
+	{
+		CheckpointHash hash;
+		hash.add(checkpointVersion);
+		hash.add(static_cast<unsigned int>(_stage));
+
+		hash.add(static_cast<unsigned int>(scanPtrs.size()));
+		for (int i = 0; i < scanPtrs.size(); ++i)
+		{
+			hash.add(scanPtrs[i]->filePath);
+			// the initial pose from the .tf file, the scan is loaded already transformed by it
+			hash.add(scanPtrs[i]->transformation);
+			// scans indexed from files are keyed before they are loaded, by the header of the ply and the order asked for
+			const Scan &scan = *scanPtrs[i];
+			bool indexed = !scan.boundaryFilePath.empty();
+			hash.add(indexed ? plyVertexNumber(scan.filePath) : static_cast<unsigned int>(scan.pointsPtr->size()));
+			hash.add(indexed ? para.sc_para.mortonOrder : scan.mortonOrder);
+		}
+		hash.add(static_cast<unsigned int>(links.size()));
+		for (int i = 0; i < links.size(); ++i)
+		{
+			hash.add(links[i].a);
+			hash.add(links[i].b);
+		}
+
+		const PairRegistration::Parameters &pr_para = para.pr_para;
+		hash.add(static_cast<unsigned int>(pr_para.mMethod));
+		hash.add(static_cast<unsigned int>(pr_para.sMethod));
+		hash.add(pr_para.distanceTest);
+		hash.add(pr_para.distThreshold);
+		hash.add(pr_para.angleTest);
+		hash.add(pr_para.angleThreshold);
+		hash.add(pr_para.boundaryTest);
+		hash.add(pr_para.biDirection);
+		hash.add(pr_para.iterationNum_max);
+		hash.add(pr_para.iterationNum_min);
+		hash.add(pr_para.activeSet);
+		hash.add(pr_para.activeSetMargin);
+		hash.add(pr_para.activeSetRefresh);
+		// the searches answer the same queries up to ties between equally near points, which can change the result
+		hash.add(pr_para.warmStart);
+		hash.add(pr_para.voxelHash);
+		hash.add(pr_para.flatKdTree);
+		hash.add(static_cast<unsigned int>(pr_para.sampling.method));
+		hash.add(pr_para.sampling.ratio);
+		hash.add(pr_para.sampling.refresh);
+		hash.add(pr_para.robust.overlapRatio);
+		hash.add(static_cast<unsigned int>(pr_para.robust.kernel));
+		hash.add(pr_para.robust.kernelWidth);
+		hash.add(para.coarseVoxelSize);
+		hash.add(para.doInitialPairRegistration);
+		hash.add(para.pairIterationNum);
+
+		if (_stage >= LOOP_STAGE)
+		{
+			hash.add(para.doIncrementalLoopRefine);
+			hash.add(static_cast<unsigned int>(loops.size()));
+			for (int i = 0; i < loops.size(); ++i)
+			{
+				hash.add(static_cast<unsigned int>(loops[i].scanIndices.size()));
+				for (int j = 0; j < loops[i].scanIndices.size(); ++j) hash.add(loops[i].scanIndices[j]);
+			}
+		}
+
+		if (_stage >= GLOBAL_STAGE)
+		{
+			hash.add(para.doGlobalRefine);
+			hash.add(para.doPoseGraphRefine);
+			hash.add(para.globalIterationNum_max);
+			hash.add(para.globalIterationNum_min);
+		}
+
+		return hash.value;
+	}
+
+	bool GlobalRegistration::checkpointValid(Stage _stage) const
+	{
+		if (para.checkpointPath.empty()) return false;
+
+		std::ifstream in(checkpointFileName(_stage).c_str(), std::ios::in | std::ios::binary);
+		if (!in.is_open()) return false;
+
+		CheckpointHeader header;
+		if (!readHeader(in, header)) return false;
+		return std::memcmp(header.magic, checkpointMagic, 8) == 0 && header.version == checkpointVersion && 
+			header.stage == static_cast<unsigned int>(_stage) && header.hash == checkpointHash(_stage) &&
+			header.scanNum == scanPtrs.size() && header.linkNum == links.size();
+	}
+
+	bool GlobalRegistration::saveCheckpoint(Stage _stage)
+	{
+		if (para.checkpointPath.empty()) return false;
+
+		// write to a temporary file first so an interrupted run never leaves a truncated checkpoint behind
+		std::string fileName = checkpointFileName(_stage);
+		std::string tempFileName = fileName + ".tmp";
+		std::ofstream out(tempFileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open())
+		{
+			std::cout << "cannot write checkpoint " << tempFileName << std::endl;
+			return false;
+		}
+
+		out.write(checkpointMagic, 8);
+		writeValue(out, checkpointVersion);
+		writeValue(out, static_cast<unsigned int>(_stage));
+		writeValue(out, checkpointHash(_stage));
+		writeValue(out, static_cast<unsigned int>(scanPtrs.size()));
+		writeValue(out, static_cast<unsigned int>(links.size()));
+
+		for (int i = 0; i < scanPtrs.size(); ++i) writeTransformation(out, transformations[i]);
+
+		for (int i = 0; i < links.size(); ++i)
+		{
+			const PairRegistrationPtr &pairRegistrationPtr = pairRegistrationPtrMap[links[i]];
+			const PairRegistration::PointPairs &final_s2t = pairRegistrationPtr->final_s2t;
+
+			writeValue(out, links[i].a);
+			writeValue(out, links[i].b);
+			writeTransformation(out, pairRegistrationPtr->transformation);
+			writeValue(out, static_cast<unsigned int>(final_s2t.size()));
+
+			// the pair arrays are written as they are, the optional indices are not kept
+			writeArray(out, final_s2t.sourcePositions);
+			writeArray(out, final_s2t.targetPositions);
+			writeArray(out, final_s2t.sourceNormals);
+			writeArray(out, final_s2t.targetNormals);
+			writeArray(out, final_s2t.weights);
+		}
+
+		bool ok = out.good();
+		out.close();
+		if (ok)
+		{
+			std::remove(fileName.c_str());
+			ok = std::rename(tempFileName.c_str(), fileName.c_str()) == 0;
+		}
+		if (!ok) std::cout << "failed to write checkpoint " << fileName << std::endl;
+		else std::cout << "checkpoint written : " << fileName << std::endl;
+		return ok;
+	}
+
+	bool GlobalRegistration::loadCheckpoint(Stage _stage)
+	{
+		if (!checkpointValid(_stage)) return false;
+
+		std::string fileName = checkpointFileName(_stage);
+		std::ifstream in(fileName.c_str(), std::ios::in | std::ios::binary);
+		CheckpointHeader header;
+		if (!readHeader(in, header)) return false;
+
+		Transformations transformations_loaded(scanPtrs.size());
+		for (int i = 0; i < scanPtrs.size(); ++i) 
+		{
+			if (!readTransformation(in, transformations_loaded[i])) return false;
+		}
+
+		std::vector<Transformation, Eigen::aligned_allocator<Transformation> > pairTransformations(links.size());
+		std::vector<PairRegistration::PointPairs> pairs(links.size());
+		for (int i = 0; i < links.size(); ++i)
+		{
+			unsigned int a, b, pairNum;
+			if (!readValue(in, a) || !readValue(in, b) || a != links[i].a || b != links[i].b) return false;
+			if (!readTransformation(in, pairTransformations[i]) || !readValue(in, pairNum)) return false;
+
+			PairRegistration::PointPairs &loaded = pairs[i];
+			if (!readArray(in, loaded.sourcePositions, 3 * pairNum) || !readArray(in, loaded.targetPositions, 3 * pairNum) ||
+				!readArray(in, loaded.sourceNormals, pairNum) || !readArray(in, loaded.targetNormals, pairNum) ||
+				!readArray(in, loaded.weights, pairNum)) return false;
+		}
+
+		// only commit once the whole file has been read
+		transformations = transformations_loaded;
+		for (int i = 0; i < links.size(); ++i)
+		{
+			PairRegistrationPtr &pairRegistrationPtr = pairRegistrationPtrMap[links[i]];
+			pairRegistrationPtr->transformation = pairTransformations[i];
+			pairRegistrationPtr->final_s2t.swap(pairs[i]);
+		}
+		scanCache.setPointPairBytes(pointPairBytes());
+
+		std::cout << "checkpoint loaded : " << fileName << std::endl;
+		return true;
+	}
+}
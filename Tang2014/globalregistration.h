@@ -5,25 +5,41 @@
 #include "link.h"
 #include "loop.h"
 #include "scan.h"
+#include "scancache.h"
 #include "pairregistration.h"
 #include "graph.h"
 
+#include "../Williams2001/SRoMCPS.h"
+#include "../include/coarsealignment.h"
+
+#include <string>
+
 namespace tang2014
 {
 	class GlobalRegistration
 	{
 	public:
 
+		enum Stage
+		{
+			NO_STAGE = 0, PAIR_STAGE = 1, LOOP_STAGE = 2, GLOBAL_STAGE = 3
+		};
+
 		struct Parameters
 		{
 			PairRegistration::Parameters pr_para;
+			ScanCache::Parameters sc_para;
 
 			bool doInitialPairRegistration;
 			bool doIncrementalLoopRefine;
 			bool doGlobalRefine;
+			bool doPoseGraphRefine;
 			unsigned int globalIterationNum_max;
 			unsigned int globalIterationNum_min;
 			unsigned int pairIterationNum;
+			float coarseVoxelSize;      // keypoint spacing of the coarse alignment starting each link, 0 starts them from the identity
+			std::string checkpointPath; // prefix of the stage checkpoints, empty disables them
+			bool resume;
 		} para;
 
 		GlobalRegistration(ScanPtrs _scanPtrs = ScanPtrs(), Links _links = Links(), Loops _loops = Loops()) : scanPtrs(_scanPtrs), links(_links), loops(_loops) {}
@@ -35,9 +51,18 @@ namespace tang2014
 		void startRegistration();
 
 		void initialTransformations();
-		void buildKdTreePtrs();
+		// the scans are loaded by the cache as the links need them, with the searches para.pr_para asks for
+		void initialScanCache();
+		void buildCoarseFeaturePtr(ScanIndex _i);
+
+		// holds the scans of a link in the cache and hands their searches to its pair registration, which gives them
+		// back on release when the cache is bounded
+		void acquireLink(const Link &_link);
+		void releaseLink(const Link &_link);
+		// of the final point pairs of all links, charged to the scan cache
+		double pointPairBytes() const;
 
-		void initialPairRegistration();
+		void initialPairRegistration(bool _doRegistration = true);
 
 		void initialGraph();
 		void incrementalLoopRefine();
@@ -51,18 +76,36 @@ namespace tang2014
 		void generateFinalPointPairs(std::vector<GraphVertex*> &_vertices1, Transformations &_transformations1, 
 			std::vector<GraphVertex*> &_vertices2, Transformations &_transformations2, 
 			bool _rePairGenerate, bool useVirtualMate, PairRegistration::PointPairs &_all_final_s2t);
+		void generateFinalPointPairMoments(std::vector<GraphVertex*> &_vertices1, Transformations &_transformations1, 
+			std::vector<GraphVertex*> &_vertices2, Transformations &_transformations2, 
+			bool _rePairGenerate, bool useVirtualMate, williams2001::PointPairMoments &_moments);
+		static void accumulatePointPairMoments(const PairRegistration::PointPairs &_pairs, 
+			const Transformation &_xTransformation, bool _xFromTarget, const Transformation &_yTransformation, bool _yFromTarget, 
+			williams2001::PointPairMoments &_moments);
 		void makeEdgesConsistent(std::vector<GraphVertex*> &_vertices1, Transformations &_transformations1, 
 			std::vector<GraphVertex*> &_vertices2, Transformations &_transformations2,
 			Transformation &_newTransformation);
 		
 		void globalPairRefine();
 		void globalRefine(unsigned int _iterationNum_max, unsigned int _iterationNum_min);
+		void globalPoseGraphRefine(unsigned int _iterationNum_max, unsigned int _iterationNum_min);
+		// the pairs of every link over the points sampled for iteration _iter, see PairRegistration::sampledIndices
+		void generateLinkMoments(williams2001::PointPairMomentsVector &_moments, int _iter = 0);
+
+		// binary snapshots of the pair transformations, final point pairs and scan transformations after each stage,
+		// the loop graph itself is not stored since the stages after it only need the snapshot
+		std::string checkpointFileName(Stage _stage) const;
+		unsigned long long checkpointHash(Stage _stage) const;
+		bool checkpointValid(Stage _stage) const;
+		bool saveCheckpoint(Stage _stage);
+		bool loadCheckpoint(Stage _stage);
 
 		ScanPtrs scanPtrs;
 		Links links;
 		Loops loops;
 
-		KdTreePtrs kdTreePtrs;
+		ScanCache scanCache;
+		std::vector<registar::CoarseAlignmentFeaturesPtr> coarseFeaturePtrs;   // only built for coarse alignment, scan by scan
 		Transformations transformations;
 
 		PairRegistrationPtrMap pairRegistrationPtrMap;
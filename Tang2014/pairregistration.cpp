@@ -4,8 +4,131 @@
 
 #include "pairregistration.h"
 #include "../include/utilities.h"
+#include "../include/correspondencekernel.h"
+#include "../include/bulktransform.h"
+#include "../include/umeyama.h"
+#include "../include/planeicp.h"
 
 #include <pcl/common/transforms.h>
+#include <algorithm>
+
+namespace
+{
+	inline int threadNumber()
+	{
+	#ifdef _OPENMP
+		return omp_get_thread_num();
+	#else
+		return 0;
+	#endif
+	}
+
+	// false for zero and NaN normals, which the packed pairs keep as invalidNormal
+	inline bool validNormal(const tang2014::Point &_point)
+	{
+		float sqrNorm = _point.getNormalVector3fMap().squaredNorm();
+		return sqrNorm > 0.0f && sqrNorm <= std::numeric_limits<float>::max();
+	}
+
+	// the loop over the queried source points, instantiated once per kernel so the tests and the match method are not
+	// looked at per point; each thread appends to its own pairs and active indices
+	struct PointPairGenerator
+	{
+		PointPairGenerator(tang2014::ScanPtr _target, const tang2014::Points &_sbuffer, tang2014::KdTreePtr _targetKdTree,
+			registar::NearestSearch *_targetSearch, const std::vector<int> &_candidateIndices, int _threads) :
+			target(_target), sbuffer(_sbuffer), targetKdTree(_targetKdTree), targetSearch(_targetSearch),
+			candidateIndices(_candidateIndices), threads(_threads) {}
+
+		template <typename Kernel>
+		void run()
+		{
+			const tang2014::Points &targetPoints = *target->pointsPtr;
+			int size = static_cast<int>(candidateIndices.size());
+
+			#pragma omp parallel num_threads (threads)
+			{
+				int tn = threadNumber();
+				tang2014::PointPairs &s2t = *pairs[tn];
+				std::vector<int> &activeIndices = *active[tn];
+				std::vector<int> indices(1);
+				std::vector<float> distance2s(1);
+
+				#pragma omp for schedule (dynamic,1000)
+				for (int it = 0; it < size; it++)
+				{
+					int index_query = candidateIndices[it];
+					const tang2014::Point &point_query = sbuffer[index_query];
+					bool found = targetSearch ? targetSearch->nearest(index_query, point_query, indices[0], distance2s[0]) :
+						targetKdTree->nearestKSearch(point_query, 1, indices, distance2s) > 0;
+					if (!found) continue;
+
+					int index_match = indices[0];
+					const tang2014::Point &point_match = targetPoints[index_match];
+					// the packed normals are scale free, the kernel leaves them as they are; a pair without both normals
+					// cannot be tested on its angle nor projected, and is dropped when the normals are used
+					if (Kernel::accept(point_query, point_match, index_match, distance2s[0], tests) &&
+						(!requireNormals || (validNormal(point_query) && validNormal(point_match))))
+						s2t.push_back(point_query.getVector3fMap(), point_query.getNormalVector3fMap(),
+							Kernel::targetPosition(point_query, point_match), point_match.getNormalVector3fMap(), 1.0f, index_query, index_match);
+
+					// without a distance test every point can still be matched
+					if ( (!Kernel::distanceTest) || distance2s[0] < activeDistance2 ) activeIndices.push_back(index_query);
+				}
+			}
+		}
+
+		tang2014::ScanPtr target;
+		const tang2014::Points &sbuffer;
+		tang2014::KdTreePtr targetKdTree;
+		registar::NearestSearch *targetSearch;
+		const std::vector<int> &candidateIndices;
+		int threads;
+
+		registar::CorrespondenceTests tests;
+		float activeDistance2;
+		bool requireNormals;
+
+		std::vector<tang2014::PointPairs*> pairs;
+		std::vector< std::vector<int>* > active;
+	};
+
+	// the squared distance the step leaves a pair at, along the target normal for the plane solvers
+	inline float squaredError(const tang2014::PointPairs &_pairs, int _i, const tang2014::Transformation &_step, bool _alongNormal)
+	{
+		Eigen::Vector3f difference = _step.block<3, 3>(0, 0) * _pairs.sourcePosition(_i) + _step.block<3, 1>(0, 3) - _pairs.targetPosition(_i);
+		if (!_alongNormal) return difference.squaredNorm();
+		float distance = difference.dot(_pairs.targetNormal(_i));
+		return distance * distance;
+	}
+
+	// one parallel pass over the pairs about their weighted centroids, which the Umeyama moments give
+	registar::PlaneICPMoments accumulatePlaneICPMoments(const tang2014::PointPairs &_s2t, bool _symmetric)
+	{
+		registar::UmeyamaMoments centroids = registar::accumulateUmeyamaMoments(&_s2t.sourcePositions[0],
+			&_s2t.targetPositions[0], &_s2t.weights[0], _s2t.size());
+		registar::PlaneICPMoments moments(centroids.sourceReference, centroids.targetReference);
+		if (!(centroids.w > 0.0)) return moments;
+		moments.sourceReference += centroids.sumSource / centroids.w;
+		moments.targetReference += centroids.sumTarget / centroids.w;
+
+		int threads = 1;
+	#ifdef _OPENMP
+		threads = omp_get_num_procs();
+	#endif
+		int size = _s2t.size();
+		registar::PlaneICPMomentsVector threadMoments(threads, moments);
+		#pragma omp parallel for schedule (static) num_threads (threads)
+		for (int i = 0; i < size; ++i)
+		{
+			if (_s2t.weights[i] == 0.0f) continue;
+			registar::PlaneICPMoments &sums = threadMoments[threadNumber()];
+			if (_symmetric) sums.addSymmetric(_s2t.sourcePosition(i), _s2t.sourceNormal(i), _s2t.targetPosition(i), _s2t.targetNormal(i), _s2t.weights[i]);
+			else sums.addGeneralized(_s2t.sourcePosition(i), _s2t.sourceNormal(i), _s2t.targetPosition(i), _s2t.targetNormal(i), _s2t.weights[i]);
+		}
+		for (int t = 0; t < threads; ++t) moments += threadMoments[t];
+		return moments;
+	}
+}
 
 namespace tang2014
 {
@@ -15,7 +138,6 @@ namespace tang2014
 
 		PointsPtr buffer(new Points);
 		PointPairs s2t, t2s;
-		Eigen::Matrix3Xf src, tgt;
 
 		float last_rms_error = std::numeric_limits<float>::max();
 
@@ -30,32 +152,29 @@ namespace tang2014
 			if(para.biDirection) 
 			{
 				generatePointPairs(target, source, targetKdTree, sourceKdTree, 
-					targetCandidateIndices, targetCandidateIndices_temp, 
-					sourceCandidateIndices, sourceCandidateIndices_temp,
-					buffer, initialTransformation, para, s2t, t2s);
+					activeIndices(false, iter), targetCandidateIndices_temp, 
+					activeIndices(true, iter), sourceCandidateIndices_temp,
+					buffer, initialTransformation, para, s2t, t2s, getTargetSearch(), getSourceSearch());
 				// std::cout << "s2t.size() = " << s2t.size() << std::endl;
 				// std::cout << "t2s.size() = " << t2s.size() << std::endl;
-				for (int i = 0; i < t2s.size(); ++i)
-				{
-					PointPair temp;
-					temp.sourcePoint = registar::transformPointWithNormal(t2s[i].targetPoint, initialTransformation );
-					temp.targetPoint = registar::transformPointWithNormal(t2s[i].sourcePoint, initialTransformation );
-					s2t.push_back(temp);
-				}
+				s2t.appendTransformed(t2s, initialTransformation, false, initialTransformation, true);
 			}
 			else 
 			{
-				generatePointPairs(target, source, targetKdTree, sourceCandidateIndices, sourceCandidateIndices_temp, buffer, initialTransformation, para, s2t);
+				generatePointPairs(target, source, targetKdTree, activeIndices(true, iter), sourceCandidateIndices_temp, buffer, initialTransformation, para, s2t, getTargetSearch());
 				// std::cout << "s2t.size() = " << s2t.size() << std::endl;
 			}
-			tempTransformation = solveRegistration(s2t, src, tgt);	
+			updateActiveIndices();
+			weightPointPairs(s2t, para, 1);
+			tempTransformation = solveRegistration(s2t);	
 
 			float total_error = 0.0f;
 			float total_weight = 0.0f;
+			bool alongNormal = isPlaneSolver(para.sMethod);
 			for (int i = 0; i < s2t.size(); ++i)
 			{
-				total_error += ( registar::transformPointWithNormal(s2t[i].sourcePoint, tempTransformation).getVector3fMap() - s2t[i].targetPoint.getVector3fMap() ).squaredNorm();
-				total_weight += 1.0f;
+				total_error += s2t.weights[i] * squaredError(s2t, i, tempTransformation, alongNormal);
+				total_weight += s2t.weights[i];
 			}
 			float rms_error = sqrtf( total_error / total_weight );
 			std::cout << "pairregistration rms_error = " <<  rms_error << " total_weight = " << total_weight << std::endl;
@@ -73,7 +192,7 @@ namespace tang2014
 		std::cout << transformation << std::endl;
 
 		final_s2t.swap(s2t);
-		for (int j = 0; j < final_s2t.size(); ++j) final_s2t[j].sourcePoint = registar::transformPointWithNormal(final_s2t[j].sourcePoint, lastTransformation.inverse());
+		final_s2t.transformSource(lastTransformation.inverse());
 	}
 
 	void PairRegistration::initiateCandidateIndices()
@@ -82,112 +201,154 @@ namespace tang2014
 		sourceCandidateIndices.clear();
 		for (int i = 0; i < target->pointsPtr->size(); ++i) targetCandidateIndices.push_back(i);
 		for (int i = 0; i < source->pointsPtr->size(); ++i) sourceCandidateIndices.push_back(i);
+		targetActiveIndices.clear();
+		sourceActiveIndices.clear();
+		targetSampler.reset();
+		sourceSampler.reset();
 	}
 
-	void PairRegistration::generatePointPairs(ScanPtr _target, ScanPtr _source, KdTreePtr _targetKdTree, 
-											std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
-											PointsPtr _sbuffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t)
+	const std::vector<int> &PairRegistration::activeIndices(bool _source, int _iter)
 	{
-		pcl::transformPointCloudWithNormals(*_source->pointsPtr, *_sbuffer, _transformation);
-
-		MatchMethod mMethod = _para.mMethod;
-		bool distanceTest = _para.distanceTest;
-		float distThreshold = _para.distThreshold;
-		bool angleTest = _para.angleTest;
-		float angleThreshold = _para.angleThreshold;
-		bool boundaryTest = _para.boundaryTest;
-
-		float distanceThreshold2 = distThreshold * distThreshold;
-		float cosAngleThreshold = cosf(angleThreshold / 180.f * M_PI);
+		// a full pass builds the active set and lets points that moved back into range rejoin it
+		bool fullPass = !para.activeSet || _iter == 0 || (para.activeSetRefresh > 0 && _iter % para.activeSetRefresh == 0);
+		if (fullPass) return sampledIndices(_source, _iter);
+		return _source ? sourceActiveIndices : targetActiveIndices;
+	}
 
-		// std::vector<float> distances;
+	const std::vector<int> &PairRegistration::sampledIndices(bool _source, int _iter)
+	{
+		// the warm started searches key their queries by point index, so a new sample needs no reset
+		registar::PointSampler &sampler = _source ? sourceSampler : targetSampler;
+		sampler.setParameters(para.sampling);
+		if (_source) return sampler.sample(*source->pointsPtr, &sourceCandidateIndices, _iter);
+		return sampler.sample(*target->pointsPtr, &targetCandidateIndices, _iter);
+	}
 
-		_sourceCandidateIndices_temp.clear();
+	void PairRegistration::updateActiveIndices()
+	{
+		// the generators leave the points near the overlap in the _temp vectors
+		if (!para.activeSet) return;
+		sourceActiveIndices.swap(sourceCandidateIndices_temp);
+		if (para.biDirection) targetActiveIndices.swap(targetCandidateIndices_temp);
+	}
 
-		for (std::vector<int>::iterator it = _sourceCandidateIndices.begin(); it != _sourceCandidateIndices.end(); it++)
+	void PairRegistration::weightPointPairs(PointPairs &_pairs, const PairRegistration::Parameters &_para, unsigned int _threads)
+	{
+		if (!registar::isRobust(_para.robust) || _pairs.empty()) return;
+
+		int size = _pairs.size();
+		int threads = std::max(1u, _threads);
+		std::vector<float> residuals(size), weights(size);
+		// the residuals the solver minimizes, so pairs sliding along a plane are not taken for outliers; a pair without
+		// normals falls back to its distance
+		bool alongNormal = _para.mMethod == POINT_TO_PLANE || isPlaneSolver(_para.sMethod);
+		#pragma omp parallel for schedule (static) num_threads (threads)
+		for (int i = 0; i < size; ++i)
 		{
-			int index_query = *it;
+			Eigen::Vector3f difference = _pairs.targetPosition(i) - _pairs.sourcePosition(i);
+			residuals[i] = alongNormal && _pairs.hasNormals(i) ? std::abs(difference.dot(_pairs.targetNormal(i))) : difference.norm();
+		}
+		registar::computeRobustWeights(&residuals[0], size, _para.robust, &weights[0], threads);
+		for (int i = 0; i < size; ++i) _pairs.weights[i] *= weights[i];
+	}
 
-		// for (int index_query = 0; index_query < _sbuffer->size(); ++index_query)
-		// {	
+	float PairRegistration::searchRadius(const PairRegistration::Parameters &_para)
+	{
+		// matches are kept up to distThreshold, and up to activeSetMargin times that for the active set
+		return _para.distThreshold * (_para.activeSet ? std::max(1.0f, _para.activeSetMargin) : 1.0f);
+	}
 
-			Point point_query = (*_sbuffer)[index_query];
-			int K = 1;
-			std::vector<int> indices(K);
-			std::vector<float> distance2s(K);
-			if ( _targetKdTree->nearestKSearch(point_query, K, indices, distance2s) > 0 )
-			{
-				int index_match = indices[0];
-				if ( (!boundaryTest) || ((*_target->boundariesPtr)[index_match].boundary_point == 0) )
-				{
-					if ( (!distanceTest) || (distance2s[0] < distanceThreshold2) )
-					{
-						Point point_match = (*_target->pointsPtr)[index_match];
-						Eigen::Vector3f normal_query = point_query.getNormalVector3fMap();
-						Eigen::Vector3f normal_match = point_match.getNormalVector3fMap();
-						normal_query.normalize();
-						normal_match.normalize();
-
-						if ( (!angleTest) || (normal_query.dot(normal_match) > cosAngleThreshold) )
-						{
-							PointPair pointPair;
-							pointPair.sourcePoint = point_query;					
-							switch(mMethod)
-							{
-								case POINT_TO_POINT:
-								{
-									pointPair.targetPoint = point_match;
-									break;
-								}
-								case POINT_TO_PLANE:
-								{
-									pointPair.targetPoint = point_match;
-									pointPair.targetPoint.getVector3fMap() = point_query.getVector3fMap() - (point_query.getVector3fMap() - point_match.getVector3fMap()).dot(normal_match) * normal_match;
-									break;
-								}
-							}
-							// distances.push_back( ( point_query.getVector3fMap() - point_match.getVector3fMap() ).norm() );
-							_s2t.push_back(pointPair);
-						}
-					}
-				}
-				
-				if ( ((*_target->boundariesPtr)[index_match].boundary_point == 0) ||  distance2s[0] < ( distanceThreshold2 * 2.0f * 2.0f ) )
-				{
-					_sourceCandidateIndices_temp.push_back(index_query);
-				}
-			}
-		}
+	void PairRegistration::setNeighbourTables(registar::NeighbourTableConstPtr _targetNeighbourTable, registar::NeighbourTableConstPtr _sourceNeighbourTable)
+	{
+		targetWarmStartSearch.setTarget(target->pointsPtr, targetKdTree, _targetNeighbourTable);
+		targetWarmStartSearch.setQueryNumber(source->pointsPtr->size());
+		sourceWarmStartSearch.setTarget(source->pointsPtr, sourceKdTree, _sourceNeighbourTable);
+		sourceWarmStartSearch.setQueryNumber(target->pointsPtr->size());
+	}
 
-		// _sourceCandidateIndices.swap(_sourceCandidateIndices_temp);
+	void PairRegistration::releaseScans()
+	{
+		targetKdTree.reset();
+		sourceKdTree.reset();
+		targetSharedSearch.reset();
+		sourceSharedSearch.reset();
+		targetWarmStartSearch = registar::WarmStartSearch();
+		sourceWarmStartSearch = registar::WarmStartSearch();
+		std::vector<int>().swap(targetCandidateIndices);
+		std::vector<int>().swap(targetCandidateIndices_temp);
+		std::vector<int>().swap(sourceCandidateIndices);
+		std::vector<int>().swap(sourceCandidateIndices_temp);
+		std::vector<int>().swap(targetActiveIndices);
+		std::vector<int>().swap(sourceActiveIndices);
+		targetSampler = registar::PointSampler();
+		sourceSampler = registar::PointSampler();
+	}
 
-		// float mean_distance = 0.0f;
-		// for (int i = 0; i < distances.size(); ++i) mean_distance += distances[i];
-		// mean_distance /= distances.size();
-		// float delta_distance = 0.0f;
-		// for (int i = 0; i < distances.size(); ++i) delta_distance += ( distances[i] - mean_distance ) * ( distances[i] - mean_distance );
-		// delta_distance = sqrtf( delta_distance / distances.size() );
+	registar::NearestSearch *PairRegistration::getTargetSearch()
+	{
+		if (targetSharedSearch) return targetSharedSearch.get();
+		return para.warmStart && targetWarmStartSearch.getTarget() ? &targetWarmStartSearch : NULL;
+	}
 
-		// PointPairs s2t_temp;
-		// for (int i = 0; i < _s2t.size(); i++)
-		// {
-		// 	if (distances[i] - mean_distance < 1.0f * delta_distance)
-		// 	{
-		// 		s2t_temp.push_back(_s2t[i]);
-		// 	}
-		// }
-		// std::cout << "cut pair by delta from " << _s2t.size() << " to " << s2t_temp.size() << std::endl;
-		// _s2t.swap(s2t_temp);
+	registar::NearestSearch *PairRegistration::getSourceSearch()
+	{
+		if (sourceSharedSearch) return sourceSharedSearch.get();
+		return para.warmStart && sourceWarmStartSearch.getTarget() ? &sourceWarmStartSearch : NULL;
+	}
 
+	void PairRegistration::generatePointPairs(ScanPtr _target, ScanPtr _source, KdTreePtr _targetKdTree, 
+											const std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
+											PointsPtr _sbuffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t,
+											registar::NearestSearch *_targetSearch)
+	{
+		registar::transformCloudWithNormals(*_source->pointsPtr, *_sbuffer, _transformation);
+		generatePointPairs(_target, *_sbuffer, _targetKdTree, _sourceCandidateIndices, _sourceCandidateIndices_temp, _para, _s2t, 1, _targetSearch);
 	}
 
 	void PairRegistration::generatePointPairs(ScanPtr _target, ScanPtr _source, KdTreePtr _targetKdTree, KdTreePtr _sourceKdTree, 
-		std::vector<int> &_targetCandidateIndices, std::vector<int> &_targetCandidateIndices_temp,
-		std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
-		PointsPtr _buffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t, PointPairs &_t2s)
+		const std::vector<int> &_targetCandidateIndices, std::vector<int> &_targetCandidateIndices_temp,
+		const std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
+		PointsPtr _buffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t, PointPairs &_t2s,
+		registar::NearestSearch *_targetSearch, registar::NearestSearch *_sourceSearch)
 	{
-		generatePointPairs(_target, _source, _targetKdTree, _sourceCandidateIndices, _sourceCandidateIndices_temp, _buffer, _transformation, _para, _s2t);
-		generatePointPairs(_source, _target, _sourceKdTree, _targetCandidateIndices, _targetCandidateIndices_temp, _buffer, _transformation.inverse(), _para,_t2s);
+		generatePointPairs(_target, _source, _targetKdTree, _sourceCandidateIndices, _sourceCandidateIndices_temp, _buffer, _transformation, _para, _s2t, _targetSearch);
+		generatePointPairs(_source, _target, _sourceKdTree, _targetCandidateIndices, _targetCandidateIndices_temp, _buffer, _transformation.inverse(), _para,_t2s, _sourceSearch);
+	}
+
+	void PairRegistration::generatePointPairs(ScanPtr _target, const Points &_sbuffer, KdTreePtr _targetKdTree, 
+								const std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
+								const PairRegistration::Parameters &_para, PointPairs &_s2t, unsigned int _threads,
+								registar::NearestSearch *_targetSearch)
+	{
+		// a search bounded below the farthest match still looked at would lose pairs, the tree answers then
+		float requiredRadius = _para.distanceTest ? searchRadius(_para) : std::numeric_limits<float>::infinity();
+		if (_targetSearch && _targetSearch->getRadius() < requiredRadius) _targetSearch = NULL;
+
+		PointPairGenerator generator(_target, _sbuffer, _targetKdTree, _targetSearch, _sourceCandidateIndices, std::max(1u, _threads));
+		generator.tests.sqrDistanceThreshold = _para.distThreshold * _para.distThreshold;
+		generator.tests.cosAngleThreshold = cosf(_para.angleThreshold / 180.f * M_PI);
+		generator.tests.boundaries = _target->boundariesPtr.get();
+		generator.activeDistance2 = generator.tests.sqrDistanceThreshold * _para.activeSetMargin * _para.activeSetMargin;
+		generator.requireNormals = _para.angleTest || _para.mMethod == POINT_TO_PLANE || isPlaneSolver(_para.sMethod);
+
+		_sourceCandidateIndices_temp.clear();
+
+		// one thread writes straight into the output
+		std::vector<PointPairs> s2t_in_threads( generator.threads == 1 ? 0 : generator.threads, PointPairs(_s2t.storeIndices) );
+		std::vector< std::vector<int> > sourceCandidateIndices_in_threads( s2t_in_threads.size() );
+		for (int tn = 0; tn < generator.threads; tn++)
+		{
+			generator.pairs.push_back(s2t_in_threads.empty() ? &_s2t : &s2t_in_threads[tn]);
+			generator.active.push_back(s2t_in_threads.empty() ? &_sourceCandidateIndices_temp : &sourceCandidateIndices_in_threads[tn]);
+		}
+
+		registar::dispatchCorrespondenceKernel(_para.distanceTest, _para.angleTest, _para.boundaryTest, _para.mMethod == POINT_TO_PLANE, generator);
+
+		for (int tn = 0; tn < s2t_in_threads.size(); tn++)
+		{
+			_s2t.append(s2t_in_threads[tn]);
+			_sourceCandidateIndices_temp.insert(_sourceCandidateIndices_temp.end(), sourceCandidateIndices_in_threads[tn].begin(), sourceCandidateIndices_in_threads[tn].end());
+		}
 	}
 
 	void PairRegistration::generateFinalPointPairs(const Transformation &_transformation)
@@ -198,83 +359,48 @@ namespace tang2014
 		generatePointPairs(target, source, targetKdTree, sourceKdTree, 
 			targetCandidateIndices, targetCandidateIndices_temp,
 			sourceCandidateIndices, sourceCandidateIndices_temp,
-			buffer, _transformation, para, s2t, t2s);
+			buffer, _transformation, para, s2t, t2s, getTargetSearch(), getSourceSearch());
 
-		for (int i = 0; i < t2s.size(); ++i)
-		{
-			PointPair temp;
-			temp.sourcePoint = registar::transformPointWithNormal(t2s[i].targetPoint, _transformation);
-			temp.targetPoint = registar::transformPointWithNormal(t2s[i].sourcePoint, _transformation);
-			s2t.push_back(temp);
-		}
+		s2t.appendTransformed(t2s, _transformation, false, _transformation, true);
 
 		// float total_error = 0.0f;
 		// float total_weight = 0.0f;
 		// for (int i = 0; i < s2t.size(); ++i)
 		// {
-		// 	total_error += ( s2t[i].sourcePoint.getVector3fMap() - s2t[i].targetPoint.getVector3fMap() ).squaredNorm();
+		// 	total_error += ( s2t.sourcePosition(i) - s2t.targetPosition(i) ).squaredNorm();
 		// 	total_weight += 1.0f;
 		// }
 		// float rms_error = sqrtf( total_error / total_weight );
 		// std::cout << "Final Point Pairs rms_error = " <<  rms_error << " total_weight = " << total_weight << std::endl;	
 
 		final_s2t.swap(s2t);
-		for (int j = 0; j < final_s2t.size(); ++j) final_s2t[j].sourcePoint = registar::transformPointWithNormal(final_s2t[j].sourcePoint, _transformation.inverse());
+		final_s2t.transformSource(_transformation.inverse());
 		// std::cout << "Final Point Pairs : " << final_s2t.size() << std::endl;
 	}
 
-	Transformation PairRegistration::solveRegistration(PointPairs &_s2t, Eigen::Matrix3Xf &src, Eigen::Matrix3Xf &tgt)
+	Transformation PairRegistration::solveRegistration(const PointPairs &_s2t)
 	{
-		src.resize(Eigen::NoChange, _s2t.size());
-		tgt.resize(Eigen::NoChange, _s2t.size());
-
-		for (int i = 0; i < _s2t.size(); ++i)
-		{
-			src(0, i) = _s2t[i].sourcePoint.x;
-			src(1, i) = _s2t[i].sourcePoint.y;
-			src(2, i) = _s2t[i].sourcePoint.z;
-
-			tgt(0, i) = _s2t[i].targetPoint.x;
-			tgt(1, i) = _s2t[i].targetPoint.y;
-			tgt(2, i) = _s2t[i].targetPoint.z;
-		}
-
-		switch(para.sMethod)
-		{
-			case UMEYAMA:
-			{
-				return pcl::umeyama (src, tgt, false);
-			}
-			case SVD:
-			{
-				return Transformation::Identity();
-			}
-		}
-		return Transformation::Identity();
+		return solveRegistration(_s2t, para.sMethod);
 	}
 
-	Transformation PairRegistration::solveRegistration(PointPairs &_s2t, PairRegistration::SolveMethod _sMethod)
+	Transformation PairRegistration::solveRegistration(const PointPairs &_s2t, PairRegistration::SolveMethod _sMethod)
 	{
-		Eigen::Matrix3Xf src, tgt;
-		src.resize(Eigen::NoChange, _s2t.size());
-		tgt.resize(Eigen::NoChange, _s2t.size());
-
-		for (int i = 0; i < _s2t.size(); ++i)
-		{
-			src(0, i) = _s2t[i].sourcePoint.x;
-			src(1, i) = _s2t[i].sourcePoint.y;
-			src(2, i) = _s2t[i].sourcePoint.z;
-
-			tgt(0, i) = _s2t[i].targetPoint.x;
-			tgt(1, i) = _s2t[i].targetPoint.y;
-			tgt(2, i) = _s2t[i].targetPoint.z;
-		}	
-
 		switch(_sMethod)
 		{
 			case UMEYAMA:
 			{
-				return pcl::umeyama (src, tgt, false);
+				// one pass over the position arrays, the pair weights are honoured
+				if (_s2t.empty()) return Transformation::Identity();
+				registar::UmeyamaMoments moments = registar::accumulateUmeyamaMoments(&_s2t.sourcePositions[0],
+					&_s2t.targetPositions[0], &_s2t.weights[0], _s2t.size());
+				return registar::solveUmeyama(moments, false);
+			}
+			case SYMMETRIC:
+			case GENERALIZED:
+			{
+				if (_s2t.empty()) return Transformation::Identity();
+				registar::PlaneICPMoments moments = accumulatePlaneICPMoments(_s2t, _sMethod == SYMMETRIC);
+				return _sMethod == SYMMETRIC ? registar::solveSymmetricICP(moments) : registar::solveGeneralizedICP(moments);
 			}
 			case SVD:
 			{
@@ -298,7 +424,6 @@ namespace tang2014
 
 		PointsPtr buffer(new Points);
 		PointPairs s2t, t2s;
-		Eigen::Matrix3Xf src, tgt;
 
 		float last_rms_error = std::numeric_limits<float>::max();
 
@@ -313,31 +438,28 @@ namespace tang2014
 			if(para.biDirection) 
 			{
 				generatePointPairsOMP(target, source, targetKdTree, sourceKdTree, 
-					targetCandidateIndices, targetCandidateIndices_temp, 
-					sourceCandidateIndices, sourceCandidateIndices_temp,
-					buffer, initialTransformation, para, s2t, t2s, threads);
+					activeIndices(false, iter), targetCandidateIndices_temp, 
+					activeIndices(true, iter), sourceCandidateIndices_temp,
+					buffer, initialTransformation, para, s2t, t2s, threads, getTargetSearch(), getSourceSearch());
 				// std::cout << s2t.size() << std::endl;
 				// std::cout << t2s.size() << std::endl;
-				for (int i = 0; i < t2s.size(); ++i)
-				{
-					PointPair temp;
-					temp.sourcePoint = registar::transformPointWithNormal(t2s[i].targetPoint, initialTransformation);
-					temp.targetPoint = registar::transformPointWithNormal(t2s[i].sourcePoint, initialTransformation);
-					s2t.push_back(temp);
-				}
+				s2t.appendTransformed(t2s, initialTransformation, false, initialTransformation, true);
 			}
 			else 
 			{
-				generatePointPairsOMP(target, source, targetKdTree, sourceCandidateIndices, sourceCandidateIndices_temp, buffer, initialTransformation, para, s2t, threads);
+				generatePointPairsOMP(target, source, targetKdTree, activeIndices(true, iter), sourceCandidateIndices_temp, buffer, initialTransformation, para, s2t, threads, getTargetSearch());
 			}
-			tempTransformation = solveRegistration(s2t, src, tgt);	
+			updateActiveIndices();
+			weightPointPairs(s2t, para, threads);
+			tempTransformation = solveRegistration(s2t);	
 
 			float total_error = 0.0f;
 			float total_weight = 0.0f;
+			bool alongNormal = isPlaneSolver(para.sMethod);
 			for (int i = 0; i < s2t.size(); ++i)
 			{
-				total_error += ( registar::transformPointWithNormal(s2t[i].sourcePoint, tempTransformation).getVector3fMap() - s2t[i].targetPoint.getVector3fMap() ).squaredNorm();
-				total_weight += 1.0f;
+				total_error += s2t.weights[i] * squaredError(s2t, i, tempTransformation, alongNormal);
+				total_weight += s2t.weights[i];
 			}
 			float rms_error = sqrtf( total_error / total_weight );
 			std::cout << "pairregistration rms_error = " <<  rms_error << " total_weight = " << total_weight << std::endl;
@@ -355,132 +477,28 @@ namespace tang2014
 		// std::cout << transformation << std::endl;
 
 		final_s2t.swap(s2t);
-		for (int j = 0; j < final_s2t.size(); ++j) final_s2t[j].sourcePoint = registar::transformPointWithNormal(final_s2t[j].sourcePoint, lastTransformation.inverse());
+		final_s2t.transformSource(lastTransformation.inverse());
 
 
 	}
 
 	void PairRegistrationOMP::generatePointPairsOMP(ScanPtr _target, ScanPtr _source, KdTreePtr _targetKdTree, 
-								std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
-								PointsPtr _sbuffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t, unsigned int _threads)
+								const std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
+								PointsPtr _sbuffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t, unsigned int _threads,
+								registar::NearestSearch *_targetSearch)
 	{
-		pcl::transformPointCloudWithNormals(*_source->pointsPtr, *_sbuffer, _transformation);
-
-		MatchMethod mMethod = _para.mMethod;
-		bool distanceTest = _para.distanceTest;
-		float distThreshold = _para.distThreshold;
-		bool angleTest = _para.angleTest;
-		float angleThreshold = _para.angleThreshold;
-		bool boundaryTest = _para.boundaryTest;
-
-		float distanceThreshold2 = distThreshold * distThreshold;
-		float cosAngleThreshold = cosf(angleThreshold / 180.f * M_PI);
-
-		// std::vector<float> distances;
-
-		_sourceCandidateIndices_temp.clear();
-
-		std::vector< std::vector<int> > sourceCandidateIndices_in_threads( _threads );
-		std::vector<PointPairs> s2t_in_threads( _threads );
-
-		// for (std::vector<int>::iterator it = _sourceCandidateIndices.begin(); it != _sourceCandidateIndices.end(); it++)
-		// {
-		// 	int index_query = *it;
-		// for (int index_query = 0; index_query < _sbuffer->size(); ++index_query)
-		// {
-
-	    #pragma omp parallel for schedule (dynamic,1000) num_threads (_threads)
-		for (int it = 0; it < _sourceCandidateIndices.size(); it++)
-		{
-			int tn = omp_get_thread_num (); 
-			
-			int index_query = _sourceCandidateIndices[it];
-
-			Point point_query = (*_sbuffer)[index_query];
-			int K = 1;
-			std::vector<int> indices(K);
-			std::vector<float> distance2s(K);
-			if ( _targetKdTree->nearestKSearch(point_query, K, indices, distance2s) > 0 )
-			{
-				int index_match = indices[0];
-				if ( (!boundaryTest) || ((*_target->boundariesPtr)[index_match].boundary_point == 0) )
-				{
-					if ( (!distanceTest) || (distance2s[0] < distanceThreshold2) )
-					{
-						Point point_match = (*_target->pointsPtr)[index_match];
-						Eigen::Vector3f normal_query = point_query.getNormalVector3fMap();
-						Eigen::Vector3f normal_match = point_match.getNormalVector3fMap();
-						normal_query.normalize();
-						normal_match.normalize();
-
-						if ( (!angleTest) || (normal_query.dot(normal_match) > cosAngleThreshold) )
-						{
-							PointPair pointPair;
-							pointPair.sourcePoint = point_query;					
-							switch(mMethod)
-							{
-								case POINT_TO_POINT:
-								{
-									pointPair.targetPoint = point_match;
-									break;
-								}
-								case POINT_TO_PLANE:
-								{
-									pointPair.targetPoint = point_match;
-									pointPair.targetPoint.getVector3fMap() = point_query.getVector3fMap() - (point_query.getVector3fMap() - point_match.getVector3fMap()).dot(normal_match) * normal_match;
-									break;
-								}
-							}
-							// distances.push_back( ( point_query.getVector3fMap() - point_match.getVector3fMap() ).norm() );
-							// _s2t.push_back(pointPair);
-							s2t_in_threads[tn].push_back(pointPair);
-						}
-					}
-				}
-				
-				if ( ((*_target->boundariesPtr)[index_match].boundary_point == 0) ||  distance2s[0] < ( distanceThreshold2 * 2.0f * 2.0f ) )
-				{
-					// _sourceCandidateIndices_temp.push_back(index_query);
-					sourceCandidateIndices_in_threads[tn].push_back(index_query);
-				}
-			}
-		}
-
-		for(int tn = 0; tn < _threads; tn++)
-		{
-			_s2t.insert(_s2t.end(), s2t_in_threads[tn].begin(), s2t_in_threads[tn].end());
-			_sourceCandidateIndices_temp.insert(_sourceCandidateIndices_temp.end(), sourceCandidateIndices_in_threads[tn].begin(), sourceCandidateIndices_in_threads[tn].end());
-		}
-
-		// _sourceCandidateIndices.swap(_sourceCandidateIndices_temp);
-
-		// float mean_distance = 0.0f;
-		// for (int i = 0; i < distances.size(); ++i) mean_distance += distances[i];
-		// mean_distance /= distances.size();
-		// float delta_distance = 0.0f;
-		// for (int i = 0; i < distances.size(); ++i) delta_distance += ( distances[i] - mean_distance ) * ( distances[i] - mean_distance );
-		// delta_distance = sqrtf( delta_distance / distances.size() );
-
-		// PointPairs s2t_temp;
-		// for (int i = 0; i < _s2t.size(); i++)
-		// {
-		// 	if (distances[i] - mean_distance < 1.0f * delta_distance)
-		// 	{
-		// 		s2t_temp.push_back(_s2t[i]);
-		// 	}
-		// }
-		// std::cout << "cut pair by delta from " << _s2t.size() << " to " << s2t_temp.size() << std::endl;
-		// _s2t.swap(s2t_temp);
-
+		registar::transformCloudWithNormals(*_source->pointsPtr, *_sbuffer, _transformation);
+		generatePointPairs(_target, *_sbuffer, _targetKdTree, _sourceCandidateIndices, _sourceCandidateIndices_temp, _para, _s2t, _threads, _targetSearch);
 	}
 
 	void PairRegistrationOMP::generatePointPairsOMP(ScanPtr _target, ScanPtr _source, KdTreePtr _targetKdTree, KdTreePtr _sourceKdTree, 
-								std::vector<int> &_targetCandidateIndices, std::vector<int> &_targetCandidateIndices_temp,
-								std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
-								PointsPtr _buffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t, PointPairs &_t2s, unsigned int _thread)
+								const std::vector<int> &_targetCandidateIndices, std::vector<int> &_targetCandidateIndices_temp,
+								const std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
+								PointsPtr _buffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t, PointPairs &_t2s, unsigned int _thread,
+								registar::NearestSearch *_targetSearch, registar::NearestSearch *_sourceSearch)
 	{
-		generatePointPairsOMP(_target, _source, _targetKdTree, _sourceCandidateIndices, _sourceCandidateIndices_temp, _buffer, _transformation, _para, _s2t, _thread);
-		generatePointPairsOMP(_source, _target, _sourceKdTree, _targetCandidateIndices, _targetCandidateIndices_temp, _buffer, _transformation.inverse(), _para,_t2s, _thread);
+		generatePointPairsOMP(_target, _source, _targetKdTree, _sourceCandidateIndices, _sourceCandidateIndices_temp, _buffer, _transformation, _para, _s2t, _thread, _targetSearch);
+		generatePointPairsOMP(_source, _target, _sourceKdTree, _targetCandidateIndices, _targetCandidateIndices_temp, _buffer, _transformation.inverse(), _para,_t2s, _thread, _sourceSearch);
 	}
 
 	void PairRegistrationOMP::generateFinalPointPairs(const Transformation &_transformation)
@@ -491,28 +509,22 @@ namespace tang2014
 		generatePointPairsOMP(target, source, targetKdTree, sourceKdTree, 
 			targetCandidateIndices, targetCandidateIndices_temp,
 			sourceCandidateIndices, sourceCandidateIndices_temp,
-			buffer, _transformation, para, s2t, t2s, threads);
+			buffer, _transformation, para, s2t, t2s, threads, getTargetSearch(), getSourceSearch());
 
-		for (int i = 0; i < t2s.size(); ++i)
-		{
-			PointPair temp;
-			temp.sourcePoint = registar::transformPointWithNormal(t2s[i].targetPoint, _transformation);
-			temp.targetPoint = registar::transformPointWithNormal(t2s[i].sourcePoint, _transformation);
-			s2t.push_back(temp);
-		}
+		s2t.appendTransformed(t2s, _transformation, false, _transformation, true);
 
 		// float total_error = 0.0f;
 		// float total_weight = 0.0f;
 		// for (int i = 0; i < s2t.size(); ++i)
 		// {
-		// 	total_error += ( s2t[i].sourcePoint.getVector3fMap() - s2t[i].targetPoint.getVector3fMap() ).squaredNorm();
+		// 	total_error += ( s2t.sourcePosition(i) - s2t.targetPosition(i) ).squaredNorm();
 		// 	total_weight += 1.0f;
 		// }
 		// float rms_error = sqrtf( total_error / total_weight );
 		// std::cout << "Final Point Pairs rms_error = " <<  rms_error << " total_weight = " << total_weight << std::endl;	
 
 		final_s2t.swap(s2t);
-		for (int j = 0; j < final_s2t.size(); ++j) final_s2t[j].sourcePoint = registar::transformPointWithNormal(final_s2t[j].sourcePoint, _transformation.inverse());
+		final_s2t.transformSource(_transformation.inverse());
 
 		// std::cout << "Final Point Pairs : " << final_s2t.size() << std::endl;
 	}
@@ -4,6 +4,12 @@
 #include "common.h"
 #include "scan.h"
 #include "link.h"
+#include "pointpairs.h"
+
+#include "../include/nearestsearch.h"
+#include "../include/warmstartsearch.h"
+#include "../include/pointsampling.h"
+#include "../include/robustweights.h"
 
 #include <map>
 
@@ -18,11 +24,17 @@ namespace tang2014
 			POINT_TO_POINT, POINT_TO_PLANE
 		};
 
+		// SYMMETRIC and GENERALIZED are the symmetric and plane-to-plane ICP steps of registar/planeicp.h, which take the
+		// normals of both points and are meant for the matches themselves, i.e. POINT_TO_POINT
 		enum SolveMethod
 		{
-			UMEYAMA, SVD
+			UMEYAMA, SVD, SYMMETRIC, GENERALIZED
 		};
 
+		static inline bool isPlaneSolver(SolveMethod _sMethod) { return _sMethod == SYMMETRIC || _sMethod == GENERALIZED; }
+		// the methods that can be asked for by number, SVD is only a stub returning the identity
+		static inline bool isImplementedSolver(int _sMethod) { return _sMethod == UMEYAMA || _sMethod == SYMMETRIC || _sMethod == GENERALIZED; }
+
 		struct Parameters
 		{
 			MatchMethod mMethod;
@@ -35,6 +47,14 @@ namespace tang2014
 			bool biDirection;
 			unsigned int iterationNum_max;
 			unsigned int iterationNum_min;
+			bool activeSet;                 // query only the points kept by the last iteration, see activeIndices
+			float activeSetMargin;          // points farther than activeSetMargin * distThreshold from their match are dropped
+			unsigned int activeSetRefresh;  // every activeSetRefresh-th iteration queries all points again, 0 never does
+			bool warmStart;                 // start each nearest neighbour query from the match of the last iteration
+			bool voxelHash;                 // answer queries from a voxel hash bounded by the distance test, see searchRadius
+			bool flatKdTree;                // answer queries from the in-house flat KD-tree instead of FLANN
+			registar::SamplingParameters sampling;   // the points a full pass queries, see sampledIndices
+			registar::RobustParameters robust;       // trimming and kernel weights of the pairs, see weightPointPairs
 		} para;
 
 
@@ -43,25 +63,33 @@ namespace tang2014
 
 		void startRegistration();
 
-		struct PointPair
-		{
-			Point targetPoint;
-			Point sourcePoint;
-		};
-		typedef std::vector< PointPair, Eigen::aligned_allocator<PointPair> > PointPairs;
+		typedef tang2014::PointPairs PointPairs;
 
 		static void generatePointPairs(ScanPtr _target, ScanPtr _source, KdTreePtr _targetKdTree, 
-								std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
-								PointsPtr _sbuffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t);
+								const std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
+								PointsPtr _sbuffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t,
+								registar::NearestSearch *_targetSearch = NULL);
 
 		static void generatePointPairs(ScanPtr _target, ScanPtr _source, KdTreePtr _targetKdTree, KdTreePtr _sourceKdTree, 
-								std::vector<int> &_targetCandidateIndices, std::vector<int> &_targetCandidateIndices_temp,
-								std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
-								PointsPtr _buffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t, PointPairs &_t2s);
+								const std::vector<int> &_targetCandidateIndices, std::vector<int> &_targetCandidateIndices_temp,
+								const std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
+								PointsPtr _buffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t, PointPairs &_t2s,
+								registar::NearestSearch *_targetSearch = NULL, registar::NearestSearch *_sourceSearch = NULL);
+
+		// the pairs of the already transformed source points in _sbuffer, shared by the generators above and their OMP
+		// counterparts; the tests and the match method are resolved once per call, see correspondencekernel.h
+		static void generatePointPairs(ScanPtr _target, const Points &_sbuffer, KdTreePtr _targetKdTree, 
+								const std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
+								const PairRegistration::Parameters &_para, PointPairs &_s2t, unsigned int _threads,
+								registar::NearestSearch *_targetSearch = NULL);
 
 		virtual void generateFinalPointPairs(const Transformation &_transformation);
 
-		Transformation solveRegistration(PointPairs &_s2t, Eigen::Matrix3Xf &src, Eigen::Matrix3Xf &tgt);
+		Transformation solveRegistration(const PointPairs &_s2t);
+
+		// multiplies the weights of pairs whose both points are in one frame by their para.robust weights, which
+		// makes each iteration one step of iteratively reweighted least squares
+		static void weightPointPairs(PointPairs &_pairs, const PairRegistration::Parameters &_para, unsigned int _threads);
 
 		inline void setKdTree(KdTreePtr _targetKdTree, KdTreePtr _sourceKdTree)
 		{
@@ -86,8 +114,46 @@ namespace tang2014
 		std::vector<int> sourceCandidateIndices;
 		std::vector<int> sourceCandidateIndices_temp;
 
+		// the points queried by the current iteration, the candidate indices above always stay the full set
+		const std::vector<int> &activeIndices(bool _source, int _iter);
+		void updateActiveIndices();
+		std::vector<int> targetActiveIndices;
+		std::vector<int> sourceActiveIndices;
+
+		// the candidates sampled by para.sampling for the iteration, or all of them; a sample is kept for
+		// para.sampling.refresh iterations
+		const std::vector<int> &sampledIndices(bool _source, int _iter);
+		registar::PointSampler targetSampler;
+		registar::PointSampler sourceSampler;
+
+		// nearest neighbour searches into the target and into the source that remember their last matches
+		void setNeighbourTables(registar::NeighbourTableConstPtr _targetNeighbourTable, registar::NeighbourTableConstPtr _sourceNeighbourTable);
+		registar::WarmStartSearch targetWarmStartSearch;
+		registar::WarmStartSearch sourceWarmStartSearch;
+
+		// searches built once per scan and shared by all pairs of it, a voxel hash or a flat KD-tree
+		inline void setSharedSearches(registar::NearestSearchPtr _targetSharedSearch, registar::NearestSearchPtr _sourceSharedSearch)
+		{
+			targetSharedSearch = _targetSharedSearch;
+			sourceSharedSearch = _sourceSharedSearch;
+		}
+		registar::NearestSearchPtr targetSharedSearch;
+		registar::NearestSearchPtr sourceSharedSearch;
+
+		// drops the searches and index sets over the scans so they can be unloaded, setKdTree and the other setters
+		// followed by initiateCandidateIndices bind them again
+		void releaseScans();
+
+		// what the generators query: the shared search if there is one, else the warm started search if para.warmStart
+		// is set and the tables were given, else NULL for the kd-tree
+		registar::NearestSearch *getTargetSearch();
+		registar::NearestSearch *getSourceSearch();
+
+		// farthest match the generators look at, searches bounded below it are not used
+		static float searchRadius(const PairRegistration::Parameters &_para);
+
 		PointPairs final_s2t;
-		static Transformation solveRegistration(PointPairs &_s2t, PairRegistration::SolveMethod _sMethod);
+		static Transformation solveRegistration(const PointPairs &_s2t, PairRegistration::SolveMethod _sMethod);
 
 		typedef boost::shared_ptr<PairRegistration> Ptr;
 	};
@@ -109,13 +175,15 @@ namespace tang2014
 	    void startRegistrationOMP();
 
 		static void generatePointPairsOMP(ScanPtr _target, ScanPtr _source, KdTreePtr _targetKdTree, 
-								std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
-								PointsPtr _sbuffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t, unsigned int _threads);
+								const std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
+								PointsPtr _sbuffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t, unsigned int _threads,
+								registar::NearestSearch *_targetSearch = NULL);
 
 		static void generatePointPairsOMP(ScanPtr _target, ScanPtr _source, KdTreePtr _targetKdTree, KdTreePtr _sourceKdTree, 
-								std::vector<int> &_targetCandidateIndices, std::vector<int> &_targetCandidateIndices_temp,
-								std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
-								PointsPtr _buffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t, PointPairs &_t2s, unsigned int _threads);
+								const std::vector<int> &_targetCandidateIndices, std::vector<int> &_targetCandidateIndices_temp,
+								const std::vector<int> &_sourceCandidateIndices, std::vector<int> &_sourceCandidateIndices_temp,
+								PointsPtr _buffer, const Transformation &_transformation, PairRegistration::Parameters _para, PointPairs &_s2t, PointPairs &_t2s, unsigned int _threads,
+								registar::NearestSearch *_targetSearch = NULL, registar::NearestSearch *_sourceSearch = NULL);
 
 		virtual void generateFinalPointPairs(const Transformation &_transformation);
 
@@ -0,0 +1,188 @@
+#include "pointpairs.h"
+#include "../include/bulktransform.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace tang2014
+{
+	namespace
+	{
+		inline float signNotZero(float _v) { return _v >= 0.0f ? 1.0f : -1.0f; }
+
+		inline unsigned int quantize(float _v)
+		{
+			float clamped = std::min(1.0f, std::max(-1.0f, _v));
+			return static_cast<unsigned int>(floorf((clamped * 0.5f + 0.5f) * 65535.0f + 0.5f));
+		}
+
+		inline float dequantize(unsigned int _q)
+		{
+			return static_cast<float>(_q) / 65535.0f * 2.0f - 1.0f;
+		}
+
+		inline void transformPositions(std::vector<float> &_positions, int _begin, int _end, const Transformation &_transformation)
+		{
+			if (_end > _begin) registar::transformPositions(&_positions[3 * _begin], _end - _begin, _transformation);
+		}
+
+		inline void transformNormals(std::vector<unsigned int> &_normals, int _begin, int _end, const Transformation &_transformation)
+		{
+			Eigen::Matrix3f R = _transformation.block<3, 3>(0, 0);
+			#pragma omp parallel for schedule (dynamic,1000) if (_end - _begin >= registar::transformParallelSize)
+			for (int i = _begin; i < _end; ++i) _normals[i] = PointPairs::packNormal(R * PointPairs::unpackNormal(_normals[i]));
+		}
+	}
+
+	void PointPairs::clear()
+	{
+		sourcePositions.clear();
+		targetPositions.clear();
+		sourceNormals.clear();
+		targetNormals.clear();
+		weights.clear();
+		sourceIndices.clear();
+		targetIndices.clear();
+	}
+
+	void PointPairs::reserve(int _size)
+	{
+		sourcePositions.reserve(3 * _size);
+		targetPositions.reserve(3 * _size);
+		sourceNormals.reserve(_size);
+		targetNormals.reserve(_size);
+		weights.reserve(_size);
+		if (storeIndices)
+		{
+			sourceIndices.reserve(_size);
+			targetIndices.reserve(_size);
+		}
+	}
+
+	void PointPairs::swap(PointPairs &_other)
+	{
+		std::swap(storeIndices, _other.storeIndices);
+		sourcePositions.swap(_other.sourcePositions);
+		targetPositions.swap(_other.targetPositions);
+		sourceNormals.swap(_other.sourceNormals);
+		targetNormals.swap(_other.targetNormals);
+		weights.swap(_other.weights);
+		sourceIndices.swap(_other.sourceIndices);
+		targetIndices.swap(_other.targetIndices);
+	}
+
+	size_t PointPairs::bytes() const
+	{
+		return (sourcePositions.capacity() + targetPositions.capacity() + weights.capacity()) * sizeof(float) +
+			(sourceNormals.capacity() + targetNormals.capacity()) * sizeof(unsigned int) + 
+			(sourceIndices.capacity() + targetIndices.capacity()) * sizeof(int);
+	}
+
+	void PointPairs::append(const PointPairs &_other)
+	{
+		sourcePositions.insert(sourcePositions.end(), _other.sourcePositions.begin(), _other.sourcePositions.end());
+		targetPositions.insert(targetPositions.end(), _other.targetPositions.begin(), _other.targetPositions.end());
+		sourceNormals.insert(sourceNormals.end(), _other.sourceNormals.begin(), _other.sourceNormals.end());
+		targetNormals.insert(targetNormals.end(), _other.targetNormals.begin(), _other.targetNormals.end());
+		weights.insert(weights.end(), _other.weights.begin(), _other.weights.end());
+		if (storeIndices)
+		{
+			if (_other.storeIndices)
+			{
+				sourceIndices.insert(sourceIndices.end(), _other.sourceIndices.begin(), _other.sourceIndices.end());
+				targetIndices.insert(targetIndices.end(), _other.targetIndices.begin(), _other.targetIndices.end());
+			}
+			else
+			{
+				sourceIndices.resize(weights.size(), -1);
+				targetIndices.resize(weights.size(), -1);
+			}
+		}
+	}
+
+	void PointPairs::appendTransformed(const PointPairs &_other, const Transformation &_targetTransformation, bool _targetFromTarget,
+		const Transformation &_sourceTransformation, bool _sourceFromTarget)
+	{
+		int offset = size();
+		int otherSize = _other.size();
+
+		const std::vector<float> &targetFrom = _targetFromTarget ? _other.targetPositions : _other.sourcePositions;
+		const std::vector<float> &sourceFrom = _sourceFromTarget ? _other.targetPositions : _other.sourcePositions;
+		const std::vector<unsigned int> &targetNormalFrom = _targetFromTarget ? _other.targetNormals : _other.sourceNormals;
+		const std::vector<unsigned int> &sourceNormalFrom = _sourceFromTarget ? _other.targetNormals : _other.sourceNormals;
+
+		sourcePositions.insert(sourcePositions.end(), sourceFrom.begin(), sourceFrom.end());
+		targetPositions.insert(targetPositions.end(), targetFrom.begin(), targetFrom.end());
+		sourceNormals.insert(sourceNormals.end(), sourceNormalFrom.begin(), sourceNormalFrom.end());
+		targetNormals.insert(targetNormals.end(), targetNormalFrom.begin(), targetNormalFrom.end());
+		weights.insert(weights.end(), _other.weights.begin(), _other.weights.end());
+		if (storeIndices)
+		{
+			if (_other.storeIndices)
+			{
+				const std::vector<int> &targetIndexFrom = _targetFromTarget ? _other.targetIndices : _other.sourceIndices;
+				const std::vector<int> &sourceIndexFrom = _sourceFromTarget ? _other.targetIndices : _other.sourceIndices;
+				sourceIndices.insert(sourceIndices.end(), sourceIndexFrom.begin(), sourceIndexFrom.end());
+				targetIndices.insert(targetIndices.end(), targetIndexFrom.begin(), targetIndexFrom.end());
+			}
+			else
+			{
+				sourceIndices.resize(weights.size(), -1);
+				targetIndices.resize(weights.size(), -1);
+			}
+		}
+
+		transformPositions(targetPositions, offset, offset + otherSize, _targetTransformation);
+		transformPositions(sourcePositions, offset, offset + otherSize, _sourceTransformation);
+		transformNormals(targetNormals, offset, offset + otherSize, _targetTransformation);
+		transformNormals(sourceNormals, offset, offset + otherSize, _sourceTransformation);
+	}
+
+	void PointPairs::transformSource(const Transformation &_transformation)
+	{
+		transformPositions(sourcePositions, 0, size(), _transformation);
+		transformNormals(sourceNormals, 0, size(), _transformation);
+	}
+
+	void PointPairs::transformTarget(const Transformation &_transformation)
+	{
+		transformPositions(targetPositions, 0, size(), _transformation);
+		transformNormals(targetNormals, 0, size(), _transformation);
+	}
+
+	unsigned int PointPairs::packNormal(const Eigen::Vector3f &_normal)
+	{
+		float l1 = fabsf(_normal.x()) + fabsf(_normal.y()) + fabsf(_normal.z());
+		if (!(l1 > 0.0f) || !(l1 <= std::numeric_limits<float>::max())) return invalidNormal;
+
+		float u = _normal.x() / l1;
+		float v = _normal.y() / l1;
+		if (_normal.z() < 0.0f)
+		{
+			float u_fold = (1.0f - fabsf(v)) * signNotZero(u);
+			float v_fold = (1.0f - fabsf(u)) * signNotZero(v);
+			u = u_fold;
+			v = v_fold;
+		}
+		// the corner code of invalidNormal and the all-ones corner both decode to -z
+		unsigned int packed = (quantize(u) << 16) | quantize(v);
+		return packed == invalidNormal ? 0xffffffffu : packed;
+	}
+
+	Eigen::Vector3f PointPairs::unpackNormal(unsigned int _packed)
+	{
+		if (_packed == invalidNormal) return Eigen::Vector3f::Zero();
+		float u = dequantize(_packed >> 16);
+		float v = dequantize(_packed & 0xffff);
+		Eigen::Vector3f normal(u, v, 1.0f - fabsf(u) - fabsf(v));
+		if (normal.z() < 0.0f)
+		{
+			float x = (1.0f - fabsf(v)) * signNotZero(u);
+			float y = (1.0f - fabsf(u)) * signNotZero(v);
+			normal.x() = x;
+			normal.y() = y;
+		}
+		return normal.normalized();
+	}
+}
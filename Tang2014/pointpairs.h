@@ -0,0 +1,83 @@
+#ifndef TANG2014_POINTPAIRS_H
+#define TANG2014_POINTPAIRS_H
+
+#include "common.h"
+
+#include <vector>
+
+namespace tang2014
+{
+	// Correspondences stored attribute by attribute: xyz of the source and target points (3 floats per pair, so the
+	// position arrays map straight onto Eigen::Matrix3Xf), both normals packed into 32 bits each, a weight and,
+	// only if requested, the indices of the two points in their scans.
+	class PointPairs
+	{
+	public:
+		PointPairs(bool _storeIndices = false) : storeIndices(_storeIndices) {}
+
+		inline int size() const { return static_cast<int>(weights.size()); }
+		inline bool empty() const { return weights.empty(); }
+
+		void clear();
+		void reserve(int _size);
+		void swap(PointPairs &_other);
+		// held by the arrays, their capacity rather than their size
+		size_t bytes() const;
+
+		inline void push_back(const Eigen::Vector3f &_sourcePosition, const Eigen::Vector3f &_sourceNormal,
+			const Eigen::Vector3f &_targetPosition, const Eigen::Vector3f &_targetNormal, float _weight = 1.0f, int _sourceIndex = -1, int _targetIndex = -1)
+		{
+			sourcePositions.push_back(_sourcePosition.x()); sourcePositions.push_back(_sourcePosition.y()); sourcePositions.push_back(_sourcePosition.z());
+			targetPositions.push_back(_targetPosition.x()); targetPositions.push_back(_targetPosition.y()); targetPositions.push_back(_targetPosition.z());
+			sourceNormals.push_back(packNormal(_sourceNormal));
+			targetNormals.push_back(packNormal(_targetNormal));
+			weights.push_back(_weight);
+			if (storeIndices)
+			{
+				sourceIndices.push_back(_sourceIndex);
+				targetIndices.push_back(_targetIndex);
+			}
+		}
+
+		void append(const PointPairs &_other);
+
+		// appends the pairs of _other with the target taken from its target (or source) point mapped by _targetTransformation
+		// and the source likewise, which covers reversing a pair and moving it into another frame in one pass
+		void appendTransformed(const PointPairs &_other, const Transformation &_targetTransformation, bool _targetFromTarget,
+			const Transformation &_sourceTransformation, bool _sourceFromTarget);
+
+		void transformSource(const Transformation &_transformation);
+		void transformTarget(const Transformation &_transformation);
+
+		inline Eigen::Map<Eigen::Vector3f> sourcePosition(int _i) { return Eigen::Map<Eigen::Vector3f>(&sourcePositions[3*_i]); }
+		inline Eigen::Map<const Eigen::Vector3f> sourcePosition(int _i) const { return Eigen::Map<const Eigen::Vector3f>(&sourcePositions[3*_i]); }
+		inline Eigen::Map<Eigen::Vector3f> targetPosition(int _i) { return Eigen::Map<Eigen::Vector3f>(&targetPositions[3*_i]); }
+		inline Eigen::Map<const Eigen::Vector3f> targetPosition(int _i) const { return Eigen::Map<const Eigen::Vector3f>(&targetPositions[3*_i]); }
+		inline Eigen::Vector3f sourceNormal(int _i) const { return unpackNormal(sourceNormals[_i]); }
+		inline Eigen::Vector3f targetNormal(int _i) const { return unpackNormal(targetNormals[_i]); }
+
+		// 3 x size() views, only valid while the pairs are not modified
+		inline Eigen::Map<const Eigen::Matrix3Xf> sourceMatrix() const { return Eigen::Map<const Eigen::Matrix3Xf>(empty() ? NULL : &sourcePositions[0], 3, size()); }
+		inline Eigen::Map<const Eigen::Matrix3Xf> targetMatrix() const { return Eigen::Map<const Eigen::Matrix3Xf>(empty() ? NULL : &targetPositions[0], 3, size()); }
+
+		// octahedral encoding, 16 bits per coordinate, below 1e-3 rad error; zero and NaN normals pack to invalidNormal,
+		// which unpacks to a zero normal
+		static unsigned int packNormal(const Eigen::Vector3f &_normal);
+		static Eigen::Vector3f unpackNormal(unsigned int _packed);
+		static const unsigned int invalidNormal = 0;
+
+		inline bool hasNormals(int _i) const { return sourceNormals[_i] != invalidNormal && targetNormals[_i] != invalidNormal; }
+
+		bool storeIndices;
+
+		std::vector<float> sourcePositions;
+		std::vector<float> targetPositions;
+		std::vector<unsigned int> sourceNormals;
+		std::vector<unsigned int> targetNormals;
+		std::vector<float> weights;
+		std::vector<int> sourceIndices;
+		std::vector<int> targetIndices;
+	};
+}
+
+#endif
@@ -2,6 +2,9 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
 
 #ifdef WIN32
 #define PCL_NO_PRECOMPILE
@@ -20,9 +23,95 @@
 #include <QtCore/QFileInfo>
 #include <QtCore/QTextStream>
 
+#include "../include/mortonorder.h"
+#include "../include/bulktransform.h"
+
 namespace tang2014
 {
-	void importScanPtrs(const std::string fileName, ScanPtrs &scanPtrs )
+	namespace
+	{
+		const char binaryScanMagic[8] = {'T', 'A', 'N', 'G', 'S', 'C', 'A', 'N'};
+		const unsigned int binaryScanVersion = 1;
+
+		// the files a copy was written from are recognised by their sizes and modification times
+		struct BinaryScanHeader
+		{
+			char magic[8];
+			unsigned int version;
+			unsigned int pointBytes;
+			unsigned int boundaryBytes;
+			unsigned int mortonOrder;
+			unsigned long long plyFileSize;
+			unsigned long long boundaryFileSize;
+			long long plyTime;
+			long long boundaryTime;
+			float transformation[16];
+			unsigned int pointWidth, pointHeight;
+			unsigned int boundaryWidth, boundaryHeight;
+			unsigned int orderNumber;
+		};
+
+		inline std::string binaryScanFileName(const Scan &scan) { return scan.filePath + ".scan"; }
+
+		bool fileStamp(const std::string &_fileName, unsigned long long &_size, long long &_time)
+		{
+			boost::system::error_code error;
+			_size = boost::filesystem::file_size(_fileName, error);
+			if (error) return false;
+			_time = boost::filesystem::last_write_time(_fileName, error);
+			return !error;
+		}
+
+		// the header the copy of the scan should have, apart from the point numbers
+		bool expectedHeader(const Scan &scan, bool _mortonOrder, BinaryScanHeader &_header)
+		{
+			std::memset(&_header, 0, sizeof(BinaryScanHeader));
+			std::memcpy(_header.magic, binaryScanMagic, 8);
+			_header.version = binaryScanVersion;
+			_header.pointBytes = sizeof(Point);
+			_header.boundaryBytes = sizeof(Boundary);
+			_header.mortonOrder = _mortonOrder ? 1 : 0;
+			std::memcpy(_header.transformation, scan.transformation.data(), 16 * sizeof(float));
+			return fileStamp(scan.filePath, _header.plyFileSize, _header.plyTime) && 
+				fileStamp(scan.boundaryFilePath, _header.boundaryFileSize, _header.boundaryTime);
+		}
+
+		// the copy holds the order the scan was loaded with, which is the file order when the boundaries do not match
+		// the points whatever was asked for
+		bool sameOrder(const BinaryScanHeader &_header, const BinaryScanHeader &_expected)
+		{
+			if (_header.mortonOrder == _expected.mortonOrder) return true;
+			return _expected.mortonOrder && !_header.mortonOrder && 
+				static_cast<size_t>(_header.pointWidth) * _header.pointHeight != static_cast<size_t>(_header.boundaryWidth) * _header.boundaryHeight;
+		}
+
+		bool sameSource(const BinaryScanHeader &_a, const BinaryScanHeader &_b)
+		{
+			return std::memcmp(_a.magic, _b.magic, 8) == 0 && _a.version == _b.version && 
+				_a.pointBytes == _b.pointBytes && _a.boundaryBytes == _b.boundaryBytes && sameOrder(_a, _b) &&
+				_a.plyFileSize == _b.plyFileSize && _a.boundaryFileSize == _b.boundaryFileSize && 
+				_a.plyTime == _b.plyTime && _a.boundaryTime == _b.boundaryTime &&
+				std::memcmp(_a.transformation, _b.transformation, 16 * sizeof(float)) == 0;
+		}
+
+		template <typename T> inline bool readArray(std::ifstream &_in, T *_array, size_t _size)
+		{
+			return _size == 0 || _in.read(reinterpret_cast<char*>(_array), _size * sizeof(T)).good();
+		}
+		template <typename T> inline void writeArray(std::ofstream &_out, const T *_array, size_t _size)
+		{
+			if (_size > 0) _out.write(reinterpret_cast<const char*>(_array), _size * sizeof(T));
+		}
+	}
+
+	void importScanPtrs(const std::string fileName, ScanPtrs &scanPtrs, bool _mortonOrder )
+	{
+		int first = scanPtrs.size();
+		indexScanPtrs(fileName, scanPtrs);
+		for (int i = first; i < scanPtrs.size(); ++i) loadScan(*scanPtrs[i], _mortonOrder);
+	}
+
+	void indexScanPtrs(const std::string fileName, ScanPtrs &scanPtrs)
 	{
 		std::fstream file;
 		file.open(fileName.c_str());
@@ -60,35 +149,160 @@ namespace tang2014
 			std::cerr << transformation << std::endl;
 			scanPtr->transformation = transformation;				
 
-			//read in pointcloud (points and normals)
-			std::cerr << "read in " << directory <<"/" << dummy << std::endl;
-			pcl::PLYReader plyReader;
-			scanPtr->pointsPtr.reset(new Points);
-			//plyReader.read(dummy, *scanPtr->pointsPtr);
-			pcl::PolygonMeshPtr polygonMesh(new pcl::PolygonMesh);
-			plyReader.read(directory + "/" + dummy, *polygonMesh);
-			pcl::fromPCLPointCloud2(polygonMesh->cloud, *scanPtr->pointsPtr);
-
-			//remove NAN points
-			scanPtr->pointsPtr->sensor_origin_ = Eigen::Vector4f(0, 0, 0, 0);
-			scanPtr->pointsPtr->sensor_orientation_ = Eigen::Quaternionf(1, 0, 0, 0);
-			std::vector<int> nanIndicesVector;
-			pcl::removeNaNFromPointCloud( *scanPtr->pointsPtr, *scanPtr->pointsPtr, nanIndicesVector );
-			std::cerr << *scanPtr->pointsPtr << std::endl;
-
-			//transform points and normals
-			pcl::transformPointCloudWithNormals(*scanPtr->pointsPtr, *scanPtr->pointsPtr, transformation);
-
-			//read in boundaries
 			//QString bdFileName = fileInfo.path() + "/" + fileInfo.completeBaseName() + ".bd";
 			QString bdFileName = QString::fromStdString(directory) + "/" + fileInfo.completeBaseName() + ".bd";
-			std::cerr << "read in " << bdFileName.toStdString() << std::endl;
-			pcl::PCDReader pcdReader;
-			scanPtr->boundariesPtr.reset(new Boundaries);
-			pcdReader.read(bdFileName.toStdString(), *scanPtr->boundariesPtr);
-			std::cerr << *scanPtr->boundariesPtr << std::endl;
+			scanPtr->boundaryFilePath = bdFileName.toStdString();
 
 			scan_i++;
 		}
 	}
+
+	unsigned int plyVertexNumber(const std::string &_fileName)
+	{
+		std::ifstream in(_fileName.c_str(), std::ios::in | std::ios::binary);
+		std::string line;
+		for (int i = 0; i < 100 && std::getline(in, line); ++i)
+		{
+			std::istringstream sstr(line);
+			std::string keyword, element;
+			unsigned int number;
+			if (!(sstr >> keyword)) continue;
+			if (keyword == "end_header") break;
+			if (keyword == "element" && sstr >> element >> number && element == "vertex") return number;
+		}
+		return 0;
+	}
+
+	void loadScan(Scan &scan, bool _mortonOrder, bool _binaryCopy)
+	{
+		if (_binaryCopy && readBinaryScan(scan, _mortonOrder))
+		{
+			std::cerr << "read in " << binaryScanFileName(scan) << std::endl;
+			return;
+		}
+
+		//read in pointcloud (points and normals)
+		std::cerr << "read in " << scan.filePath << std::endl;
+		pcl::PLYReader plyReader;
+		scan.pointsPtr.reset(new Points);
+		pcl::PolygonMeshPtr polygonMesh(new pcl::PolygonMesh);
+		plyReader.read(scan.filePath, *polygonMesh);
+		pcl::fromPCLPointCloud2(polygonMesh->cloud, *scan.pointsPtr);
+		polygonMesh.reset();
+
+		//remove NAN points
+		scan.pointsPtr->sensor_origin_ = Eigen::Vector4f(0, 0, 0, 0);
+		scan.pointsPtr->sensor_orientation_ = Eigen::Quaternionf(1, 0, 0, 0);
+		std::vector<int> nanIndicesVector;
+		pcl::removeNaNFromPointCloud( *scan.pointsPtr, *scan.pointsPtr, nanIndicesVector );
+		std::cerr << *scan.pointsPtr << std::endl;
+
+		//transform points and normals
+		registar::transformCloudWithNormals(*scan.pointsPtr, *scan.pointsPtr, scan.transformation);
+
+		//read in boundaries
+		std::cerr << "read in " << scan.boundaryFilePath << std::endl;
+		pcl::PCDReader pcdReader;
+		scan.boundariesPtr.reset(new Boundaries);
+		pcdReader.read(scan.boundaryFilePath, *scan.boundariesPtr);
+		std::cerr << *scan.boundariesPtr << std::endl;
+
+		//reorder points and boundaries, both or neither
+		scan.fileOrder.clear();
+		bool mortonOrder = _mortonOrder;
+		if (mortonOrder && scan.boundariesPtr->size() != scan.pointsPtr->size())
+		{
+			std::cerr << "boundaries of " << scan.filePath << " do not match its points, the scan keeps its file order" << std::endl;
+			mortonOrder = false;
+		}
+		if (mortonOrder)
+		{
+			std::vector<int> order;
+			registar::computeMortonOrder(*scan.pointsPtr, order);
+			registar::applyOrder(*scan.pointsPtr, order);
+			registar::applyOrder(*scan.boundariesPtr, order);
+			scan.fileOrder.resize(order.size());
+			for (int i = 0; i < order.size(); ++i) scan.fileOrder[i] = nanIndicesVector[order[i]];
+		}
+		scan.pointNumber = scan.pointsPtr->size();
+		scan.mortonOrder = mortonOrder;
+
+		if (_binaryCopy && !writeBinaryScan(scan)) std::cerr << "cannot write " << binaryScanFileName(scan) << std::endl;
+	}
+
+	bool readBinaryScan(Scan &scan, bool _mortonOrder, bool _headerOnly)
+	{
+		BinaryScanHeader expected, header;
+		if (!expectedHeader(scan, _mortonOrder, expected)) return false;
+
+		std::ifstream in(binaryScanFileName(scan).c_str(), std::ios::in | std::ios::binary);
+		if (!in.is_open()) return false;
+		if (!readArray(in, &header, 1) || !sameSource(header, expected)) return false;
+
+		scan.pointNumber = static_cast<unsigned int>(header.pointWidth) * header.pointHeight;
+		scan.mortonOrder = header.mortonOrder != 0;
+		if (_headerOnly) return true;
+
+		// the arrays are read straight into the clouds, one read each
+		PointsPtr pointsPtr(new Points);
+		pointsPtr->points.resize(scan.pointNumber);
+		pointsPtr->width = header.pointWidth;
+		pointsPtr->height = header.pointHeight;
+		pointsPtr->is_dense = true;
+		pointsPtr->sensor_origin_ = Eigen::Vector4f(0, 0, 0, 0);
+		pointsPtr->sensor_orientation_ = Eigen::Quaternionf(1, 0, 0, 0);
+		BoundariesPtr boundariesPtr(new Boundaries);
+		boundariesPtr->points.resize(static_cast<size_t>(header.boundaryWidth) * header.boundaryHeight);
+		boundariesPtr->width = header.boundaryWidth;
+		boundariesPtr->height = header.boundaryHeight;
+		std::vector<int> fileOrder(header.orderNumber);
+
+		if (!readArray(in, pointsPtr->points.empty() ? NULL : &pointsPtr->points[0], pointsPtr->points.size()) ||
+			!readArray(in, boundariesPtr->points.empty() ? NULL : &boundariesPtr->points[0], boundariesPtr->points.size()) ||
+			!readArray(in, fileOrder.empty() ? NULL : &fileOrder[0], fileOrder.size())) 
+			return false;
+
+		scan.pointsPtr = pointsPtr;
+		scan.boundariesPtr = boundariesPtr;
+		scan.fileOrder.swap(fileOrder);
+		return true;
+	}
+
+	bool writeBinaryScan(const Scan &scan)
+	{
+		if (!scan.pointsPtr || !scan.boundariesPtr) return false;
+		BinaryScanHeader header;
+		if (!expectedHeader(scan, scan.mortonOrder, header)) return false;
+		const Points &points = *scan.pointsPtr;
+		const Boundaries &boundaries = *scan.boundariesPtr;
+		header.pointWidth = points.width;
+		header.pointHeight = points.height;
+		header.boundaryWidth = boundaries.width;
+		header.boundaryHeight = boundaries.height;
+		header.orderNumber = scan.fileOrder.size();
+		if (points.size() != static_cast<size_t>(points.width) * points.height || 
+			boundaries.size() != static_cast<size_t>(boundaries.width) * boundaries.height) 
+			return false;
+
+		// written to a temporary file first, as the checkpoints, so an interrupted run leaves no truncated copy
+		std::string fileName = binaryScanFileName(scan);
+		std::string tempFileName = fileName + ".tmp";
+		std::ofstream out(tempFileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) return false;
+
+		writeArray(out, &header, 1);
+		writeArray(out, points.points.empty() ? NULL : &points.points[0], points.size());
+		writeArray(out, boundaries.points.empty() ? NULL : &boundaries.points[0], boundaries.size());
+		writeArray(out, scan.fileOrder.empty() ? NULL : &scan.fileOrder[0], scan.fileOrder.size());
+
+		bool ok = out.good();
+		out.close();
+		if (ok)
+		{
+			std::remove(fileName.c_str());
+			ok = std::rename(tempFileName.c_str(), fileName.c_str()) == 0;
+		}
+		if (!ok) std::remove(tempFileName.c_str());
+		return ok;
+	}
 }
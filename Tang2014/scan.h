@@ -10,20 +10,47 @@ namespace tang2014
 {
 	struct Scan
 	{
+		Scan() : transformation(Transformation::Identity()), pointNumber(0), mortonOrder(false) {}
+
+		// empty while the scan is not loaded, see ScanCache
 		PointsPtr pointsPtr;
 		BoundariesPtr boundariesPtr;
 		
 		Transformation transformation;
 		std::string filePath;
+		// the boundaries of a scan indexed from a .scans file, empty for scans given in memory, which cannot be loaded again
+		std::string boundaryFilePath;
+		// index in the ply file of each point when the points were reordered on import, empty otherwise
+		std::vector<int> fileOrder;
+
+		// the points left after the NaN points are removed and whether they were reordered, known once the scan has
+		// been loaded or the header of its binary copy read
+		unsigned int pointNumber;
+		bool mortonOrder;
 
 		typedef boost::shared_ptr<Scan> Ptr;
 	};
 	typedef Scan::Ptr ScanPtr;
 	typedef std::vector<ScanPtr> ScanPtrs; 
 
-	void importScanPtrs(const std::string fileName, ScanPtrs &scanPtrs );
-}
+	// _mortonOrder sorts the points of each scan, and their boundaries, along a Morton curve after the NaN points are removed
+	void importScanPtrs(const std::string fileName, ScanPtrs &scanPtrs, bool _mortonOrder = false );
 
-#endif
+	// the file paths and transformations of the scans only, their points are read by loadScan when needed
+	void indexScanPtrs(const std::string fileName, ScanPtrs &scanPtrs);
 
+	// the vertex number in the header of a ply file, NaN points included, 0 if there is none
+	unsigned int plyVertexNumber(const std::string &_fileName);
 
+	// reads the points and boundaries of an indexed scan and moves them by its transformation; _binaryCopy reads the
+	// binary copy of the scan instead if it is valid, and writes one otherwise
+	void loadScan(Scan &scan, bool _mortonOrder = false, bool _binaryCopy = false);
+
+	// Binary copies "<ply>.scan" of loaded scans, the points and boundaries as they are in memory. A copy is valid while
+	// the ply and boundary files, the transformation and the ordering are those it was written from, and reading it
+	// skips parsing the ply, removing the NaN points, transforming and reordering. _headerOnly reads the point number.
+	bool readBinaryScan(Scan &scan, bool _mortonOrder, bool _headerOnly = false);
+	bool writeBinaryScan(const Scan &scan);
+}
+
+#endif
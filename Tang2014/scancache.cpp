@@ -0,0 +1,289 @@
+#include "scancache.h"
+
+#include <iostream>
+#include <algorithm>
+
+#include "../include/voxelhashsearch.h"
+#include "../include/flatkdtree.h"
+
+namespace tang2014
+{
+	namespace
+	{
+		// rough bytes per point of the searches, the FLANN tree keeps a copy of the positions and two index arrays
+		const double kdTreeBytes = 24.0;
+		const double voxelHashBytes = 24.0;
+		const double flatKdTreeBytes = 16.0;
+
+		void dropPoints(Scan &_scan)
+		{
+			_scan.pointsPtr.reset();
+			_scan.boundariesPtr.reset();
+			std::vector<int>().swap(_scan.fileOrder);
+		}
+
+		// The cache as scheduleLinks sees it: which scans are resident, their bytes and when they were last used,
+		// changed by the same rules as the cache itself.
+		struct CacheSimulation
+		{
+			CacheSimulation(const std::vector<double> &_bytes, double _budget) :
+				bytes(_bytes), budget(_budget), used(0.0), time(0), resident(_bytes.size(), false), held(_bytes.size(), false), lastUse(_bytes.size(), 0), loads(0) {}
+
+			void insert(int _i, unsigned long long _lastUse)
+			{
+				resident[_i] = true;
+				lastUse[_i] = _lastUse;
+				used += bytes[_i];
+				residents.push_back(_i);
+				time = std::max(time, _lastUse);
+			}
+
+			// evicts the least recently used scans that are not held until _bytes more fit
+			void makeRoom(double _bytes)
+			{
+				while (used + _bytes > budget)
+				{
+					int oldest = -1;
+					for (int k = 0; k < residents.size(); ++k)
+					{
+						int i = residents[k];
+						if (!held[i] && (oldest < 0 || lastUse[i] < lastUse[residents[oldest]])) oldest = k;
+					}
+					if (oldest < 0) break;
+					resident[residents[oldest]] = false;
+					used -= bytes[residents[oldest]];
+					residents[oldest] = residents.back();
+					residents.pop_back();
+				}
+			}
+
+			void use(const Link &_link)
+			{
+				held[_link.a] = held[_link.b] = true;
+				ScanIndex indices[2] = {_link.a, _link.b};
+				for (int k = 0; k < 2; ++k)
+				{
+					ScanIndex i = indices[k];
+					if (resident[i]) continue;
+					makeRoom(bytes[i]);
+					insert(i, 0);
+					++loads;
+				}
+				held[_link.a] = held[_link.b] = false;
+				lastUse[_link.a] = ++time;
+				lastUse[_link.b] = ++time;
+				makeRoom(0.0);
+			}
+
+			const std::vector<double> &bytes;
+			double budget;
+			double used;
+			unsigned long long time;
+			std::vector<bool> resident;
+			std::vector<bool> held;
+			std::vector<unsigned long long> lastUse;
+			std::vector<int> residents;
+			unsigned int loads;
+		};
+	}
+
+	void ScanCache::setScans(const ScanPtrs &_scanPtrs, const Parameters &_para, const Searches &_searches)
+	{
+		scanPtrs = _scanPtrs;
+		para = _para;
+		searches = _searches;
+		entries.assign(scanPtrs.size(), Entry());
+		clock = 0;
+		residentBytes = 0.0;
+		pointPairBytes = 0.0;
+		loadNumber = 0;
+	}
+
+	double ScanCache::bytesPerPoint(bool _withPoints) const
+	{
+		double bytes = kdTreeBytes;
+		if (_withPoints) bytes += sizeof(Point) + sizeof(Boundary) + (para.mortonOrder ? sizeof(int) : 0);
+		if (searches.neighbourNumber > 0) bytes += searches.neighbourNumber * (sizeof(int) + sizeof(float)) + sizeof(int);
+		if (searches.voxelHashRadius > 0.0f) bytes += voxelHashBytes;
+		else if (searches.flatKdTree) bytes += flatKdTreeBytes;
+		return bytes;
+	}
+
+	double ScanCache::estimateBytes(ScanIndex _i) const
+	{
+		const Entry &entry = entries[_i];
+		if (entry.loaded) return entry.bytes;
+		const Scan &scan = *scanPtrs[_i];
+		unsigned int pointNumber = scan.pointsPtr ? scan.pointsPtr->size() : entry.counted ? scan.pointNumber : plyVertexNumber(scan.filePath);
+		return pointNumber * bytesPerPoint(reloadable(_i));
+	}
+
+	void ScanCache::acquire(ScanIndex _i)
+	{
+		acquire(&_i, 1);
+	}
+
+	void ScanCache::acquire(const Link &_link)
+	{
+		ScanIndex indices[2] = {_link.a, _link.b};
+		acquire(indices, 2);
+	}
+
+	void ScanCache::acquire(const ScanIndex *_indices, int _number)
+	{
+		// both scans of a link are held before either is loaded, so loading one never evicts the other
+		for (int k = 0; k < _number; ++k) entries[_indices[k]].holds++;
+		for (int k = 0; k < _number; ++k)
+		{
+			ScanIndex i = _indices[k];
+			if (entries[i].loaded) continue;
+			makeRoom(estimateBytes(i));
+			load(i);
+		}
+		for (int k = 0; k < _number; ++k) entries[_indices[k]].lastUse = ++clock;
+	}
+
+	void ScanCache::release(ScanIndex _i)
+	{
+		entries[_i].holds--;
+		entries[_i].lastUse = ++clock;
+		makeRoom(0.0);
+	}
+
+	void ScanCache::release(const Link &_link)
+	{
+		release(_link.a);
+		release(_link.b);
+	}
+
+	void ScanCache::load(ScanIndex _i)
+	{
+		Entry &entry = entries[_i];
+		Scan &scan = *scanPtrs[_i];
+		if (!scan.pointsPtr)
+		{
+			loadScan(scan, para.mortonOrder, para.binaryCopies);
+			++loadNumber;
+		}
+		scan.pointNumber = scan.pointsPtr->size();
+		entry.counted = true;
+
+		entry.kdTreePtr.reset(new KdTree);
+		entry.kdTreePtr->setInputCloud(scan.pointsPtr);
+		if (searches.neighbourNumber > 0)
+		{
+			entry.neighbourTablePtr.reset(new registar::NeighbourTable);
+			entry.neighbourTablePtr->build(scan.pointsPtr, entry.kdTreePtr, searches.neighbourNumber);
+		}
+		if (searches.voxelHashRadius > 0.0f)
+		{
+			registar::VoxelHashSearchPtr voxelHashPtr(new registar::VoxelHashSearch);
+			if (voxelHashPtr->setInputCloud(scan.pointsPtr, searches.voxelHashRadius)) entry.searchPtr = voxelHashPtr;
+			else std::cout << "distance threshold too large for the voxel hash of scan " << _i << ", using a KD-tree" << std::endl;
+		}
+		if (!entry.searchPtr && searches.flatKdTree)
+		{
+			registar::FlatKdTreePtr flatKdTreePtr(new registar::FlatKdTree);
+			flatKdTreePtr->setInputCloud(scan.pointsPtr);
+			entry.searchPtr = flatKdTreePtr;
+		}
+
+		entry.bytes = scan.pointNumber * bytesPerPoint(reloadable(_i));
+		entry.loaded = true;
+		residentBytes += entry.bytes;
+	}
+
+	void ScanCache::evict(ScanIndex _i)
+	{
+		Entry &entry = entries[_i];
+		entry.kdTreePtr.reset();
+		entry.neighbourTablePtr.reset();
+		entry.searchPtr.reset();
+		if (reloadable(_i)) dropPoints(*scanPtrs[_i]);
+		entry.loaded = false;
+		residentBytes -= entry.bytes;
+		entry.bytes = 0.0;
+	}
+
+	void ScanCache::setPointPairBytes(double _bytes)
+	{
+		pointPairBytes = _bytes;
+		makeRoom(0.0);
+	}
+
+	void ScanCache::makeRoom(double _bytes)
+	{
+		if (!bounded()) return;
+		while (residentBytes + pointPairBytes + _bytes > para.budget)
+		{
+			int oldest = -1;
+			for (int i = 0; i < entries.size(); ++i)
+			{
+				if (entries[i].loaded && entries[i].holds == 0 && (oldest < 0 || entries[i].lastUse < entries[oldest].lastUse)) oldest = i;
+			}
+			if (oldest < 0) break;
+			evict(oldest);
+		}
+	}
+
+	std::vector<int> ScanCache::scheduleLinks(const Links &_links) const
+	{
+		std::vector<int> order;
+		if (!bounded())
+		{
+			for (int l = 0; l < _links.size(); ++l) order.push_back(l);
+			return order;
+		}
+
+		std::vector<double> bytes(scanPtrs.size());
+		for (int i = 0; i < scanPtrs.size(); ++i) bytes[i] = estimateBytes(i);
+		std::vector<std::vector<int> > scanLinks(scanPtrs.size());
+		for (int l = 0; l < _links.size(); ++l)
+		{
+			scanLinks[_links[l].a].push_back(l);
+			if (_links[l].b != _links[l].a) scanLinks[_links[l].b].push_back(l);
+		}
+
+		// starts from the scans resident now
+		CacheSimulation cache(bytes, std::max(para.budget - pointPairBytes, 0.0));
+		for (int i = 0; i < entries.size(); ++i) if (entries[i].loaded) cache.insert(i, entries[i].lastUse);
+
+		std::vector<bool> done(_links.size(), false);
+		int first = 0;
+		for (int step = 0; step < _links.size(); ++step)
+		{
+			// fewest scans to load, then the most recently used scan, then the first link
+			int best = -1;
+			int bestMissing = 3;
+			unsigned long long bestUse = 0;
+			for (int k = 0; k < cache.residents.size(); ++k)
+			{
+				int i = cache.residents[k];
+				for (int j = 0; j < scanLinks[i].size(); ++j)
+				{
+					int l = scanLinks[i][j];
+					if (done[l]) continue;
+					int missing = (cache.resident[_links[l].a] ? 0 : 1) + (cache.resident[_links[l].b] ? 0 : 1);
+					unsigned long long use = cache.lastUse[i];
+					if (missing < bestMissing || (missing == bestMissing && (use > bestUse || (use == bestUse && l < best))))
+					{
+						best = l;
+						bestMissing = missing;
+						bestUse = use;
+					}
+				}
+			}
+			if (best < 0)
+			{
+				while (done[first]) ++first;
+				best = first;
+			}
+
+			done[best] = true;
+			order.push_back(best);
+			cache.use(_links[best]);
+		}
+		std::cout << "link schedule loads " << cache.loads << " scans" << std::endl;
+		return order;
+	}
+}
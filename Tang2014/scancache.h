@@ -0,0 +1,108 @@
+#ifndef TANG2014_SCANCACHE_H
+#define TANG2014_SCANCACHE_H
+
+#include "common.h"
+#include "link.h"
+#include "scan.h"
+
+#include "../include/neighbourtable.h"
+#include "../include/nearestsearch.h"
+
+#include <vector>
+
+namespace tang2014
+{
+	// Keeps the scans of a registration in memory within a budget. A scan is loaded when a link acquires it, together
+	// with its KD-tree and the searches the pair registrations share, and the least recently used scans no link holds
+	// are dropped while the resident ones exceed the budget. Scans given in memory cannot be loaded again, only their
+	// searches are dropped. The resident bytes are estimated per point from the structures kept for each scan.
+	class ScanCache
+	{
+	public:
+		struct Parameters
+		{
+			Parameters() : budget(0.0), mortonOrder(false), binaryCopies(false) {}
+
+			double budget;         // bytes, 0 keeps every scan once loaded
+			bool mortonOrder;      // see importScanPtrs
+			bool binaryCopies;     // loads through the binary copies of the scans, see readBinaryScan
+		};
+
+		// the searches built with the KD-tree of each scan
+		struct Searches
+		{
+			Searches() : neighbourNumber(0), voxelHashRadius(0.0f), flatKdTree(false) {}
+
+			int neighbourNumber;     // of the neighbour table for warm started searches, 0 builds none
+			float voxelHashRadius;   // a voxel hash bounded by it if positive, else a flat KD-tree if flatKdTree
+			bool flatKdTree;
+		};
+
+		ScanCache() : clock(0), residentBytes(0.0), pointPairBytes(0.0), loadNumber(0) {}
+
+		void setScans(const ScanPtrs &_scanPtrs, const Parameters &_para, const Searches &_searches);
+		inline const Parameters &getParameters() const { return para; }
+		inline bool bounded() const { return para.budget > 0.0; }
+
+		// a scan stays loaded while it is held, acquire and release come in pairs; the scans not held are evicted
+		// before a load rather than after it, which bounds the peak
+		void acquire(ScanIndex _i);
+		void acquire(const Link &_link);
+		void release(ScanIndex _i);
+		void release(const Link &_link);
+		inline bool isLoaded(ScanIndex _i) const { return entries[_i].loaded; }
+
+		inline KdTreePtr kdTree(ScanIndex _i) const { return entries[_i].kdTreePtr; }
+		inline registar::NeighbourTablePtr neighbourTable(ScanIndex _i) const { return entries[_i].neighbourTablePtr; }
+		inline registar::NearestSearchPtr search(ScanIndex _i) const { return entries[_i].searchPtr; }
+
+		// The indices of the links in an order that loads each scan as few times as the budget allows. The order is
+		// greedy over a simulation of the cache: the next link is one whose scans are both resident if there is one, else
+		// one sharing a scan with the most recently used resident scans, else the first link left. Without a budget
+		// every scan is loaded once whatever the order, and the links keep theirs.
+		std::vector<int> scheduleLinks(const Links &_links) const;
+
+		// the final point pairs the links keep between uses, which count against the budget but cannot be evicted,
+		// so the scans are fitted in what they leave
+		void setPointPairBytes(double _bytes);
+
+		double getResidentBytes() const { return residentBytes; }
+		unsigned int getLoadNumber() const { return loadNumber; }
+
+	private:
+		struct Entry
+		{
+			Entry() : holds(0), lastUse(0), bytes(0.0), loaded(false), counted(false) {}
+
+			KdTreePtr kdTreePtr;
+			registar::NeighbourTablePtr neighbourTablePtr;
+			registar::NearestSearchPtr searchPtr;
+			int holds;
+			unsigned long long lastUse;
+			double bytes;
+			bool loaded;
+			bool counted;
+		};
+
+		inline bool reloadable(ScanIndex _i) const { return !scanPtrs[_i]->boundaryFilePath.empty(); }
+		double bytesPerPoint(bool _withPoints) const;
+		double estimateBytes(ScanIndex _i) const;
+
+		void acquire(const ScanIndex *_indices, int _number);
+		void load(ScanIndex _i);
+		void evict(ScanIndex _i);
+		// evicts the least recently used scans not held until _bytes more fit in the budget
+		void makeRoom(double _bytes);
+
+		ScanPtrs scanPtrs;
+		Parameters para;
+		Searches searches;
+		std::vector<Entry> entries;
+		unsigned long long clock;
+		double residentBytes;
+		double pointPairBytes;
+		unsigned int loadNumber;
+	};
+}
+
+#endif
@@ -4,38 +4,114 @@
 
 #include <pcl/common/transforms.h>
 #include <pcl/common/time.h>
+#include <omp.h>
 
 #include "pairregistration.h"
 #include "globalregistration.h"
 
-#include "../Williams2001/SRoMCPS.h"
 #include "../include/utilities.h"
+#include "../include/posegraph.h"
 
 namespace tang2014
 {
 	void GlobalRegistration::startRegistration()
 	{
 		pcl::ScopeTime time("calculation");
-		buildKdTreePtrs();
-		std::cout << "time after building kdtrees : "<< time.getTimeSeconds() << std::endl;
+		initialScanCache();
+		std::cout << "time after indexing scans : "<< time.getTimeSeconds() << std::endl;
 		initialTransformations();
-		initialPairRegistration();
+
+		// resume from the latest stage whose checkpoint matches the current scans and parameters
+		Stage resumed = NO_STAGE;
+		if(para.resume)
+		{
+			if(checkpointValid(GLOBAL_STAGE)) resumed = GLOBAL_STAGE;
+			else if(checkpointValid(LOOP_STAGE)) resumed = LOOP_STAGE;
+			else if(checkpointValid(PAIR_STAGE)) resumed = PAIR_STAGE;
+			if(resumed == NO_STAGE) std::cout << "no valid checkpoint found, starting from scratch" << std::endl;
+		}
+
+		initialPairRegistration(resumed == NO_STAGE);
+		if(resumed != NO_STAGE && !loadCheckpoint(resumed))
+		{
+			std::cout << "failed to load checkpoint, starting from scratch" << std::endl;
+			resumed = NO_STAGE;
+			pairRegistrationPtrMap.clear();
+			initialPairRegistration();
+		}
+		if(resumed == NO_STAGE) saveCheckpoint(PAIR_STAGE);
 		std::cout << "time after initial pair registration : " << time.getTimeSeconds() << std::endl;
-		if(para.doIncrementalLoopRefine) incrementalLoopRefine();
+
+		if(resumed < LOOP_STAGE)
+		{
+			if(para.doIncrementalLoopRefine) incrementalLoopRefine();
+			saveCheckpoint(LOOP_STAGE);
+		}
 		std::cout << "time after incremental loop refinement : " << time.getTimeSeconds() << std::endl;
-		if(para.doGlobalRefine && para.doInitialPairRegistration) globalPairRefine();
-		else if(para.doGlobalRefine) globalRefine(para.globalIterationNum_max, para.globalIterationNum_min);
+
+		if(resumed < GLOBAL_STAGE)
+		{
+			if(para.doGlobalRefine && para.doPoseGraphRefine) globalPoseGraphRefine(para.globalIterationNum_max, para.globalIterationNum_min);
+			else if(para.doGlobalRefine && para.doInitialPairRegistration) globalPairRefine();
+			else if(para.doGlobalRefine) globalRefine(para.globalIterationNum_max, para.globalIterationNum_min);
+			saveCheckpoint(GLOBAL_STAGE);
+		}
 		std::cout << "time after global refinement : " << time.getTimeSeconds() << std::endl;
 	}
 
-	void GlobalRegistration::buildKdTreePtrs()
+	void GlobalRegistration::initialScanCache()
 	{
-		for (int i = 0; i < scanPtrs.size(); ++i)
+		ScanCache::Searches searches;
+		if (para.pr_para.warmStart) searches.neighbourNumber = registar::WarmStartSearch::neighbourNumber;
+		if (para.pr_para.voxelHash && para.pr_para.distanceTest) searches.voxelHashRadius = PairRegistration::searchRadius(para.pr_para);
+		searches.flatKdTree = para.pr_para.flatKdTree;
+		scanCache.setScans(scanPtrs, para.sc_para, searches);
+		coarseFeaturePtrs.assign(scanPtrs.size(), registar::CoarseAlignmentFeaturesPtr());
+	}
+
+	void GlobalRegistration::buildCoarseFeaturePtr(ScanIndex _i)
+	{
+		if (coarseFeaturePtrs[_i]) return;
+		registar::CoarseAlignmentParameters coarseParameters = registar::defaultCoarseAlignmentParameters(para.coarseVoxelSize);
+		registar::CoarseAlignmentFeaturesPtr featuresPtr(new registar::CoarseAlignmentFeatures);
+		featuresPtr->compute(*scanPtrs[_i]->pointsPtr, coarseParameters);
+		coarseFeaturePtrs[_i] = featuresPtr;
+	}
+
+	void GlobalRegistration::acquireLink(const Link &_link)
+	{
+		scanCache.acquire(_link);
+		PairRegistrationPtrMap::iterator it = pairRegistrationPtrMap.find(_link);
+		if (it == pairRegistrationPtrMap.end() || !it->second) return;
+		PairRegistrationPtr pairRegistrationPtr = it->second;
+		pairRegistrationPtr->setKdTree(scanCache.kdTree(_link.a), scanCache.kdTree(_link.b));
+		if (scanCache.neighbourTable(_link.a)) pairRegistrationPtr->setNeighbourTables(scanCache.neighbourTable(_link.a), scanCache.neighbourTable(_link.b));
+		if (scanCache.search(_link.a)) pairRegistrationPtr->setSharedSearches(scanCache.search(_link.a), scanCache.search(_link.b));
+		if (pairRegistrationPtr->targetCandidateIndices.size() != scanPtrs[_link.a]->pointsPtr->size() || 
+			pairRegistrationPtr->sourceCandidateIndices.size() != scanPtrs[_link.b]->pointsPtr->size())
+			pairRegistrationPtr->initiateCandidateIndices();
+	}
+
+	void GlobalRegistration::releaseLink(const Link &_link)
+	{
+		// without a budget the scans stay loaded and the pair registrations keep their searches and samples
+		if (scanCache.bounded())
+		{
+			PairRegistrationPtrMap::iterator it = pairRegistrationPtrMap.find(_link);
+			if (it != pairRegistrationPtrMap.end() && it->second) it->second->releaseScans();
+			scanCache.setPointPairBytes(pointPairBytes());
+		}
+		scanCache.release(_link);
+	}
+
+	double GlobalRegistration::pointPairBytes() const
+	{
+		double bytes = 0.0;
+		for (PairRegistrationPtrMap::const_iterator it = pairRegistrationPtrMap.begin(); it != pairRegistrationPtrMap.end(); ++it)
 		{
-			KdTreePtr kdTreePtr(new KdTree);
-			kdTreePtr->setInputCloud(scanPtrs[i]->pointsPtr);
-			kdTreePtrs.push_back(kdTreePtr);
+			if (it->second) bytes += it->second->final_s2t.bytes();
 		}
+		return bytes;
 	}
 
 	void GlobalRegistration::initialTransformations()
@@ -46,29 +122,49 @@ namespace tang2014
 		}
 	}
 
-	void GlobalRegistration::initialPairRegistration()
+	void GlobalRegistration::initialPairRegistration(bool _doRegistration)
 	{
 		int threads = omp_get_num_procs();
 		std::cout << threads << "threads" << std::endl;
-		for (int i = 0; i < links.size(); ++i)
+		// the features of each scan are shared by all its links
+		bool coarse = _doRegistration && para.coarseVoxelSize > 0.0f;
+		registar::CoarseAlignmentParameters coarseParameters = registar::defaultCoarseAlignmentParameters(para.coarseVoxelSize);
+		std::vector<int> order = scanCache.scheduleLinks(links);
+		for (int k = 0; k < order.size(); ++k)
 		{
-			Link link = links[i];
+			Link link = links[order[k]];
 			ScanIndex a = link.a;
 			ScanIndex b = link.b;
 			// PairRegistrationPtr pairReigstrationPtr(new PairRegistration(scanPtrs[a], scanPtrs[b]));
 			PairRegistrationOMPPtr pairReigstrationPtr(new PairRegistrationOMP(scanPtrs[a], scanPtrs[b], threads));
-			pairReigstrationPtr->setKdTree(kdTreePtrs[a], kdTreePtrs[b]);
 			pairReigstrationPtr->setParameter(para.pr_para);
 			pairReigstrationPtr->setTransformation(Transformation::Identity());
-			pairReigstrationPtr->initiateCandidateIndices();
-			if(para.doInitialPairRegistration) 
+			std::pair<Link, PairRegistrationPtr> pairLP(link, pairReigstrationPtr);
+			// a repeated link is registered once
+			if (!pairRegistrationPtrMap.insert(pairLP).second) continue;
+			// otherwise the scans are bound when the link is first used
+			bool registration = para.doInitialPairRegistration && _doRegistration;
+			if (!coarse && !registration) continue;
+
+			acquireLink(link);
+			if (coarse)
+			{
+				buildCoarseFeaturePtr(a);
+				buildCoarseFeaturePtr(b);
+				registar::CoarseAlignmentResult coarseResult = registar::coarseAlign(*coarseFeaturePtrs[a], *coarseFeaturePtrs[b], coarseParameters);
+				std::cout << "coarse alignment : " << link.a << " <<-- " << link.b << " " << coarseResult.inliers << " of " << coarseResult.matches << " matches" << std::endl;
+				if (coarseFeaturePtrs[a]->missingNormals()) std::cout << "scan " << a << " has no normals, coarse alignment skipped" << std::endl;
+				if (coarseFeaturePtrs[b]->missingNormals()) std::cout << "scan " << b << " has no normals, coarse alignment skipped" << std::endl;
+				if (!coarseResult.aligned) std::cout << "coarse alignment kept the initial transformation" << std::endl;
+				pairReigstrationPtr->setTransformation(coarseResult.transformation);
+			}
+			if(registration) 
 			{
 				std::cout << "pair registration : " << link.a << " <<-- " << link.b << std::endl;
 				// pairReigstrationPtr->startRegistration();
 				pairReigstrationPtr->startRegistrationOMP();
 			}
-			std::pair<Link, PairRegistrationPtr> pairLP(link, pairReigstrationPtr);
-			pairRegistrationPtrMap.insert(pairLP);
+			releaseLink(link);
 		}
 	}
 
@@ -249,29 +345,24 @@ namespace tang2014
 						// std::cout << "find link [ " << link.a << " " << link.b << " ]" << std::endl;
 						// std::cout << "link transformation :\n"  << 	pairRegistrationPtrMap[link]->transformation << std::endl;			
 
-						if(_rePairGenerate) pairRegistrationPtrMap[link]->generateFinalPointPairs( pairRegistrationPtrMap[link]->transformation );
+						if(_rePairGenerate)
+						{
+							acquireLink(link);
+							pairRegistrationPtrMap[link]->generateFinalPointPairs( pairRegistrationPtrMap[link]->transformation );
+							releaseLink(link);
+						}
 
-						for (int k = 0; k < pairRegistrationPtrMap[link]->final_s2t.size(); ++k)
+						const PairRegistration::PointPairs &final_s2t = pairRegistrationPtrMap[link]->final_s2t;
+						if( useVirtualMate )
+						{
+							Transformation transformation = pairRegistrationPtrMap[link]->transformation;
+							_all_final_s2t.appendTransformed( final_s2t, _transformations1[i] * transformation, false, _transformations2[j], false );
+							_all_final_s2t.appendTransformed( final_s2t, _transformations1[i], true, _transformations2[j] * transformation.inverse(), true );
+						}
+						else
 						{
-							if( useVirtualMate )
-							{
-								PairRegistration::PointPair temp = pairRegistrationPtrMap[link]->final_s2t[k];
-								Transformation transformation = pairRegistrationPtrMap[link]->transformation;
-								PairRegistration::PointPair temp1, temp2;
-								temp1.targetPoint = registar::transformPointWithNormal( temp.sourcePoint, _transformations1[i] * transformation );
-								temp1.sourcePoint = registar::transformPointWithNormal( temp.sourcePoint, _transformations2[j] );
-								temp2.targetPoint = registar::transformPointWithNormal( temp.targetPoint, _transformations1[i] );
-								temp2.sourcePoint = registar::transformPointWithNormal( temp.targetPoint, _transformations2[j] * transformation.inverse() );
-								_all_final_s2t.push_back(temp1);
-								_all_final_s2t.push_back(temp2);							
-							}
-							else
-							{
-								PairRegistration::PointPair temp = pairRegistrationPtrMap[link]->final_s2t[k];
-								temp.targetPoint = registar::transformPointWithNormal( temp.targetPoint, _transformations1[i] );   //direct mate not the virtual mate, it should also be enough since we continue update 
-								temp.sourcePoint = registar::transformPointWithNormal( temp.sourcePoint, _transformations2[j] );   //the transformation using pair registration
-								_all_final_s2t.push_back(temp);
-							}
+							//direct mate not the virtual mate, it should also be enough since we continue update the transformation using pair registration
+							_all_final_s2t.appendTransformed( final_s2t, _transformations1[i], true, _transformations2[j], false );
 						}
 					}
 					else if ( it_21 != graph.edges.end() )  // edge in reverse order
@@ -283,43 +374,126 @@ namespace tang2014
 						// std::cout << "find link reverse [ " << link.a << " " << link.b << " ]" << std::endl;
 						// std::cout << "link transformation :\n"  << 	pairRegistrationPtrMap[link]->transformation << std::endl;	
 
-						if(_rePairGenerate) pairRegistrationPtrMap[link]->generateFinalPointPairs( pairRegistrationPtrMap[link]->transformation );
+						if(_rePairGenerate)
+						{
+							acquireLink(link);
+							pairRegistrationPtrMap[link]->generateFinalPointPairs( pairRegistrationPtrMap[link]->transformation );
+							releaseLink(link);
+						}
 
-						for (int k = 0; k < pairRegistrationPtrMap[link]->final_s2t.size(); ++k)
+						// the link runs the other way, so its target points are the sources here
+						const PairRegistration::PointPairs &final_s2t = pairRegistrationPtrMap[link]->final_s2t;
+						if ( useVirtualMate )
+						{
+							Transformation transformation = pairRegistrationPtrMap[link]->transformation;
+							Transformation transformation2 = transformation.inverse();	
+							_all_final_s2t.appendTransformed( final_s2t, _transformations1[i] * transformation2, true, _transformations2[j], true );
+							_all_final_s2t.appendTransformed( final_s2t, _transformations1[i], false, _transformations2[j] * transformation, false );
+						}
+						else
 						{
-							if ( useVirtualMate )
-							{
-								PairRegistration::PointPair temp = pairRegistrationPtrMap[link]->final_s2t[k];					
-								PairRegistration::PointPair temp2;
-								temp2.targetPoint = temp.sourcePoint;
-								temp2.sourcePoint = temp.targetPoint;
-								Transformation transformation = pairRegistrationPtrMap[link]->transformation;
-								Transformation transformation2 = transformation.inverse();	
-								PairRegistration::PointPair temp2_1, temp2_2;
-								temp2_1.targetPoint = registar::transformPointWithNormal( temp2.sourcePoint, _transformations1[i] * transformation2 );
-								temp2_1.sourcePoint = registar::transformPointWithNormal( temp2.sourcePoint, _transformations2[j] );
-								temp2_2.targetPoint = registar::transformPointWithNormal( temp2.targetPoint, _transformations1[i] );
-								temp2_2.sourcePoint = registar::transformPointWithNormal( temp2.targetPoint, _transformations2[j] * transformation2.inverse() );
-								_all_final_s2t.push_back(temp2_1);
-								_all_final_s2t.push_back(temp2_2);
-							}
-							else
-							{
-								PairRegistration::PointPair temp = pairRegistrationPtrMap[link]->final_s2t[k];
-								PairRegistration::PointPair temp2;
-								temp2.targetPoint = temp.sourcePoint;
-								temp2.sourcePoint = temp.targetPoint;
-								temp2.targetPoint = registar::transformPointWithNormal( temp2.targetPoint, _transformations1[i] ); //direct mate not the virtual mate, it should also be enough since we continue update 
-								temp2.sourcePoint = registar::transformPointWithNormal( temp2.sourcePoint, _transformations2[j] ); //the transformation using pair registration
-								_all_final_s2t.push_back(temp2);
-							}
-						}					
+							//direct mate not the virtual mate, it should also be enough since we continue update the transformation using pair registration
+							_all_final_s2t.appendTransformed( final_s2t, _transformations1[i], false, _transformations2[j], true );
+						}
 					}
 				}
 			}
 		}
 	}
 
+	void GlobalRegistration::generateFinalPointPairMoments(std::vector<GraphVertex*> &_vertices1, Transformations &_transformations1, 
+		std::vector<GraphVertex*> &_vertices2, Transformations &_transformations2, 
+		bool _rePairGenerate, bool useVirtualMate, williams2001::PointPairMoments &_moments)
+	{
+		// same point pairs as generateFinalPointPairs, but only their moments are accumulated
+		for (int i = 0; i < _vertices1.size(); ++i)
+		{
+			for (int j = 0; j < _vertices2.size(); ++j)
+			{
+				if ( !_vertices1[i]->isGraphLoop() && !_vertices2[j]->isGraphLoop() )
+				{
+					std::map< std::pair<GraphVertex*, GraphVertex*>, GraphEdge*>::iterator  it_12 = 
+						graph.edges.find(std::pair<GraphVertex*, GraphVertex*>( _vertices1[i], _vertices2[j] ) );
+					std::map< std::pair<GraphVertex*, GraphVertex*>, GraphEdge*>::iterator  it_21 = 
+						graph.edges.find(std::pair<GraphVertex*, GraphVertex*>( _vertices2[j], _vertices1[i]) );
+
+					if ( it_12 != graph.edges.end() )
+					{
+						Link link;
+						link.a = (*it_12).second->a->vbase;
+						link.b = (*it_12).second->b->vbase;
+
+						if(_rePairGenerate)
+						{
+							acquireLink(link);
+							pairRegistrationPtrMap[link]->generateFinalPointPairs( pairRegistrationPtrMap[link]->transformation );
+							releaseLink(link);
+						}
+
+						PairRegistration::PointPairs &final_s2t = pairRegistrationPtrMap[link]->final_s2t;
+						Transformation transformation = pairRegistrationPtrMap[link]->transformation;
+						if( useVirtualMate )
+						{
+							accumulatePointPairMoments(final_s2t, _transformations1[i] * transformation, false, _transformations2[j], false, _moments);
+							accumulatePointPairMoments(final_s2t, _transformations1[i], true, _transformations2[j] * transformation.inverse(), true, _moments);
+						}
+						else accumulatePointPairMoments(final_s2t, _transformations1[i], true, _transformations2[j], false, _moments);
+					}
+					else if ( it_21 != graph.edges.end() )  // edge in reverse order
+					{
+						Link link;
+						link.a = (*it_21).second->a->vbase;
+						link.b = (*it_21).second->b->vbase;
+
+						if(_rePairGenerate)
+						{
+							acquireLink(link);
+							pairRegistrationPtrMap[link]->generateFinalPointPairs( pairRegistrationPtrMap[link]->transformation );
+							releaseLink(link);
+						}
+
+						PairRegistration::PointPairs &final_s2t = pairRegistrationPtrMap[link]->final_s2t;
+						Transformation transformation = pairRegistrationPtrMap[link]->transformation;
+						Transformation transformation2 = transformation.inverse();
+						if ( useVirtualMate )
+						{
+							accumulatePointPairMoments(final_s2t, _transformations1[i] * transformation2, true, _transformations2[j], true, _moments);
+							accumulatePointPairMoments(final_s2t, _transformations1[i], false, _transformations2[j] * transformation, false, _moments);
+						}
+						else accumulatePointPairMoments(final_s2t, _transformations1[i], false, _transformations2[j], true, _moments);
+					}
+				}
+			}
+		}
+	}
+
+	void GlobalRegistration::accumulatePointPairMoments(const PairRegistration::PointPairs &_pairs, 
+		const Transformation &_xTransformation, bool _xFromTarget, const Transformation &_yTransformation, bool _yFromTarget, 
+		williams2001::PointPairMoments &_moments)
+	{
+		// x = _xTransformation * (target or source point of the pair), y likewise; each thread sums its own moments
+		int threads = omp_get_num_procs();
+		williams2001::PointPairMomentsVector threadMoments(threads);
+
+		Eigen::Matrix<williams2001::Scalar, 3, 3> xR = _xTransformation.block<3, 3>(0, 0).cast<williams2001::Scalar>();
+		williams2001::Point xt = _xTransformation.block<3, 1>(0, 3).cast<williams2001::Scalar>();
+		Eigen::Matrix<williams2001::Scalar, 3, 3> yR = _yTransformation.block<3, 3>(0, 0).cast<williams2001::Scalar>();
+		williams2001::Point yt = _yTransformation.block<3, 1>(0, 3).cast<williams2001::Scalar>();
+
+		int size = _pairs.size();
+		#pragma omp parallel for schedule (static) num_threads (threads)
+		for (int k = 0; k < size; ++k)
+		{
+			Eigen::Vector3f xPosition = _xFromTarget ? _pairs.targetPosition(k) : _pairs.sourcePosition(k);
+			Eigen::Vector3f yPosition = _yFromTarget ? _pairs.targetPosition(k) : _pairs.sourcePosition(k);
+			williams2001::Point x = xR * xPosition.cast<williams2001::Scalar>() + xt;
+			williams2001::Point y = yR * yPosition.cast<williams2001::Scalar>() + yt;
+			threadMoments[omp_get_thread_num()].add(x, y, _pairs.weights[k]);
+		}
+
+		for (int t = 0; t < threads; ++t) _moments += threadMoments[t];
+	}
+
 	void GlobalRegistration::makeEdgesConsistent(std::vector<GraphVertex*> &_vertices1, Transformations &_transformations1, 
 		std::vector<GraphVertex*> &_vertices2, Transformations &_transformations2,
 		Transformation &_newTransformation)
@@ -386,11 +560,9 @@ namespace tang2014
 		if (_graphLoop->loop.size() <= 2) return std::numeric_limits<float>::max();
 
 		williams2001::ScanIndexPairs sipairs;
-		std::vector<williams2001::PointPairWithWeights> ppairwwss;
+		williams2001::PointPairMomentsVector moments;
 		int M = _graphLoop->loop.size();
 
-		williams2001::PointPairWithWeights buffer1;
-
 		std::cout << "refine loop : " << *_graphLoop << std::endl;
 		for (int i = 0; i < M; ++i)
 		{
@@ -408,28 +580,17 @@ namespace tang2014
 				GraphVertexDecompose(vertex1, Transformation::Identity(), NULL, vertices1, transformations1, false);
 				GraphVertexDecompose(vertex2, Transformation::Identity(), NULL, vertices2, transformations2, false);
 
-				PairRegistration::PointPairs all_final_s2t;
+				williams2001::PointPairMoments linkMoments;
 
-				generateFinalPointPairs(vertices1, transformations1, vertices2, transformations2, false, true, all_final_s2t);
+				generateFinalPointPairMoments(vertices1, transformations1, vertices2, transformations2, false, true, linkMoments);
 
-				// std::cout << "all_final_s2t.size() : " << all_final_s2t.size() << std::endl;
+				// std::cout << "linkMoments.w : " << linkMoments.w << std::endl;
 
 				ScanIndex a = i;
 				ScanIndex b = (i + 1)%M;
 
 				sipairs.push_back(williams2001::ScanIndexPair(a,b));
-
-				buffer1.clear();
-				for (int k = 0; k < all_final_s2t.size(); ++k)
-				{
-					PairRegistration::PointPair temp = all_final_s2t[k];
-					williams2001::PointPairWithWeight temp_1;
-					temp_1.w = 1.0;
-					temp_1.ppair.first = temp.targetPoint.getVector3fMap().cast<williams2001::Scalar>(); 
-					temp_1.ppair.second = temp.sourcePoint.getVector3fMap().cast<williams2001::Scalar>();
-					buffer1.push_back(temp_1);
-				}
-				ppairwwss.push_back(buffer1);
+				moments.push_back(linkMoments);
 			}
 			else if (it_21 != graph.edges.end())
 			{
@@ -440,28 +601,17 @@ namespace tang2014
 				GraphVertexDecompose(vertex1, Transformation::Identity(), NULL, vertices1, transformations1, false);
 				GraphVertexDecompose(vertex2, Transformation::Identity(), NULL, vertices2, transformations2, false);
 
-				PairRegistration::PointPairs all_final_s2t;
+				williams2001::PointPairMoments linkMoments;
 
-				generateFinalPointPairs(vertices1, transformations1, vertices2, transformations2, false, true, all_final_s2t);
+				generateFinalPointPairMoments(vertices1, transformations1, vertices2, transformations2, false, true, linkMoments);
 
-				// std::cout << "inverse all_final_s2t.size() : " << all_final_s2t.size() << std::endl;
+				// std::cout << "inverse linkMoments.w : " << linkMoments.w << std::endl;
 
 				ScanIndex a = i;
 				ScanIndex b = (i + 1)%M;
 
 				sipairs.push_back(williams2001::ScanIndexPair(a,b));
-
-				buffer1.clear();
-				for (int k = 0; k < all_final_s2t.size(); ++k)
-				{
-					PairRegistration::PointPair temp = all_final_s2t[k];
-					williams2001::PointPairWithWeight temp_1;
-					temp_1.w = 1.0;
-					temp_1.ppair.first = temp.targetPoint.getVector3fMap().cast<williams2001::Scalar>(); 
-					temp_1.ppair.second = temp.sourcePoint.getVector3fMap().cast<williams2001::Scalar>();
-					buffer1.push_back(temp_1);
-				}
-				ppairwwss.push_back(buffer1);
+				moments.push_back(linkMoments);
 			}
 			else
 			{
@@ -474,19 +624,12 @@ namespace tang2014
 
 		// std::cout << "M :" << M << std::endl;
 		// std::cout << "sipairs.size() : " << sipairs.size() << std::endl;
-		// std::cout << "ppairwwss.size() : " << ppairwwss.size() << std::endl;
+		// std::cout << "moments.size() : " << moments.size() << std::endl;
 
-		williams2001::SRoMCPS sromcps_globalrefine(sipairs, ppairwwss, M);
+		williams2001::SRoMCPS sromcps_globalrefine(sipairs, moments, M);
 
 		float total_error = ( sromcps_globalrefine.R *  sromcps_globalrefine.Q * sromcps_globalrefine.R.transpose() ).trace();
-		float total_weight = 0.0f;
-		for (int i = 0; i < ppairwwss.size(); ++i)
-		{
-			for (int j = 0; j < ppairwwss[i].size(); ++j)
-			{
-				total_weight += ppairwwss[i][j].w;
-			}
-		}
+		float total_weight = sromcps_globalrefine.totalWeight();
 		float rms_error = sqrtf( total_error / total_weight );
 		std::cout << "looprefine rms_error = " <<  rms_error << " total_weight = " << total_weight << std::endl;
 
@@ -703,11 +846,9 @@ namespace tang2014
 	void GlobalRegistration::globalPairRefine()
 	{
 		williams2001::ScanIndexPairs sipairs;
-		std::vector<williams2001::PointPairWithWeights> ppairwwss;
+		williams2001::PointPairMomentsVector moments(links.size());
 		int M = scanPtrs.size();
 
-		williams2001::PointPairWithWeights buffer1;
-
 		for (int i = 0; i < links.size(); ++i)
 		{
 			Link link = links[i];
@@ -716,43 +857,20 @@ namespace tang2014
 
 			sipairs.push_back(williams2001::ScanIndexPair(a,b));
 
-			buffer1.clear();
-			for (int k = 0; k < pairRegistrationPtrMap[link]->final_s2t.size(); ++k)
-			{
-				PairRegistration::PointPair temp = pairRegistrationPtrMap[link]->final_s2t[k];
-				Transformation transformation = pairRegistrationPtrMap[link]->transformation;
-				PairRegistration::PointPair temp1, temp2;
-				temp1.targetPoint = registar::transformPointWithNormal( temp.sourcePoint, transformation );
-				temp1.sourcePoint = temp.sourcePoint;
-				temp2.targetPoint = temp.targetPoint;
-				temp2.sourcePoint = registar::transformPointWithNormal( temp.targetPoint, transformation.inverse() );
-
-				williams2001::PointPairWithWeight temp_1;
-				temp_1.w = 1.0;
-				temp_1.ppair.first = temp1.targetPoint.getVector3fMap().cast<williams2001::Scalar>(); 
-				temp_1.ppair.second = temp1.sourcePoint.getVector3fMap().cast<williams2001::Scalar>();
-				buffer1.push_back(temp_1);
-
-				williams2001::PointPairWithWeight temp_2;
-				temp_2.w = 1.0;
-				temp_2.ppair.first = temp2.targetPoint.getVector3fMap().cast<williams2001::Scalar>(); 
-				temp_2.ppair.second = temp2.sourcePoint.getVector3fMap().cast<williams2001::Scalar>();
-				buffer1.push_back(temp_2);
-			}
-			ppairwwss.push_back(buffer1);
+			// virtual mates of the source points and of the target points
+			PairRegistration::PointPairs &final_s2t = pairRegistrationPtrMap[link]->final_s2t;
+			Transformation transformation = pairRegistrationPtrMap[link]->transformation;
+			accumulatePointPairMoments(final_s2t, transformation, false, Transformation::Identity(), false, moments[i]);
+			accumulatePointPairMoments(final_s2t, Transformation::Identity(), true, transformation.inverse(), true, moments[i]);
 		}
 
-		williams2001::SRoMCPS sromcps_globalrefine(sipairs, ppairwwss, M);	
+		// warm start the rotation sweep from the current transformations
+		williams2001::Rotations R_initial(3, 3*M);
+		for (int i = 0; i < M; ++i) R_initial.block<3, 3>(0, 3*i) = transformations[i].block<3, 3>(0, 0).cast<williams2001::Scalar>();
+		williams2001::SRoMCPS sromcps_globalrefine(sipairs, moments, M, williams2001::SRoMCPS::SolveParameters(), R_initial);	
 
 		float total_error = ( sromcps_globalrefine.R *  sromcps_globalrefine.Q * sromcps_globalrefine.R.transpose() ).trace();
-		float total_weight = 0.0f;
-		for (int i = 0; i < ppairwwss.size(); ++i)
-		{
-			for (int j = 0; j < ppairwwss[i].size(); ++j)
-			{
-				total_weight += ppairwwss[i][j].w;
-			}
-		}
+		float total_weight = sromcps_globalrefine.totalWeight();
 		float rms_error = sqrtf( total_error / total_weight );
 		std::cout << "globalrefine rms_error = " <<  rms_error << " total_weight = " << total_weight << std::endl;
 
@@ -763,96 +881,86 @@ namespace tang2014
 		}
 	}
 
-	void GlobalRegistration::globalRefine(unsigned int _iterationNum_max, unsigned int _iterationNum_min)
+	void GlobalRegistration::generateLinkMoments(williams2001::PointPairMomentsVector &_moments, int _iter)
 	{
 		PointsPtr buffer(new Points);
 		PairRegistration::PointPairs s2t, t2s;
 
+		int threads = omp_get_num_procs();
+
+		_moments.assign(links.size(), williams2001::PointPairMoments());
+		std::vector<int> order = scanCache.scheduleLinks(links);
+		for (int k = 0; k < order.size(); ++k)
+		{
+			int i = order[k];
+			Link link = links[i];
+			ScanIndex a = link.a;
+			ScanIndex b = link.b;
+			acquireLink(link);
+
+			buffer->clear();
+			s2t.clear();
+			t2s.clear();
+			Transformation transformation = transformations[a].inverse() * transformations[b];
+			PairRegistrationPtr pairRegistrationPtr = pairRegistrationPtrMap[link];
+			ScanPtr target = pairRegistrationPtr->target;
+			ScanPtr source = pairRegistrationPtr->source;
+			KdTreePtr targetKdTree = pairRegistrationPtr->targetKdTree;
+			KdTreePtr sourceKdTree = pairRegistrationPtr->sourceKdTree;
+			const std::vector<int> &targetCandidateIndices = pairRegistrationPtr->sampledIndices(false, _iter);
+			std::vector<int> &targetCandidateIndices_temp = pairRegistrationPtr->targetCandidateIndices_temp;			
+			const std::vector<int> &sourceCandidateIndices = pairRegistrationPtr->sampledIndices(true, _iter);
+			std::vector<int> &sourceCandidateIndices_temp = pairRegistrationPtr->sourceCandidateIndices_temp;
+			PairRegistration::Parameters para = pairRegistrationPtr->para;
+			// PairRegistration::generatePointPairs(target, source, targetKdTree, sourceKdTree, 
+			// 	targetCandidateIndices, targetCandidateIndices_temp,
+			// 	sourceCandidateIndices, sourceCandidateIndices_temp,
+			// 	buffer, transformation, para, s2t, t2s);
+
+			PairRegistrationOMP::generatePointPairsOMP(target, source, targetKdTree, sourceKdTree, 
+				targetCandidateIndices, targetCandidateIndices_temp,
+				sourceCandidateIndices, sourceCandidateIndices_temp,
+				buffer, transformation, para, s2t, t2s, threads,
+				pairRegistrationPtr->getTargetSearch(), pairRegistrationPtr->getSourceSearch());
+
+			PairRegistration::weightPointPairs(s2t, para, threads);
+			PairRegistration::weightPointPairs(t2s, para, threads);
+
+			// the generated source points are in the target frame, so map them back into their own scan
+			accumulatePointPairMoments(s2t, Transformation::Identity(), true, transformation.inverse(), false, _moments[i]);
+			accumulatePointPairMoments(t2s, transformation, false, Transformation::Identity(), true, _moments[i]);
+			// std::cout << transformation << std::endl;
+			// std::cout << link.a << " <<-- " << link.b << " : " << _moments[i].w << std::endl;	
+			releaseLink(link);
+		}
+	}
+
+	void GlobalRegistration::globalRefine(unsigned int _iterationNum_max, unsigned int _iterationNum_min)
+	{
 		int threads = omp_get_num_procs();
 		std::cout << threads << "threads" << std::endl;
 
 		williams2001::ScanIndexPairs sipairs;
-		std::vector<williams2001::PointPairWithWeights> ppairwwss;
+		williams2001::PointPairMomentsVector moments;
 		int M = scanPtrs.size();
 
-		williams2001::PointPairWithWeights buffer1;
+		for (int i = 0; i < links.size(); ++i) sipairs.push_back(williams2001::ScanIndexPair(links[i].a, links[i].b));
 
 		float last_rms_error = std::numeric_limits<float>::max();
 
 		for (int iter = 0; iter < _iterationNum_max; ++iter)
 		{
-			sipairs.clear();
-			ppairwwss.clear();
-			for (int i = 0; i < links.size(); ++i)
-			{
-				Link link = links[i];
-				ScanIndex a = link.a;
-				ScanIndex b = link.b;
-
-				sipairs.push_back(williams2001::ScanIndexPair(a,b));
-
-				buffer->clear();
-				s2t.clear();
-				t2s.clear();
-				Transformation transformation = transformations[a].inverse() * transformations[b];
-				PairRegistrationPtr pairRegistrationPtr = pairRegistrationPtrMap[link];
-				ScanPtr target = pairRegistrationPtr->target;
-				ScanPtr source = pairRegistrationPtr->source;
-				KdTreePtr targetKdTree = pairRegistrationPtr->targetKdTree;
-				KdTreePtr sourceKdTree = pairRegistrationPtr->sourceKdTree;
-				std::vector<int> &targetCandidateIndices = pairRegistrationPtr->targetCandidateIndices;	
-				std::vector<int> &targetCandidateIndices_temp = pairRegistrationPtr->targetCandidateIndices_temp;			
-				std::vector<int> &sourceCandidateIndices = pairRegistrationPtr->sourceCandidateIndices;
-				std::vector<int> &sourceCandidateIndices_temp = pairRegistrationPtr->sourceCandidateIndices_temp;
-				PairRegistration::Parameters para = pairRegistrationPtr->para;
-				// PairRegistration::generatePointPairs(target, source, targetKdTree, sourceKdTree, 
-				// 	targetCandidateIndices, targetCandidateIndices_temp,
-				// 	sourceCandidateIndices, sourceCandidateIndices_temp,
-				// 	buffer, transformation, para, s2t, t2s);
-
-				PairRegistrationOMP::generatePointPairsOMP(target, source, targetKdTree, sourceKdTree, 
-					targetCandidateIndices, targetCandidateIndices_temp,
-					sourceCandidateIndices, sourceCandidateIndices_temp,
-					buffer, transformation, para, s2t, t2s, threads);
-
-				for (int j = 0; j < s2t.size(); ++j) s2t[j].sourcePoint = registar::transformPointWithNormal(s2t[j].sourcePoint, transformation.inverse());
-				for (int j = 0; j < t2s.size(); ++j) t2s[j].sourcePoint = registar::transformPointWithNormal(t2s[j].sourcePoint, transformation);
-
-				buffer1.clear();
-				for (int j = 0; j < s2t.size(); ++j)
-				{
-					williams2001::PointPairWithWeight temp;
-					temp.w = 1.0;
-					temp.ppair.first = s2t[j].targetPoint.getVector3fMap().cast<williams2001::Scalar>(); 
-					temp.ppair.second = s2t[j].sourcePoint.getVector3fMap().cast<williams2001::Scalar>();
-					buffer1.push_back(temp);
-				}
-				for (int j = 0; j < t2s.size(); ++j)
-				{
-					williams2001::PointPairWithWeight temp;
-					temp.w = 1.0;
-					temp.ppair.first = t2s[j].sourcePoint.getVector3fMap().cast<williams2001::Scalar>(); 
-					temp.ppair.second = t2s[j].targetPoint.getVector3fMap().cast<williams2001::Scalar>();
-					buffer1.push_back(temp);
-				}
-				// std::cout << transformation << std::endl;
-				// std::cout << link.a << " <<-- " << link.b << " : " << buffer1.size() << std::endl;	
-				ppairwwss.push_back(buffer1);
-			}
+			generateLinkMoments(moments, iter);
 
-			williams2001::SRoMCPS sromcps_globalrefine(sipairs, ppairwwss, M);
+			// warm start the rotation sweep from the previous iteration
+			williams2001::Rotations R_initial(3, 3*M);
+			for (int i = 0; i < M; ++i) R_initial.block<3, 3>(0, 3*i) = transformations[i].block<3, 3>(0, 0).cast<williams2001::Scalar>();
+			williams2001::SRoMCPS sromcps_globalrefine(sipairs, moments, M, williams2001::SRoMCPS::SolveParameters(), R_initial);
 
 			float total_error = ( sromcps_globalrefine.R *  sromcps_globalrefine.Q * sromcps_globalrefine.R.transpose() ).trace();
-			float total_weight = 0.0f;
-			for (int i = 0; i < ppairwwss.size(); ++i)
-			{
-				for (int j = 0; j < ppairwwss[i].size(); ++j)
-				{
-					total_weight += ppairwwss[i][j].w;
-				}
-			}
+			float total_weight = sromcps_globalrefine.totalWeight();
 			float rms_error = sqrtf( total_error / total_weight );
-			std::cout << "globalrefine rms_error = " <<  rms_error << " total_weight = " << total_weight << std::endl;
+			std::cout << "globalrefine rms_error = " <<  rms_error << " total_weight = " << total_weight << " rotation sweeps = " << sromcps_globalrefine.iterations << std::endl;
 
 			if ( last_rms_error < rms_error && iter > _iterationNum_min)
 			{
@@ -868,6 +976,51 @@ namespace tang2014
 			}
 		}
 	}
+
+	void GlobalRegistration::globalPoseGraphRefine(unsigned int _iterationNum_max, unsigned int _iterationNum_min)
+	{
+		// same outer loop as globalRefine, but the poses are solved by the sparse pose graph instead of the dense SRoMCPS system
+		williams2001::PointPairMomentsVector moments;
+		int M = scanPtrs.size();
+
+		registar::PoseGraph poseGraph(M);
+
+		float last_rms_error = std::numeric_limits<float>::max();
+
+		for (int iter = 0; iter < _iterationNum_max; ++iter)
+		{
+			generateLinkMoments(moments, iter);
+
+			poseGraph.clearEdges();
+			for (int i = 0; i < M; ++i) poseGraph.setPose(i, transformations[i].cast<double>());
+			for (int i = 0; i < links.size(); ++i)
+			{
+				registar::PoseGraphEdgeMoments edgeMoments;
+				edgeMoments.w = moments[i].w;
+				edgeMoments.sp = moments[i].sx;
+				edgeMoments.sq = moments[i].sy;
+				edgeMoments.Spp = moments[i].Hxx;
+				edgeMoments.Sqq = moments[i].Hyy;
+				edgeMoments.Spq = moments[i].Hxy;
+				poseGraph.addEdge(links[i].a, links[i].b, edgeMoments);
+			}
+
+			int poseGraphIterations = poseGraph.optimize();
+
+			float total_weight = poseGraph.totalWeight();
+			float rms_error = sqrtf( std::max(poseGraph.error(), 0.0) / total_weight );
+			std::cout << "posegraphrefine rms_error = " <<  rms_error << " total_weight = " << total_weight << " iterations = " << poseGraphIterations << std::endl;
+
+			if ( last_rms_error < rms_error && iter > _iterationNum_min)
+			{
+				std::cout << "posegraphrefine converged after " << iter << " iteration(s)" << std::endl;
+				break;
+			}
+			last_rms_error = rms_error;
+
+			for (int i = 0; i < M; ++i) transformations[i] = poseGraph.getPose(i).cast<float>();
+		}
+	}
 }
 
 	// Transformation resultTransformation, resultTransformation0, resultTransformation1;
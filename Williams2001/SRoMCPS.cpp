@@ -1,5 +1,7 @@
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <cmath>
 #include <Eigen/Dense>
 #include <Eigen/SVD>
 
@@ -7,7 +9,55 @@
 
 namespace williams2001
 { 
-	SRoMCPS::SRoMCPS(ScanIndexPairs &_sipairs, std::vector<PointPairWithWeights> &_ppairwwss, int _M) : sipairs(_sipairs), ppairwwss(_ppairwwss), M(_M)
+	void PointPairMoments::setZero()
+	{
+		w = 0.0;
+		sx.setZero();
+		sy.setZero();
+		Hxx.setZero();
+		Hyy.setZero();
+		Hxy.setZero();
+	}
+
+	void PointPairMoments::add(const Point &_x, const Point &_y, Weight _w)
+	{
+		w += _w;
+		sx += _w * _x;
+		sy += _w * _y;
+		Hxx += _w * _x * _x.transpose();
+		Hyy += _w * _y * _y.transpose();
+		Hxy += _w * _x * _y.transpose();
+	}
+
+	PointPairMoments& PointPairMoments::operator+=(const PointPairMoments &_other)
+	{
+		w += _other.w;
+		sx += _other.sx;
+		sy += _other.sy;
+		Hxx += _other.Hxx;
+		Hyy += _other.Hyy;
+		Hxy += _other.Hxy;
+		return *this;
+	}
+
+	SRoMCPS::SRoMCPS(ScanIndexPairs &_sipairs, std::vector<PointPairWithWeights> &_ppairwwss, int _M, 
+		const SolveParameters &_sp, const Rotations &_R_initial) : sipairs(_sipairs), M(_M), sp(_sp), R_initial(_R_initial)
+	{
+		moments.resize(_ppairwwss.size());
+		for (int u = 0; u < _ppairwwss.size(); ++u)
+		{
+			for (int i = 0; i < _ppairwwss[u].size(); ++i) moments[u].add(_ppairwwss[u][i].ppair.first, _ppairwwss[u][i].ppair.second, _ppairwwss[u][i].w);
+		}
+		initialize();
+	}
+
+	SRoMCPS::SRoMCPS(ScanIndexPairs &_sipairs, PointPairMomentsVector &_moments, int _M, 
+		const SolveParameters &_sp, const Rotations &_R_initial) : sipairs(_sipairs), moments(_moments), M(_M), sp(_sp), R_initial(_R_initial)
+	{
+		initialize();
+	}
+
+	void SRoMCPS::initialize()
 	{
 		P = sipairs.size(); 
 		createViewSelectionMatrices();
@@ -42,20 +92,8 @@ namespace williams2001
 		y_mean.resize(P);
 		for (int u = 0; u < P; ++u)
 		{
-			Eigen::Matrix<Scalar, 3, 1> x_mean_u = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>::Zero(3, 1);
-			Eigen::Matrix<Scalar, 3, 1> y_mean_u = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>::Zero(3, 1);
-
-			int N_u = ppairwwss[u].size();
-			for (int i = 0; i < N_u; ++i)
-			{
-				x_mean_u += ppairwwss[u][i].ppair.first * ppairwwss[u][i].w;
-				y_mean_u += ppairwwss[u][i].ppair.second * ppairwwss[u][i].w;
-			}
-			x_mean_u /= ws[u];
-			y_mean_u /= ws[u];
-
-			x_mean[u] = x_mean_u;
-			y_mean[u] = y_mean_u;
+			x_mean[u] = moments[u].sx / ws[u];
+			y_mean[u] = moments[u].sy / ws[u];
 		}	
 	}
 
@@ -66,15 +104,20 @@ namespace williams2001
 		ws.resize(P);
 		for (int u = 0; u < P; ++u)
 		{
-			int N_u = ppairwwss[u].size();
-			Weight w_u = 0.0;
-			for (int i = 0; i < N_u; ++i) w_u += ppairwwss[u][i].w;
+			Weight w_u = moments[u].w;
 			Eigen::Matrix<Scalar, 3, 3> W_u = Eigen::Matrix<Scalar, 3, 3>::Identity() * w_u;
 			W.block<3,3>(3*u, 3*u) = W_u;
 			ws[u] = w_u;
 		}
 	}
 
+	Weight SRoMCPS::totalWeight() const
+	{
+		Weight w = 0.0;
+		for (int u = 0; u < moments.size(); ++u) w += moments[u].w;
+		return w;
+	}
+
 	void SRoMCPS::createViewSelectionMatrices()
 	{
 		C_a = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>::Zero(3*M, 3*P);
@@ -99,35 +142,18 @@ namespace williams2001
 
 	void SRoMCPS::createQ_R()
 	{
-		Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Hxx = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>::Zero(3*P,3*P);
-		Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Hyy = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>::Zero(3*P,3*P);
-		Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Hxy = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>::Zero(3*P,3*P);
-		Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Hyx = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>::Zero(3*P,3*P);
+		// C_a * Hxx * C_a^T + C_b * Hyy * C_b^T - C_a * Hxy * C_b^T - C_b * Hyx * C_a^T, assembled block by block from the link moments
+		Q_R = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>::Zero(3*M, 3*M);
 
 		for (int u = 0; u < P; ++u)
 		{
-			Eigen::Matrix<Scalar, 3, 3> Hxx_u = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>::Zero(3,3);
-			Eigen::Matrix<Scalar, 3, 3> Hyy_u = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>::Zero(3,3);
-			Eigen::Matrix<Scalar, 3, 3> Hxy_u = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>::Zero(3,3);
-			Eigen::Matrix<Scalar, 3, 3> Hyx_u = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>::Zero(3,3);
-
-			int N_u = ppairwwss[u].size();
-			for (int i = 0; i < N_u; ++i)
-			{
-				Hxx_u += ppairwwss[u][i].w * ppairwwss[u][i].ppair.first * ppairwwss[u][i].ppair.first.transpose();
-				Hyy_u += ppairwwss[u][i].w * ppairwwss[u][i].ppair.second * ppairwwss[u][i].ppair.second.transpose();
-				Hxy_u += ppairwwss[u][i].w * ppairwwss[u][i].ppair.first * ppairwwss[u][i].ppair.second.transpose();
-				Hyx_u += ppairwwss[u][i].w * ppairwwss[u][i].ppair.second * ppairwwss[u][i].ppair.first.transpose();
-			}
-
-			Hxx.block<3,3>(3*u, 3*u) = Hxx_u;
-			Hyy.block<3,3>(3*u, 3*u) = Hyy_u;
-			Hxy.block<3,3>(3*u, 3*u) = Hxy_u;
-			Hyx.block<3,3>(3*u, 3*u) = Hyx_u;				
+			int a = sipairs[u].first;
+			int b = sipairs[u].second;
+			Q_R.block<3,3>(3*a, 3*a) += moments[u].Hxx;
+			Q_R.block<3,3>(3*b, 3*b) += moments[u].Hyy;
+			Q_R.block<3,3>(3*a, 3*b) -= moments[u].Hxy;
+			Q_R.block<3,3>(3*b, 3*a) -= moments[u].Hxy.transpose();
 		}
-
-		Q_R = C_a * Hxx * C_a.transpose() + C_b * Hyy * C_b.transpose() - C_a * Hxy * C_b.transpose() - C_b * Hyx * C_a.transpose();
-
 	}
 
 	void SRoMCPS::createQ_RT()
@@ -181,65 +207,67 @@ namespace williams2001
 		solve_T();
 	}
 
+	Eigen::Matrix<Scalar, 3, 3> SRoMCPS::solveViewRotation(const Rotations &_R, int _j) const
+	{
+		// Sj = sum_{k != j} Q_jk * R_k^T, Rj minimizes trace(Rj * Sj)
+		Eigen::Matrix<Scalar, 3, 3> Sj = Q.middleRows<3>(3*_j) * _R.transpose() - Q.block<3,3>(3*_j, 3*_j) * _R.block<3,3>(0, 3*_j).transpose();
+
+		Eigen::JacobiSVD< Eigen::Matrix<Scalar, 3, 3> > svd(-Sj, Eigen::ComputeFullU | Eigen::ComputeFullV);
+		Eigen::Matrix<Scalar, 3, 3> V = svd.matrixV();
+		if ( (V * svd.matrixU().transpose()).determinant() < 0 ) V.col(2) = -V.col(2);
+		return V * svd.matrixU().transpose();
+	}
+
+	Scalar SRoMCPS::objectiveValue(const Rotations &_R) const
+	{
+		return ( _R * Q * _R.transpose() ).trace();
+	}
+
 	void SRoMCPS::solve_R() 
 	{
-		Eigen::Matrix<Scalar, 3, Eigen::Dynamic> R_initial;
-		R_initial.resize(Eigen::NoChange, 3*M); 
-		for (int j = 0; j < M; ++j) R_initial.block<3,3>(0, 3*j) = Eigen::Matrix<Scalar, 3, 3>::Identity(); // R_initial could be set by the uniform angle refine method
+		Rotations R_current;
+		if (R_initial.cols() == 3*M) R_current = R_initial;
+		else
+		{
+			R_current.resize(Eigen::NoChange, 3*M); 
+			for (int j = 0; j < M; ++j) R_current.block<3,3>(0, 3*j) = Eigen::Matrix<Scalar, 3, 3>::Identity(); // R_initial could be set by the uniform angle refine method
+		}
 
-		Eigen::Matrix<Scalar, 3, Eigen::Dynamic> R_current = R_initial;
-		const int max_iter = 10;
-		for (int iter = 0; iter < max_iter; ++iter)
+		Rotations R_last;
+		Scalar objective_last = objectiveValue(R_current);
+		Scalar noise = 1e-12 * std::abs(Q_R.trace()); // round-off level of trace(RQR_t)
+		iterations = 0;
+		for (int iter = 0; iter < sp.max_iter; ++iter)
 		{
+			R_last = R_current;
+			// the translations eliminated, Q couples every pair of views, so the views are updated one after another
+			for (int j = 0; j < M; ++j) R_current.block<3,3>(0, 3*j) = solveViewRotation(R_current, j);
+
+			Scalar objective_current = objectiveValue(R_current);
+			iterations = iter + 1;
+
+			Scalar update = 0.0, orthogonality = 0.0;
 			for (int j = 0; j < M; ++j)
 			{
-				Eigen::Matrix<Scalar, 3, 3> Sj;
-				Eigen::Matrix<Scalar, 3, Eigen::Dynamic> R_L, R_U;
-				Eigen::Matrix<Scalar, 3, Eigen::Dynamic> Q_jL, Q_jU;
-
-				if (j == 0)
-				{
-					//Sj = Q.block<3, 3*(M-1-j)>(j*3, (j+1)*3) * R_current.block<3, 3*(M-j-1)>(0, (j+1)*3).transpose();
-					//Sj = Q.block(j*3, (j+1)*3, 3, 3*(M-1-j)) * R_current.block(0, (j+1)*3, 3, 3*(M-j-1)).transpose();
-					Q_jU = Q.block(j*3, (j+1)*3, 3, 3*(M-1-j));
-					R_U = R_current.block(0, (j+1)*3, 3, 3*(M-j-1));
-					Sj = Q_jU * R_U.transpose();					
-				}
-				else if (j == M-1)
-				{
-					//Sj = Q.block<3, 3*j>(j*3, 0) * R_current.block<3, 3*j>(0, 0).transpose();
-					//Sj = Q.block(j*3, 0, 3, 3*j) * R_current.block(0, 0, 3, 3*j).transpose();
-					Q_jL = Q.block(j*3, 0, 3, 3*j);	
-					R_L = R_current.block(0, 0, 3, 3*j);			
-					Sj = Q_jL * R_L.transpose();
-				}
-				else
-				{
-					// Sj = Q.block<3, 3*j>(j*3, 0) * R_current.block<3, 3*j>(0, 0).transpose() + Q.block<3, 3*(M-1-j)>(j*3, (j+1)*3) * R_current.block<3, 3*(M-j-1)>(0, (j+1)*3).transpose();
-					//Sj = Q.block(j*3, 0, 3, 3*j) * R_current.block(0, 0, 3, 3*j).transpose() + Q.block(j*3, (j+1)*3, 3, 3*(M-1-j)) * R_current.block(0, (j+1)*3, 3, 3*(M-j-1)).transpose();
-					R_L = R_current.block(0, 0, 3, 3*j);
-					R_U = R_current.block(0, (j+1)*3, 3, 3*(M-j-1));
-					Q_jL = Q.block(j*3, 0, 3, 3*j);
-					Q_jU = Q.block(j*3, (j+1)*3, 3, 3*(M-1-j));				
-					Sj = Q_jL * R_L.transpose() + Q_jU * R_U.transpose();
-				}
-				Eigen::JacobiSVD< Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> > svd(-Sj, Eigen::ComputeThinU | Eigen::ComputeThinV);
-				Eigen::Matrix<Scalar, 3, 3> Rj = svd.matrixV() * svd.matrixU().transpose();
-				R_current.block<3,3>(0, j*3) = Rj;
-
-				// std::cout << "iter = \t" << iter << "\t j = \t" << j << "\t trace(RQR_t) = " << ( R_current * Q * R_current.transpose() ).trace() << std::endl;	
-				if (Rj.determinant() < 0)
-				{
-					std::cout << "iter = \t" << iter << "\t j = \t" << j << "\t Rj determinant = " << Rj.determinant() << std::endl;
-					exit(1);	
-				}
+				update = std::max(update, (R_current.block<3,3>(0, 3*j) - R_last.block<3,3>(0, 3*j)).norm());
+				orthogonality = std::max(orthogonality, 
+					(R_current.block<3,3>(0, 3*j) * R_current.block<3,3>(0, 3*j).transpose() - Eigen::Matrix<Scalar, 3, 3>::Identity()).norm());
+			}
+			if (orthogonality > 1e-6)
+			{
+				std::cout << "iter = \t" << iter << "\t rotation orthogonality error = " << orthogonality << std::endl;
 			}
+
+			// std::cout << "iter = \t" << iter << "\t trace(RQR_t) = " << objective_current << "\t update = " << update << std::endl;	
+			bool converged = std::abs(objective_last - objective_current) <= sp.tolerance * std::abs(objective_current) + noise 
+				&& update <= std::sqrt(sp.tolerance);
+			objective_last = objective_current;
+			if (converged) break;
 		}
 		R = R_current;
+		objective = objective_last;
 
-		//R = R_initial;
-
-		// std::cout << "trace(RQR_t) = " << ( R * Q * R.transpose() ).trace() << std::endl;
+		// std::cout << "trace(RQR_t) = " << objective << " after " << iterations << " iteration(s)" << std::endl;
 	}
 
 	void SRoMCPS::solve_T()
@@ -1,3 +1,6 @@
+#ifndef WILLIAMS2001_SROMCPS_H
+#define WILLIAMS2001_SROMCPS_H
+
 #include <vector>
 #include <Eigen/Dense>
 
@@ -17,15 +20,43 @@ namespace williams2001
 		PointPairWithWeight(PointPair _ppair, Weight _w) : ppair(_ppair), w(_w) {}
 	};
 	typedef std::vector<PointPairWithWeight, Eigen::aligned_allocator<PointPairWithWeight> > PointPairWithWeights;
+
+	// weighted sufficient statistics of the point pairs of one link, x is the point in scan a and y the point in scan b 
+	struct PointPairMoments
+	{
+		Weight w;
+		Point sx, sy;
+		Eigen::Matrix<Scalar, 3, 3> Hxx, Hyy, Hxy; // Hyx = Hxy^T
+		PointPairMoments() { setZero(); }
+		void setZero();
+		void add(const Point &_x, const Point &_y, Weight _w = 1.0);
+		PointPairMoments& operator+=(const PointPairMoments &_other);
+	};
+	typedef std::vector<PointPairMoments, Eigen::aligned_allocator<PointPairMoments> > PointPairMomentsVector;
 	typedef unsigned int ScanIndex; 
 	typedef std::pair<ScanIndex, ScanIndex> ScanIndexPair;
 	typedef std::vector<ScanIndexPair> ScanIndexPairs;
+	typedef Eigen::Matrix<Scalar, 3, Eigen::Dynamic> Rotations;
 
 	class SRoMCPS
 	{
 	public:
 
-		SRoMCPS(ScanIndexPairs &_sipairs, std::vector<PointPairWithWeights> &_ppairwwss, int _M);
+		struct SolveParameters
+		{
+			int max_iter;
+			Scalar tolerance; // stop when the relative objective decrease and the largest rotation update fall below it
+			SolveParameters() : max_iter(100), tolerance(1e-9) {}
+		};
+
+		// an empty _R_initial starts the rotation sweep from identities, otherwise it is a 3 x 3M warm start
+		SRoMCPS(ScanIndexPairs &_sipairs, std::vector<PointPairWithWeights> &_ppairwwss, int _M, 
+			const SolveParameters &_sp = SolveParameters(), const Rotations &_R_initial = Rotations());
+
+		SRoMCPS(ScanIndexPairs &_sipairs, PointPairMomentsVector &_moments, int _M, 
+			const SolveParameters &_sp = SolveParameters(), const Rotations &_R_initial = Rotations());
+
+		void initialize();
 
 		void createViewSelectionMatrices();
 
@@ -39,19 +70,29 @@ namespace williams2001
 
 		void create_W_ws();
 
+		Weight totalWeight() const;
+
 		Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> pseudo_inverse(Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> squareMatrix, const Scalar pinvtoler = 1e-6); // cannot set to Eigen::NumTraits<Scalar>::epsilon() when scalar is float, since it's too small 
 
 		void solve_RT();
 
 		void solve_R();
 
+		Eigen::Matrix<Scalar, 3, 3> solveViewRotation(const Rotations &_R, int _j) const;
+
+		Scalar objectiveValue(const Rotations &_R) const;
+
 		void solve_T();
 
 		ScanIndexPairs sipairs;
-		std::vector<PointPairWithWeights> ppairwwss;
+		PointPairMomentsVector moments;
 
 		int M;
-		Eigen::Matrix<Scalar, 3, Eigen::Dynamic> R;
+		SolveParameters sp;
+		Rotations R_initial;
+		Rotations R;
+		int iterations;
+		Scalar objective;
 		Eigen::Matrix<Scalar, Eigen::Dynamic, 1> T;
 
 		int P;
@@ -70,3 +111,5 @@ namespace williams2001
 	};	
 }
 
+#endif
+
@@ -4,6 +4,7 @@
 #include <QtCore/QVariantMap>
 
 #include "pclbase.h"
+#include "neighbourtable.h"
 
 namespace registar
 {
@@ -16,6 +17,11 @@ namespace registar
 
 		static void filter(CloudDataConstPtr cloudData, QVariantMap parameters, BoundariesPtr &boundaries, CloudDataPtr &cloudData_inliers, CloudDataPtr &cloudData_outliers);
 		static void filter(CloudDataConstPtr cloudData, QVariantMap parameters, BoundariesPtr &boundaries, CloudDataPtr &cloudData_filtered);
+
+		// tree and neighbourTable are borrowed from the cloud when given, rows of neighbourTable that contain 
+		// the whole search sphere replace the radius search
+		static void filter(CloudDataConstPtr cloudData, QVariantMap parameters, KdTreePtr tree, NeighbourTableConstPtr neighbourTable, 
+			BoundariesPtr &boundaries, CloudDataPtr &cloudData_inliers, CloudDataPtr &cloudData_outliers);
 	};
 }
 
@@ -0,0 +1,77 @@
+#ifndef BULKTRANSFORM_H
+#define BULKTRANSFORM_H
+
+#include <Eigen/Dense>
+
+#include "pclbase.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define REGISTAR_SSE2_TRANSFORM
+#include <emmintrin.h>
+#endif
+
+namespace registar
+{
+	// loops over fewer points than this stay on one thread
+	const int transformParallelSize = 16384;
+
+	// Transforms the position and normal of a PointType with the four floats of each held in one SSE register, so a
+	// point costs three broadcasts, three multiply-adds and a translation; the fourth lanes and the other fields are
+	// kept. The columns are prepared once per transformation.
+	class PointTransformer
+	{
+	public:
+		explicit PointTransformer(const Eigen::Matrix4f &transformation)
+		{
+			for (int c = 0; c < 4; ++c)
+				for (int r = 0; r < 4; ++r)
+					columns[c][r] = r < 3 ? transformation(r, c) : 0.0f;
+		}
+
+		// in and out may be the same point
+		inline void transform(const PointType &in, PointType &out) const
+		{
+		#ifdef REGISTAR_SSE2_TRANSFORM
+			__m128 c0 = _mm_loadu_ps(columns[0]);
+			__m128 c1 = _mm_loadu_ps(columns[1]);
+			__m128 c2 = _mm_loadu_ps(columns[2]);
+			__m128 c3 = _mm_loadu_ps(columns[3]);
+			__m128 lastLane = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+
+			__m128 p = _mm_loadu_ps(in.data);
+			__m128 n = _mm_loadu_ps(in.data_n);
+			__m128 rp = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0))),
+				_mm_mul_ps(c1, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)))),
+				_mm_add_ps(_mm_mul_ps(c2, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2))), c3));
+			__m128 rn = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_shuffle_ps(n, n, _MM_SHUFFLE(0, 0, 0, 0))),
+				_mm_mul_ps(c1, _mm_shuffle_ps(n, n, _MM_SHUFFLE(1, 1, 1, 1)))),
+				_mm_mul_ps(c2, _mm_shuffle_ps(n, n, _MM_SHUFFLE(2, 2, 2, 2))));
+			rp = _mm_or_ps(_mm_andnot_ps(lastLane, rp), _mm_and_ps(lastLane, p));
+			rn = _mm_or_ps(_mm_andnot_ps(lastLane, rn), _mm_and_ps(lastLane, n));
+
+			if (&out != &in) out = in;
+			_mm_storeu_ps(out.data, rp);
+			_mm_storeu_ps(out.data_n, rn);
+		#else
+			Eigen::Map<const Eigen::Matrix4f> T(&columns[0][0]);
+			Eigen::Vector3f p = T.block<3, 3>(0, 0) * in.getVector3fMap() + T.block<3, 1>(0, 3);
+			Eigen::Vector3f n = T.block<3, 3>(0, 0) * in.getNormalVector3fMap();
+			if (&out != &in) out = in;
+			out.getVector3fMap() = p;
+			out.getNormalVector3fMap() = n;
+		#endif
+		}
+
+	private:
+		float columns[4][4];
+	};
+
+	// pcl::transformPointCloudWithNormals on PointTransformer, multithreaded above transformParallelSize; in and out
+	// may be the same cloud
+	void transformCloudWithNormals(const CloudData &in, CloudData &out, const Eigen::Matrix4f &transformation);
+
+	// number xyz triplets stored one after another, as the position arrays of tang2014::PointPairs
+	void transformPositions(float *positions, int number, const Eigen::Matrix4f &transformation);
+}
+
+#endif
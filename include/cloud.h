@@ -5,6 +5,7 @@
 
 #ifndef Q_MOC_RUN
 #include "pclbase.h"
+#include "neighbourtable.h"
 // #include <boost/shared_ptr.hpp>
 #endif
 
@@ -28,7 +29,8 @@ namespace registar
 			const QString &cloudName = "", QObject *parent = 0);
 		virtual ~Cloud();
 
-		void setCloudData(CloudDataPtr cloudData);
+		// keepsOrder tells the points are those of the cloud in the same order, with new attributes or positions
+		void setCloudData(CloudDataPtr cloudData, bool keepsOrder = false);
 		CloudDataConstPtr getCloudData()const;
 		CloudDataPtr getCloudData();
 
@@ -50,10 +52,28 @@ namespace registar
 		void setRegistrationTransformation(const Eigen::Matrix4f &registrationTransformation);
 		const Eigen::Matrix4f &getRegistrationTransformation()const;
 
+		// pose of the scanner in the frame of cloudData, identity as the points of a scan file are read in the frame of
+		// their scanner; it moves with the points when a transformation is applied to them
+		void setScannerPose(const Eigen::Matrix4f &scannerPose);
+		const Eigen::Matrix4f &getScannerPose()const;
+
 		void setBoundaries(BoundariesPtr boundaries);
 		BoundariesConstPtr getBoundaries()const;
 		BoundariesPtr getBoundaries();
 
+		// permutation applied on import, fileOrder[i] is the index in the file of point i; empty if the cloud is kept
+		// in file order. setCloudData drops it unless the new points keep the order.
+		void setFileOrder(const std::vector<int> &fileOrder);
+		const std::vector<int> &getFileOrder()const;
+		// cloud data, polygons and boundaries put back in file order for saving
+		void getInFileOrder(CloudDataPtr &cloudData, Polygons &polygons, BoundariesPtr &boundaries)const;
+
+		// spatial index of cloudData, built on first use and dropped by setCloudData
+		unsigned int getCloudDataVersion()const;
+		KdTreePtr getKdTree();
+		NeighbourTablePtr getNeighbourTable(int K);
+		NeighbourTablePtr getNeighbourTable();
+
 	protected:
 		CloudDataPtr cloudData;
 		Polygons polygons;
@@ -61,7 +81,13 @@ namespace registar
 		FromWhere fromWhere;
 		Eigen::Matrix4f transformation;
 		Eigen::Matrix4f registrationTransformation;
+		Eigen::Matrix4f scannerPose;
 		BoundariesPtr boundaries;
+		std::vector<int> fileOrder;
+
+		unsigned int cloudDataVersion;
+		KdTreePtr kdTree;
+		NeighbourTablePtr neighbourTable;
 	};
 }
 
@@ -13,7 +13,9 @@ namespace registar
 		CloudIO();
 		virtual ~CloudIO();
 
-		static bool importPLYCloudData(const QString &fileName, CloudDataPtr cloudData);
+		// with an order, an unorganized cloud is sorted along a Morton curve and order receives the permutation, see
+		// mortonorder.h; order is left empty for organized clouds
+		static bool importPLYCloudData(const QString &fileName, CloudDataPtr cloudData, std::vector<int> *order = NULL);
 		static bool exportPLYCloudData(const QString &fileName, CloudDataConstPtr cloudData);
 
 		static bool importPLYPolygonMesh(const QString &fileName, PolygonMeshPtr polygonMesh);
@@ -22,7 +24,8 @@ namespace registar
 		static bool importTransformation(const QString &fileName, Eigen::Matrix4f &transformation);
 		static bool exportTransformation(const QString &fileName, const Eigen::Matrix4f &transformation);
 
-		static bool importBoundaries(const QString &fileName, BoundariesPtr boundaries);
+		// boundaries of a cloud imported with an order are permuted the same way
+		static bool importBoundaries(const QString &fileName, BoundariesPtr boundaries, const std::vector<int> *order = NULL);
 		static bool exportBoundaries(const QString &fileName, BoundariesConstPtr boundaries);
 
 		static bool importVTKCloudData(const QString &fileName, CloudDataPtr cloudData);
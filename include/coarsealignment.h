@@ -0,0 +1,76 @@
+#ifndef COARSEALIGNMENT_H
+#define COARSEALIGNMENT_H
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <Eigen/Dense>
+
+#include "pclbase.h"
+
+namespace registar
+{
+	typedef pcl::FPFHSignature33 Descriptor;
+	typedef pcl::PointCloud<Descriptor> Descriptors;
+	typedef Descriptors::Ptr DescriptorsPtr;
+
+	struct CoarseAlignmentParameters
+	{
+		float voxelSize;        // spacing of the keypoints
+		float featureRadius;    // neighbourhood of the descriptors among the keypoints
+		float inlierDistance;   // matches closer than this once aligned support a hypothesis
+		float edgeSimilarity;   // sampled triangles whose matching edge lengths have a smaller ratio are skipped
+		float confidence;       // probability of having drawn one all inlier sample at which the search stops
+		int maxIterations;
+		unsigned int seed;
+	};
+
+	// descriptors over 5 keypoint spacings, inliers within 1.5
+	CoarseAlignmentParameters defaultCoarseAlignmentParameters(float voxelSize);
+
+	// a 200th of the bounding box diagonal, for callers without a scale of their own
+	float estimateCoarseVoxelSize(const CloudData &cloudData);
+
+	// Keypoints of one cloud and their FPFH descriptors (Rusu et al. 2009). The keypoints are the points closest to
+	// the centroids of the occupied voxels, which keeps their measured normals, and the descriptors are computed
+	// among the keypoints only. Points without a normal are left out, so a cloud whose normals were never estimated
+	// has no keypoints, see missingNormals. Computed once per cloud and shared by every pair it takes part in.
+	class CoarseAlignmentFeatures
+	{
+	public:
+		CoarseAlignmentFeatures();
+
+		void compute(const CloudData &cloudData, const CoarseAlignmentParameters &parameters);
+
+		inline int size() const {return static_cast<int>(keypoints->size());}
+		// finite points were left out for lacking a normal and none kept one
+		inline bool missingNormals() const {return keypoints->empty() && unorientedPoints > 0;}
+
+		int unorientedPoints;  // finite points without a valid normal
+		CloudDataPtr keypoints;
+		DescriptorsPtr descriptors;
+
+		typedef boost::shared_ptr<CoarseAlignmentFeatures> Ptr;
+		typedef boost::shared_ptr<const CoarseAlignmentFeatures> ConstPtr;
+	};
+	typedef CoarseAlignmentFeatures::Ptr CoarseAlignmentFeaturesPtr;
+	typedef CoarseAlignmentFeatures::ConstPtr CoarseAlignmentFeaturesConstPtr;
+
+	struct CoarseAlignmentResult
+	{
+		Eigen::Matrix4f transformation;
+		int matches;      // descriptor matches the samples are drawn from
+		int inliers;      // matches supporting the transformation
+		int iterations;   // hypotheses drawn before the search stopped
+		bool aligned;     // a hypothesis replaced the guess, false when the guess is returned as it was
+	};
+
+	// The transformation taking source onto target. Mutual nearest descriptors are matched, falling back to the
+	// nearest target descriptor of each source keypoint when fewer than three are mutual, then RANSAC draws triples of
+	// matches in parallel batches until the adaptive number of draws for the confidence is reached. Each draw seeds its
+	// own generator, so the result does not depend on the number of threads. The guess is scored first and only a
+	// hypothesis with more inliers replaces it; the winner is refitted to its inliers.
+	CoarseAlignmentResult coarseAlign(const CoarseAlignmentFeatures &target, const CoarseAlignmentFeatures &source,
+		const CoarseAlignmentParameters &parameters, const Eigen::Matrix4f &guess = Eigen::Matrix4f::Identity());
+}
+
+#endif
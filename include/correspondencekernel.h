@@ -0,0 +1,96 @@
+#ifndef CORRESPONDENCEKERNEL_H
+#define CORRESPONDENCEKERNEL_H
+
+#include <cmath>
+
+#include "pclbase.h"
+
+namespace registar
+{
+	struct CorrespondenceTests
+	{
+		float sqrDistanceThreshold;
+		float cosAngleThreshold;
+		const Boundaries *boundaries;
+	};
+
+	// The tests and the target position of one query and its nearest match, with every option fixed at compile time so
+	// the loops calling it carry no per-point flags. Normals are compared and projected on without normalizing them, and
+	// a zero normal passes the angle test and leaves the match where it is.
+	template <bool DistanceTest, bool AngleTest, bool BoundaryTest, bool PointToPlane>
+	struct CorrespondenceKernel
+	{
+		static const bool distanceTest = DistanceTest;
+
+		static inline bool accept(const PointType &query, const PointType &match, int matchIndex, float sqrDistance,
+			const CorrespondenceTests &tests)
+		{
+			if (DistanceTest && !(sqrDistance < tests.sqrDistanceThreshold)) return false;
+			if (BoundaryTest && (*tests.boundaries)[matchIndex].boundary_point != 0) return false;
+			if (AngleTest)
+			{
+				Eigen::Map<const Eigen::Vector3f> queryNormal = query.getNormalVector3fMap();
+				Eigen::Map<const Eigen::Vector3f> matchNormal = match.getNormalVector3fMap();
+				float sqrNorms = queryNormal.squaredNorm() * matchNormal.squaredNorm();
+				if (sqrNorms != 0.0f && !(queryNormal.dot(matchNormal) > tests.cosAngleThreshold * std::sqrt(sqrNorms))) return false;
+			}
+			return true;
+		}
+
+		// the match itself, or its foot on the tangent plane of the match for point to plane
+		static inline Eigen::Vector3f targetPosition(const PointType &query, const PointType &match)
+		{
+			if (!PointToPlane) return match.getVector3fMap();
+			Eigen::Map<const Eigen::Vector3f> normal = match.getNormalVector3fMap();
+			float sqrNorm = normal.squaredNorm();
+			if (sqrNorm == 0.0f) return match.getVector3fMap();
+			return query.getVector3fMap() - ((query.getVector3fMap() - match.getVector3fMap()).dot(normal) / sqrNorm) * normal;
+		}
+	};
+
+	namespace correspondencekernel_detail
+	{
+		template <bool DistanceTest, bool AngleTest, bool BoundaryTest>
+		struct PointToPlaneDispatch
+		{
+			template <typename Visitor>
+			static inline void run(bool pointToPlane, Visitor &visitor)
+			{
+				if (pointToPlane) visitor.template run<CorrespondenceKernel<DistanceTest, AngleTest, BoundaryTest, true> >();
+				else visitor.template run<CorrespondenceKernel<DistanceTest, AngleTest, BoundaryTest, false> >();
+			}
+		};
+
+		template <bool DistanceTest, bool AngleTest>
+		struct BoundaryTestDispatch
+		{
+			template <typename Visitor>
+			static inline void run(bool boundaryTest, bool pointToPlane, Visitor &visitor)
+			{
+				if (boundaryTest) PointToPlaneDispatch<DistanceTest, AngleTest, true>::run(pointToPlane, visitor);
+				else PointToPlaneDispatch<DistanceTest, AngleTest, false>::run(pointToPlane, visitor);
+			}
+		};
+
+		template <bool DistanceTest>
+		struct AngleTestDispatch
+		{
+			template <typename Visitor>
+			static inline void run(bool angleTest, bool boundaryTest, bool pointToPlane, Visitor &visitor)
+			{
+				if (angleTest) BoundaryTestDispatch<DistanceTest, true>::run(boundaryTest, pointToPlane, visitor);
+				else BoundaryTestDispatch<DistanceTest, false>::run(boundaryTest, pointToPlane, visitor);
+			}
+		};
+	}
+
+	// calls visitor.run<Kernel>() once with the kernel matching the options, the visitor holds the loop over the points
+	template <typename Visitor>
+	inline void dispatchCorrespondenceKernel(bool distanceTest, bool angleTest, bool boundaryTest, bool pointToPlane, Visitor &visitor)
+	{
+		if (distanceTest) correspondencekernel_detail::AngleTestDispatch<true>::run(angleTest, boundaryTest, pointToPlane, visitor);
+		else correspondencekernel_detail::AngleTestDispatch<false>::run(angleTest, boundaryTest, pointToPlane, visitor);
+	}
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define EUCLIDEANCLUSTEREXTRACTION_H
 
 #include <QtCore/QVariantMap>
+#include <pcl/PointIndices.h>
 
 #include "pclbase.h"
 
@@ -17,6 +18,11 @@ namespace registar
 		//static void filter(CloudDataPtr cloudData, QVariantMap parameters, std::vector<CloudDataPtr> cloudData_filtereds);
 		static void filter(CloudDataConstPtr cloudData, QVariantMap parameters, CloudDataPtr &cloudData_inliers, CloudDataPtr &cloudData_outliers);
 		static void filter(CloudDataConstPtr cloudData, QVariantMap parameters, CloudDataPtr &cloudData_filtered);
+		static void filter(CloudDataConstPtr cloudData, QVariantMap parameters, KdTreePtr tree, CloudDataPtr &cloudData_inliers, CloudDataPtr &cloudData_outliers);
+
+		// multithreaded counterpart of pcl::EuclideanClusterExtraction, clusters are sorted by size as in pcl
+		static void extractClustersOMP(CloudDataConstPtr cloudData, KdTreePtr tree, float clusterTolerance, 
+			int minClusterSize, int maxClusterSize, std::vector<pcl::PointIndices> &cluster_indices);
 
 	};
 }
@@ -0,0 +1,53 @@
+#ifndef FLATKDTREE_H
+#define FLATKDTREE_H
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include "pclbase.h"
+#include "nearestsearch.h"
+
+namespace registar
+{
+	// KD-tree over the point positions kept in flat arrays. The tree is complete and balanced: node i has children
+	// 2i+1 and 2i+2 and splits its range of points at the middle, so ranges are implicit and a node only stores its
+	// split plane. Leaves hold at most bucketSize points in separate x, y and z arrays, scanned as one Eigen array
+	// expression. The levels are built one after another, the nodes of a level in parallel.
+	class FlatKdTree : public NearestSearch
+	{
+	public:
+		// bucket sizes below 2 are raised to 2
+		FlatKdTree(int bucketSize = 16);
+		virtual ~FlatKdTree();
+
+		// rebuilds only if the cloud changed
+		void setInputCloud(CloudDataConstPtr cloudData);
+		inline CloudDataConstPtr getInputCloud() const {return cloudData;}
+
+		// the query index is unused, the search keeps no state between queries
+		virtual bool nearest(int queryIndex, const PointType &query, int &match, float &sqrDistance);
+		using NearestSearch::nearest;
+
+		bool nearest(const PointType &query, int &match, float &sqrDistance) const;
+
+	private:
+		void build();
+
+		CloudDataConstPtr cloudData;
+		int bucketSize;
+
+		// levels of internal nodes, 2^depth leaves
+		int depth;
+		std::vector<float> splits;
+		std::vector<unsigned char> axes;
+
+		std::vector<float> xs;
+		std::vector<float> ys;
+		std::vector<float> zs;
+		std::vector<int> pointIndices;
+	};
+
+	typedef boost::shared_ptr<FlatKdTree> FlatKdTreePtr;
+}
+
+#endif
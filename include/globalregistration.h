@@ -25,11 +25,12 @@ namespace registar
 		~CycleRegistration();
 
 		QList<PairwiseRegistration*> prList;
-		void refine(CycleRegistrationRefineMethod method = UNIFORM_REFINE);
+		// the correspondence parameters are those of the minimized pairs, pairs set freezed keep their transformations
+		void refine(CycleRegistrationRefineMethod method, const CorrespondencesComputationParameters &correspondencesComputationParameters);
 
 		void uniform_refine();
 		void non_uniform_refine();
-		void minimize_refine();
+		void minimize_refine(const CorrespondencesComputationParameters &correspondencesComputationParameters);
 	};
 
 	class CycleRegistrationManager : public QObject
@@ -36,6 +36,7 @@ private slots:
 	void on_estimatePushButton_clicked();
 	void on_uniformRefinePushButton_clicked();
 	void on_nonUniformRefinePushButton_clicked();
+	void on_minimizeRefinePushButton_clicked();
 	void on_sendRelationPushButton_clicked();
 	void on_exportPushButton_clicked();
 
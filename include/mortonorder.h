@@ -0,0 +1,38 @@
+#ifndef MORTONORDER_H
+#define MORTONORDER_H
+
+#include <vector>
+
+#include "pclbase.h"
+
+namespace registar
+{
+	// Permutation sorting the points along a Z-order curve over their bounding box, 21 bits per axis, so points close
+	// in space are mostly close in memory. order[i] is the old index of the point moved to i; non-finite points go last
+	// in their old order.
+	void computeMortonOrder(const CloudData &cloudData, std::vector<int> &order);
+
+	// cloud[i] = old cloud[order[i]], anything index based over the same points is permuted with the same order
+	template <typename PointT>
+	void applyOrder(pcl::PointCloud<PointT> &cloud, const std::vector<int> &order)
+	{
+		pcl::PointCloud<PointT> temp(cloud);
+		for (int i = 0; i < order.size(); ++i) cloud.points[i] = temp.points[order[i]];
+	}
+
+	// cloud[order[i]] = ordered cloud[i], the inverse of applyOrder
+	template <typename PointT>
+	void restoreOrder(const pcl::PointCloud<PointT> &ordered, const std::vector<int> &order, pcl::PointCloud<PointT> &cloud)
+	{
+		cloud = ordered;
+		for (int i = 0; i < order.size(); ++i) cloud.points[order[i]] = ordered.points[i];
+	}
+
+	// vertex indices of polygons over points permuted by applyOrder, and back
+	void applyOrder(Polygons &polygons, const std::vector<int> &order);
+	void restoreOrder(const Polygons &ordered, const std::vector<int> &order, Polygons &polygons);
+
+	void invertOrder(const std::vector<int> &order, std::vector<int> &inverse);
+}
+
+#endif
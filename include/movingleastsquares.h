@@ -15,6 +15,7 @@ namespace registar
 		virtual ~MovingLeastSquares();
 
 		static void filter(CloudDataConstPtr &cloudData, QVariantMap parameters, CloudDataPtr &cloudData_filtered);
+		static void filter(CloudDataConstPtr &cloudData, QVariantMap parameters, KdTreePtr tree, CloudDataPtr &cloudData_filtered);
 	};
 }
 
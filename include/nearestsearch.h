@@ -0,0 +1,33 @@
+#ifndef NEARESTSEARCH_H
+#define NEARESTSEARCH_H
+
+#include <vector>
+#include <limits>
+#include <boost/shared_ptr.hpp>
+
+#include "pclbase.h"
+
+namespace registar
+{
+	// Common interface of the nearest neighbour searches used to find correspondences. Queries are numbered so a search
+	// may keep state per query; queries with distinct indices may run in parallel.
+	class NearestSearch
+	{
+	public:
+		virtual ~NearestSearch() {}
+
+		// false if the target has no point closer than getRadius()
+		virtual bool nearest(int queryIndex, const PointType &query, int &match, float &sqrDistance) = 0;
+
+		// searches bounded by a radius report nothing beyond it
+		virtual float getRadius() const {return std::numeric_limits<float>::infinity();}
+
+		// answers every point of queries with its index as query index, matches are -1 for non-finite queries
+		// and for queries without a match
+		virtual void nearest(const CloudData &queries, std::vector<int> &matches, std::vector<float> &sqrDistances, int threads = 1);
+	};
+
+	typedef boost::shared_ptr<NearestSearch> NearestSearchPtr;
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef NEIGHBOURTABLE_H
+#define NEIGHBOURTABLE_H
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include "pclbase.h"
+
+namespace registar
+{
+	// K nearest neighbours of every point, self excluded, stored row by row in ascending distance.
+	// Rows of points without K neighbours (non-finite points, tiny clouds) are shorter, see getNeighbourNumber.
+	class NeighbourTable
+	{
+	public:
+		NeighbourTable();
+		virtual ~NeighbourTable();
+
+		void build(CloudDataConstPtr cloudData, KdTreePtr tree, int K);
+		bool covers(CloudDataConstPtr cloudData, int K) const;
+
+		inline int getK() const {return K;}
+		inline int size() const {return static_cast<int>(neighbourNumbers.size());}
+		inline int getNeighbourNumber(int i) const {return neighbourNumbers[i];}
+		inline const int *getIndices(int i) const {return &indices[static_cast<size_t>(i) * K];}
+		inline const float *getSqrDistances(int i) const {return &sqrDistances[static_cast<size_t>(i) * K];}
+
+		// all neighbours within radius are in the row when the row is full and its last entry lies outside
+		inline bool coversRadius(int i, float radius) const 
+		{
+			return neighbourNumbers[i] < K || sqrDistances[static_cast<size_t>(i) * K + K - 1] > radius * radius;
+		}
+
+	private:
+		boost::weak_ptr<const CloudData> cloudData;
+		int K;
+		std::vector<int> indices;
+		std::vector<float> sqrDistances;
+		std::vector<int> neighbourNumbers;
+	};
+
+	typedef boost::shared_ptr<NeighbourTable> NeighbourTablePtr;
+	typedef boost::shared_ptr<const NeighbourTable> NeighbourTableConstPtr;
+}
+
+#endif
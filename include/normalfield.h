@@ -4,6 +4,7 @@
 #include <QtCore/QVariantMap>
 
 #include "pclbase.h"
+#include "neighbourtable.h"
 
 namespace registar
 {
@@ -14,8 +15,14 @@ namespace registar
 		virtual ~NormalField();
 
 		static void filter(CloudDataConstPtr &cloudData, QVariantMap parameters, CloudDataPtr &cloudData_filtered);
+		static void filter(CloudDataConstPtr &cloudData, QVariantMap parameters, KdTreePtr tree, NeighbourTableConstPtr neighbourTable, CloudDataPtr &cloudData_filtered);
+
+		// PCA normals over kNN (searchRadius <= 0) or fixed radius neighbourhoods, oriented towards viewpoint,
+		// neighbourhoods are read from neighbourTable wherever it holds them completely
+		static void estimateNormals(CloudDataConstPtr cloudData, KdTreePtr tree, NeighbourTableConstPtr neighbourTable, 
+			int nearestK, float searchRadius, const Eigen::Vector3f &viewpoint, CloudData &cloudData_estimated);
 	};
 }
 
 
-#endif
\ No newline at end of file
+#endif
@@ -4,6 +4,7 @@
 #include <QtCore/QVariantMap>
 
 #include "pclbase.h"
+#include "neighbourtable.h"
 
 namespace registar
 {
@@ -16,6 +17,10 @@ namespace registar
 
 		static void filter(CloudDataConstPtr cloudData, QVariantMap parameters, CloudDataPtr &cloudData_inliers, CloudDataPtr &cloudData_outliers);
 		static void filter(CloudDataConstPtr cloudData, QVariantMap parameters, CloudDataPtr &cloudData_filtered);
+
+		// neighbourTable is rebuilt only when it does not cover cloudData with nearestK neighbours
+		static void filter(CloudDataConstPtr cloudData, QVariantMap parameters, NeighbourTablePtr &neighbourTable, 
+			CloudDataPtr &cloudData_inliers, CloudDataPtr &cloudData_outliers);
 	};
 }
 
@@ -9,6 +9,15 @@
 #include <Eigen/Dense>
 #include "pclbase.h"
 #include "registrationdatamanager.h"
+#include "warmstartsearch.h"
+#include "voxelhashsearch.h"
+#include "flatkdtree.h"
+#include "projectivesearch.h"
+#include "correspondencekernel.h"
+#include "umeyama.h"
+#include "planeicp.h"
+#include "pointsampling.h"
+#include "robustweights.h"
 #endif
 
 namespace registar
@@ -28,16 +37,53 @@ namespace registar
 	};
 	typedef std::vector<CorrespondenceIndex, Eigen::aligned_allocator<CorrespondenceIndex> > CorrespondenceIndices;
 
+	// the searches into one target and the sample of the points queried into it, built on first use and kept across
+	// the iterations of one registration
+	struct CorrespondencesSearches
+	{
+		CloudDataConstPtr target;
+		WarmStartSearch warmStartSearch;
+		VoxelHashSearch voxelHashSearch;
+		FlatKdTree flatKdTree;
+		ProjectiveSearch projectiveSearch;
+		PointSampler sampler;
+	};
+
 	struct CorrespondencesComputationData
 	{
+		CorrespondencesComputationData() : iteration(0) {}
+
+		// iteration of the registration, samples are drawn again from it, see PointSampler
+		int iteration;
+
 		CloudData cloudData_source_dynamic;
-		pcl::Correspondences pcl_correspondences;
-		pcl::Correspondences pcl_correspondences_temp;
+		std::vector<int> matches;
+		std::vector<float> sqrDistances;
+		std::vector<int> positions;
+
+		// one per target so both directions of a bidirectional call keep theirs
+		CorrespondencesSearches searches[2];
+		inline CorrespondencesSearches &getSearches(CloudDataConstPtr target)
+		{
+			if (!searches[0].target || searches[0].target == target)
+			{
+				searches[0].target = target;
+				return searches[0];
+			}
+			searches[1].target = target;
+			return searches[1];
+		}
 	};
 
 	enum CorrespondenceComputationMethod
 	{
-		POINT_TO_POINT, POINT_TO_PLANE, POINT_TO_MLSSURFACE, DIRECT_POINT_PAIR
+		// the last two pair the matches themselves, both normals are left to the solver
+		POINT_TO_POINT, POINT_TO_PLANE, POINT_TO_MLSSURFACE, DIRECT_POINT_PAIR, SYMMETRIC_POINT_TO_PLANE, PLANE_TO_PLANE
+	};
+
+	enum NearestNeighbourSearchMethod
+	{
+		KDTREE_SEARCH, VOXELHASH_SEARCH, FLAT_KDTREE_SEARCH, PROJECTIVE_SEARCH
 	};
 
 	struct CorrespondencesComputationParameters
@@ -47,25 +93,41 @@ namespace registar
 		float normalAngleThreshold;
 		bool boundaryTest;
 		bool biDirectional;
+		NearestNeighbourSearchMethod searchMethod;
+		SamplingParameters sampling;
 		bool use_scpu;
 		bool use_mcpu;
 	};
 
 	struct PairwiseRegistrationComputationData
 	{
-		Eigen::Matrix<float, 3, Eigen::Dynamic> cloud_src;
-		Eigen::Matrix<float, 3, Eigen::Dynamic> cloud_tgt;
+		// per-thread sums of registAr and the residuals and weights of its pairs, kept between iterations
+		std::vector<UmeyamaMoments> threadMoments;
+		PlaneICPMomentsVector threadPlaneMoments;
+		std::vector<float> residuals;
+		std::vector<float> weights;
 	};
 
+	typedef std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > Transformations;
+
+	struct TransformationScore
+	{
+		float rmsError;  // NaN without pairs
+		int ovlNumber;   // pairs passing the tests, in both directions when bidirectional
+	};
+	typedef std::vector<TransformationScore> TransformationScores;
+
 	enum PairwiseRegistrationComputationMethod
 	{
-		SVD, UMEYAMA
+		// symmetric ICP and generalized ICP take the normals of both points of a pair, see planeicp.h
+		SVD, UMEYAMA, SYMMETRIC_ICP, GENERALIZED_ICP
 	};
 
 	struct PairwiseRegistrationComputationParameters
 	{
 		PairwiseRegistrationComputationMethod method;
 		bool allowScaling;
+		RobustParameters robust;   // trimming and kernel weights of the pairs, recomputed every iteration
 	};
 
 	class PairwiseRegistration : public QObject
@@ -82,8 +144,13 @@ namespace registar
 		virtual void initializeTransformation(const Eigen::Matrix4f &transformation);
 		virtual void process(QVariantMap parameters);
 
-		void estimateRMSErrorByTransformation(const Eigen::Matrix4f &transformation, float &rmsError, int &ovlNumber); 
-		void estimateVirtualRMSErrorByTransformation(const Eigen::Matrix4f &transformation, float &rmsError, int &ovlNumber);
+		// the errors of the pairs passing the tests of the parameters, NaN when no pair does
+		void estimateRMSErrorByTransformation(const Eigen::Matrix4f &transformation, 
+			const CorrespondencesComputationParameters &correspondencesComputationParameters, float &rmsError, int &ovlNumber); 
+		void estimateVirtualRMSErrorByTransformation(const Eigen::Matrix4f &transformation, 
+			CorrespondencesComputationParameters correspondencesComputationParameters, float &rmsError, int &ovlNumber);
+		void estimateRMSErrorByTransformations(const Transformations &transformations, 
+			const CorrespondencesComputationParameters &correspondencesComputationParameters, TransformationScores &scores);
 
 		inline RegistrationData* getTarget() {return target;}
 		inline RegistrationData* getSource() {return source;}
@@ -100,6 +167,9 @@ namespace registar
 
 		static inline QString generateName(QString targetName, QString sourceName) {return targetName + "<-" + sourceName;}
 
+		// the correspondence parameters of a command of the pairwise registration dialog, without sampling
+		static CorrespondencesComputationParameters correspondencesComputationParametersFrom(const QVariantMap &parameters);
+
 		static void preCorrespondences(RegistrationData *target, RegistrationData *source,
 			const Eigen::Matrix4f &initialTransformation, CorrespondencesComputationParameters &correspondencesComputationParameters, 
 			Correspondences &correspondences, CorrespondenceIndices &correspondenceIndices, 
@@ -113,6 +183,14 @@ namespace registar
 			const Eigen::Matrix4f &initialTransformation, CorrespondencesComputationParameters &correspondencesComputationParameters, 
 			PairwiseRegistrationComputationParameters pairwiseRegistrationComputationParameters, int iterationNumber);
 
+		// The RMS error and overlap of the pairs each candidate transformation of the source would give, in one pass over
+		// the points. The candidates are chained from near to near, and the exact match of a point under one candidate
+		// seeds the warm started search under the next; a point whose previous distance to the target, less how far it
+		// moved, is still beyond the distance threshold is not searched at all. The search method and sampling of the
+		// parameters are not used.
+		static void scoreTransformations(RegistrationData *target, RegistrationData *source, const Transformations &transformations,
+			const CorrespondencesComputationParameters &correspondencesComputationParameters, TransformationScores &scores);
+
 		static void computeSquareErrors(Correspondences &correspondences, std::vector<float> &squareErrors_total, float &rmsError_total);
 
 	protected:
@@ -24,6 +24,8 @@ public:
 
 	registar::CloudVisualizer* addCloudVisualizerTab(QString targetBySource);
 	void showResults(const Eigen::Matrix4f &transformation, float rmsError, int corrNumber);
+	// the correspondence settings of the dialog, as the Pre-Correspondences command sends them
+	QVariantMap getCorrespondencesParameters();
 
 public slots:
 	void on_tabWidget_currentChanged(int index);
@@ -38,6 +40,7 @@ private slots:
 	void on_icpPushButton_clicked();
 	void on_exportPushButton_clicked();
 	void on_manualPushButton_clicked();
+	void on_coarsePushButton_clicked();
 
 	void on_targetComboBox_currentIndexChanged(const QString &cloudName_target);
 	void on_sourceComboBox_currentIndexChanged(const QString &cloudName_source);
@@ -0,0 +1,100 @@
+#ifndef PLANEICP_H
+#define PLANEICP_H
+
+#include <vector>
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+namespace registar
+{
+	typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+	typedef Eigen::Matrix<double, 6, 1> Vector6d;
+
+	// variance along the normal of the flat covariances of generalized ICP, the variance in the plane being one
+	const double planeCovarianceEpsilon = 1e-3;
+
+	// Normal equations of one linearised step of the ICP variants using the normals of both points of a pair, in
+	// double about a reference pair as UmeyamaMoments; the centroids of the pairs make the best references. The pairs
+	// are the matches themselves, in the frame of the current estimate, and the partial sums of several threads add up.
+	// Symmetric ICP (Rusinkiewicz 2019) measures each pair along the sum of its normals and rotates the source and the
+	// target half way each. Generalized ICP (Segal et al. 2009), plane-to-plane, measures each pair by the inverse of
+	// the sum of the covariances of its points, which are taken flat along their normals so they are rotated with them.
+	struct PlaneICPMoments
+	{
+		Eigen::Vector3d sourceReference, targetReference;
+		double w;
+		Matrix6d ata;
+		Vector6d atb;
+
+		PlaneICPMoments(const Eigen::Vector3d &sourceReference = Eigen::Vector3d::Zero(), const Eigen::Vector3d &targetReference = Eigen::Vector3d::Zero()) :
+			sourceReference(sourceReference), targetReference(targetReference), w(0.0), ata(Matrix6d::Zero()), atb(Vector6d::Zero()) {}
+
+		// unknowns: the tangent of the half rotation times its axis, then the translation between the half rotations
+		inline void addSymmetric(const Eigen::Vector3f &source, const Eigen::Vector3f &sourceNormal,
+			const Eigen::Vector3f &target, const Eigen::Vector3f &targetNormal, double weight = 1.0)
+		{
+			Eigen::Vector3d s = source.cast<double>() - sourceReference;
+			Eigen::Vector3d t = target.cast<double>() - targetReference;
+			// normals facing apart would cancel out
+			Eigen::Vector3d n = sourceNormal.cast<double>();
+			if (sourceNormal.dot(targetNormal) < 0.0f) n -= targetNormal.cast<double>();
+			else n += targetNormal.cast<double>();
+			Vector6d a;
+			a << (s + t).cross(n), n;
+			w += weight;
+			ata += weight * a * a.transpose();
+			atb -= weight * (s - t).dot(n) * a;
+		}
+
+		// unknowns: the rotation vector of the source about its reference point, then the translation
+		inline void addGeneralized(const Eigen::Vector3f &source, const Eigen::Vector3f &sourceNormal,
+			const Eigen::Vector3f &target, const Eigen::Vector3f &targetNormal, double weight = 1.0)
+		{
+			Eigen::Vector3d s = source.cast<double>() - sourceReference;
+			Eigen::Vector3d d = target.cast<double>() - source.cast<double>();
+			Eigen::Matrix3d covariances = 2.0 * Eigen::Matrix3d::Identity() - (1.0 - planeCovarianceEpsilon) * (flat(sourceNormal) + flat(targetNormal));
+			Eigen::Matrix3d M = covariances.inverse();
+
+			// the residual d - w x s - t is linear in the unknowns with the jacobian [ [s]x, -I ]
+			Eigen::Matrix3d S;
+			S << 0.0, -s.z(), s.y(),
+				s.z(), 0.0, -s.x(),
+				-s.y(), s.x(), 0.0;
+			Eigen::Matrix3d MS = M * S;
+			w += weight;
+			ata.topLeftCorner<3, 3>() += weight * S.transpose() * MS;
+			ata.topRightCorner<3, 3>() -= weight * MS.transpose();
+			ata.bottomLeftCorner<3, 3>() -= weight * MS;
+			ata.bottomRightCorner<3, 3>() += weight * M;
+			atb.head<3>() -= weight * MS.transpose() * d;
+			atb.tail<3>() += weight * M * d;
+		}
+
+		// both must share the reference pair
+		inline PlaneICPMoments& operator+=(const PlaneICPMoments &other)
+		{
+			w += other.w;
+			ata += other.ata;
+			atb += other.atb;
+			return *this;
+		}
+
+		// the outer product of the unit normal, zero for a point without one
+		static inline Eigen::Matrix3d flat(const Eigen::Vector3f &normal)
+		{
+			double sqrNorm = normal.cast<double>().squaredNorm();
+			if (sqrNorm == 0.0) return Eigen::Matrix3d::Zero();
+			return normal.cast<double>() * normal.cast<double>().transpose() / sqrNorm;
+		}
+
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	};
+	typedef std::vector<PlaneICPMoments, Eigen::aligned_allocator<PlaneICPMoments> > PlaneICPMomentsVector;
+
+	// the rigid transformations taking the sources onto the targets after one step, identity without pairs; the
+	// directions a degenerate scene leaves free, such as sliding along a plane, are not moved along
+	Eigen::Matrix4f solveSymmetricICP(const PlaneICPMoments &moments);
+	Eigen::Matrix4f solveGeneralizedICP(const PlaneICPMoments &moments);
+}
+
+#endif
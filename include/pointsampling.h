@@ -0,0 +1,64 @@
+#ifndef POINTSAMPLING_H
+#define POINTSAMPLING_H
+
+#include <vector>
+
+#include "pclbase.h"
+
+namespace registar
+{
+	enum SamplingMethod
+	{
+		NO_SAMPLING, UNIFORM_SAMPLING, RANDOM_SAMPLING, NORMAL_SPACE_SAMPLING, COVARIANCE_SAMPLING
+	};
+
+	struct SamplingParameters
+	{
+		SamplingMethod method;
+		float ratio;            // sample size as a fraction of the candidates
+		unsigned int refresh;   // iterations a sample is kept for, 0 keeps it for the whole registration
+	};
+
+	// Picks sampleSize of the candidates, all points if candidates is NULL, and returns them in increasing order.
+	// Uniform takes every k-th candidate, random draws them without repetition, normal space (Rusinkiewicz and Levoy
+	// 2001) draws in turn from buckets of normal directions so that small planes are kept, covariance (Gelfand et al.
+	// 2003) picks the points constraining the least constrained of the six rigid motions first. Points without a
+	// finite position and normal are only kept by uniform and random sampling. The seed fixes the random draws.
+	void samplePoints(const CloudData &cloudData, const std::vector<int> *candidates, SamplingMethod method, int sampleSize,
+		unsigned int seed, std::vector<int> &samples);
+
+	// The sample of one cloud kept across the iterations of a registration. It is drawn again on the first call, once
+	// refresh iterations have passed since the last draw, when the iteration goes back, and when the cloud or the
+	// number of candidates changes.
+	class PointSampler
+	{
+	public:
+		PointSampler();
+
+		inline void setParameters(const SamplingParameters &parameters)
+		{
+			if (parameters.method != this->parameters.method || parameters.ratio != this->parameters.ratio) drawIteration = -1;
+			this->parameters = parameters;
+		}
+		inline const SamplingParameters &getParameters() const {return parameters;}
+
+		// the candidates themselves, or all points, without sampling
+		const std::vector<int> &sample(const CloudData &cloudData, const std::vector<int> *candidates, int iteration);
+
+		// whether the last call drew a new sample, searches remembering the previous queries should forget them
+		inline bool isResampled() const {return resampled;}
+
+		void reset();
+
+	private:
+		SamplingParameters parameters;
+		const CloudData *cloudData;
+		int candidateNumber;
+		int drawIteration;
+		unsigned int draws;
+		bool resampled;
+		std::vector<int> samples;
+	};
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef POSEGRAPH_H
+#define POSEGRAPH_H
+
+#include <vector>
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+namespace registar
+{
+	// Weighted sums of the correspondences of one edge, p in the target scan frame and q in the source scan frame.
+	struct PoseGraphEdgeMoments
+	{
+		double w;
+		Eigen::Vector3d sp, sq;
+		Eigen::Matrix3d Spp, Sqq, Spq;
+
+		PoseGraphEdgeMoments() : w(0.0), sp(Eigen::Vector3d::Zero()), sq(Eigen::Vector3d::Zero()),
+			Spp(Eigen::Matrix3d::Zero()), Sqq(Eigen::Matrix3d::Zero()), Spq(Eigen::Matrix3d::Zero()) {}
+
+		inline void add(const Eigen::Vector3d &p, const Eigen::Vector3d &q, double weight = 1.0)
+		{
+			w += weight;
+			sp += weight * p;
+			sq += weight * q;
+			Spp += weight * p * p.transpose();
+			Sqq += weight * q * q.transpose();
+			Spq += weight * p * q.transpose();
+		}
+
+		inline PoseGraphEdgeMoments& operator+=(const PoseGraphEdgeMoments &other)
+		{
+			w += other.w;
+			sp += other.sp;
+			sq += other.sq;
+			Spp += other.Spp;
+			Sqq += other.Sqq;
+			Spq += other.Spq;
+			return *this;
+		}
+	};
+
+	// Scan poses X_i (world <- scan) linked by edges whose cost is sum |X_target * p - X_source * q|^2 over the
+	// edge correspondences. The cost is an exact quadratic in the edge moments, so the sparse Levenberg-Marquardt
+	// steps never touch the points themselves.
+	class PoseGraph
+	{
+	public:
+		struct Parameters
+		{
+			int iterationNum_max;
+			double tolerance; // relative error decrease below which the optimization stops
+			double lambda_initial;
+			int fixedVertex;
+			Parameters() : iterationNum_max(50), tolerance(1e-8), lambda_initial(1e-6), fixedVertex(0) {}
+		};
+
+		PoseGraph(int vertexNumber = 0);
+		virtual ~PoseGraph();
+
+		void setVertexNumber(int vertexNumber);
+		inline int getVertexNumber() const {return static_cast<int>(poses.size());}
+
+		inline void setPose(int i, const Eigen::Matrix4d &pose) {poses[i] = pose;}
+		inline const Eigen::Matrix4d &getPose(int i) const {return poses[i];}
+
+		void addEdge(int target, int source, const PoseGraphEdgeMoments &moments);
+		inline void clearEdges() {edges.clear();}
+		inline int getEdgeNumber() const {return static_cast<int>(edges.size());}
+
+		double error() const;
+		double totalWeight() const;
+
+		// returns the number of iterations
+		int optimize(const Parameters &parameters = Parameters());
+
+	private:
+		typedef std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > Poses;
+
+		// moments about the correspondence centroids, which keeps the error free of cancellation far from the origin
+		struct Edge
+		{
+			int target, source;
+			double w;
+			Eigen::Vector3d p_mean, q_mean;
+			Eigen::Matrix3d Cpp, Cqq, Cpq;
+		};
+
+		double edgeError(const Edge &edge, const Poses &poses) const;
+		double error(const Poses &poses) const;
+		void edgeSystem(const Edge &edge, Eigen::Matrix<double, 12, 12> &H, Eigen::Matrix<double, 12, 1> &g) const;
+
+		Poses poses;
+		std::vector<Edge> edges;
+	};
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef PROJECTIVESEARCH_H
+#define PROJECTIVESEARCH_H
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <Eigen/Dense>
+
+#include "pclbase.h"
+#include "nearestsearch.h"
+
+namespace registar
+{
+	// Projective data association into an organised target, such as the depth images of the virtual cameras. The
+	// pinhole projection of the target grid is estimated from its own points by least squares, a query is projected
+	// onto the grid and matched to the nearest point in a window around its pixel, so it costs a constant number of
+	// distance checks whatever the size of the target.
+	class ProjectiveSearch : public NearestSearch
+	{
+	public:
+		ProjectiveSearch(int window = 2);
+		virtual ~ProjectiveSearch();
+
+		// whether the points fill a grid of more than one row
+		static bool isOrganized(const CloudData &cloudData);
+
+		// rebuilds only if the cloud changed, false if it is not organised, not a pinhole image or too flat to fix the
+		// projection, as a planar target is
+		bool setInputCloud(CloudDataConstPtr cloudData);
+		inline CloudDataConstPtr getInputCloud() const {return cloudData;}
+		inline bool isValid() const {return valid;}
+
+		// pixels searched on each side of the projected one
+		inline void setWindow(int window) {this->window = window;}
+
+		// the query index is unused, the search keeps no state between queries
+		virtual bool nearest(int queryIndex, const PointType &query, int &match, float &sqrDistance);
+		using NearestSearch::nearest;
+
+		bool nearest(const PointType &query, int &match, float &sqrDistance) const;
+
+	private:
+		void build();
+
+		CloudDataConstPtr cloudData;
+		int window;
+		bool valid;
+		Eigen::Matrix<float, 3, 4, Eigen::DontAlign> projection;   // unaligned, the search is held by value
+	};
+
+	typedef boost::shared_ptr<ProjectiveSearch> ProjectiveSearchPtr;
+}
+
+#endif
@@ -16,6 +16,7 @@ namespace registar
 		virtual ~RegistrationData();
 
 		Cloud * cloud;
+		unsigned int cloudDataVersion;
 		CloudDataPtr cloudData;	
 		KdTreePtr kdTree;
 		BoundariesConstPtr boundaries;
@@ -0,0 +1,33 @@
+#ifndef ROBUSTWEIGHTS_H
+#define ROBUSTWEIGHTS_H
+
+namespace registar
+{
+	enum RobustKernel
+	{
+		NO_KERNEL, HUBER_KERNEL, TUKEY_KERNEL, CAUCHY_KERNEL
+	};
+
+	struct RobustParameters
+	{
+		float overlapRatio;   // fraction of the pairs with the smallest residuals kept, as in trimmed ICP; 1 keeps all
+		RobustKernel kernel;
+		float kernelWidth;    // in units of the estimated scale, 0 for the usual width of the kernel
+	};
+
+	inline bool isRobust(const RobustParameters &parameters)
+	{
+		return parameters.overlapRatio < 1.0f || parameters.kernel != NO_KERNEL;
+	}
+
+	// The q-quantile of number values, which are left as they are. One parallel pass counts the values into a
+	// histogram between their extremes, and nth_element only runs over the values of the bin holding the quantile.
+	float parallelQuantile(const float *values, int number, float q, int threads);
+
+	// Weights of pairs with the given residual distances for one iteratively reweighted least squares step: 0 for the
+	// residuals beyond the overlapRatio quantile, otherwise the kernel weight at residual / scale with the scale
+	// 1.4826 times the median of the kept residuals. Returns the scale.
+	float computeRobustWeights(const float *residuals, int number, const RobustParameters &parameters, float *weights, int threads);
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef UMEYAMA_H
+#define UMEYAMA_H
+
+#include <vector>
+#include <Eigen/Dense>
+
+namespace registar
+{
+	// Weighted sums of point pairs in double, taken about a reference pair so the sums of far scans do not cancel.
+	// They hold all the closed form alignment of Umeyama needs, and the partial sums of several threads add up.
+	struct UmeyamaMoments
+	{
+		Eigen::Vector3d sourceReference, targetReference;
+		double w;
+		Eigen::Vector3d sumSource, sumTarget;
+		Eigen::Matrix3d sumTargetSource;
+		double sumSourceSquared;
+
+		UmeyamaMoments(const Eigen::Vector3d &sourceReference = Eigen::Vector3d::Zero(), const Eigen::Vector3d &targetReference = Eigen::Vector3d::Zero()) :
+			sourceReference(sourceReference), targetReference(targetReference), w(0.0), sumSource(Eigen::Vector3d::Zero()),
+			sumTarget(Eigen::Vector3d::Zero()), sumTargetSource(Eigen::Matrix3d::Zero()), sumSourceSquared(0.0) {}
+
+		inline void add(const Eigen::Vector3f &source, const Eigen::Vector3f &target, double weight = 1.0)
+		{
+			Eigen::Vector3d s = source.cast<double>() - sourceReference;
+			Eigen::Vector3d t = target.cast<double>() - targetReference;
+			w += weight;
+			sumSource += weight * s;
+			sumTarget += weight * t;
+			sumTargetSource += weight * t * s.transpose();
+			sumSourceSquared += weight * s.squaredNorm();
+		}
+
+		// both must share the reference pair
+		inline UmeyamaMoments& operator+=(const UmeyamaMoments &other)
+		{
+			w += other.w;
+			sumSource += other.sumSource;
+			sumTarget += other.sumTarget;
+			sumTargetSource += other.sumTargetSource;
+			sumSourceSquared += other.sumSourceSquared;
+			return *this;
+		}
+	};
+
+	// the transformation taking the sources onto the targets in the least squares sense, a similarity with scaling;
+	// identity without pairs
+	Eigen::Matrix4f solveUmeyama(const UmeyamaMoments &moments, bool withScaling = false);
+
+	// one parallel pass over number xyz triplets stored one after another, weights may be NULL for unit weights;
+	// the reference pair is the first one
+	UmeyamaMoments accumulateUmeyamaMoments(const float *sourcePositions, const float *targetPositions, const float *weights, int number);
+}
+
+#endif
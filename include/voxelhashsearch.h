@@ -0,0 +1,68 @@
+#ifndef VOXELHASHSEARCH_H
+#define VOXELHASHSEARCH_H
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include "pclbase.h"
+#include "nearestsearch.h"
+
+namespace registar
+{
+	// Fixed-radius nearest neighbour search over a hash of cubic cells whose edge is the search radius, so a query only
+	// looks at the 27 cells around its own. Positions are copied cell by cell into separate x, y and z arrays, and the
+	// points of a cell are scanned as one Eigen array expression.
+	// Queries beyond the radius report no match, which is what a correspondence search with a distance threshold needs.
+	// A radius far above the point spacing puts so many points in each cell that the scan of a cell costs more than a
+	// KD-tree query, the search is then left empty and reported invalid so the caller can use a tree instead.
+	class VoxelHashSearch : public NearestSearch
+	{
+	public:
+		VoxelHashSearch();
+		virtual ~VoxelHashSearch();
+
+		// rebuilds only if the cloud or the radius changed, false if the cells are too crowded to search
+		bool setInputCloud(CloudDataConstPtr cloudData, float radius);
+		inline CloudDataConstPtr getInputCloud() const {return cloudData;}
+		inline bool isValid() const {return valid;}
+		virtual float getRadius() const {return radius;}
+
+		// the query index is unused, the search keeps no state between queries
+		virtual bool nearest(int queryIndex, const PointType &query, int &match, float &sqrDistance);
+		using NearestSearch::nearest;
+
+		// nearest point strictly closer than the radius, safe to call from several threads
+		bool nearest(const PointType &query, int &match, float &sqrDistance) const;
+
+	private:
+		struct Cell
+		{
+			unsigned long long key;
+			int begin;
+			int end;
+		};
+
+		void build();
+		inline unsigned long long cellKey(int x, int y, int z) const;
+		inline const Cell *findCell(unsigned long long key) const;
+
+		CloudDataConstPtr cloudData;
+		float radius;
+		float inverseCellSize;
+		bool valid;
+
+		std::vector<float> xs;
+		std::vector<float> ys;
+		std::vector<float> zs;
+		std::vector<int> pointIndices;
+
+		// open addressing, a power of two in size and at most half full
+		std::vector<Cell> cells;
+		unsigned long long cellMask;
+	};
+
+	typedef boost::shared_ptr<VoxelHashSearch> VoxelHashSearchPtr;
+	typedef boost::shared_ptr<const VoxelHashSearch> VoxelHashSearchConstPtr;
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef WARMSTARTSEARCH_H
+#define WARMSTARTSEARCH_H
+
+#include <vector>
+
+#include "pclbase.h"
+#include "neighbourtable.h"
+#include "nearestsearch.h"
+
+namespace registar
+{
+	// Nearest neighbour search for queries that move a little between calls, as in ICP. The match of the previous call
+	// for the same query index is the start of a descent over the neighbour table of the target. The point where the
+	// descent stops is the exact nearest neighbour when its table row covers twice the query distance, since every
+	// point closer to the query lies within that radius of it; otherwise the tree answers the query.
+	// The table may belong to a rigidly transformed copy of the target, distances and indices are the same.
+	class WarmStartSearch : public NearestSearch
+	{
+	public:
+		WarmStartSearch();
+		virtual ~WarmStartSearch();
+
+		// previous matches are dropped when the target changes
+		void setTarget(CloudDataConstPtr cloudData, KdTreePtr tree, NeighbourTableConstPtr neighbourTable = NeighbourTableConstPtr());
+		inline void setNeighbourTable(NeighbourTableConstPtr neighbourTable) {this->neighbourTable = neighbourTable;}
+		inline CloudDataConstPtr getTarget() const {return cloudData;}
+
+		// keeps the previous matches if the number of queries is unchanged, forgets them otherwise
+		void setQueryNumber(int queryNumber);
+		void reset();
+
+		// true once a whole round of queries has left its matches, i.e. a neighbour table would pay off
+		inline bool isWarm() const {return warm;}
+		inline void setWarm() {warm = true;}
+
+		// queries with distinct indices may run in parallel
+		virtual bool nearest(int queryIndex, const PointType &query, int &match, float &sqrDistance);
+		using NearestSearch::nearest;
+
+		int maxSteps;
+
+		// number of neighbours per row of the tables built for this search
+		static const int neighbourNumber = 16;
+
+	private:
+		CloudDataConstPtr cloudData;
+		KdTreePtr tree;
+		NeighbourTableConstPtr neighbourTable;
+		std::vector<int> previousMatches;
+		bool warm;
+	};
+}
+
+#endif
@@ -40,6 +40,7 @@
 
 #include "manual_registration.h"
 #include "../include/qtbase.h"
+#include "../include/coarsealignment.h"
 
 //QT4
 #include <QtGui/QApplication>
@@ -116,6 +117,8 @@ ManualRegistration::ManualRegistration (QWidget *parent): QMainWindow(parent)
 
   ball_radius_src_ = 1.0f;
   ball_radius_dst_ = 1.0f;
+
+  transform_ = Eigen::Matrix4f::Identity ();
 }
 
 void ManualRegistration::SourcePointPickCallback (const pcl::visualization::PointPickingEvent& event, void*)
@@ -245,8 +248,23 @@ void ManualRegistration::applyTransformPressed()
   emit sendParameters(parameters);
 }
 
+// automatic coarse alignment, the picked transformation is only replaced by one with more inliers
 void ManualRegistration::refinePressed()
 {
+  if (!cloud_src_ || !cloud_dst_)
+  {
+    PCL_INFO ("Please load both clouds first\n");
+    return;
+  }
+  float voxelSize = std::max(registar::estimateCoarseVoxelSize(*cloud_src_), registar::estimateCoarseVoxelSize(*cloud_dst_));
+  registar::CoarseAlignmentParameters parameters = registar::defaultCoarseAlignmentParameters(voxelSize);
+  registar::CoarseAlignmentFeatures features_src, features_dst;
+  features_src.compute(*cloud_src_, parameters);
+  features_dst.compute(*cloud_dst_, parameters);
+  registar::CoarseAlignmentResult result = registar::coarseAlign(features_dst, features_src, parameters, transform_);
+  PCL_INFO ("Coarse alignment : %d of %d matches after %d iterations\n", result.inliers, result.matches, result.iterations);
+  transform_ = result.transformation;
+  std::cout << "Transform : " << std::endl << transform_ << std::endl;
 }
 
 void ManualRegistration::undoPressed()
@@ -21,5 +21,8 @@ INCLUDEPATH += . /usr/local/include/pcl-1.8/ /usr/include/eigen3 /usr/include/vt
 
 # Input
 FORMS += manual_registration.ui
-HEADERS += manual_registration.h
-SOURCES += manual_registration.cpp main.cpp
+HEADERS += manual_registration.h ../include/coarsealignment.h ../include/umeyama.h
+SOURCES += manual_registration.cpp main.cpp ../src/coarsealignment.cpp ../src/umeyama.cpp
+
+QMAKE_CXXFLAGS += -fopenmp
+QMAKE_LFLAGS += -fopenmp
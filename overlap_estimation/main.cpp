@@ -35,7 +35,6 @@ int main(int argc, char** argv)
 	Links links;
 	Loops loops;
   	GlobalRegistration globalRegistration(scanPtrs, links, loops);
-  	globalRegistration.buildKdTreePtrs();
 
 	PairRegistration::Parameters pr_para;
 	pr_para.mMethod = PairRegistration::POINT_TO_PLANE;
@@ -46,6 +45,18 @@ int main(int argc, char** argv)
 	pr_para.biDirection = true;
 	pr_para.iterationNum_max = 0;
 	pr_para.iterationNum_min = 0;
+	pr_para.activeSet = false;
+	pr_para.activeSetMargin = 2.0f;
+	pr_para.activeSetRefresh = 0;
+	pr_para.warmStart = false;
+	pr_para.voxelHash = false;
+	pr_para.flatKdTree = false;
+	pr_para.sampling.method = registar::NO_SAMPLING;
+	pr_para.sampling.ratio = 1.0f;
+	pr_para.sampling.refresh = 0;
+	pr_para.robust.overlapRatio = 1.0f;
+	pr_para.robust.kernel = registar::NO_KERNEL;
+	pr_para.robust.kernelWidth = 0.0f;
 
 	float distThreshold;
 	pcl::console::parse_argument(argc, argv, "--distance", distThreshold);
@@ -54,6 +65,10 @@ int main(int argc, char** argv)
 	pr_para.distThreshold = distThreshold;
 	pr_para.angleThreshold = angleThreshold;
 
+	// the scans were imported, the cache only builds their KD-trees
+	globalRegistration.para.pr_para = pr_para;
+	globalRegistration.initialScanCache();
+
   	for (int i = 0; i < scanPtrs.size(); ++i)
   	{
   		for (int j = i+1; j < scanPtrs.size(); ++j)
@@ -64,7 +79,8 @@ int main(int argc, char** argv)
 
 			// PairRegistrationPtr pairReigstrationPtr(new PairRegistration(scanPtrs[link.a], scanPtrs[link.b]));
 			PairRegistrationOMPPtr pairReigstrationPtr(new PairRegistrationOMP(scanPtrs[link.a], scanPtrs[link.b], 8));
-			pairReigstrationPtr->setKdTree( globalRegistration.kdTreePtrs[link.a], globalRegistration.kdTreePtrs[link.b] );
+			globalRegistration.scanCache.acquire(link);
+			pairReigstrationPtr->setKdTree( globalRegistration.scanCache.kdTree(link.a), globalRegistration.scanCache.kdTree(link.b) );
 
 			pairReigstrationPtr->setParameter(pr_para);
 			pairReigstrationPtr->setTransformation(Transformation::Identity());
@@ -72,6 +88,7 @@ int main(int argc, char** argv)
 
 			std::cerr << i << " <<-- " << j << std::endl;
 			pairReigstrationPtr->generateFinalPointPairs(Transformation::Identity());
+			globalRegistration.scanCache.release(link);
 
 			std::pair<Link, PairRegistrationPtr> pairLP(link, pairReigstrationPtr);
 			globalRegistration.pairRegistrationPtrMap.insert(pairLP);
@@ -6,20 +6,52 @@ include(overlap_estimation.pri)
 HEADERS += ../Tang2014/graph.h \
 			../Tang2014/common.h \
 			../Tang2014/pairregistration.h \
+			../Tang2014/pointpairs.h \
 			../Tang2014/globalregistration.h \
 			../Tang2014/scan.h \
+			../Tang2014/scancache.h \
 			../Tang2014/loop.h \
 			../Tang2014/link.h \
-			../Williams2001/SRoMCPS.h
+			../Williams2001/SRoMCPS.h \
+			../include/posegraph.h \
+			../include/neighbourtable.h \
+			../include/warmstartsearch.h \
+			../include/voxelhashsearch.h \
+			../include/nearestsearch.h \
+			../include/flatkdtree.h \
+			../include/mortonorder.h \
+			../include/correspondencekernel.h \
+			../include/bulktransform.h \
+			../include/umeyama.h \
+			../include/planeicp.h \
+			../include/pointsampling.h \
+			../include/robustweights.h \
+			../include/coarsealignment.h
 
 SOURCES += ../Tang2014/graph.cpp \
 			../Tang2014/pairregistration.cpp \
+			../Tang2014/pointpairs.cpp \
 			../Tang2014/tang2014_globalregistration.cpp \
+			../Tang2014/checkpoint.cpp \
 			main.cpp \
 			../Tang2014/scan.cpp \
+			../Tang2014/scancache.cpp \
 			../Tang2014/loop.cpp \
 			../Tang2014/link.cpp \
-			../Williams2001/SRoMCPS.cpp
+			../Williams2001/SRoMCPS.cpp \
+			../src/posegraph.cpp \
+			../src/neighbourtable.cpp \
+			../src/warmstartsearch.cpp \
+			../src/voxelhashsearch.cpp \
+			../src/nearestsearch.cpp \
+			../src/flatkdtree.cpp \
+			../src/mortonorder.cpp \
+			../src/bulktransform.cpp \
+			../src/umeyama.cpp \
+			../src/planeicp.cpp \
+			../src/pointsampling.cpp \
+			../src/robustweights.cpp \
+			../src/coarsealignment.cpp
 
 
 
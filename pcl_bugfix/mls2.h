@@ -377,12 +377,17 @@ namespace pcl
       class MLSVoxelGrid
       {
         public:
-          struct Leaf { Leaf () : valid (true) {} bool valid; };
-
+          /** \brief Build the grid of the occupied voxels
+            * \param[in] threads the number of threads used for building and dilating the grid
+            */
           MLSVoxelGrid (PointCloudInConstPtr& cloud,
                         IndicesPtr &indices,
-                        float voxel_size);
+                        float voxel_size,
+                        unsigned int threads = 1);
 
+          /** \brief Grow the grid by one voxel in every direction, only the voxels added by the
+            * previous step are expanded, so one step costs in proportion to the new shell
+            */
           void
           dilate ();
 
@@ -419,11 +424,18 @@ namespace pcl
               point[i] = static_cast<Eigen::Vector3f::Scalar> (index_3d[i]) * voxel_size_ + bounding_min_[i];
           }
 
-          typedef std::map<uint64_t, Leaf> HashMap;
-          HashMap voxel_grid_;
+          /** \brief Sort and deduplicate keys, chunks are sorted by the threads and merged pairwise */
+          void
+          sortUnique (std::vector<uint64_t> &keys) const;
+
+          /** \brief Occupied voxels as sorted 1D indices */
+          std::vector<uint64_t> voxel_grid_;
+          /** \brief Voxels added by the last dilation step (all voxels before the first one) */
+          std::vector<uint64_t> frontier_;
           Eigen::Vector4f bounding_min_, bounding_max_;
           uint64_t data_size_;
           float voxel_size_;
+          unsigned int threads_;
       };
 
 
@@ -531,7 +543,8 @@ namespace pcl
 #ifdef _OPENMP
   /** \brief MovingLeastSquaresOMP2 is a parallelized version of MovingLeastSquares2, using the OpenMP standard.
    * \note Compared to MovingLeastSquares, an overhead is incurred in terms of runtime and memory usage.
-   * \note The upsampling methods DISTINCT_CLOUD and VOXEL_GRID_DILATION are not parallelized completely, i.e. parts of the algorithm run on a single thread only.
+   * \note The voxel grid of VOXEL_GRID_DILATION is built, dilated and projected in parallel; the dilated voxels are
+   * projected in blocks so that the temporaries stay bounded for large dilation iteration numbers.
    * \author Robert Huitl
    * \ingroup surface
    */
@@ -46,6 +46,8 @@
 #include <pcl/common/eigen.h>
 #include <pcl/common/geometry.h>
 
+#include <algorithm>
+
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -102,8 +104,9 @@ pcl::MovingLeastSquares2<PointInT, PointOutT>::process (PointCloudOut &output)
     setSearchMethod (tree);
   }
 
-  // Send the surface dataset to the spatial locator
-  tree_->setInputCloud (input_);
+  // Send the surface dataset to the spatial locator, a tree already built on input_ is reused
+  if (tree_->getInputCloud () != input_)
+    tree_->setInputCloud (input_);
 
   switch (upsample_method_)
   {
@@ -777,11 +780,11 @@ pcl::MovingLeastSquares2<PointInT, PointOutT>::performUpsampling (PointCloudOut
     for (int iteration = 0; iteration < dilation_iteration_num_; ++iteration)
       voxel_grid.dilate ();
 
-    for (typename MLSVoxelGrid::HashMap::iterator m_it = voxel_grid.voxel_grid_.begin (); m_it != voxel_grid.voxel_grid_.end (); ++m_it)
+    for (size_t vg_i = 0; vg_i < voxel_grid.voxel_grid_.size (); ++vg_i)
     {
       // Get 3D position of point
       Eigen::Vector3f pos;
-      voxel_grid.getPosition (m_it->first, pos);
+      voxel_grid.getPosition (voxel_grid.voxel_grid_[vg_i], pos);
 
       PointInT p;
       p.x = pos[0];
@@ -837,9 +840,11 @@ pcl::MovingLeastSquaresOMP2<PointInT, PointOutT>::performUpsampling (PointCloudO
   
   if (upsample_method_ == DISTINCT_CLOUD)
   {
-    output.resize(distinct_cloud_->size());
-    corresponding_input_indices_->indices.resize(distinct_cloud_->size());
-    normals_->resize(distinct_cloud_->size());
+    size_t output_size = output.size ();
+    output.resize (output_size + distinct_cloud_->size ());
+    corresponding_input_indices_->indices.resize (output_size + distinct_cloud_->size (), -1);
+    if (compute_normals_)
+      normals_->resize (output_size + distinct_cloud_->size ());
 
     #pragma omp parallel for schedule (dynamic,1000) num_threads (threads)
     for (int dp_i = 0; dp_i < distinct_cloud_->size (); ++dp_i) // dp_i = distinct_point_i
@@ -850,8 +855,8 @@ pcl::MovingLeastSquaresOMP2<PointInT, PointOutT>::performUpsampling (PointCloudO
 
       // Get 3D position of point
       //Eigen::Vector3f pos = distinct_cloud_->points[dp_i].getVector3fMap ();
-      std::vector<int> nn_indices;
-      std::vector<float> nn_dists;
+      std::vector<int> nn_indices (1);
+      std::vector<float> nn_dists (1);
       tree_->nearestKSearch (distinct_cloud_->points[dp_i], 1, nn_indices, nn_dists);
       int input_index = nn_indices.front ();
 
@@ -890,94 +895,120 @@ pcl::MovingLeastSquaresOMP2<PointInT, PointOutT>::performUpsampling (PointCloudO
 
     // Store the id of the original point
     //corresponding_input_indices_->indices.push_back (input_index);
-    corresponding_input_indices_->indices[dp_i] = input_index;
+    corresponding_input_indices_->indices[output_size + dp_i] = input_index;
 
     //output.push_back (result_point);
-    output[dp_i] = result_point;
+    output[output_size + dp_i] = result_point;
 
     if (compute_normals_)
       //normals_->push_back (result_normal);
-      (*normals_)[dp_i] = result_normal;
+      (*normals_)[output_size + dp_i] = result_normal;
     }
+
+    // Drop the slots of the skipped nan points, keeping the order of the distinct cloud
+    size_t valid_size = output_size;
+    for (size_t i = output_size; i < output.size (); ++i)
+    {
+      if (corresponding_input_indices_->indices[i] < 0)
+        continue;
+      output[valid_size] = output[i];
+      corresponding_input_indices_->indices[valid_size] = corresponding_input_indices_->indices[i];
+      if (compute_normals_)
+        (*normals_)[valid_size] = (*normals_)[i];
+      ++valid_size;
+    }
+    output.resize (valid_size);
+    corresponding_input_indices_->indices.resize (valid_size);
+    if (compute_normals_)
+      normals_->resize (valid_size);
   }
 
   // For the voxel grid upsampling method, generate the voxel grid and dilate it
   // Then, project the newly obtained points to the MLS surface
   if(upsample_method_ == VOXEL_GRID_DILATION)
   {
-    MLSVoxelGrid voxel_grid(input_, indices_, voxel_size_);
+    MLSVoxelGrid voxel_grid (input_, indices_, voxel_size_, threads);
     
     for (int iteration = 0; iteration < dilation_iteration_num_; ++iteration)
       voxel_grid.dilate ();
 
-    std::vector<uint64_t> index_vector;
-    for (typename MLSVoxelGrid::HashMap::iterator m_it = voxel_grid.voxel_grid_.begin (); m_it != voxel_grid.voxel_grid_.end (); ++m_it)
-      index_vector.push_back(m_it->first);
-
-    // Create temporaries for each thread in order to avoid synchronization
-    typename PointCloudOut::CloudVectorType temp_output (threads);
-    typename NormalCloud::CloudVectorType temp_normals (threads);
-    std::vector<PointIndices> corresponding_input_indices (threads);
+    // Project the voxels block by block, every block is written into fixed slots and compacted
+    // in voxel order, so the temporaries never exceed one block
+    const int block_size = 1 << 20;
+    const int voxel_number = static_cast<int> (voxel_grid.voxel_grid_.size ());
+    PointCloudOut block_output;
+    NormalCloud block_normals;
+    std::vector<int> block_indices;
 
-    #pragma omp parallel for schedule (dynamic,1000) num_threads (threads)
-    for (int vg_i = 0 ; vg_i < index_vector.size(); ++vg_i)
+    for (int block_begin = 0; block_begin < voxel_number; block_begin += block_size)
     {
-      int tn = omp_get_thread_num (); 
-
-      // Get 3D position of point
-      Eigen::Vector3f pos;
-      voxel_grid.getPosition (index_vector[vg_i], pos);
-
-      PointInT p;
-      p.x = pos[0];
-      p.y = pos[1];
-      p.z = pos[2];
-
-      std::vector<int> nn_indices;
-      std::vector<float> nn_dists;
-      tree_->nearestKSearch (p, 1, nn_indices, nn_dists);
-      int input_index = nn_indices.front ();
-
-      // If the closest point did not have a valid MLS fitting result
-      // OR if it is too far away from the sampled point
-      if (mls_results_[input_index].valid == false)
-        continue;
+      const int block_end = (std::min) (voxel_number, block_begin + block_size);
+      block_output.resize (block_end - block_begin);
+      if (compute_normals_)
+        block_normals.resize (block_end - block_begin);
+      block_indices.assign (block_end - block_begin, -1);
 
-      Eigen::Vector3d add_point = p.getVector3fMap ().template cast<double> ();
-      float u_disp = static_cast<float> ((add_point - mls_results_[input_index].mean).dot (mls_results_[input_index].u_axis)),
-            v_disp = static_cast<float> ((add_point - mls_results_[input_index].mean).dot (mls_results_[input_index].v_axis));
+      #pragma omp parallel num_threads (threads)
+      {
+        std::vector<int> nn_indices (1);
+        std::vector<float> nn_dists (1);
 
-      PointOutT result_point;
-      pcl::Normal result_normal;
-      projectPointToMLSSurface (u_disp, v_disp,
-                                mls_results_[input_index].u_axis, mls_results_[input_index].v_axis,
-                                mls_results_[input_index].plane_normal,
-                                mls_results_[input_index].mean,
-                                mls_results_[input_index].curvature,
-                                mls_results_[input_index].c_vec,
-                                mls_results_[input_index].num_neighbors,
-                                result_point, result_normal);
+        #pragma omp for schedule (dynamic,1000)
+        for (int vg_i = block_begin; vg_i < block_end; ++vg_i)
+        {
+          // Get 3D position of point
+          Eigen::Vector3f pos;
+          voxel_grid.getPosition (voxel_grid.voxel_grid_[vg_i], pos);
 
-      // Copy additional point information if available
-      copyMissingFields (input_->points[input_index], result_point);
+          PointInT p;
+          p.x = pos[0];
+          p.y = pos[1];
+          p.z = pos[2];
 
-      // Store the id of the original point
-      corresponding_input_indices[tn].indices.push_back (input_index);
+          tree_->nearestKSearch (p, 1, nn_indices, nn_dists);
+          int input_index = nn_indices.front ();
 
-      temp_output[tn].push_back (result_point);
+          // If the closest point did not have a valid MLS fitting result
+          // OR if it is too far away from the sampled point
+          if (mls_results_[input_index].valid == false)
+            continue;
 
-      if (compute_normals_)
-        temp_normals[tn].push_back (result_normal);
-    }
+          Eigen::Vector3d add_point = p.getVector3fMap ().template cast<double> ();
+          float u_disp = static_cast<float> ((add_point - mls_results_[input_index].mean).dot (mls_results_[input_index].u_axis)),
+                v_disp = static_cast<float> ((add_point - mls_results_[input_index].mean).dot (mls_results_[input_index].v_axis));
+
+          PointOutT result_point;
+          pcl::Normal result_normal;
+          projectPointToMLSSurface (u_disp, v_disp,
+                                    mls_results_[input_index].u_axis, mls_results_[input_index].v_axis,
+                                    mls_results_[input_index].plane_normal,
+                                    mls_results_[input_index].mean,
+                                    mls_results_[input_index].curvature,
+                                    mls_results_[input_index].c_vec,
+                                    mls_results_[input_index].num_neighbors,
+                                    result_point, result_normal);
+
+          // Copy additional point information if available
+          copyMissingFields (input_->points[input_index], result_point);
+
+          // Store the id of the original point
+          block_indices[vg_i - block_begin] = input_index;
+          block_output[vg_i - block_begin] = result_point;
+          if (compute_normals_)
+            block_normals[vg_i - block_begin] = result_normal;
+        }
+      }
 
-    // Combine all threads' results into the output vectors
-    for (unsigned int tn = 0; tn < threads; ++tn)
-    {
-      output.insert (output.end (), temp_output[tn].begin (), temp_output[tn].end ());
-      corresponding_input_indices_->indices.insert (corresponding_input_indices_->indices.end (),
-          corresponding_input_indices[tn].indices.begin (), corresponding_input_indices[tn].indices.end ());
-      if (compute_normals_)
-        normals_->insert (normals_->end (), temp_normals[tn].begin (), temp_normals[tn].end ());
+      // Append the projected voxels of this block to the output vectors
+      for (int i = 0; i < block_end - block_begin; ++i)
+      {
+        if (block_indices[i] < 0)
+          continue;
+        output.push_back (block_output[i]);
+        corresponding_input_indices_->indices.push_back (block_indices[i]);
+        if (compute_normals_)
+          normals_->push_back (block_normals[i]);
+      }
     }
   }
 }
@@ -1001,8 +1032,10 @@ pcl::MovingLeastSquares2<PointInT, PointOutT>::MLSResult::MLSResult (const Eigen
 template <typename PointInT, typename PointOutT>
 pcl::MovingLeastSquares2<PointInT, PointOutT>::MLSVoxelGrid::MLSVoxelGrid (PointCloudInConstPtr& cloud,
     IndicesPtr &indices,
-    float voxel_size) :
-    voxel_grid_ (), bounding_min_ (), bounding_max_ (), data_size_ (), voxel_size_ (voxel_size)
+    float voxel_size,
+    unsigned int threads) :
+    voxel_grid_ (), frontier_ (), bounding_min_ (), bounding_max_ (), data_size_ (), voxel_size_ (voxel_size),
+    threads_ (threads == 0 ? 1 : threads)
 {
   pcl::getMinMax3D (*cloud, *indices, bounding_min_, bounding_max_);
 
@@ -1010,57 +1043,124 @@ pcl::MovingLeastSquares2<PointInT, PointOutT>::MLSVoxelGrid::MLSVoxelGrid (Point
   double max_size = (std::max) ((std::max)(bounding_box_size.x (), bounding_box_size.y ()), bounding_box_size.z ());
   // Put initial cloud in voxel grid
   data_size_ = static_cast<uint64_t> (1.5 * max_size / voxel_size_);
-  for (unsigned int i = 0; i < indices->size (); ++i)
+
+  std::vector<uint64_t> keys (indices->size ());
+  std::vector<char> valid (indices->size (), 0);
+  #pragma omp parallel for schedule (static) num_threads (threads_)
+  for (int i = 0; i < static_cast<int> (indices->size ()); ++i)
     if (pcl_isfinite (cloud->points[(*indices)[i]].x))
     {
       Eigen::Vector3i pos;
       getCellIndex (cloud->points[(*indices)[i]].getVector3fMap (), pos);
+      getIndexIn1D (pos, keys[i]);
+      valid[i] = 1;
+    }
+
+  size_t valid_size = 0;
+  for (size_t i = 0; i < keys.size (); ++i)
+    if (valid[i])
+      keys[valid_size++] = keys[i];
+  keys.resize (valid_size);
+
+  sortUnique (keys);
+  voxel_grid_ = keys;
+  frontier_.swap (keys);
+}
 
-      uint64_t index_1d;
-      getIndexIn1D (pos, index_1d);
-      Leaf leaf;
-      voxel_grid_[index_1d] = leaf;
+//////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointInT, typename PointOutT> void
+pcl::MovingLeastSquares2<PointInT, PointOutT>::MLSVoxelGrid::sortUnique (std::vector<uint64_t> &keys) const
+{
+  const int size = static_cast<int> (keys.size ());
+  const int chunks = (std::min) (static_cast<int> (threads_), (std::max) (1, size / 65536));
+  std::vector<int> bounds (chunks + 1);
+  for (int c = 0; c <= chunks; ++c)
+    bounds[c] = static_cast<int> (static_cast<double> (size) * c / chunks);
+
+  #pragma omp parallel for schedule (static) num_threads (chunks)
+  for (int c = 0; c < chunks; ++c)
+    std::sort (keys.begin () + bounds[c], keys.begin () + bounds[c + 1]);
+
+  // Pairwise merges, the merges of one round are independent of each other
+  for (int width = 1; width < chunks; width *= 2)
+  {
+    #pragma omp parallel for schedule (static) num_threads (chunks)
+    for (int c = 0; c < chunks - width; c += 2 * width)
+    {
+      int last = (std::min) (c + 2 * width, chunks);
+      std::inplace_merge (keys.begin () + bounds[c], keys.begin () + bounds[c + width], keys.begin () + bounds[last]);
     }
+  }
+
+  keys.erase (std::unique (keys.begin (), keys.end ()), keys.end ());
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 template <typename PointInT, typename PointOutT> void
 pcl::MovingLeastSquares2<PointInT, PointOutT>::MLSVoxelGrid::dilate ()
 {
-  HashMap new_voxel_grid = voxel_grid_;
-  for (typename MLSVoxelGrid::HashMap::iterator m_it = voxel_grid_.begin (); m_it != voxel_grid_.end (); ++m_it)
+  // Interior voxels only have occupied neighbours, so only the last shell can grow the grid.
+  // The shell is expanded in chunks to bound the candidate buffers.
+  const int chunk_size = 65536 * static_cast<int> (threads_);
+  const int frontier_size = static_cast<int> (frontier_.size ());
+  std::vector<uint64_t> added;
+  std::vector<std::vector<uint64_t> > candidates (threads_);
+
+  for (int chunk_begin = 0; chunk_begin < frontier_size; chunk_begin += chunk_size)
   {
-    Eigen::Vector3i index;
-    getIndexIn3D (m_it->first, index);
-
-    // Now dilate all of its voxels
-    for (int x = -1; x <= 1; ++x)
-      for (int y = -1; y <= 1; ++y)
-        for (int z = -1; z <= 1; ++z)
-          if (x != 0 || y != 0 || z != 0)
-          {
-			  Eigen::Vector3i new_index;
-			  new_index = index + Eigen::Vector3i (x, y, z);
+    const int chunk_end = (std::min) (frontier_size, chunk_begin + chunk_size);
 
-			  if ( new_index.x() >=0 && new_index.x() < data_size_ &&  
-				  new_index.y() >=0 && new_index.y() < data_size_ &&  
-				  new_index.z() >=0 && new_index.z() < data_size_   )
-			  {
-				  uint64_t index_1d;
-				  getIndexIn1D (new_index, index_1d);
-				  Leaf leaf;
-				  new_voxel_grid[index_1d] = leaf;
-			  }
-            //Eigen::Vector3i new_index;
-            //new_index = index + Eigen::Vector3i (x, y, z);
+    #pragma omp parallel num_threads (threads_)
+    {
+#ifdef _OPENMP
+      int tn = omp_get_thread_num ();
+#else
+      int tn = 0;
+#endif
+      std::vector<uint64_t> &thread_candidates = candidates[tn];
+      thread_candidates.clear ();
 
-            //uint64_t index_1d;
-            //getIndexIn1D (new_index, index_1d);
-            //Leaf leaf;
-            //new_voxel_grid[index_1d] = leaf;
-          }
+      #pragma omp for schedule (static)
+      for (int i = chunk_begin; i < chunk_end; ++i)
+      {
+        Eigen::Vector3i index;
+        getIndexIn3D (frontier_[i], index);
+
+        // Now dilate all of its voxels
+        for (int x = -1; x <= 1; ++x)
+          for (int y = -1; y <= 1; ++y)
+            for (int z = -1; z <= 1; ++z)
+              if (x != 0 || y != 0 || z != 0)
+              {
+                Eigen::Vector3i new_index;
+                new_index = index + Eigen::Vector3i (x, y, z);
+
+                if ( new_index.x() >=0 && new_index.x() < data_size_ &&  
+                  new_index.y() >=0 && new_index.y() < data_size_ &&  
+                  new_index.z() >=0 && new_index.z() < data_size_   )
+                {
+                  uint64_t index_1d;
+                  getIndexIn1D (new_index, index_1d);
+                  if (!std::binary_search (voxel_grid_.begin (), voxel_grid_.end (), index_1d))
+                    thread_candidates.push_back (index_1d);
+                }
+              }
+      }
+
+      std::sort (thread_candidates.begin (), thread_candidates.end ());
+      thread_candidates.erase (std::unique (thread_candidates.begin (), thread_candidates.end ()), thread_candidates.end ());
+    }
+
+    for (unsigned int tn = 0; tn < threads_; ++tn)
+      added.insert (added.end (), candidates[tn].begin (), candidates[tn].end ());
   }
-  voxel_grid_ = new_voxel_grid;
+
+  sortUnique (added);
+
+  size_t old_size = voxel_grid_.size ();
+  voxel_grid_.insert (voxel_grid_.end (), added.begin (), added.end ());
+  std::inplace_merge (voxel_grid_.begin (), voxel_grid_.begin () + old_size, voxel_grid_.end ());
+  frontier_.swap (added);
 }
 
 
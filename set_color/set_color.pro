@@ -38,8 +38,12 @@ unix{
 }
 
 HEADERS += set_color.h \
-			../Tang2014/scan.h
+			../Tang2014/scan.h \
+			../include/mortonorder.h \
+			../include/bulktransform.h
 
 SOURCES += main.cpp \
 			set_color.cpp \
-			../Tang2014/scan.cpp 
+			../Tang2014/scan.cpp \
+			../src/mortonorder.cpp \
+			../src/bulktransform.cpp
@@ -1,5 +1,6 @@
 #include <QtCore/QDebug>
 //#include "../include/qtbase.h"
+#include <omp.h>
 
 #define PCL_NO_PRECOMPILE
 #include <pcl/features/boundary.h>
@@ -14,6 +15,12 @@ BoundaryEstimation::BoundaryEstimation(){}
 BoundaryEstimation::~BoundaryEstimation(){}
 
 void BoundaryEstimation::filter(CloudDataConstPtr cloudData, QVariantMap parameters, BoundariesPtr &boundaries, CloudDataPtr &cloudData_inliers, CloudDataPtr &cloudData_outliers)
+{
+	filter(cloudData, parameters, KdTreePtr(), NeighbourTableConstPtr(), boundaries, cloudData_inliers, cloudData_outliers);
+}
+
+void BoundaryEstimation::filter(CloudDataConstPtr cloudData, QVariantMap parameters, KdTreePtr tree, NeighbourTableConstPtr neighbourTable, 
+	BoundariesPtr &boundaries, CloudDataPtr &cloudData_inliers, CloudDataPtr &cloudData_outliers)
 {
 	float searchRadius = parameters["searchRadius"].toFloat(); 
 	float angleThreshold = parameters["angleThreshold"].toFloat();
@@ -25,15 +32,56 @@ void BoundaryEstimation::filter(CloudDataConstPtr cloudData, QVariantMap paramet
 
 	qDebug() << "Cloud Size Before : " << cloudData->size();
 
-	pcl::BoundaryEstimation<PointType, PointType, pcl::Boundary> be;
-	be.setInputCloud(cloudData);
-	be.setInputNormals(cloudData);
-	be.setRadiusSearch(searchRadius);
-	pcl::search::KdTree<PointType>::Ptr tree (new pcl::search::KdTree<PointType>);
-	be.setSearchMethod(tree);
-	be.setAngleThreshold(angleThreshold/180.0f*M_PI);
+	if (!tree || tree->getInputCloud() != cloudData)
+	{
+		tree.reset(new KdTree);
+		tree->setInputCloud(cloudData);
+	}
+
+	bool use_table = neighbourTable && neighbourTable->covers(cloudData, 1);
+	if (use_table) qDebug() << "Reuse Neighbour Table : K = " << neighbourTable->getK();
+
+	int size = static_cast<int>(cloudData->size());
 	boundaries.reset(new Boundaries);
-	be.compute(*boundaries);
+	boundaries->resize(size);
+	boundaries->header = cloudData->header;
+	boundaries->width = cloudData->width;
+	boundaries->height = cloudData->height;
+
+	// per point the same test as pcl::BoundaryEstimation::computeFeature
+	float searchRadius2 = searchRadius * searchRadius;
+	float angle = angleThreshold / 180.0f * M_PI;
+	int threads = omp_get_num_procs();
+	#pragma omp parallel num_threads (threads)
+	{
+		pcl::BoundaryEstimation<PointType, PointType, pcl::Boundary> be;
+		std::vector<int> indices;
+		std::vector<float> sqr_distances;
+
+		#pragma omp for schedule (dynamic,1000)
+		for (int i = 0; i < size; ++i)
+		{
+			const PointType &point = (*cloudData)[i];
+			(*boundaries)[i].boundary_point = 0;
+			if ( !pcl_isfinite(point.x) || !pcl_isfinite(point.y) || !pcl_isfinite(point.z) ) continue;
+			if ( !pcl_isfinite(point.normal_x) || !pcl_isfinite(point.normal_y) || !pcl_isfinite(point.normal_z) ) continue;
+
+			if (use_table && neighbourTable->coversRadius(i, searchRadius))
+			{
+				int n = neighbourTable->getNeighbourNumber(i);
+				const int *row_indices = neighbourTable->getIndices(i);
+				const float *row_sqrDistances = neighbourTable->getSqrDistances(i);
+				indices.resize(1);
+				indices[0] = i;
+				for (int j = 0; j < n && row_sqrDistances[j] <= searchRadius2; ++j) indices.push_back(row_indices[j]);
+			}
+			else if (tree->radiusSearch(point, searchRadius, indices, sqr_distances) == 0) continue;
+
+			Eigen::Vector4f u = Eigen::Vector4f::Zero(), v = Eigen::Vector4f::Zero();
+			be.getCoordinateSystemOnPlane(point, u, v);
+			(*boundaries)[i].boundary_point = be.isBoundaryPoint(*cloudData, point, indices, u, v, angle);
+		}
+	}
 
 	for(int i = 0; i < (*boundaries).size(); ++i)
 	{
@@ -0,0 +1,53 @@
+#include <omp.h>
+#include <algorithm>
+
+#include "../include/bulktransform.h"
+
+using namespace registar;
+
+namespace
+{
+	// columns of xyz triplets handed to one Eigen product at a time
+	const int positionBlockSize = 1024;
+}
+
+void registar::transformCloudWithNormals(const CloudData &in, CloudData &out, const Eigen::Matrix4f &transformation)
+{
+	if (&in != &out)
+	{
+		out.header = in.header;
+		out.width = in.width;
+		out.height = in.height;
+		out.is_dense = in.is_dense;
+		out.sensor_origin_ = in.sensor_origin_;
+		out.sensor_orientation_ = in.sensor_orientation_;
+		out.points.resize(in.points.size());
+	}
+
+	PointTransformer transformer(transformation);
+	int size = static_cast<int>(in.points.size());
+	int threads = omp_get_num_procs();
+	#pragma omp parallel for schedule (dynamic,1000) num_threads (threads) if (size >= transformParallelSize)
+	for (int i = 0; i < size; ++i)
+	{
+		transformer.transform(in.points[i], out.points[i]);
+	}
+}
+
+void registar::transformPositions(float *positions, int number, const Eigen::Matrix4f &transformation)
+{
+	Eigen::Matrix3f R = transformation.block<3, 3>(0, 0);
+	Eigen::Vector3f t = transformation.block<3, 1>(0, 3);
+	int blocks = (number + positionBlockSize - 1) / positionBlockSize;
+	int threads = omp_get_num_procs();
+	#pragma omp parallel for schedule (dynamic,1) num_threads (threads) if (number >= transformParallelSize)
+	for (int b = 0; b < blocks; ++b)
+	{
+		int begin = b * positionBlockSize;
+		int n = std::min(positionBlockSize, number - begin);
+		Eigen::Map<Eigen::Matrix3Xf> block(positions + 3 * begin, 3, n);
+		Eigen::Matrix3Xf rotated(3, n);
+		rotated.noalias() = R * block;
+		block = rotated.colwise() + t;
+	}
+}
@@ -1,4 +1,5 @@
 #include "../include/cloud.h"
+#include "../include/mortonorder.h"
 
 using namespace registar;
 
@@ -12,14 +13,20 @@ Cloud::Cloud(CloudDataPtr cloudData, const Polygons &polygons, const FromWhere &
 	this->fileName = fileName;
 	this->transformation = transformation;
 	this->registrationTransformation = transformation;
+	this->scannerPose = Eigen::Matrix4f::Identity();
 	this->setObjectName(cloudName);
+	this->cloudDataVersion = 0;
 }
 
 Cloud::~Cloud(){}
 
-void Cloud::setCloudData(CloudDataPtr cloudData)
+void Cloud::setCloudData(CloudDataPtr cloudData, bool keepsOrder)
 {
+	if (!keepsOrder || !cloudData || cloudData->size() != this->fileOrder.size()) this->fileOrder.clear();
 	this->cloudData = cloudData;
+	this->cloudDataVersion++;
+	this->kdTree.reset();
+	this->neighbourTable.reset();
 }
 
 CloudDataConstPtr Cloud::getCloudData()const
@@ -82,6 +89,16 @@ const Eigen::Matrix4f& Cloud::getRegistrationTransformation()const
 	return this->registrationTransformation;
 }
 
+void Cloud::setScannerPose(const Eigen::Matrix4f &scannerPose)
+{
+	this->scannerPose = scannerPose;
+}
+
+const Eigen::Matrix4f& Cloud::getScannerPose()const
+{
+	return this->scannerPose;
+}
+
 void Cloud::setBoundaries(BoundariesPtr boundaries)
 {
 	this->boundaries = boundaries;
@@ -105,4 +122,65 @@ void Cloud::setPolygons(const Polygons &polygons)
 const Polygons &Cloud::getPolygons()const
 {
 	return this->polygons;
-}
\ No newline at end of file
+}
+
+void Cloud::setFileOrder(const std::vector<int> &fileOrder)
+{
+	this->fileOrder = fileOrder;
+}
+
+const std::vector<int> &Cloud::getFileOrder()const
+{
+	return this->fileOrder;
+}
+
+void Cloud::getInFileOrder(CloudDataPtr &cloudData, Polygons &polygons, BoundariesPtr &boundaries)const
+{
+	if (this->fileOrder.empty() || !this->cloudData || this->cloudData->size() != this->fileOrder.size())
+	{
+		cloudData = this->cloudData;
+		polygons = this->polygons;
+		boundaries = this->boundaries;
+		return;
+	}
+
+	cloudData.reset(new CloudData);
+	restoreOrder(*this->cloudData, this->fileOrder, *cloudData);
+	restoreOrder(this->polygons, this->fileOrder, polygons);
+	boundaries = this->boundaries;
+	if (this->boundaries && this->boundaries->size() == this->fileOrder.size())
+	{
+		boundaries.reset(new Boundaries);
+		restoreOrder(*this->boundaries, this->fileOrder, *boundaries);
+	}
+}
+
+unsigned int Cloud::getCloudDataVersion()const
+{
+	return this->cloudDataVersion;
+}
+
+KdTreePtr Cloud::getKdTree()
+{
+	if (!this->kdTree && this->cloudData)
+	{
+		this->kdTree.reset(new KdTree);
+		this->kdTree->setInputCloud(this->cloudData);
+	}
+	return this->kdTree;
+}
+
+NeighbourTablePtr Cloud::getNeighbourTable(int K)
+{
+	if (this->cloudData && !(this->neighbourTable && this->neighbourTable->covers(this->cloudData, K)))
+	{
+		this->neighbourTable.reset(new NeighbourTable);
+		this->neighbourTable->build(this->cloudData, getKdTree(), K);
+	}
+	return this->neighbourTable;
+}
+
+NeighbourTablePtr Cloud::getNeighbourTable()
+{
+	return this->neighbourTable;
+}
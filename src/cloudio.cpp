@@ -9,6 +9,7 @@
 #include <pcl/filters/filter.h>
 
 #include "../include/cloudio.h"
+#include "../include/mortonorder.h"
 
 using namespace registar;
 
@@ -16,7 +17,7 @@ CloudIO::CloudIO(){}
 
 CloudIO::~CloudIO(){}
 
-bool CloudIO::importPLYCloudData(const QString &fileName, CloudDataPtr cloudData)
+bool CloudIO::importPLYCloudData(const QString &fileName, CloudDataPtr cloudData, std::vector<int> *order)
 {
 	pcl::PLYReader reader;
 	if (reader.read(fileName.toStdString(), *cloudData) == 0)
@@ -34,6 +35,16 @@ bool CloudIO::importPLYCloudData(const QString &fileName, CloudDataPtr cloudData
 
 		// std::vector<int> nanIndicesVector;
 		// pcl::removeNaNFromPointCloud( *cloudData, *cloudData, nanIndicesVector );
+
+		if (order)
+		{
+			order->clear();
+			if (!cloudData->isOrganized())
+			{
+				computeMortonOrder(*cloudData, *order);
+				applyOrder(*cloudData, *order);
+			}
+		}
 	}
 	else return false;
 
@@ -86,7 +97,7 @@ bool CloudIO::importTransformation(const QString &fileName, Eigen::Matrix4f &tra
 	return true;
 }
 
-bool CloudIO::importBoundaries(const QString &fileName, BoundariesPtr boundaries)
+bool CloudIO::importBoundaries(const QString &fileName, BoundariesPtr boundaries, const std::vector<int> *order)
 {
 	QFileInfo fileInfo(fileName);
 	QString bdFileName = fileInfo.path() + "/" + fileInfo.completeBaseName() + ".bd";
@@ -101,6 +112,17 @@ bool CloudIO::importBoundaries(const QString &fileName, BoundariesPtr boundaries
 	}
 
 	pcl::io::loadPCDFile(bdFileName.toStdString(), *boundaries);
+	if (order && !order->empty())
+	{
+		// the points are reordered already, boundaries that cannot follow them would index the wrong points
+		if (boundaries->size() != order->size())
+		{
+			qDebug() << "Boundaries do not match the points, not imported!";
+			boundaries->clear();
+			return false;
+		}
+		applyOrder(*boundaries, *order);
+	}
 
 	return true;
 }
@@ -8,6 +8,7 @@
 #include "../include/cloud.h"
 #include "../include/cloudvisualizer.h"
 #include "../include/utilities.h"
+#include "../include/bulktransform.h"
 
 using namespace registar;
 
@@ -48,8 +49,8 @@ bool CloudVisualizer::addCloud(const Cloud* cloud)
 {
 	//CloudDataPtr cloudData = cloud->getCloudData();
 	CloudDataPtr cloudData(new CloudData);
-	if (registrationMode) pcl::transformPointCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getRegistrationTransformation());
-	else pcl::transformPointCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getTransformation());
+	if (registrationMode) transformCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getRegistrationTransformation());
+	else transformCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getTransformation());
 	QString cloudName = cloud->getCloudName();
 	Polygons polygons = cloud->getPolygons();
 	if (polygons.size() == 0) addCloud(cloudData, cloudName);
@@ -209,8 +210,8 @@ bool CloudVisualizer::removeShape(const QString &shapeName)
 bool CloudVisualizer::updateCloud(const Cloud* cloud)
 {
 	CloudDataPtr cloudData(new CloudData);
-	if (registrationMode) pcl::transformPointCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getRegistrationTransformation());
-	else pcl::transformPointCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getTransformation());
+	if (registrationMode) transformCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getRegistrationTransformation());
+	else transformCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getTransformation());
 	QString cloudName = cloud->getCloudName();
 	Polygons polygons = cloud->getPolygons();
 	if (polygons.size() == 0)
@@ -382,7 +383,7 @@ void CloudVisualizer::resetCamera(const Cloud* cloud)
 
 	// CloudDataPtr cloudData = cloud->getCloudData();
 	CloudDataPtr cloudData(new CloudData);
-	pcl::transformPointCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getTransformation());
+	transformCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getTransformation());
 	resetCamera(cloudData);
 }
 
@@ -0,0 +1,428 @@
+#include <omp.h>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <Eigen/StdVector>
+
+#define PCL_NO_PRECOMPILE
+#include <pcl/search/kdtree.h>
+
+#include "../include/coarsealignment.h"
+#include "../include/umeyama.h"
+
+using namespace registar;
+
+namespace
+{
+	typedef pcl::search::KdTree<Descriptor> DescriptorTree;
+
+	// bins of each of the three angle features of FPFH
+	const int binNumber = 11;
+	const int descriptorLength = 3 * binNumber;
+
+	// draws between two updates of the number of draws needed
+	const int ransacBatchSize = 256;
+
+	// bits of each voxel coordinate in the keys the points are sorted by
+	const int voxelKeyBits = 21;
+
+	inline bool finitePoint(const PointType &point)
+	{
+		return pcl_isfinite(point.x) && pcl_isfinite(point.y) && pcl_isfinite(point.z);
+	}
+
+	inline bool validPoint(const PointType &point)
+	{
+		if ( !finitePoint(point) ) return false;
+		if ( !pcl_isfinite(point.normal_x) || !pcl_isfinite(point.normal_y) || !pcl_isfinite(point.normal_z) ) return false;
+		return point.getNormalVector3fMap().squaredNorm() > 0.0f;
+	}
+
+	// splitmix64, the generator of each RANSAC draw starts from the seed and the draw number
+	inline unsigned long long mix(unsigned long long x)
+	{
+		x += 0x9E3779B97F4A7C15ULL;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		return x ^ (x >> 31);
+	}
+
+	// the point of each occupied voxel closest to the centroid of the voxel, in the order of the voxel keys
+	void voxelKeypoints(const CloudData &cloudData, float voxelSize, CloudData &keypoints)
+	{
+		int size = static_cast<int>(cloudData.size());
+		Eigen::Vector3f minimum = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+		for (int i = 0; i < size; ++i) if (validPoint(cloudData[i])) minimum = minimum.cwiseMin(cloudData[i].getVector3fMap());
+
+		const long long keyMask = (1LL << voxelKeyBits) - 1;
+		float inverseSize = voxelSize > 0.0f ? 1.0f / voxelSize : 0.0f;
+		std::vector<std::pair<long long, int> > keys(size);
+		int threads = omp_get_num_procs();
+		#pragma omp parallel for schedule (dynamic,1000) num_threads (threads)
+		for (int i = 0; i < size; ++i)
+		{
+			keys[i].second = i;
+			if (!validPoint(cloudData[i]))
+			{
+				keys[i].first = -1;
+				continue;
+			}
+			// without a voxel size every point is its own voxel
+			if (inverseSize == 0.0f)
+			{
+				keys[i].first = i;
+				continue;
+			}
+			Eigen::Vector3f cell = (cloudData[i].getVector3fMap() - minimum) * inverseSize;
+			long long x = std::min(keyMask, static_cast<long long>(cell.x()));
+			long long y = std::min(keyMask, static_cast<long long>(cell.y()));
+			long long z = std::min(keyMask, static_cast<long long>(cell.z()));
+			keys[i].first = (x << (2 * voxelKeyBits)) | (y << voxelKeyBits) | z;
+		}
+		std::sort(keys.begin(), keys.end());
+
+		std::vector<int> voxelStarts;
+		for (int i = 0; i < size; ++i)
+		{
+			if (keys[i].first >= 0 && (voxelStarts.empty() || keys[i].first != keys[i - 1].first)) voxelStarts.push_back(i);
+		}
+		int voxelNumber = static_cast<int>(voxelStarts.size());
+		voxelStarts.push_back(size);
+
+		keypoints.clear();
+		keypoints.resize(voxelNumber);
+		#pragma omp parallel for schedule (dynamic,1000) num_threads (threads)
+		for (int v = 0; v < voxelNumber; ++v)
+		{
+			Eigen::Vector3f centroid = Eigen::Vector3f::Zero();
+			for (int k = voxelStarts[v]; k < voxelStarts[v + 1]; ++k) centroid += cloudData[keys[k].second].getVector3fMap();
+			centroid /= static_cast<float>(voxelStarts[v + 1] - voxelStarts[v]);
+
+			int closest = keys[voxelStarts[v]].second;
+			float closestDistance2 = std::numeric_limits<float>::max();
+			for (int k = voxelStarts[v]; k < voxelStarts[v + 1]; ++k)
+			{
+				float distance2 = (cloudData[keys[k].second].getVector3fMap() - centroid).squaredNorm();
+				if (distance2 < closestDistance2)
+				{
+					closestDistance2 = distance2;
+					closest = keys[k].second;
+				}
+			}
+			keypoints[v] = cloudData[closest];
+		}
+	}
+
+	// the angle features of PFH between two oriented points, measured in the Darboux frame of the point whose normal
+	// is closer to the line joining them; false when the points coincide or the frame is undefined
+	bool pairFeatures(const PointType &point1, const PointType &point2, float &theta, float &alpha, float &phi)
+	{
+		Eigen::Vector3f p1 = point1.getVector3fMap();
+		Eigen::Vector3f n1 = point1.getNormalVector3fMap().normalized();
+		Eigen::Vector3f p2 = point2.getVector3fMap();
+		Eigen::Vector3f n2 = point2.getNormalVector3fMap().normalized();
+
+		Eigen::Vector3f d = p2 - p1;
+		float distance = d.norm();
+		if (distance == 0.0f) return false;
+		d /= distance;
+
+		float angle1 = n1.dot(d);
+		float angle2 = n2.dot(d);
+		if (std::abs(angle1) < std::abs(angle2))
+		{
+			std::swap(n1, n2);
+			d = -d;
+			phi = -angle2;
+		}
+		else phi = angle1;
+
+		Eigen::Vector3f v = d.cross(n1);
+		float vNorm = v.norm();
+		if (vNorm == 0.0f) return false;
+		v /= vNorm;
+		Eigen::Vector3f w = n1.cross(v);
+
+		alpha = v.dot(n2);
+		theta = std::atan2(w.dot(n2), n1.dot(n2));
+		return true;
+	}
+
+	inline int featureBin(float value, float lower, float upper)
+	{
+		int bin = static_cast<int>(binNumber * (value - lower) / (upper - lower));
+		return std::max(0, std::min(binNumber - 1, bin));
+	}
+
+	// matches within inlierDistance2 once the source is transformed, and their positions if asked for
+	int countInliers(const Eigen::Matrix4f &transformation, const std::vector<float> &sources, const std::vector<float> &targets,
+		float inlierDistance2, std::vector<float> *inlierSources = NULL, std::vector<float> *inlierTargets = NULL)
+	{
+		Eigen::Matrix3f R = transformation.block<3, 3>(0, 0);
+		Eigen::Vector3f t = transformation.block<3, 1>(0, 3);
+		int number = static_cast<int>(sources.size() / 3);
+		int inliers = 0;
+		for (int i = 0; i < number; ++i)
+		{
+			Eigen::Map<const Eigen::Vector3f> source(&sources[3 * i]);
+			Eigen::Map<const Eigen::Vector3f> target(&targets[3 * i]);
+			if ((R * source + t - target).squaredNorm() > inlierDistance2) continue;
+			++inliers;
+			if (inlierSources) inlierSources->insert(inlierSources->end(), &sources[3 * i], &sources[3 * i] + 3);
+			if (inlierTargets) inlierTargets->insert(inlierTargets->end(), &targets[3 * i], &targets[3 * i] + 3);
+		}
+		return inliers;
+	}
+
+	// whether the two triangles of the sample have each pair of matching edges within the length ratio
+	bool similarTriangles(const std::vector<float> &sources, const std::vector<float> &targets, const int *sample, float similarity)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			int a = sample[k], b = sample[(k + 1) % 3];
+			float sourceLength = (Eigen::Map<const Eigen::Vector3f>(&sources[3 * a]) - Eigen::Map<const Eigen::Vector3f>(&sources[3 * b])).norm();
+			float targetLength = (Eigen::Map<const Eigen::Vector3f>(&targets[3 * a]) - Eigen::Map<const Eigen::Vector3f>(&targets[3 * b])).norm();
+			if (sourceLength < similarity * targetLength || targetLength < similarity * sourceLength) return false;
+		}
+		return true;
+	}
+
+	void nearestDescriptors(const Descriptors &queries, const DescriptorTree &tree, std::vector<int> &nearest, int threads)
+	{
+		int size = static_cast<int>(queries.size());
+		nearest.resize(size);
+		#pragma omp parallel num_threads (threads)
+		{
+			std::vector<int> indices(1);
+			std::vector<float> distance2s(1);
+
+			#pragma omp for schedule (dynamic,100)
+			for (int i = 0; i < size; ++i)
+			{
+				nearest[i] = tree.nearestKSearch(queries[i], 1, indices, distance2s) > 0 ? indices[0] : -1;
+			}
+		}
+	}
+}
+
+CoarseAlignmentParameters registar::defaultCoarseAlignmentParameters(float voxelSize)
+{
+	CoarseAlignmentParameters parameters;
+	parameters.voxelSize = voxelSize;
+	parameters.featureRadius = 5.0f * voxelSize;
+	parameters.inlierDistance = 1.5f * voxelSize;
+	parameters.edgeSimilarity = 0.9f;
+	parameters.confidence = 0.999f;
+	parameters.maxIterations = 100000;
+	parameters.seed = 0;
+	return parameters;
+}
+
+float registar::estimateCoarseVoxelSize(const CloudData &cloudData)
+{
+	Eigen::Vector3f minimum = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+	Eigen::Vector3f maximum = Eigen::Vector3f::Constant(-std::numeric_limits<float>::max());
+	for (int i = 0; i < cloudData.size(); ++i)
+	{
+		if (!validPoint(cloudData[i])) continue;
+		minimum = minimum.cwiseMin(cloudData[i].getVector3fMap());
+		maximum = maximum.cwiseMax(cloudData[i].getVector3fMap());
+	}
+	if (!(minimum.x() <= maximum.x())) return 0.0f;
+	return (maximum - minimum).norm() / 200.0f;
+}
+
+CoarseAlignmentFeatures::CoarseAlignmentFeatures() : keypoints(new CloudData), descriptors(new Descriptors), unorientedPoints(0) {}
+
+void CoarseAlignmentFeatures::compute(const CloudData &cloudData, const CoarseAlignmentParameters &parameters)
+{
+	unorientedPoints = 0;
+	for (int i = 0; i < cloudData.size(); ++i) if (finitePoint(cloudData[i]) && !validPoint(cloudData[i])) ++unorientedPoints;
+	keypoints.reset(new CloudData);
+	voxelKeypoints(cloudData, parameters.voxelSize, *keypoints);
+	int size = static_cast<int>(keypoints->size());
+	descriptors.reset(new Descriptors);
+	descriptors->resize(size);
+	if (size == 0) return;
+
+	KdTreePtr tree(new KdTree);
+	tree->setInputCloud(keypoints);
+
+	// the simplified histogram of every keypoint over its own neighbours first, in percent of the pairs, then the
+	// FPFH adds those of the neighbours weighted by their inverse distance
+	std::vector<float> histograms(size * descriptorLength, 0.0f);
+	int threads = omp_get_num_procs();
+	#pragma omp parallel num_threads (threads)
+	{
+		std::vector<int> indices;
+		std::vector<float> distance2s;
+
+		#pragma omp for schedule (dynamic,100)
+		for (int i = 0; i < size; ++i)
+		{
+			const PointType &point = (*keypoints)[i];
+			tree->radiusSearch(point, parameters.featureRadius, indices, distance2s);
+			float *histogram = &histograms[i * descriptorLength];
+			int pairs = 0;
+			for (int j = 0; j < indices.size(); ++j)
+			{
+				float theta, alpha, phi;
+				if (indices[j] == i || !pairFeatures(point, (*keypoints)[indices[j]], theta, alpha, phi)) continue;
+				++histogram[featureBin(theta, -static_cast<float>(M_PI), static_cast<float>(M_PI))];
+				++histogram[binNumber + featureBin(alpha, -1.0f, 1.0f)];
+				++histogram[2 * binNumber + featureBin(phi, -1.0f, 1.0f)];
+				++pairs;
+			}
+			if (pairs > 0) for (int b = 0; b < descriptorLength; ++b) histogram[b] *= 100.0f / pairs;
+		}
+
+		#pragma omp for schedule (dynamic,100)
+		for (int i = 0; i < size; ++i)
+		{
+			tree->radiusSearch((*keypoints)[i], parameters.featureRadius, indices, distance2s);
+			float *descriptor = (*descriptors)[i].histogram;
+			std::fill(descriptor, descriptor + descriptorLength, 0.0f);
+			for (int j = 0; j < indices.size(); ++j)
+			{
+				if (indices[j] == i || distance2s[j] <= 0.0f) continue;
+				float weight = 1.0f / std::sqrt(distance2s[j]);
+				const float *neighbour = &histograms[indices[j] * descriptorLength];
+				for (int b = 0; b < descriptorLength; ++b) descriptor[b] += weight * neighbour[b];
+			}
+			for (int f = 0; f < 3; ++f)
+			{
+				float sum = 0.0f;
+				for (int b = f * binNumber; b < (f + 1) * binNumber; ++b) sum += descriptor[b];
+				if (sum > 0.0f) for (int b = f * binNumber; b < (f + 1) * binNumber; ++b) descriptor[b] *= 100.0f / sum;
+			}
+			const float *histogram = &histograms[i * descriptorLength];
+			for (int b = 0; b < descriptorLength; ++b) descriptor[b] += histogram[b];
+		}
+	}
+}
+
+CoarseAlignmentResult registar::coarseAlign(const CoarseAlignmentFeatures &target, const CoarseAlignmentFeatures &source,
+	const CoarseAlignmentParameters &parameters, const Eigen::Matrix4f &guess)
+{
+	CoarseAlignmentResult result;
+	result.transformation = guess;
+	result.matches = 0;
+	result.inliers = 0;
+	result.iterations = 0;
+	result.aligned = false;
+	if (target.size() < 3 || source.size() < 3) return result;
+
+	int threads = omp_get_num_procs();
+	DescriptorTree targetTree, sourceTree;
+	targetTree.setInputCloud(target.descriptors);
+	sourceTree.setInputCloud(source.descriptors);
+	std::vector<int> sourceToTarget, targetToSource;
+	nearestDescriptors(*source.descriptors, targetTree, sourceToTarget, threads);
+	nearestDescriptors(*target.descriptors, sourceTree, targetToSource, threads);
+
+	std::vector<float> sources, targets;
+	for (int i = 0; i < source.size(); ++i)
+	{
+		int j = sourceToTarget[i];
+		if (j < 0 || targetToSource[j] != i) continue;
+		sources.insert(sources.end(), (*source.keypoints)[i].data, (*source.keypoints)[i].data + 3);
+		targets.insert(targets.end(), (*target.keypoints)[j].data, (*target.keypoints)[j].data + 3);
+	}
+	if (sources.size() < 9)
+	{
+		sources.clear();
+		targets.clear();
+		for (int i = 0; i < source.size(); ++i)
+		{
+			int j = sourceToTarget[i];
+			if (j < 0) continue;
+			sources.insert(sources.end(), (*source.keypoints)[i].data, (*source.keypoints)[i].data + 3);
+			targets.insert(targets.end(), (*target.keypoints)[j].data, (*target.keypoints)[j].data + 3);
+		}
+	}
+	int matchNumber = static_cast<int>(sources.size() / 3);
+	result.matches = matchNumber;
+	if (matchNumber < 3) return result;
+
+	float inlierDistance2 = parameters.inlierDistance * parameters.inlierDistance;
+	Eigen::Matrix4f best = guess;
+	int bestInliers = countInliers(guess, sources, targets, inlierDistance2);
+	bool improved = false;
+
+	std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > hypotheses(ransacBatchSize);
+	std::vector<int> support(ransacBatchSize);
+	int needed = parameters.maxIterations;
+	int drawn = 0;
+	while (drawn < needed)
+	{
+		int batch = std::min(ransacBatchSize, needed - drawn);
+		#pragma omp parallel for schedule (dynamic,8) num_threads (threads)
+		for (int b = 0; b < batch; ++b)
+		{
+			support[b] = -1;
+			unsigned long long state = (static_cast<unsigned long long>(parameters.seed) << 32) ^ static_cast<unsigned long long>(drawn + b);
+			int sample[3];
+			for (int k = 0; k < 3; ++k)
+			{
+				bool repeated;
+				do
+				{
+					state = mix(state);
+					sample[k] = static_cast<int>(state % static_cast<unsigned long long>(matchNumber));
+					repeated = false;
+					for (int l = 0; l < k; ++l) repeated = repeated || sample[l] == sample[k];
+				} while (repeated);
+			}
+			if (!similarTriangles(sources, targets, sample, parameters.edgeSimilarity)) continue;
+
+			UmeyamaMoments moments(Eigen::Map<const Eigen::Vector3f>(&sources[3 * sample[0]]).cast<double>(),
+				Eigen::Map<const Eigen::Vector3f>(&targets[3 * sample[0]]).cast<double>());
+			for (int k = 0; k < 3; ++k)
+			{
+				moments.add(Eigen::Map<const Eigen::Vector3f>(&sources[3 * sample[k]]), Eigen::Map<const Eigen::Vector3f>(&targets[3 * sample[k]]));
+			}
+			hypotheses[b] = solveUmeyama(moments);
+			support[b] = countInliers(hypotheses[b], sources, targets, inlierDistance2);
+		}
+
+		// the earliest draw wins ties, as it would drawn one at a time
+		for (int b = 0; b < batch; ++b)
+		{
+			if (support[b] <= bestInliers) continue;
+			best = hypotheses[b];
+			bestInliers = support[b];
+			improved = true;
+		}
+		drawn += batch;
+
+		// draws needed to have drawn one sample of three inliers with the given confidence
+		double allInliers = std::pow(static_cast<double>(bestInliers) / matchNumber, 3.0);
+		if (allInliers > 0.0)
+		{
+			double draws = allInliers >= 1.0 ? 0.0 : std::log(1.0 - parameters.confidence) / std::log(1.0 - allInliers);
+			if (draws < needed) needed = static_cast<int>(std::ceil(draws));
+		}
+	}
+	result.iterations = drawn;
+
+	// least squares over the inliers, again while that gains inliers
+	for (int refit = 0; improved && refit < 3; ++refit)
+	{
+		std::vector<float> inlierSources, inlierTargets;
+		countInliers(best, sources, targets, inlierDistance2, &inlierSources, &inlierTargets);
+		int number = static_cast<int>(inlierSources.size() / 3);
+		if (number < 3) break;
+		Eigen::Matrix4f refined = solveUmeyama(accumulateUmeyamaMoments(&inlierSources[0], &inlierTargets[0], NULL, number));
+		int refinedInliers = countInliers(refined, sources, targets, inlierDistance2);
+		if (refinedInliers < bestInliers) break;
+		best = refined;
+		if (refinedInliers == bestInliers) break;
+		bestInliers = refinedInliers;
+	}
+
+	result.transformation = best;
+	result.inliers = bestInliers;
+	result.aligned = improved;
+	return result;
+}
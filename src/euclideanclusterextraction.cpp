@@ -1,5 +1,9 @@
 #include <QtCore/QDebug>
 //#include "../include/qtbase.h"
+#include <omp.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #define PCL_NO_PRECOMPILE
 #include <pcl/common/io.h>
@@ -11,12 +15,60 @@
 
 using namespace registar;
 
+namespace
+{
+	inline bool compareAndSwap(volatile int *address, int expected, int desired)
+	{
+#ifdef _MSC_VER
+		return _InterlockedCompareExchange(reinterpret_cast<volatile long*>(address), desired, expected) == expected;
+#else
+		return __sync_bool_compare_and_swap(address, expected, desired);
+#endif
+	}
+
+	// lock-free union-find, roots always link under the smaller index so the root of a set is its first point
+	inline int findRoot(volatile int *parent, int x)
+	{
+		while (true)
+		{
+			int p = parent[x];
+			if (p == x) return x;
+			int gp = parent[p];
+			if (gp != p) compareAndSwap(&parent[x], p, gp);
+			x = gp;
+		}
+	}
+
+	inline void unite(volatile int *parent, int a, int b)
+	{
+		while (true)
+		{
+			a = findRoot(parent, a);
+			b = findRoot(parent, b);
+			if (a == b) return;
+			if (a < b) std::swap(a, b);
+			if (compareAndSwap(&parent[a], a, b)) return;
+		}
+	}
+
+	inline bool compareClusterSize(const pcl::PointIndices &a, const pcl::PointIndices &b)
+	{
+		if (a.indices.size() != b.indices.size()) return a.indices.size() > b.indices.size();
+		return a.indices.front() < b.indices.front();
+	}
+}
+
 EuclideanClusterExtraction::EuclideanClusterExtraction(){}
 
 EuclideanClusterExtraction::~EuclideanClusterExtraction(){}
 
 // void EuclideanClusterExtraction::filter(CloudDataPtr cloudData, QVariantMap parameters, std::vector<CloudDataPtr> cloudData_filtereds)
 void EuclideanClusterExtraction::filter(CloudDataConstPtr cloudData, QVariantMap parameters, CloudDataPtr &cloudData_inliers, CloudDataPtr &cloudData_outliers)
+{
+	filter(cloudData, parameters, KdTreePtr(), cloudData_inliers, cloudData_outliers);
+}
+
+void EuclideanClusterExtraction::filter(CloudDataConstPtr cloudData, QVariantMap parameters, KdTreePtr tree, CloudDataPtr &cloudData_inliers, CloudDataPtr &cloudData_outliers)
 {
 	// cloudData = parameters["cloudData"].value<CloudDataPtr>();
 	// cloudData_filtered = parameters["cloudData_filtered"].value<CloudDataPtr>();
@@ -25,6 +77,7 @@ void EuclideanClusterExtraction::filter(CloudDataConstPtr cloudData, QVariantMap
 	int minClusterSize = parameters["minClusterSize"].toInt();
 	int maxClusterSize = parameters["maxClusterSize"].toInt();
 	bool use_cpu = parameters["use_cpu"].toBool();
+	bool use_mcpu = parameters["use_mcpu"].toBool();
 	bool use_gpu = parameters["use_gpu"].toBool();
 
 	qDebug() << "ClusterTolerance : " << QString::number(clusterTolerance);
@@ -32,22 +85,26 @@ void EuclideanClusterExtraction::filter(CloudDataConstPtr cloudData, QVariantMap
 	qDebug() << "MaxClusterSize : " << QString::number(maxClusterSize);
 
 	qDebug() << "use_cpu : " << use_cpu;
+	qDebug() << "use_mcpu : " << use_mcpu;
 	qDebug() << "use_gpu : " << use_gpu;
 
 	std::vector<pcl::PointIndices> cluster_indices;
 
-	if(use_cpu)
+	if ((use_cpu || use_mcpu) && (!tree || tree->getInputCloud() != cloudData))
 	{
-		pcl::EuclideanClusterExtraction<PointType> ec;
-		ec.setClusterTolerance(clusterTolerance);
-		ec.setMinClusterSize(minClusterSize);
-		ec.setMaxClusterSize(maxClusterSize);
-		pcl::search::KdTree<PointType>::Ptr tree (new pcl::search::KdTree<PointType>);
-		ec.setSearchMethod(tree);
-		ec.setInputCloud(cloudData);
+		tree.reset(new KdTree);
+		tree->setInputCloud(cloudData);
+	}
 
-		//std::vector<pcl::PointIndices> cluster_indices;
-		ec.extract (cluster_indices);
+	if(use_cpu)
+	{
+		// pcl::EuclideanClusterExtraction::extract would rebuild the tree, call its worker with the borrowed one
+		pcl::extractEuclideanClusters<PointType>(*cloudData, tree, clusterTolerance, cluster_indices, minClusterSize, maxClusterSize);
+		std::sort(cluster_indices.rbegin(), cluster_indices.rend(), pcl::comparePointClusters);
+	}
+	else if (use_mcpu)
+	{
+		extractClustersOMP(cloudData, tree, clusterTolerance, minClusterSize, maxClusterSize, cluster_indices);
 	}
 	else if (use_gpu)
 	{
@@ -121,3 +178,120 @@ void EuclideanClusterExtraction::filter(CloudDataConstPtr cloudData, QVariantMap
 	// }
 	// qDebug() << "Cloud Size After : " << cloudData_filtered->size();
 }
+
+void EuclideanClusterExtraction::extractClustersOMP(CloudDataConstPtr cloudData, KdTreePtr tree, float clusterTolerance, 
+	int minClusterSize, int maxClusterSize, std::vector<pcl::PointIndices> &cluster_indices)
+{
+	cluster_indices.clear();
+	int size = static_cast<int>(cloudData->size());
+	if (size == 0) return;
+
+	int threads = omp_get_num_procs();
+
+	std::vector<int> parent(size);
+	for (int i = 0; i < size; ++i) parent[i] = i;
+	volatile int *parent_data = &parent[0];
+
+	// radius queries in parallel, every edge is seen from both ends so only the upper half is united
+	#pragma omp parallel num_threads (threads)
+	{
+		std::vector<int> indices;
+		std::vector<float> distance2s;
+
+		#pragma omp for schedule (dynamic,1000)
+		for (int i = 0; i < size; ++i)
+		{
+			const PointType &point = (*cloudData)[i];
+			if ( !pcl_isfinite(point.x) || !pcl_isfinite(point.y) || !pcl_isfinite(point.z) ) continue;
+
+			tree->radiusSearch(point, clusterTolerance, indices, distance2s);
+			for (int j = 0; j < indices.size(); ++j)
+			{
+				if (indices[j] > i) unite(parent_data, i, indices[j]);
+			}
+		}
+	}
+
+	// label every point with its root and count the set sizes
+	std::vector<int> roots(size);
+	std::vector<int> sizes(size, 0);
+	#pragma omp parallel for schedule (dynamic,1000) num_threads (threads)
+	for (int i = 0; i < size; ++i)
+	{
+		int root = findRoot(parent_data, i);
+		roots[i] = root;
+		#pragma omp atomic
+		sizes[root]++;
+	}
+
+	std::vector<int> clusterIds(size, -1);
+	int clusterNumber = 0;
+	for (int i = 0; i < size; ++i)
+	{
+		if (roots[i] != i) continue;
+		if (sizes[i] >= minClusterSize && sizes[i] <= maxClusterSize) clusterIds[i] = clusterNumber++;
+	}
+	if (clusterNumber == 0) return;
+
+	cluster_indices.resize(clusterNumber);
+	for (int i = 0; i < size; ++i)
+	{
+		if (roots[i] != i || clusterIds[i] < 0) continue;
+		cluster_indices[clusterIds[i]].header = cloudData->header;
+		cluster_indices[clusterIds[i]].indices.resize(sizes[i]);
+	}
+
+	// compaction, each thread sorts the (cluster, point) pairs of its own contiguous block of points; the runs of one
+	// cluster take their offsets in thread order, so the memory stays linear in the points whatever the cluster number
+	int block = (size + threads - 1) / threads;
+	std::vector<std::vector<std::pair<int, int> > > threadPairs(threads);
+	std::vector<std::vector<int> > threadRunBegins(threads);
+	#pragma omp parallel for num_threads (threads)
+	for (int t = 0; t < threads; ++t)
+	{
+		std::vector<std::pair<int, int> > &pairs = threadPairs[t];
+		int end = std::min(size, (t + 1) * block);
+		for (int i = t * block; i < end; ++i)
+		{
+			int c = clusterIds[roots[i]];
+			if (c >= 0) pairs.push_back(std::make_pair(c, i));
+		}
+		std::sort(pairs.begin(), pairs.end());
+		for (int k = 0; k < pairs.size(); ++k)
+		{
+			if (k == 0 || pairs[k].first != pairs[k-1].first) threadRunBegins[t].push_back(k);
+		}
+	}
+
+	std::vector<std::vector<int> > threadRunOffsets(threads);
+	std::vector<int> offsets(clusterNumber, 0);
+	for (int t = 0; t < threads; ++t)
+	{
+		const std::vector<std::pair<int, int> > &pairs = threadPairs[t];
+		const std::vector<int> &runBegins = threadRunBegins[t];
+		threadRunOffsets[t].resize(runBegins.size());
+		for (int r = 0; r < runBegins.size(); ++r)
+		{
+			int c = pairs[runBegins[r]].first;
+			int runEnd = r + 1 < runBegins.size() ? runBegins[r+1] : static_cast<int>(pairs.size());
+			threadRunOffsets[t][r] = offsets[c];
+			offsets[c] += runEnd - runBegins[r];
+		}
+	}
+
+	#pragma omp parallel for num_threads (threads)
+	for (int t = 0; t < threads; ++t)
+	{
+		const std::vector<std::pair<int, int> > &pairs = threadPairs[t];
+		const std::vector<int> &runBegins = threadRunBegins[t];
+		for (int r = 0; r < runBegins.size(); ++r)
+		{
+			int runEnd = r + 1 < runBegins.size() ? runBegins[r+1] : static_cast<int>(pairs.size());
+			std::vector<int> &indices = cluster_indices[pairs[runBegins[r]].first].indices;
+			int offset = threadRunOffsets[t][r];
+			for (int k = runBegins[r]; k < runEnd; ++k) indices[offset++] = pairs[k].second;
+		}
+	}
+
+	std::sort(cluster_indices.begin(), cluster_indices.end(), compareClusterSize);
+}
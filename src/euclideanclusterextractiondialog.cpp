@@ -17,6 +17,7 @@ void EuclideanClusterExtractionDialog::on_applyButton_clicked()
 	int maxClusterSize = maxClusterSizeLineEdit->text().toInt();
 	bool overwrite = overwriteCheckBox->isChecked();
 	bool use_cpu = cpuRadioButton->isChecked();
+	bool use_mcpu = mcpuRadioButton->isChecked();
 	bool use_gpu = gpuRadioButton->isChecked();
 	
 	QVariantMap parameters;
@@ -26,6 +27,7 @@ void EuclideanClusterExtractionDialog::on_applyButton_clicked()
 	parameters["overwrite"] = overwrite;
 
 	parameters["use_cpu"] = use_cpu;
+	parameters["use_mcpu"] = use_mcpu;
 	parameters["use_gpu"] = use_gpu;
 	
 	emit sendParameters(parameters);
@@ -0,0 +1,190 @@
+#include <omp.h>
+#include <algorithm>
+
+#include "../include/flatkdtree.h"
+
+using namespace registar;
+
+namespace
+{
+	struct AxisLess
+	{
+		AxisLess(const CloudData &cloudData, int axis) : cloudData(cloudData), axis(axis) {}
+		inline bool operator()(int a, int b) const {return cloudData[a].data[axis] < cloudData[b].data[axis];}
+		const CloudData &cloudData;
+		int axis;
+	};
+
+	struct StackEntry
+	{
+		int node;
+		int begin;
+		int end;
+		float bound;
+	};
+}
+
+// a bucket of one would split single points into an empty and a full leaf, two or more keeps every leaf non-empty
+FlatKdTree::FlatKdTree(int bucketSize) : bucketSize(std::max(2, bucketSize)), depth(0) {}
+
+FlatKdTree::~FlatKdTree(){}
+
+void FlatKdTree::setInputCloud(CloudDataConstPtr cloudData)
+{
+	if (this->cloudData == cloudData) return;
+	this->cloudData = cloudData;
+	build();
+}
+
+void FlatKdTree::build()
+{
+	depth = 0;
+	splits.clear();
+	axes.clear();
+	xs.clear();
+	ys.clear();
+	zs.clear();
+	pointIndices.clear();
+	if (!cloudData) return;
+
+	const CloudData &cloud = *cloudData;
+	std::vector<int> order;
+	order.reserve(cloud.size());
+	for (int i = 0; i < cloud.size(); ++i)
+	{
+		const PointType &point = cloud[i];
+		if ( pcl_isfinite(point.x) && pcl_isfinite(point.y) && pcl_isfinite(point.z) ) order.push_back(i);
+	}
+	int size = static_cast<int>(order.size());
+
+	while (((size + (1 << depth) - 1) >> depth) > bucketSize) ++depth;
+	int internalNumber = (1 << depth) - 1;
+	splits.assign(internalNumber, 0.0f);
+	axes.assign(internalNumber, 0);
+
+	std::vector<int> begins(2 * internalNumber + 1), ends(2 * internalNumber + 1);
+	begins[0] = 0;
+	ends[0] = size;
+
+	int threads = omp_get_num_procs();
+	for (int level = 0; level < depth; ++level)
+	{
+		int first = (1 << level) - 1;
+		int number = 1 << level;
+
+		#pragma omp parallel for schedule (dynamic,1) num_threads (threads)
+		for (int k = 0; k < number; ++k)
+		{
+			int node = first + k;
+			int begin = begins[node];
+			int end = ends[node];
+
+			// split along the widest extent of the points of the node
+			Eigen::Vector3f minimum = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+			Eigen::Vector3f maximum = -minimum;
+			for (int i = begin; i < end; ++i)
+			{
+				Eigen::Vector3f position = cloud[order[i]].getVector3fMap();
+				minimum = minimum.cwiseMin(position);
+				maximum = maximum.cwiseMax(position);
+			}
+			int axis;
+			(maximum - minimum).maxCoeff(&axis);
+
+			int middle = begin + (end - begin) / 2;
+			std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, AxisLess(cloud, axis));
+			splits[node] = cloud[order[middle]].data[axis];
+			axes[node] = static_cast<unsigned char>(axis);
+
+			begins[2 * node + 1] = begin;
+			ends[2 * node + 1] = middle;
+			begins[2 * node + 2] = middle;
+			ends[2 * node + 2] = end;
+		}
+	}
+
+	xs.resize(size);
+	ys.resize(size);
+	zs.resize(size);
+	pointIndices.swap(order);
+	#pragma omp parallel for schedule (dynamic,1000) num_threads (threads)
+	for (int i = 0; i < size; ++i)
+	{
+		const PointType &point = cloud[pointIndices[i]];
+		xs[i] = point.x;
+		ys[i] = point.y;
+		zs[i] = point.z;
+	}
+}
+
+bool FlatKdTree::nearest(int queryIndex, const PointType &query, int &match, float &sqrDistance)
+{
+	return nearest(query, match, sqrDistance);
+}
+
+bool FlatKdTree::nearest(const PointType &query, int &match, float &sqrDistance) const
+{
+	if (pointIndices.empty()) return false;
+	if ( !pcl_isfinite(query.x) || !pcl_isfinite(query.y) || !pcl_isfinite(query.z) ) return false;
+
+	int internalNumber = (1 << depth) - 1;
+	float best = std::numeric_limits<float>::infinity();
+	int best_position = -1;
+
+	// one far side per level at most is pending
+	StackEntry stack[64];
+	int top = 0;
+	StackEntry root = {0, 0, static_cast<int>(pointIndices.size()), 0.0f};
+	stack[top++] = root;
+
+	while (top > 0)
+	{
+		StackEntry entry = stack[--top];
+		if (entry.bound >= best) continue;
+
+		int node = entry.node;
+		int begin = entry.begin;
+		int end = entry.end;
+		while (node < internalNumber)
+		{
+			int middle = begin + (end - begin) / 2;
+			float difference = query.data[axes[node]] - splits[node];
+			StackEntry farSide;
+			farSide.bound = difference * difference;
+			if (difference < 0.0f)
+			{
+				farSide.node = 2 * node + 2;
+				farSide.begin = middle;
+				farSide.end = end;
+				node = 2 * node + 1;
+				end = middle;
+			}
+			else
+			{
+				farSide.node = 2 * node + 1;
+				farSide.begin = begin;
+				farSide.end = middle;
+				node = 2 * node + 2;
+				begin = middle;
+			}
+			if (farSide.bound < best) stack[top++] = farSide;
+		}
+
+		int n = end - begin;
+		if (n == 0) continue;
+		Eigen::Map<const Eigen::ArrayXf> x(&xs[begin], n);
+		Eigen::Map<const Eigen::ArrayXf> y(&ys[begin], n);
+		Eigen::Map<const Eigen::ArrayXf> z(&zs[begin], n);
+		int j;
+		float d = ((x - query.x).square() + (y - query.y).square() + (z - query.z).square()).minCoeff(&j);
+		if (d < best)
+		{
+			best = d;
+			best_position = begin + j;
+		}
+	}
+
+	match = pointIndices[best_position];
+	sqrDistance = best;
+	return true;
+}
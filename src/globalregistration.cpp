@@ -2,6 +2,7 @@
 
 #include "../include/utilities.h"
 #include "../include/globalregistration.h"
+#include "../include/posegraph.h"
 
 using namespace registar;
 
@@ -15,7 +16,7 @@ CycleRegistration::~CycleRegistration()
 
 }
 
-void CycleRegistration::refine(CycleRegistrationRefineMethod method)
+void CycleRegistration::refine(CycleRegistrationRefineMethod method, const CorrespondencesComputationParameters &correspondencesComputationParameters)
 {
 	switch(method)
 	{
@@ -31,7 +32,7 @@ void CycleRegistration::refine(CycleRegistrationRefineMethod method)
 		}
 		case MINIMIZE_REFINE:
 		{
-			minimize_refine();
+			minimize_refine(correspondencesComputationParameters);
 			break;
 		}
 	}
@@ -111,9 +112,130 @@ void CycleRegistration::non_uniform_refine()
 
 }
 
-void CycleRegistration::minimize_refine()
+void CycleRegistration::minimize_refine(const CorrespondencesComputationParameters &correspondencesComputationParameters)
 {
+	QList<RegistrationData*> clouds;
+	for (int i = 0; i < prList.size(); ++i)
+	{
+		if (!clouds.contains(prList[i]->getTarget())) clouds.append(prList[i]->getTarget());
+		if (!clouds.contains(prList[i]->getSource())) clouds.append(prList[i]->getSource());
+	}
+
+	// one vertex per set of clouds joined by freezed pairs, which hold them rigidly together; offsets map each cloud
+	// into the frame of its vertex, the vertex of the first target stays fixed
+	std::vector<int> vertexIndices(clouds.size(), -1);
+	std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > offsets(clouds.size(), Eigen::Matrix4d::Identity());
+	int vertexNumber = 0;
+	for (int c = 0; c < clouds.size(); ++c)
+	{
+		if (vertexIndices[c] >= 0) continue;
+		vertexIndices[c] = vertexNumber++;
+		bool changed = true;
+		while (changed)
+		{
+			changed = false;
+			for (int i = 0; i < prList.size(); ++i)
+			{
+				if (!prList[i]->getFreezed()) continue;
+				int t = clouds.indexOf(prList[i]->getTarget());
+				int s = clouds.indexOf(prList[i]->getSource());
+				Eigen::Matrix4d transformation = toRigidTransformation(prList[i]->getTransformation()).cast<double>();
+				if (vertexIndices[t] >= 0 && vertexIndices[s] < 0)
+				{
+					vertexIndices[s] = vertexIndices[t];
+					offsets[s] = offsets[t] * transformation;
+					changed = true;
+				}
+				else if (vertexIndices[s] >= 0 && vertexIndices[t] < 0)
+				{
+					vertexIndices[t] = vertexIndices[s];
+					offsets[t] = offsets[s] * transformation.inverse();
+					changed = true;
+				}
+			}
+		}
+	}
+
+	PoseGraph poseGraph(vertexNumber);
+
+	// chain the pairwise transformations into initial poses
+	std::vector<bool> posed(vertexNumber, false);
+	posed[0] = true;
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (int i = 0; i < prList.size(); ++i)
+		{
+			int t = clouds.indexOf(prList[i]->getTarget());
+			int s = clouds.indexOf(prList[i]->getSource());
+			// vertex of the target <- vertex of the source
+			Eigen::Matrix4d transformation = offsets[t] * toRigidTransformation(prList[i]->getTransformation()).cast<double>() * offsets[s].inverse();
+			if (posed[vertexIndices[t]] && !posed[vertexIndices[s]])
+			{
+				poseGraph.setPose(vertexIndices[s], poseGraph.getPose(vertexIndices[t]) * transformation);
+				posed[vertexIndices[s]] = changed = true;
+			}
+			else if (posed[vertexIndices[s]] && !posed[vertexIndices[t]])
+			{
+				poseGraph.setPose(vertexIndices[t], poseGraph.getPose(vertexIndices[s]) * transformation.inverse());
+				posed[vertexIndices[t]] = changed = true;
+			}
+		}
+	}
+
+	CorrespondencesComputationParameters parameters = correspondencesComputationParameters;
+	for (int i = 0; i < prList.size(); ++i)
+	{
+		int t = clouds.indexOf(prList[i]->getTarget());
+		int s = clouds.indexOf(prList[i]->getSource());
+		if (vertexIndices[t] == vertexIndices[s]) continue;
+
+		Eigen::Matrix4f transformation = toRigidTransformation(prList[i]->getTransformation());
+
+		CorrespondencesComputationData correspondencesComputationData;
+		Correspondences correspondences;
+		CorrespondenceIndices correspondenceIndices;
+		int inverseStartIndex;
+		PairwiseRegistration::preCorrespondences(prList[i]->getTarget(), prList[i]->getSource(), transformation, 
+			parameters, correspondences, 
+			correspondenceIndices, inverseStartIndex, correspondencesComputationData);
+
+		// source points come back in the target frame, the edge wants them in the frames of the vertices
+		Eigen::Matrix4d target_offset = offsets[t];
+		Eigen::Matrix4d source_offset = offsets[s] * transformation.cast<double>().inverse();
+		PoseGraphEdgeMoments moments;
+		for (int k = 0; k < correspondences.size(); ++k)
+		{
+			Eigen::Vector3d p = correspondences[k].targetPoint.getVector3fMap().cast<double>();
+			Eigen::Vector3d q = correspondences[k].sourcePoint.getVector3fMap().cast<double>();
+			moments.add(target_offset.block<3, 3>(0, 0) * p + target_offset.block<3, 1>(0, 3), 
+				source_offset.block<3, 3>(0, 0) * q + source_offset.block<3, 1>(0, 3));
+		}
+		poseGraph.addEdge(vertexIndices[t], vertexIndices[s], moments);
+	}
 
+	if (poseGraph.getEdgeNumber() > 0)
+	{
+		double weight = poseGraph.totalWeight();
+		if (weight <= 0.0) return;
+		double error_before = poseGraph.error();
+		int iterations = poseGraph.optimize();
+		double error_after = poseGraph.error();
+		qDebug() << "minimize refine rms error:" << std::sqrt(std::max(error_before, 0.0) / weight) 
+			<< "->" << std::sqrt(std::max(error_after, 0.0) / weight) << "after" << iterations << "iteration(s)";
+	}
+
+	for (int i = 0; i < prList.size(); ++i)
+	{
+		if (prList[i]->getFreezed()) continue;
+		int t = clouds.indexOf(prList[i]->getTarget());
+		int s = clouds.indexOf(prList[i]->getSource());
+		const Eigen::Matrix4d &pose_target = poseGraph.getPose(vertexIndices[t]);
+		const Eigen::Matrix4d &pose_source = poseGraph.getPose(vertexIndices[s]);
+		Eigen::Matrix4f transformation = (offsets[t].inverse() * pose_target.inverse() * pose_source * offsets[s]).cast<float>();
+		prList[i]->initializeTransformation(transformation);
+	}
 }
 
 
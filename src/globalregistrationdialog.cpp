@@ -177,6 +177,34 @@ void GlobalRegistrationDialog::on_nonUniformRefinePushButton_clicked()
 
 }
 
+void GlobalRegistrationDialog::on_minimizeRefinePushButton_clicked()
+{
+	QVariantMap parameters;
+	parameters["command"] = QString("MinimizeRefine");
+
+	int offset = cycleComboBox->currentIndex();
+
+	QStringList targets, sources;
+	QList<bool> freezeds;
+	for (int i = 0; i < pairListWidget->count(); ++i)
+	{
+		QStringList target_source = pairListWidget->item( ( i + offset ) % pairListWidget->count() )->text().split("<-");
+		targets << target_source[0];
+		sources << target_source[1];
+		if (pairListWidget->item( ( i + offset ) % pairListWidget->count() )->checkState() == Qt::Unchecked)
+		{
+			freezeds.append(false);
+		}
+		else freezeds.append(true);
+	}
+	parameters["targets"] = targets;
+	parameters["sources"] = sources;
+	parameters["freezeds"].setValue( freezeds );
+	parameters["offset"] = offset;
+
+	emit sendParameters(parameters);
+}
+
 void GlobalRegistrationDialog::on_estimatePushButton_clicked()
 {
 	QVariantMap parameters;
@@ -7,6 +7,8 @@
 #include "../include/cloudmanager.h"
 #include "../include/cloudvisualizer.h"
 #include "../include/cloudio.h"
+#include "../include/mortonorder.h"
+#include "../include/bulktransform.h"
 #include "../include/euclideanclusterextractiondialog.h"
 #include "../include/euclideanclusterextraction.h"
 #include "../include/voxelgriddialog.h"
@@ -202,22 +204,31 @@ void MainWindow::on_openAction_triggered()
 			CloudDataPtr cloudData(new CloudData);
 			Eigen::Matrix4f transformation;
 			BoundariesPtr boundaries(new Boundaries);
+			std::vector<int> order;
+			std::vector<int> *orderPtr = mortonOrderAction->isChecked() ? &order : NULL;
 			QApplication::setOverrideCursor(Qt::WaitCursor);
 			if ( CloudIO::importPLYPolygonMesh(fileName, polygonMesh) )
 			{
 				pcl::fromPCLPointCloud2(polygonMesh->cloud, *cloudData);
+				if (orderPtr && !cloudData->isOrganized())
+				{
+					computeMortonOrder(*cloudData, order);
+					applyOrder(*cloudData, order);
+					applyOrder(polygonMesh->polygons, order);
+				}
 			}
-			else if ( !CloudIO::importPLYCloudData(fileName, cloudData) ) 
+			else if ( !CloudIO::importPLYCloudData(fileName, cloudData, orderPtr) ) 
 			{
 				it++;
 				continue;
 			}
 			CloudIO::importTransformation(fileName, transformation);
-			CloudIO::importBoundaries(fileName, boundaries);
+			CloudIO::importBoundaries(fileName, boundaries, orderPtr);
 			QApplication::restoreOverrideCursor();
 			QApplication::beep();
 			Cloud* cloud = cloudManager->addCloud(cloudData, polygonMesh->polygons, Cloud::fromIO, fileName, transformation);
 			cloud->setBoundaries(boundaries);
+			cloud->setFileOrder(order);
 			cloudBrowser->addCloud(cloud);
 			cloudVisualizer->addCloud(cloud);
 			cloudVisualizer->resetCamera(cloud);
@@ -242,9 +253,11 @@ bool MainWindow::on_saveAction_triggered()
 	{
 		QString cloudName = (*it);
 		Cloud *cloud = cloudManager->getCloud(cloudName);
-		CloudDataConstPtr cloudData = cloud->getCloudData();
+		CloudDataPtr cloudData;
+		Polygons polygons;
+		BoundariesPtr boundaries;
+		cloud->getInFileOrder(cloudData, polygons, boundaries);
 		Eigen::Matrix4f transformation = cloud->getTransformation();
-		BoundariesConstPtr boundaries = cloud->getBoundaries();
 		QString fileName = cloud->getFileName();
 		if (fileName.isEmpty())
 		{
@@ -264,20 +277,20 @@ bool MainWindow::on_saveAction_triggered()
 		{
 			if (fileName.mid( fileName.size()-4, 4) == ".ply")
 			{
-				if (cloud->getPolygons().size() > 0)
+				if (polygons.size() > 0)
 				{
 					PolygonMeshPtr polygonMesh(new PolygonMesh);
-					toPolygonMesh(*cloudData, cloud->getPolygons(), *polygonMesh);
+					toPolygonMesh(*cloudData, polygons, *polygonMesh);
 					CloudIO::exportPLYPolygonMesh(fileName, polygonMesh);
 				}
 				else CloudIO::exportPLYCloudData(fileName, cloudData);
 			}
 			else if (fileName.mid( fileName.size()-4, 4) == ".vtk")
 			{
-				if (cloud->getPolygons().size() > 0)
+				if (polygons.size() > 0)
 				{
 					PolygonMeshPtr polygonMesh(new PolygonMesh);
-					toPolygonMesh(*cloudData, cloud->getPolygons(), *polygonMesh);
+					toPolygonMesh(*cloudData, polygons, *polygonMesh);
 					CloudIO::exportVTKPolygonMesh(fileName, polygonMesh);
 				}
 				else CloudIO::exportVTKCloudData(fileName, cloudData);
@@ -309,9 +322,11 @@ bool MainWindow::on_saveAsAction_triggered()
 	{
 		QString cloudName = (*it);
 		Cloud *cloud = cloudManager->getCloud(cloudName);
-		CloudDataConstPtr cloudData = cloud->getCloudData();
+		CloudDataPtr cloudData;
+		Polygons polygons;
+		BoundariesPtr boundaries;
+		cloud->getInFileOrder(cloudData, polygons, boundaries);
 		Eigen::Matrix4f transformation = cloud->getTransformation();
-		BoundariesConstPtr boundaries = cloud->getBoundaries();
 		QString fileName = cloud->getFileName();
 		QString newFileName = QFileDialog::getSaveFileName(this, tr("Save %1 - %2 as").arg(cloudName).arg(strippedName(fileName)), currentDirectory, tr("PLY file (*.ply)\nVTK file (*.vtk)"));
 		if (newFileName.isEmpty())
@@ -328,20 +343,20 @@ bool MainWindow::on_saveAsAction_triggered()
 		{
 			if (fileName.mid( fileName.size()-4, 4) == ".ply")
 			{
-				if (cloud->getPolygons().size() > 0)
+				if (polygons.size() > 0)
 				{
 					PolygonMeshPtr polygonMesh(new PolygonMesh);
-					toPolygonMesh(*cloudData, cloud->getPolygons(), *polygonMesh);
+					toPolygonMesh(*cloudData, polygons, *polygonMesh);
 					CloudIO::exportPLYPolygonMesh(fileName, polygonMesh);
 				}
 				else CloudIO::exportPLYCloudData(fileName, cloudData);
 			}
 			else if (fileName.mid( fileName.size()-4, 4) == ".vtk")
 			{
-				if (cloud->getPolygons().size() > 0)
+				if (polygons.size() > 0)
 				{
 					PolygonMeshPtr polygonMesh(new PolygonMesh);
-					toPolygonMesh(*cloudData, cloud->getPolygons(), *polygonMesh);
+					toPolygonMesh(*cloudData, polygons, *polygonMesh);
 					CloudIO::exportVTKPolygonMesh(fileName, polygonMesh);
 				}
 				else CloudIO::exportVTKCloudData(fileName, cloudData);
@@ -609,7 +624,7 @@ void MainWindow::on_concatenationAction_triggered()
 		QString cloudName = (*it);
 		Cloud *cloud = cloudManager->getCloud(cloudName);
 		CloudDataPtr cloudData(new CloudData);
-		pcl::transformPointCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getTransformation());
+		transformCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getTransformation());
 		(*con_cloudData) += (*cloudData);
 		(*con_boundaries) += (*cloud->getBoundaries());
 		qDebug() << cloudName << " added!";
@@ -845,8 +860,9 @@ void MainWindow::on_applyTransformationAction_triggered()
 		QString cloudName = (*it_name);
 		Cloud *cloud = cloudManager->getCloud(cloudName);
 		CloudDataPtr cloudData(new CloudData);
-		pcl::transformPointCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getTransformation());
-		cloud->setCloudData(cloudData);
+		transformCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getTransformation());
+		cloud->setCloudData(cloudData, true);
+		cloud->setScannerPose(cloud->getTransformation() * cloud->getScannerPose());
 		cloud->setTransformation(Eigen::Matrix4f::Identity());
 		cloud->setRegistrationTransformation(Eigen::Matrix4f::Identity());
 		bool isVisible = (*it_visible);
@@ -896,7 +912,7 @@ void MainWindow::on_euclideanClusterExtractionDialog_sendParameters(QVariantMap
 		CloudDataPtr cloudData_inliers, cloudData_outliers;
 		
 		QApplication::setOverrideCursor(Qt::WaitCursor);
-		EuclideanClusterExtraction::filter(cloudData, parameters, cloudData_inliers, cloudData_outliers);
+		EuclideanClusterExtraction::filter(cloudData, parameters, cloud->getKdTree(), cloudData_inliers, cloudData_outliers);
 		QApplication::restoreOverrideCursor();
 		QApplication::beep();
 
@@ -912,10 +928,12 @@ void MainWindow::on_euclideanClusterExtractionDialog_sendParameters(QVariantMap
 		{
 			Polygons polygons(0);
 			Cloud* cloudInliers = cloudManager->addCloud(cloudData_inliers, polygons, Cloud::fromFilter);
+			cloudInliers->setScannerPose(cloud->getScannerPose());
 			cloudBrowser->addCloud(cloudInliers);
 			cloudVisualizer->addCloud(cloudInliers);
 
 			Cloud* cloudOutliers= cloudManager->addCloud(cloudData_outliers, polygons, Cloud::fromFilter);
+			cloudOutliers->setScannerPose(cloud->getScannerPose());
 			cloudBrowser->addCloud(cloudOutliers);
 			cloudVisualizer->addCloud(cloudOutliers);
 		}
@@ -956,6 +974,7 @@ void MainWindow::on_voxelGridDialog_sendParameters(QVariantMap parameters)
 		{
 			Polygons polygons(0);
 			Cloud* cloudFiltered = cloudManager->addCloud(cloudData_filtered, polygons, Cloud::fromFilter);
+			cloudFiltered->setScannerPose(cloud->getScannerPose());
 			cloudBrowser->addCloud(cloudFiltered);
 			cloudVisualizer->addCloud(cloudFiltered);
 		}	
@@ -981,7 +1000,7 @@ void MainWindow::on_movingLeastSquaresDialog_sendParameters(QVariantMap paramete
 
 		CloudDataPtr cloudData_filtered;
 		QApplication::setOverrideCursor(Qt::WaitCursor);
-		MovingLeastSquares::filter(cloudData, parameters, cloudData_filtered);
+		MovingLeastSquares::filter(cloudData, parameters, cloud->getKdTree(), cloudData_filtered);
 		QApplication::restoreOverrideCursor();
 		QApplication::beep();
 
@@ -997,6 +1016,7 @@ void MainWindow::on_movingLeastSquaresDialog_sendParameters(QVariantMap paramete
 		{
 			Polygons polygons(0);
 			Cloud* cloudFiltered = cloudManager->addCloud(cloudData_filtered, polygons, Cloud::fromFilter);
+			cloudFiltered->setScannerPose(cloud->getScannerPose());
 			cloudBrowser->addCloud(cloudFiltered);
 			cloudVisualizer->addCloud(cloudFiltered);
 		}	
@@ -1022,7 +1042,7 @@ void MainWindow::on_boundaryEstimationDialog_sendParameters(QVariantMap paramete
 		BoundariesPtr boundaries;
 		
 		QApplication::setOverrideCursor(Qt::WaitCursor);
-		BoundaryEstimation::filter(cloudData, parameters, boundaries, cloudData_inliers, cloudData_outliers);
+		BoundaryEstimation::filter(cloudData, parameters, cloud->getKdTree(), cloud->getNeighbourTable(), boundaries, cloudData_inliers, cloudData_outliers);
 		QApplication::restoreOverrideCursor();
 		QApplication::beep();
 
@@ -1071,7 +1091,8 @@ void MainWindow::on_outliersRemovalDialog_sendParameters(QVariantMap parameters)
 		CloudDataPtr cloudData_inliers, cloudData_outliers;
 		
 		QApplication::setOverrideCursor(Qt::WaitCursor);
-		OutliersRemoval::filter(cloudData, parameters, cloudData_inliers, cloudData_outliers);
+		NeighbourTablePtr neighbourTable = cloud->getNeighbourTable(std::max(parameters["nearestK"].toInt(), 1));
+		OutliersRemoval::filter(cloudData, parameters, neighbourTable, cloudData_inliers, cloudData_outliers);
 		QApplication::restoreOverrideCursor();
 		QApplication::beep();
 
@@ -1087,10 +1108,12 @@ void MainWindow::on_outliersRemovalDialog_sendParameters(QVariantMap parameters)
 		{
 			Polygons polygons(0);
 			Cloud* cloudInliers = cloudManager->addCloud(cloudData_inliers, polygons, Cloud::fromFilter);
+			cloudInliers->setScannerPose(cloud->getScannerPose());
 			cloudBrowser->addCloud(cloudInliers);
 			cloudVisualizer->addCloud(cloudInliers);
 			
 			Cloud* cloudOutliers= cloudManager->addCloud(cloudData_outliers, polygons, Cloud::fromFilter);
+			cloudOutliers->setScannerPose(cloud->getScannerPose());
 			cloudBrowser->addCloud(cloudOutliers);
 			cloudVisualizer->addCloud(cloudOutliers);
 		}
@@ -1113,17 +1136,19 @@ void MainWindow::on_normalFieldDialog_sendParameters(QVariantMap parameters)
 		Cloud *cloud = cloudManager->getCloud(cloudName);
 		CloudDataConstPtr cloudData = cloud->getCloudData();
 
+		parameters["scannerPose"] = QVariant::fromValue<Eigen::Matrix4f>(cloud->getScannerPose());
+
 		CloudDataPtr cloudData_filtered;
 		QApplication::setOverrideCursor(Qt::WaitCursor);
 
-		NormalField::filter(cloudData, parameters, cloudData_filtered);
+		NormalField::filter(cloudData, parameters, cloud->getKdTree(), cloud->getNeighbourTable(), cloudData_filtered);
 
 		QApplication::restoreOverrideCursor();
 		QApplication::beep();
 
 		if( parameters["overwrite"].value<bool>() )
 		{
-			cloud->setCloudData(cloudData_filtered);
+			cloud->setCloudData(cloudData_filtered, true);
 			cloudBrowser->updateCloud(cloud);
 			bool isVisible = (*it_visible);
 			if(isVisible)cloudVisualizer->updateCloud(cloud);
@@ -1133,6 +1158,7 @@ void MainWindow::on_normalFieldDialog_sendParameters(QVariantMap parameters)
 			Polygons polygons = cloud->getPolygons();
 			Eigen::Matrix4f transformation = cloud->getTransformation();
 			Cloud* cloudFiltered = cloudManager->addCloud(cloudData_filtered, polygons, Cloud::fromFilter, "", transformation);
+			cloudFiltered->setScannerPose(cloud->getScannerPose());
 			cloudBrowser->addCloud(cloudFiltered);
 			cloudVisualizer->addCloud(cloudFiltered);
 		}	
@@ -1191,7 +1217,7 @@ void MainWindow::on_colorFieldDialog_sendParameters(QVariantMap parameters)
 
 		if( parameters["overwrite"].value<bool>() )
 		{
-			cloud->setCloudData(cloudData_filtered);
+			cloud->setCloudData(cloudData_filtered, true);
 			cloudBrowser->updateCloud(cloud);
 			bool isVisible = (*it_visible);
 			if(isVisible)cloudVisualizer->updateCloud(cloud);
@@ -1201,6 +1227,7 @@ void MainWindow::on_colorFieldDialog_sendParameters(QVariantMap parameters)
 			Polygons polygons = cloud->getPolygons();
 			Eigen::Matrix4f transformation = cloud->getTransformation();
 			Cloud* cloudFiltered = cloudManager->addCloud(cloudData_filtered, polygons, Cloud::fromFilter, "", transformation);
+			cloudFiltered->setScannerPose(cloud->getScannerPose());
 			cloudBrowser->addCloud(cloudFiltered);
 			cloudVisualizer->addCloud(cloudFiltered);
 		}	
@@ -1256,7 +1283,7 @@ void MainWindow::on_addNoiseDialog_sendParameters(QVariantMap parameters)
 
 		if( parameters["overwrite"].value<bool>() )
 		{
-			cloud->setCloudData(cloudData_filtered);
+			cloud->setCloudData(cloudData_filtered, true);
 			cloudBrowser->updateCloud(cloud);
 			bool isVisible = (*it_visible);
 			if(isVisible)cloudVisualizer->updateCloud(cloud);
@@ -1266,6 +1293,7 @@ void MainWindow::on_addNoiseDialog_sendParameters(QVariantMap parameters)
 			Polygons polygons = cloud->getPolygons();
 			Eigen::Matrix4f transformation = cloud->getTransformation();
 			Cloud* cloudFiltered = cloudManager->addCloud(cloudData_filtered, polygons, Cloud::fromFilter, "", transformation);
+			cloudFiltered->setScannerPose(cloud->getScannerPose());
 			cloudBrowser->addCloud(cloudFiltered);
 			cloudVisualizer->addCloud(cloudFiltered);
 		}	
@@ -1815,6 +1843,25 @@ void MainWindow::on_pairwiseRegistrationDialog_sendParameters(QVariantMap parame
 		}
 	}
 
+	if(parameters["command"] == "Coarse")
+	{
+		if (pairwiseRegistration == NULL)
+		{
+			qDebug() << "Still Uninitialized";
+		}
+		else
+		{
+			QApplication::setOverrideCursor(Qt::WaitCursor);
+			pairwiseRegistration->process(parameters);
+			QApplication::restoreOverrideCursor();
+			QApplication::beep();
+			pairwiseRegistrationDialog->showResults(
+				pairwiseRegistration->getTransformation(), 
+				pairwiseRegistration->getRMSError(),
+				pairwiseRegistration->getSquareErrors().size());
+		}
+	}
+
 	if(parameters["command"] == "Export")
 	{
 		if (pairwiseRegistration == NULL)
@@ -2005,7 +2052,7 @@ void MainWindow::on_globalRegistrationDialog_sendParameters(QVariantMap paramete
 		cycleRegistrationManager->addCycleRegistration(prList);
 	}
 
-	if (parameters["command"] == "UniformRefine")
+	if (parameters["command"] == "UniformRefine" || parameters["command"] == "MinimizeRefine")
 	{
 		//qDebug() << "make circle consistent";
 
@@ -2028,7 +2075,28 @@ void MainWindow::on_globalRegistrationDialog_sendParameters(QVariantMap paramete
 		}
 		else
 		{
-			cycleRegistration->uniform_refine();
+			// the checked pairs of the dialog keep their transformations during this refinement only, the freeze flags of
+			// the pairs are given back afterwards
+			QList<PairwiseRegistration*> pairwiseRegistrations;
+			QList<bool> oldFreezeds;
+			for (int i = 0; i < targets.size(); ++i)
+			{
+				QString prName = PairwiseRegistration::generateName(targets[i], sources[i]);
+				PairwiseRegistration *pairwiseRegistration = pairwiseRegistrationManager->getPairwiseRegistration(prName);
+				if (pairwiseRegistration == NULL) continue;
+				pairwiseRegistrations.append(pairwiseRegistration);
+				oldFreezeds.append(pairwiseRegistration->getFreezed());
+				pairwiseRegistration->setFreezed(freezeds[i]);
+			}
+
+			// the pairs are minimized with the correspondence settings of the pairwise registration dialog
+			CorrespondencesComputationParameters correspondencesComputationParameters = 
+				PairwiseRegistration::correspondencesComputationParametersFrom(pairwiseRegistrationDialog->getCorrespondencesParameters());
+
+			if (parameters["command"] == "MinimizeRefine") cycleRegistration->refine(MINIMIZE_REFINE, correspondencesComputationParameters);
+			else cycleRegistration->refine(UNIFORM_REFINE, correspondencesComputationParameters);
+
+			for (int i = pairwiseRegistrations.size() - 1; i >= 0; --i) pairwiseRegistrations[i]->setFreezed(oldFreezeds[i]);
 		}
 	}
 
@@ -2063,16 +2131,24 @@ void MainWindow::on_globalRegistrationDialog_sendParameters(QVariantMap paramete
 		float error1 = 0.0f, error2 = 0.0f;
 		int ovlNumber1 = 0, ovlNumber2 = 0;
 
+		// the errors are estimated with the correspondence settings of the pairwise registration dialog
+		CorrespondencesComputationParameters correspondencesComputationParameters = 
+			PairwiseRegistration::correspondencesComputationParametersFrom(pairwiseRegistrationDialog->getCorrespondencesParameters());
+
 		if(pairwiseRegistration) 
 		{
 			//std::cerr << (transformation_total * transformationList.back().inverse()).inverse() << std::endl;
-			pairwiseRegistration->estimateRMSErrorByTransformation((transformation_total * transformationList.back().inverse()).inverse(), error1, ovlNumber1);
-			pairwiseRegistration->estimateVirtualRMSErrorByTransformation((transformation_total * transformationList.back().inverse()).inverse(), error2, ovlNumber2);
+			pairwiseRegistration->estimateRMSErrorByTransformation((transformation_total * transformationList.back().inverse()).inverse(), 
+				correspondencesComputationParameters, error1, ovlNumber1);
+			pairwiseRegistration->estimateVirtualRMSErrorByTransformation((transformation_total * transformationList.back().inverse()).inverse(), 
+				correspondencesComputationParameters, error2, ovlNumber2);
 		}
 		else
 		{
-			reversePairwiseRegistration->estimateRMSErrorByTransformation(transformation_total * transformationList.back().inverse(), error1, ovlNumber1);
-			reversePairwiseRegistration->estimateVirtualRMSErrorByTransformation(transformation_total * transformationList.back().inverse(), error2, ovlNumber2);
+			reversePairwiseRegistration->estimateRMSErrorByTransformation(transformation_total * transformationList.back().inverse(), 
+				correspondencesComputationParameters, error1, ovlNumber1);
+			reversePairwiseRegistration->estimateVirtualRMSErrorByTransformation(transformation_total * transformationList.back().inverse(), 
+				correspondencesComputationParameters, error2, ovlNumber2);
 		} 
 		globalRegistrationDialog->showEstimation(transformation_total, error1, error2, ovlNumber1, ovlNumber2);
 
@@ -2147,7 +2223,7 @@ void MainWindow::on_tang2014Dialog_sendParameters(QVariantMap parameters) {
 
 		scanPtr->transformation = cloudList[i]->getRegistrationTransformation();
 		scanPtr->pointsPtr.reset(new tang2014::Points);
-		pcl::transformPointCloudWithNormals(*cloudList[i]->getCloudData(), *scanPtr->pointsPtr, scanPtr->transformation);
+		transformCloudWithNormals(*cloudList[i]->getCloudData(), *scanPtr->pointsPtr, scanPtr->transformation);
 		scanPtr->boundariesPtr = cloudList[i]->getBoundaries();
 		scanPtr->filePath = cloudList[i]->getFileName().toStdString();
 	}
@@ -2195,22 +2271,31 @@ void MainWindow::dropEvent(QDropEvent *event) {
 			CloudDataPtr cloudData(new CloudData);
 			Eigen::Matrix4f transformation;
 			BoundariesPtr boundaries(new Boundaries);
+			std::vector<int> order;
+			std::vector<int> *orderPtr = mortonOrderAction->isChecked() ? &order : NULL;
 			QApplication::setOverrideCursor(Qt::WaitCursor);
 			if ( CloudIO::importPLYPolygonMesh(fileName, polygonMesh) )
 			{
 				pcl::fromPCLPointCloud2(polygonMesh->cloud, *cloudData);
+				if (orderPtr && !cloudData->isOrganized())
+				{
+					computeMortonOrder(*cloudData, order);
+					applyOrder(*cloudData, order);
+					applyOrder(polygonMesh->polygons, order);
+				}
 			}
-			else if ( !CloudIO::importPLYCloudData(fileName, cloudData) ) 
+			else if ( !CloudIO::importPLYCloudData(fileName, cloudData, orderPtr) ) 
 			{
 				it++;
 				continue;
 			}
 			CloudIO::importTransformation(fileName, transformation);
-			CloudIO::importBoundaries(fileName, boundaries);
+			CloudIO::importBoundaries(fileName, boundaries, orderPtr);
 			QApplication::restoreOverrideCursor();
 			QApplication::beep();
 			Cloud* cloud = cloudManager->addCloud(cloudData, polygonMesh->polygons, Cloud::fromIO, fileName, transformation);
 			cloud->setBoundaries(boundaries);
+			cloud->setFileOrder(order);
 			cloudBrowser->addCloud(cloud);
 			cloudVisualizer->addCloud(cloud);
 			cloudVisualizer->resetCamera(cloud);
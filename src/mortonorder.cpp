@@ -0,0 +1,83 @@
+#include <omp.h>
+#include <algorithm>
+
+#include "../include/mortonorder.h"
+
+using namespace registar;
+
+namespace
+{
+	// spreads the lower 21 bits of v so that two zero bits follow each of them
+	inline unsigned long long splitBy3(unsigned long long v)
+	{
+		v &= 0x1fffffULL;
+		v = (v | (v << 32)) & 0x1f00000000ffffULL;
+		v = (v | (v << 16)) & 0x1f0000ff0000ffULL;
+		v = (v | (v << 8)) & 0x100f00f00f00f00fULL;
+		v = (v | (v << 4)) & 0x10c30c30c30c30c3ULL;
+		v = (v | (v << 2)) & 0x1249249249249249ULL;
+		return v;
+	}
+}
+
+void registar::computeMortonOrder(const CloudData &cloudData, std::vector<int> &order)
+{
+	int size = static_cast<int>(cloudData.size());
+
+	Eigen::Vector3f minimum = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+	Eigen::Vector3f maximum = -minimum;
+	for (int i = 0; i < size; ++i)
+	{
+		const PointType &point = cloudData[i];
+		if ( !pcl_isfinite(point.x) || !pcl_isfinite(point.y) || !pcl_isfinite(point.z) ) continue;
+		minimum = minimum.cwiseMin(point.getVector3fMap());
+		maximum = maximum.cwiseMax(point.getVector3fMap());
+	}
+	float extent = (maximum - minimum).maxCoeff();
+	float scale = extent > 0.0f ? 2097151.0f / extent : 0.0f;
+
+	// non-finite points get the largest code, ties are broken by the index so they keep their order
+	std::vector<std::pair<unsigned long long, int> > codes(size);
+	int threads = omp_get_num_procs();
+	#pragma omp parallel for schedule (dynamic,1000) num_threads (threads)
+	for (int i = 0; i < size; ++i)
+	{
+		const PointType &point = cloudData[i];
+		unsigned long long code = ~0ULL;
+		if ( pcl_isfinite(point.x) && pcl_isfinite(point.y) && pcl_isfinite(point.z) )
+		{
+			Eigen::Vector3f q = (point.getVector3fMap() - minimum) * scale;
+			code = splitBy3(static_cast<unsigned long long>(q.x())) |
+				(splitBy3(static_cast<unsigned long long>(q.y())) << 1) |
+				(splitBy3(static_cast<unsigned long long>(q.z())) << 2);
+		}
+		codes[i] = std::make_pair(code, i);
+	}
+	std::sort(codes.begin(), codes.end());
+
+	order.resize(size);
+	for (int i = 0; i < size; ++i) order[i] = codes[i].second;
+}
+
+void registar::applyOrder(Polygons &polygons, const std::vector<int> &order)
+{
+	std::vector<int> inverse;
+	invertOrder(order, inverse);
+	for (int i = 0; i < polygons.size(); ++i)
+		for (int j = 0; j < polygons[i].vertices.size(); ++j)
+			polygons[i].vertices[j] = inverse[polygons[i].vertices[j]];
+}
+
+void registar::restoreOrder(const Polygons &ordered, const std::vector<int> &order, Polygons &polygons)
+{
+	polygons = ordered;
+	for (int i = 0; i < polygons.size(); ++i)
+		for (int j = 0; j < polygons[i].vertices.size(); ++j)
+			polygons[i].vertices[j] = order[polygons[i].vertices[j]];
+}
+
+void registar::invertOrder(const std::vector<int> &order, std::vector<int> &inverse)
+{
+	inverse.resize(order.size());
+	for (int i = 0; i < order.size(); ++i) inverse[order[i]] = i;
+}
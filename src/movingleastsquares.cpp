@@ -13,6 +13,11 @@ MovingLeastSquares::MovingLeastSquares(){}
 MovingLeastSquares::~MovingLeastSquares(){}
 
 void MovingLeastSquares::filter(CloudDataConstPtr &cloudData, QVariantMap parameters, CloudDataPtr &cloudData_filtered)
+{
+	filter(cloudData, parameters, KdTreePtr(), cloudData_filtered);
+}
+
+void MovingLeastSquares::filter(CloudDataConstPtr &cloudData, QVariantMap parameters, KdTreePtr tree, CloudDataPtr &cloudData_filtered)
 {
 	pcl::MovingLeastSquares2<PointType, PointType>::UpsamplingMethod method = 
 	(pcl::MovingLeastSquares2<PointType,PointType>::UpsamplingMethod)(parameters["method"].toInt());
@@ -66,7 +71,7 @@ void MovingLeastSquares::filter(CloudDataConstPtr &cloudData, QVariantMap parame
 	}
 
 	//pcl::MovingLeastSquaresOMP2<PointType, PointType> mls(8);
-	pcl::search::KdTree<PointType>::Ptr tree (new pcl::search::KdTree<PointType>);
+	if (!tree) tree.reset(new KdTree);
 	mls->setSearchMethod(tree);
 	mls->setPolynomialFit(true);
 	mls->setInputCloud(cloudData);
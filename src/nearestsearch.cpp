@@ -0,0 +1,23 @@
+#include <omp.h>
+
+#include "../include/nearestsearch.h"
+
+using namespace registar;
+
+void NearestSearch::nearest(const CloudData &queries, std::vector<int> &matches, std::vector<float> &sqrDistances, int threads)
+{
+	int size = static_cast<int>(queries.size());
+	matches.resize(size);
+	sqrDistances.resize(size);
+
+	#pragma omp parallel for schedule (dynamic,1000) num_threads (threads)
+	for (int i = 0; i < size; ++i)
+	{
+		const PointType &query = queries[i];
+		if ( !pcl_isfinite(query.x) || !pcl_isfinite(query.y) || !pcl_isfinite(query.z) || !nearest(i, query, matches[i], sqrDistances[i]) )
+		{
+			matches[i] = -1;
+			sqrDistances[i] = std::numeric_limits<float>::infinity();
+		}
+	}
+}
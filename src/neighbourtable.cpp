@@ -0,0 +1,52 @@
+#include <omp.h>
+
+#include "../include/neighbourtable.h"
+
+using namespace registar;
+
+NeighbourTable::NeighbourTable() : K(0) {}
+
+NeighbourTable::~NeighbourTable(){}
+
+void NeighbourTable::build(CloudDataConstPtr cloudData, KdTreePtr tree, int K)
+{
+	this->cloudData = cloudData;
+	this->K = K;
+
+	int size = static_cast<int>(cloudData->size());
+	indices.assign(static_cast<size_t>(size) * K, -1);
+	sqrDistances.assign(static_cast<size_t>(size) * K, 0.0f);
+	neighbourNumbers.assign(size, 0);
+
+	int threads = omp_get_num_procs();
+
+	#pragma omp parallel num_threads (threads)
+	{
+		std::vector<int> indices_temp(K + 1);
+		std::vector<float> sqrDistances_temp(K + 1);
+
+		#pragma omp for schedule (dynamic,1000)
+		for (int i = 0; i < size; ++i)
+		{
+			const PointType &point = (*cloudData)[i];
+			if ( !pcl_isfinite(point.x) || !pcl_isfinite(point.y) || !pcl_isfinite(point.z) ) continue;
+
+			// the first result is the point itself, or a duplicate at the same distance
+			int found = tree->nearestKSearch(point, K + 1, indices_temp, sqrDistances_temp);
+			if (found < 1) continue;
+
+			size_t row = static_cast<size_t>(i) * K;
+			for (int j = 1; j < found; ++j)
+			{
+				indices[row + j - 1] = indices_temp[j];
+				sqrDistances[row + j - 1] = sqrDistances_temp[j];
+			}
+			neighbourNumbers[i] = found - 1;
+		}
+	}
+}
+
+bool NeighbourTable::covers(CloudDataConstPtr cloudData, int K) const
+{
+	return cloudData && this->cloudData.lock() == cloudData && this->K >= K;
+}
@@ -1,7 +1,10 @@
 #include <QtCore/QDebug>
+#include <omp.h>
 
 #define PCL_NO_PRECOMPILE
+#include <pcl/common/eigen.h>
 
+#include "../include/qtbase.h"
 #include "../include/normalfield.h"
 #include "../include/utilities.h"
 
@@ -12,6 +15,11 @@ NormalField::NormalField(){}
 NormalField::~NormalField(){}
 
 void NormalField::filter(CloudDataConstPtr &cloudData, QVariantMap parameters, CloudDataPtr &cloudData_filtered)
+{
+	filter(cloudData, parameters, KdTreePtr(), NeighbourTableConstPtr(), cloudData_filtered);
+}
+
+void NormalField::filter(CloudDataConstPtr &cloudData, QVariantMap parameters, KdTreePtr tree, NeighbourTableConstPtr neighbourTable, CloudDataPtr &cloudData_filtered)
 {
 	float X = parameters["X"].toFloat();
 	float Y = parameters["Y"].toFloat();
@@ -30,12 +38,131 @@ void NormalField::filter(CloudDataConstPtr &cloudData, QVariantMap parameters, C
 	view_point.y = Y;
 	view_point.z = Z;
 
-	if (method == 0)
+	// scanner pose expressed in the frame of cloudData, see Cloud::getScannerPose
+	if (method == 2 || method == 5)
+	{
+		Eigen::Matrix4f scannerPose = Eigen::Matrix4f::Identity();
+		if (parameters.contains("scannerPose")) scannerPose = parameters["scannerPose"].value<Eigen::Matrix4f>();
+		view_point.x = scannerPose(0, 3);
+		view_point.y = scannerPose(1, 3);
+		view_point.z = scannerPose(2, 3);
+
+		qDebug() << "Scanner Viewpoint : " << view_point.x << view_point.y << view_point.z;
+	}
+
+	if (method == 0 || method == 2)
 	{
 		flipPointCloudNormalsTowardsViewpoint(*cloudData, view_point, *cloudData_filtered);
 	} else if (method == 3){
 		setPointCloudNormalsTowardsViewpoint(*cloudData, view_point, *cloudData_filtered);
+	} else if (method == 4 || method == 5){
+		int neighbourhood = parameters["neighbourhood"].toInt();
+		int nearestK = parameters["nearestK"].toInt();
+		float searchRadius = parameters["searchRadius"].toFloat();
+		if (neighbourhood == 0) searchRadius = 0.0f;
+
+		qDebug() << "Neighbourhood : " << (neighbourhood == 0 ? "kNN" : "radius");
+		qDebug() << "NearestK : " << nearestK;
+		qDebug() << "SearchRadius : " << searchRadius;
+
+		// a table holding every kNN neighbourhood makes the tree unnecessary
+		bool use_tree = searchRadius > 0.0f || !neighbourTable || !neighbourTable->covers(cloudData, std::max(nearestK, 3) - 1);
+		if (use_tree && (!tree || tree->getInputCloud() != cloudData))
+		{
+			tree.reset(new KdTree);
+			tree->setInputCloud(cloudData);
+		}
+		estimateNormals(cloudData, tree, neighbourTable, nearestK, searchRadius, view_point.getVector3fMap(), *cloudData_filtered);
 	}
 
 	qDebug() << "Cloud Size After : " << cloudData_filtered->size();
-}
\ No newline at end of file
+}
+
+void NormalField::estimateNormals(CloudDataConstPtr cloudData_ptr, KdTreePtr tree, NeighbourTableConstPtr neighbourTable, 
+	int nearestK, float searchRadius, const Eigen::Vector3f &viewpoint, CloudData &cloudData_estimated)
+{
+	const CloudData &cloudData = *cloudData_ptr;
+	if (&cloudData != &cloudData_estimated) cloudData_estimated = cloudData;
+	if (nearestK < 3) nearestK = 3;
+
+	// the table rows exclude the query point itself
+	bool use_table = false;
+	if (neighbourTable)
+	{
+		if (searchRadius > 0.0f) use_table = neighbourTable->covers(cloudData_ptr, 1);
+		else use_table = neighbourTable->covers(cloudData_ptr, nearestK - 1);
+	}
+	if (use_table) qDebug() << "Reuse Neighbour Table : K = " << neighbourTable->getK();
+
+	int threads = omp_get_num_procs();
+	int size = static_cast<int>(cloudData.size());
+
+	#pragma omp parallel num_threads (threads)
+	{
+		// scratch buffers are reused by all queries of a thread
+		std::vector<int> indices;
+		std::vector<float> distance2s;
+		indices.reserve(nearestK);
+		distance2s.reserve(nearestK);
+
+		#pragma omp for schedule (dynamic,1000)
+		for (int i = 0; i < size; ++i)
+		{
+			PointType &point = cloudData_estimated[i];
+			if ( !pcl_isfinite(point.x) || !pcl_isfinite(point.y) || !pcl_isfinite(point.z) ) continue;
+
+			int found;
+			if (use_table && (searchRadius <= 0.0f || neighbourTable->coversRadius(i, searchRadius)))
+			{
+				int n = neighbourTable->getNeighbourNumber(i);
+				if (searchRadius <= 0.0f) n = std::min(n, nearestK - 1);
+				const int *row_indices = neighbourTable->getIndices(i);
+				const float *row_sqrDistances = neighbourTable->getSqrDistances(i);
+				indices.resize(1);
+				indices[0] = i;
+				for (int j = 0; j < n; ++j)
+				{
+					if (searchRadius > 0.0f && row_sqrDistances[j] > searchRadius * searchRadius) break;
+					indices.push_back(row_indices[j]);
+				}
+				found = static_cast<int>(indices.size());
+			}
+			else if (searchRadius > 0.0f) found = tree->radiusSearch(cloudData[i], searchRadius, indices, distance2s);
+			else found = tree->nearestKSearch(cloudData[i], nearestK, indices, distance2s);
+
+			if (found < 3)
+			{
+				point.getNormalVector3fMap() = Eigen::Vector3f::Zero();
+				point.curvature = 0.0f;
+				continue;
+			}
+
+			// moments are taken relative to the query point to keep float accuracy for far scans,
+			// the padded 4-vectors let Eigen vectorize the outer product
+			Eigen::Vector4f center = cloudData[i].getVector4fMap();
+			center[3] = 0.0f;
+			Eigen::Vector4f sum = Eigen::Vector4f::Zero();
+			Eigen::Matrix4f sum2 = Eigen::Matrix4f::Zero();
+			for (int j = 0; j < found; ++j)
+			{
+				Eigen::Vector4f d = cloudData[indices[j]].getVector4fMap() - center;
+				d[3] = 0.0f;
+				sum += d;
+				sum2.noalias() += d * d.transpose();
+			}
+			float inv = 1.0f / static_cast<float>(found);
+			Eigen::Vector3f mean = sum.head<3>() * inv;
+			Eigen::Matrix3f covariance = sum2.topLeftCorner<3, 3>() * inv - mean * mean.transpose();
+
+			float eigen_value;
+			Eigen::Vector3f eigen_vector;
+			pcl::eigen33(covariance, eigen_value, eigen_vector);
+
+			float trace = covariance.trace();
+			point.curvature = (trace != 0.0f) ? fabsf(eigen_value / trace) : 0.0f;
+
+			if (eigen_vector.dot(viewpoint - point.getVector3fMap()) < 0.0f) eigen_vector = -eigen_vector;
+			point.getNormalVector3fMap() = eigen_vector;
+		}
+	}
+}
@@ -25,6 +25,9 @@ void NormalFieldDialog::on_applyButton_clicked()
 	parameters["Z"] = Z;
 	parameters["overwrite"] = overwrite;
 	parameters["method"] = method;
+	parameters["neighbourhood"] = neighbourhoodComboBox->currentIndex();
+	parameters["nearestK"] = nearestKSpinBox->value();
+	parameters["searchRadius"] = radiusDoubleSpinBox->value();
 
 	emit sendParameters(parameters);
 }
@@ -1,9 +1,9 @@
 #include <QtCore/QDebug>
 //#include "../include/qtbase.h"
+#include <omp.h>
 
 #define PCL_NO_PRECOMPILE
-#include <pcl/filters/radius_outlier_removal.h>
-#include <pcl/filters/statistical_outlier_removal.h>
+#include <pcl/common/io.h>
 
 #include "../include/outliersremoval.h" 
 
@@ -14,6 +14,20 @@ OutliersRemoval::OutliersRemoval(){}
 OutliersRemoval::~OutliersRemoval(){}
 
 void OutliersRemoval::filter(CloudDataConstPtr cloudData, QVariantMap parameters, CloudDataPtr &cloudData_inliers, CloudDataPtr &cloudData_outliers)
+{
+	NeighbourTablePtr neighbourTable;
+	filter(cloudData, parameters, neighbourTable, cloudData_inliers, cloudData_outliers);
+}
+
+void OutliersRemoval::filter(CloudDataConstPtr cloudData, QVariantMap parameters, CloudDataPtr &cloudData_filtered)
+{
+	CloudDataPtr cloudData_inliers, cloudData_outliers;
+	filter(cloudData, parameters, cloudData_inliers, cloudData_outliers);
+	cloudData_filtered = cloudData_inliers;
+}
+
+void OutliersRemoval::filter(CloudDataConstPtr cloudData, QVariantMap parameters, NeighbourTablePtr &neighbourTable, 
+	CloudDataPtr &cloudData_inliers, CloudDataPtr &cloudData_outliers)
 {
 	int method = parameters["method"].toInt();
 	float searchRadius = parameters["searchRadius"].toFloat(); 
@@ -27,45 +41,89 @@ void OutliersRemoval::filter(CloudDataConstPtr cloudData, QVariantMap parameters
 
 	qDebug() << "Cloud Size Before : " << cloudData->size();
 
-	CloudDataPtr cloudInliers(new CloudData), cloudOutliers(new CloudData);
+	int K = std::max(nearestK, 1);
+	if (neighbourTable && neighbourTable->covers(cloudData, K))
+	{
+		qDebug() << "Reuse Neighbour Table : K = " << neighbourTable->getK();
+	}
+	else
+	{
+		KdTreePtr tree(new KdTree);
+		tree->setInputCloud(cloudData);
+		neighbourTable.reset(new NeighbourTable);
+		neighbourTable->build(cloudData, tree, K);
+	}
+	const NeighbourTable &table = *neighbourTable;
+
+	int size = static_cast<int>(cloudData->size());
+	int threads = omp_get_num_procs();
+	std::vector<char> isInlier(size, 0);
+
 	switch(method)
 	{
 		case 0:
 		{
-			pcl::RadiusOutlierRemoval<PointType> ror;
-			ror.setInputCloud(cloudData);
-			ror.setRadiusSearch(searchRadius);
-			ror.setMinNeighborsInRadius(nearestK);
-			ror.setNegative(false);
-			ror.filter(*cloudInliers);
-			ror.setNegative(true);
-			ror.filter(*cloudOutliers);
+			// same decision as pcl::RadiusOutlierRemoval, the nearestK-th neighbour has to lie within searchRadius
+			float searchRadius2 = searchRadius * searchRadius;
+			#pragma omp parallel for schedule (dynamic,1000) num_threads (threads)
+			for (int i = 0; i < size; ++i)
+			{
+				const PointType &point = (*cloudData)[i];
+				if ( !pcl_isfinite(point.x) || !pcl_isfinite(point.y) || !pcl_isfinite(point.z) ) continue;
+				if (nearestK <= 0) isInlier[i] = 1;
+				else if (table.getNeighbourNumber(i) >= nearestK && table.getSqrDistances(i)[nearestK - 1] <= searchRadius2) isInlier[i] = 1;
+			}
 			break;
 		}
 		case 1:
 		{
-			pcl::StatisticalOutlierRemoval<PointType> sor;
-			sor.setInputCloud(cloudData);
-			sor.setMeanK(nearestK);
-			sor.setStddevMulThresh(deviation);
-			sor.setNegative(false);
-			sor.filter(*cloudInliers);
-			sor.setNegative(true);
-			sor.filter(*cloudOutliers);
+			// same statistics as pcl::StatisticalOutlierRemoval, non-finite points keep a zero mean distance; points with
+			// fewer than K neighbours average the ones they have, rather than look closer than they are
+			std::vector<float> distances(size, 0.0f);
+			double sum = 0.0, sq_sum = 0.0;
+			int valid = 0;
+			#pragma omp parallel for schedule (dynamic,1000) num_threads (threads) reduction (+:sum,sq_sum,valid)
+			for (int i = 0; i < size; ++i)
+			{
+				int n = std::min(table.getNeighbourNumber(i), K);
+				if (n == 0) continue;
+				const float *sqrDistances = table.getSqrDistances(i);
+				double dist_sum = 0.0;
+				for (int k = 0; k < n; ++k) dist_sum += sqrt(sqrDistances[k]);
+				distances[i] = static_cast<float>(dist_sum / n);
+				sum += distances[i];
+				sq_sum += distances[i] * distances[i];
+				valid++;
+			}
+
+			double mean = sum / static_cast<double>(valid);
+			double variance = (sq_sum - sum * sum / static_cast<double>(valid)) / (static_cast<double>(valid) - 1);
+			double stddev = sqrt(variance);
+			double distance_threshold = mean + deviation * stddev;
+
+			#pragma omp parallel for schedule (dynamic,1000) num_threads (threads)
+			for (int i = 0; i < size; ++i)
+			{
+				if (distances[i] <= distance_threshold) isInlier[i] = 1;
+			}
 			break;
 		}
 	}
 
+	std::vector<int> inliers_indices, outliers_indices;
+	for (int i = 0; i < size; ++i)
+	{
+		if (isInlier[i]) inliers_indices.push_back(i);
+		else outliers_indices.push_back(i);
+	}
+
+	CloudDataPtr cloudInliers(new CloudData), cloudOutliers(new CloudData);
+	pcl::copyPointCloud(*cloudData, inliers_indices, *cloudInliers);
+	pcl::copyPointCloud(*cloudData, outliers_indices, *cloudOutliers);
+
 	cloudData_inliers = cloudInliers;
 	cloudData_outliers = cloudOutliers;
 
 	qDebug() << "Cloud Inliers Size : " << cloudData_inliers->size();
 	qDebug() << "Cloud Outliers Size : " << cloudData_outliers->size();
 }
-
-void OutliersRemoval::filter(CloudDataConstPtr cloudData, QVariantMap parameters, CloudDataPtr &cloudData_filtered)
-{
-	CloudDataPtr cloudData_inliers, cloudData_outliers;
-	filter(cloudData, parameters, cloudData_inliers, cloudData_outliers);
-	cloudData_filtered = cloudData_inliers;
-}
@@ -1,12 +1,239 @@
 #include <QtCore/QDebug>
 #include <QtCore/QStringList>
 #include <pcl/common/transforms.h>
+#include <pcl/common/io.h>
+#include <omp.h>
 
 #include "../include/utilities.h"
 #include "../include/pairwiseregistration.h"
+#include "../include/bulktransform.h"
+#include "../include/umeyama.h"
 
 using namespace registar;
 
+namespace
+{
+	// appends the pairs passing the kernel in query order: flags first, then the output slots, then the pairs themselves
+	struct CorrespondencesCollector
+	{
+		CorrespondencesCollector(const CloudData &cloudData_target, const CloudData &cloudData_source,
+			const std::vector<int> &matches, const std::vector<float> &sqrDistances, const CorrespondenceTests &tests, int threads,
+			std::vector<int> &positions, Correspondences &correspondences, CorrespondenceIndices &correspondenceIndices,
+			const std::vector<int> *sourceIndices = NULL) :
+			cloudData_target(cloudData_target), cloudData_source(cloudData_source), matches(matches), sqrDistances(sqrDistances),
+			tests(tests), threads(threads), positions(positions), correspondences(correspondences), correspondenceIndices(correspondenceIndices),
+			sourceIndices(sourceIndices) {}
+
+		template <typename Kernel>
+		void run()
+		{
+			int size = static_cast<int>(matches.size());
+			positions.resize(size);
+			#pragma omp parallel for schedule (dynamic,1000) num_threads (threads)
+			for (int i = 0; i < size; ++i)
+			{
+				int match = matches[i];
+				positions[i] = match >= 0 && Kernel::accept(cloudData_source[i], cloudData_target[match], match, sqrDistances[i], tests);
+			}
+
+			int number = static_cast<int>(correspondences.size());
+			for (int i = 0; i < size; ++i)
+			{
+				int accepted = positions[i];
+				positions[i] = accepted ? number : -1;
+				number += accepted;
+			}
+			correspondences.resize(number);
+			correspondenceIndices.resize(number);
+
+			#pragma omp parallel for schedule (dynamic,1000) num_threads (threads)
+			for (int i = 0; i < size; ++i)
+			{
+				int position = positions[i];
+				if (position < 0) continue;
+				int match = matches[i];
+				Correspondence &correspondence = correspondences[position];
+				correspondence.sourcePoint = cloudData_source[i];
+				correspondence.targetPoint = cloudData_target[match];
+				correspondence.targetPoint.getVector3fMap() = Kernel::targetPosition(cloudData_source[i], cloudData_target[match]);
+				correspondenceIndices[position].sourceIndex = sourceIndices ? (*sourceIndices)[i] : i;
+				correspondenceIndices[position].targetIndex = match;
+			}
+		}
+
+		const CloudData &cloudData_target;
+		const CloudData &cloudData_source;
+		const std::vector<int> &matches;
+		const std::vector<float> &sqrDistances;
+		const CorrespondenceTests &tests;
+		int threads;
+		std::vector<int> &positions;
+		Correspondences &correspondences;
+		CorrespondenceIndices &correspondenceIndices;
+		const std::vector<int> *sourceIndices;   // index in the source of each query when the queries are a sample of it
+	};
+
+	// sums the square errors and numbers of the pairs passing the kernel under every transformation, per thread; the
+	// transformations of a point are visited in chain order so the search state of the point carries over
+	struct TransformationsScorer
+	{
+		TransformationsScorer(const CloudData &cloudData_target, const CloudData &cloudData_source, WarmStartSearch &search,
+			const std::vector<PointTransformer> &transformers, const std::vector<int> &order, const std::vector<float> &errorScales,
+			const CorrespondenceTests &tests, int threads, std::vector<double> &threadSums, std::vector<int> &threadCounts) :
+			cloudData_target(cloudData_target), cloudData_source(cloudData_source), search(search), transformers(transformers),
+			order(order), errorScales(errorScales), tests(tests), threads(threads), threadSums(threadSums), threadCounts(threadCounts) {}
+
+		template <typename Kernel>
+		void run()
+		{
+			int size = static_cast<int>(cloudData_source.size());
+			int number = static_cast<int>(transformers.size());
+			float threshold = Kernel::distanceTest ? std::sqrt(tests.sqrDistanceThreshold) : std::numeric_limits<float>::infinity();
+			#pragma omp parallel for schedule (dynamic,1000) num_threads (threads)
+			for (int i = 0; i < size; ++i)
+			{
+				const PointType &point = cloudData_source[i];
+				if ( !pcl_isfinite(point.x) || !pcl_isfinite(point.y) || !pcl_isfinite(point.z) ) continue;
+				double *sums = &threadSums[omp_get_thread_num() * number];
+				int *counts = &threadCounts[omp_get_thread_num() * number];
+
+				PointType query, previousQuery;
+				float lowerBound = 0.0f;   // of the distance from previousQuery to the target
+				for (int o = 0; o < number; ++o)
+				{
+					int k = order[o];
+					transformers[k].transform(point, query);
+					if (o > 0) lowerBound -= (query.getVector3fMap() - previousQuery.getVector3fMap()).norm();
+					previousQuery = query;
+					if (lowerBound >= threshold) continue;
+
+					int match;
+					float sqrDistance;
+					if (!search.nearest(i, query, match, sqrDistance))
+					{
+						lowerBound = 0.0f;
+						continue;
+					}
+					lowerBound = std::sqrt(sqrDistance);
+					if (!Kernel::accept(query, cloudData_target[match], match, sqrDistance, tests)) continue;
+					sums[k] += errorScales[k] * (query.getVector3fMap() - Kernel::targetPosition(query, cloudData_target[match])).squaredNorm();
+					++counts[k];
+				}
+			}
+		}
+
+		const CloudData &cloudData_target;
+		const CloudData &cloudData_source;
+		WarmStartSearch &search;
+		const std::vector<PointTransformer> &transformers;
+		const std::vector<int> &order;
+		const std::vector<float> &errorScales;
+		const CorrespondenceTests &tests;
+		int threads;
+		std::vector<double> &threadSums;
+		std::vector<int> &threadCounts;
+	};
+
+	// greedy chain over the transformations, each followed by the one moving the corners of the bounding box of the
+	// queries the least from where it put them, which bounds how far any query moves
+	void chainTransformations(const CloudData &queries, const Transformations &transformations, std::vector<int> &order)
+	{
+		Eigen::Vector3f minimum = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+		Eigen::Vector3f maximum = Eigen::Vector3f::Constant(-std::numeric_limits<float>::max());
+		for (int i = 0; i < queries.size(); ++i)
+		{
+			const PointType &point = queries[i];
+			if ( !pcl_isfinite(point.x) || !pcl_isfinite(point.y) || !pcl_isfinite(point.z) ) continue;
+			minimum = minimum.cwiseMin(point.getVector3fMap());
+			maximum = maximum.cwiseMax(point.getVector3fMap());
+		}
+		if (!(minimum.x() <= maximum.x())) minimum = maximum = Eigen::Vector3f::Zero();
+
+		Eigen::Matrix<float, 4, 8> corners;
+		for (int c = 0; c < 8; ++c)
+		{
+			corners.col(c) << (c & 1 ? maximum.x() : minimum.x()), (c & 2 ? maximum.y() : minimum.y()), (c & 4 ? maximum.z() : minimum.z()), 1.0f;
+		}
+		typedef Eigen::Matrix<float, 3, 8> Corners;
+		int number = static_cast<int>(transformations.size());
+		std::vector<Corners, Eigen::aligned_allocator<Corners> > moved(number);
+		for (int k = 0; k < number; ++k) moved[k] = transformations[k].topRows<3>() * corners;
+
+		order.clear();
+		std::vector<char> chained(number, 0);
+		for (int current = 0; current >= 0; )
+		{
+			order.push_back(current);
+			chained[current] = 1;
+			int next = -1;
+			float nextDistance = std::numeric_limits<float>::max();
+			for (int k = 0; k < number; ++k)
+			{
+				if (chained[k]) continue;
+				float distance = (moved[k] - moved[current]).colwise().norm().maxCoeff();
+				if (next < 0 || distance < nextDistance)
+				{
+					next = k;
+					nextDistance = distance;
+				}
+			}
+			current = next;
+		}
+	}
+
+	// the pairs from the source points under every transformation, or from the target points under their inverses
+	// for the reverse direction of a bidirectional score, whose errors are then measured in the target frame as well
+	void scoreDirection(RegistrationData *target, RegistrationData *source, const Transformations &transformations, bool inverse,
+		const CorrespondencesComputationParameters &correspondencesComputationParameters, std::vector<double> &sums, std::vector<int> &counts)
+	{
+		int number = static_cast<int>(transformations.size());
+		if (number == 0) return;
+		const CloudData &cloudData_source = *source->cloudData;
+
+		Transformations queryTransformations(number);
+		std::vector<PointTransformer> transformers;
+		std::vector<float> errorScales(number);
+		for (int k = 0; k < number; ++k)
+		{
+			queryTransformations[k] = inverse ? Eigen::Matrix4f(transformations[k].inverse()) : transformations[k];
+			transformers.push_back(PointTransformer(queryTransformations[k]));
+			errorScales[k] = inverse ? transformations[k].topLeftCorner<3, 3>().colwise().squaredNorm().mean() : 1.0f;
+		}
+		std::vector<int> order;
+		chainTransformations(cloudData_source, queryTransformations, order);
+
+		// the first transformation starts cold, the others from the match of the one before
+		WarmStartSearch search;
+		search.setTarget(target->cloudData, target->kdTree);
+		search.setQueryNumber(cloudData_source.size());
+		if (number > 1 && target->cloud && target->cloudDataVersion == target->cloud->getCloudDataVersion())
+			search.setNeighbourTable(target->cloud->getNeighbourTable(WarmStartSearch::neighbourNumber));
+
+		CorrespondenceTests tests;
+		float distanceThreshold = correspondencesComputationParameters.distanceThreshold;
+		tests.sqrDistanceThreshold = distanceThreshold * distanceThreshold;
+		tests.cosAngleThreshold = cosf(correspondencesComputationParameters.normalAngleThreshold / 180.0f * M_PI);
+		tests.boundaries = target->boundaries.get();
+
+		int threads = correspondencesComputationParameters.use_mcpu ? omp_get_num_procs() : 1;
+		std::vector<double> threadSums(threads * number, 0.0);
+		std::vector<int> threadCounts(threads * number, 0);
+		TransformationsScorer scorer(*target->cloudData, cloudData_source, search, transformers, order, errorScales, tests, threads,
+			threadSums, threadCounts);
+		dispatchCorrespondenceKernel(true, true, correspondencesComputationParameters.boundaryTest,
+			correspondencesComputationParameters.method == POINT_TO_PLANE, scorer);
+
+		for (int t = 0; t < threads; ++t)
+		{
+			for (int k = 0; k < number; ++k)
+			{
+				sums[k] += threadSums[t * number + k];
+				counts[k] += threadCounts[t * number + k];
+			}
+		}
+	}
+}
+
 PairwiseRegistration::PairwiseRegistration(RegistrationData *target, RegistrationData *source, 
 	QString registrationName, QObject *parent) : QObject(parent)
 {
@@ -55,44 +282,43 @@ void PairwiseRegistration::initializeTransformation(const Eigen::Matrix4f &trans
 	squareErrors_total.clear();
 }
 
-void PairwiseRegistration::process(QVariantMap parameters) {}
-
-void PairwiseRegistration::estimateRMSErrorByTransformation(const Eigen::Matrix4f &transformation, float &rmsError, int &ovlNumber)
+CorrespondencesComputationParameters PairwiseRegistration::correspondencesComputationParametersFrom(const QVariantMap &parameters)
 {
 	CorrespondencesComputationParameters correspondencesComputationParameters;
 
-	correspondencesComputationParameters.method = POINT_TO_PLANE;
-	correspondencesComputationParameters.distanceThreshold = 0.12f;
-	correspondencesComputationParameters.normalAngleThreshold = 45.0f;
-	correspondencesComputationParameters.boundaryTest = true;
-	correspondencesComputationParameters.biDirectional = true;
+	correspondencesComputationParameters.method = (CorrespondenceComputationMethod)parameters["method"].toInt();
+	correspondencesComputationParameters.distanceThreshold = parameters["distanceThreshold"].toFloat();
+	correspondencesComputationParameters.normalAngleThreshold = parameters["normalAngleThreshold"].toFloat();
+	correspondencesComputationParameters.boundaryTest = parameters["boundaryTest"].toBool();
+	correspondencesComputationParameters.biDirectional = parameters["biDirectional"].toBool();
+	correspondencesComputationParameters.searchMethod = (NearestNeighbourSearchMethod)parameters["searchMethod"].toInt();
+	correspondencesComputationParameters.sampling.method = NO_SAMPLING;
+	correspondencesComputationParameters.use_scpu = parameters["use_scpu"].toBool();
+	correspondencesComputationParameters.use_mcpu = parameters["use_mcpu"].toBool();
+	return correspondencesComputationParameters;
+}
 
-	CorrespondencesComputationData correspondencesComputationData;
-	Correspondences correspondences;
-	CorrespondenceIndices correspondenceIndices;
-	int inverseStartIndex;
-	preCorrespondences(target, source, transformation, 
-		correspondencesComputationParameters, correspondences, 
-		correspondenceIndices, inverseStartIndex, correspondencesComputationData);
+void PairwiseRegistration::process(QVariantMap parameters) {}
 
-	float rmsError_total;
-	std::vector<float> squareErrors_total;
-	computeSquareErrors(correspondences, squareErrors_total, rmsError_total);
+void PairwiseRegistration::estimateRMSErrorByTransformation(const Eigen::Matrix4f &transformation, 
+	const CorrespondencesComputationParameters &correspondencesComputationParameters, float &rmsError, int &ovlNumber)
+{
+	TransformationScores scores;
+	scoreTransformations(target, source, Transformations(1, transformation), correspondencesComputationParameters, scores);
 
-	rmsError = rmsError_total;
-	ovlNumber = squareErrors_total.size();
+	rmsError = scores[0].rmsError;
+	ovlNumber = scores[0].ovlNumber;
 }
 
-void PairwiseRegistration::estimateVirtualRMSErrorByTransformation(const Eigen::Matrix4f &transformation, float &rmsError, int &ovlNumber)
+void PairwiseRegistration::estimateRMSErrorByTransformations(const Transformations &transformations, 
+	const CorrespondencesComputationParameters &correspondencesComputationParameters, TransformationScores &scores)
 {
-	CorrespondencesComputationParameters correspondencesComputationParameters;
-
-	correspondencesComputationParameters.method = POINT_TO_PLANE;
-	correspondencesComputationParameters.distanceThreshold = 0.12f;
-	correspondencesComputationParameters.normalAngleThreshold = 45.0f;
-	correspondencesComputationParameters.boundaryTest = true;
-	correspondencesComputationParameters.biDirectional = true;	
+	scoreTransformations(target, source, transformations, correspondencesComputationParameters, scores);
+}
 
+void PairwiseRegistration::estimateVirtualRMSErrorByTransformation(const Eigen::Matrix4f &transformation, 
+	CorrespondencesComputationParameters correspondencesComputationParameters, float &rmsError, int &ovlNumber)
+{
 	CorrespondencesComputationData correspondencesComputationData;
 	Correspondences correspondences;
 	CorrespondenceIndices correspondenceIndices;
@@ -101,14 +327,21 @@ void PairwiseRegistration::estimateVirtualRMSErrorByTransformation(const Eigen::
 		correspondencesComputationParameters, correspondences, 
 		correspondenceIndices, inverseStartIndex, correspondencesComputationData);
 
-	for (int i = 0; i < inverseStartIndex; ++i)
-	{
-		correspondences[i].targetPoint = transformPointWithNormal(correspondences[i].sourcePoint, transformation * this->transformation.inverse());
-	}
-	for (int i = inverseStartIndex; i < correspondences.size(); ++i)
+	PointTransformer forwardTransformer(transformation * this->transformation.inverse());
+	PointTransformer sourceTransformer(this->transformation.inverse());
+	PointTransformer targetTransformer(transformation.inverse());
+	int size = static_cast<int>(correspondences.size());
+	int threads = omp_get_num_procs();
+	#pragma omp parallel for schedule (dynamic,1000) num_threads (threads) if (size >= transformParallelSize)
+	for (int i = 0; i < size; ++i)
 	{
-		correspondences[i].sourcePoint = transformPointWithNormal(correspondences[i].targetPoint, this->transformation.inverse());
-		correspondences[i].targetPoint = transformPointWithNormal(correspondences[i].targetPoint, transformation.inverse());
+		Correspondence &correspondence = correspondences[i];
+		if (i < inverseStartIndex) forwardTransformer.transform(correspondence.sourcePoint, correspondence.targetPoint);
+		else
+		{
+			sourceTransformer.transform(correspondence.targetPoint, correspondence.sourcePoint);
+			targetTransformer.transform(correspondence.targetPoint, correspondence.targetPoint);
+		}
 	}
 
 	float rmsError_total;
@@ -141,19 +374,19 @@ void PairwiseRegistration::preCorrespondences(RegistrationData *target, Registra
 			correspondencesComputationParameters_temp, correspondences, 
 			correspondenceIndices, inverseStartIndex_temp2, correspondencesComputationData);
 
-		for (int i = inverseStartIndex; i < correspondences.size(); ++i)
+		PointTransformer transformer(initialTransformation);
+		int size = static_cast<int>(correspondences.size());
+		int threads = omp_get_num_procs();
+		#pragma omp parallel for schedule (dynamic,1000) num_threads (threads) if (size - inverseStartIndex >= transformParallelSize)
+		for (int i = inverseStartIndex; i < size; ++i)
 		{
-			Correspondence correspondence = correspondences[i];
-			Correspondence correspondence_inverse;
-			correspondence_inverse.sourcePoint = transformPointWithNormal(correspondence.targetPoint, initialTransformation);
-			correspondence_inverse.targetPoint = transformPointWithNormal(correspondence.sourcePoint, initialTransformation);
-			correspondences[i] = correspondence_inverse;
-
-			CorrespondenceIndex correspondenceIndex = correspondenceIndices[i];
-			CorrespondenceIndex correspondenceIndex_inverse;
-			correspondenceIndex_inverse.sourceIndex = correspondenceIndex.targetIndex;
-			correspondenceIndex_inverse.targetIndex = correspondenceIndex.sourceIndex;
-			correspondenceIndices[i] = correspondenceIndex_inverse;
+			Correspondence &correspondence = correspondences[i];
+			std::swap(correspondence.sourcePoint, correspondence.targetPoint);
+			transformer.transform(correspondence.sourcePoint, correspondence.sourcePoint);
+			transformer.transform(correspondence.targetPoint, correspondence.targetPoint);
+
+			CorrespondenceIndex &correspondenceIndex = correspondenceIndices[i];
+			std::swap(correspondenceIndex.sourceIndex, correspondenceIndex.targetIndex);
 		}
 	}
 	else if(correspondencesComputationParameters.method != DIRECT_POINT_PAIR)
@@ -163,297 +396,84 @@ void PairwiseRegistration::preCorrespondences(RegistrationData *target, Registra
 		BoundariesConstPtr boundaries_target = target->boundaries;
 		CloudData &cloudData_source = *source->cloudData;
 
-		CloudData &cloudData_source_dynamic = correspondencesComputationData.cloudData_source_dynamic;		
-		pcl::transformPointCloudWithNormals(cloudData_source, cloudData_source_dynamic, initialTransformation);
+		CorrespondencesSearches &searches = correspondencesComputationData.getSearches(target->cloudData);
+		WarmStartSearch &warmStartSearch = searches.warmStartSearch;
 
-		pcl::Correspondences &pcl_correspondences = correspondencesComputationData.pcl_correspondences;
-		pcl::Correspondences &pcl_correspondences_temp = correspondencesComputationData.pcl_correspondences_temp;
-
-		bool use_omp = correspondencesComputationParameters.use_mcpu;
-		if ( use_omp )
+		// only the sampled source points are queried, their previous matches are of other points once resampled
+		CloudData &cloudData_source_dynamic = correspondencesComputationData.cloudData_source_dynamic;
+		const std::vector<int> *sourceIndices = NULL;
+		if (correspondencesComputationParameters.sampling.method != NO_SAMPLING)
 		{
-			int _threads = omp_get_num_procs();
-			std::cout << _threads << " threads" << std::endl;
-			std::vector<pcl::Correspondences> pcl_correspondences_temp_in_threads(_threads);
-
-			pcl_correspondences_temp.clear();
-			#pragma omp parallel for schedule (dynamic,1000) num_threads (_threads)
-			for (int i = 0; i < cloudData_source_dynamic.size(); ++i)
-			{
-				int tn = omp_get_thread_num();
-
-				PointType point = cloudData_source_dynamic[i];
-				if ( pcl_isnan(point.x) || pcl_isnan(point.y) || pcl_isnan(point.z) ) continue;
-				int K = 1;
-				std::vector<int> indices(K);
-				std::vector<float> distance2s(K);
-				if (tree_target->nearestKSearch(point, K, indices, distance2s) > 0)
-				{
-					pcl::Correspondence temp;
-					temp.index_query = i;
-					temp.index_match = indices[0];
-					//temp.distance = sqrtf(distance2s[0]);
-					temp.distance = distance2s[0];
-					pcl_correspondences_temp_in_threads[tn].push_back(temp);
-				}
-			}
-			for (int i = 0; i < pcl_correspondences_temp_in_threads.size(); i++)
-			{
-				pcl_correspondences_temp.insert(pcl_correspondences_temp.end(), pcl_correspondences_temp_in_threads[i].begin(), pcl_correspondences_temp_in_threads[i].end());
-				pcl_correspondences_temp_in_threads[i].clear();
-			}
-			pcl_correspondences.swap(pcl_correspondences_temp);
-
-			//std::cerr << pcl_correspondences.size() << std::endl;
-
-			float normalAngleThreshold = correspondencesComputationParameters.normalAngleThreshold;
-			float NAthreshold = cosf(normalAngleThreshold / 180.0f * M_PI);
-			float distanceThreshold = correspondencesComputationParameters.distanceThreshold;
-			float distanceThreshold2 = distanceThreshold * distanceThreshold;
-			pcl_correspondences_temp.clear();
-			#pragma omp parallel for schedule (dynamic,1000) num_threads (_threads)
-			for (int i = 0; i < pcl_correspondences.size(); ++i)
-			{
-				int tn = omp_get_thread_num();
-
-				if (pcl_correspondences[i].distance < distanceThreshold2)
-				{
-					int index_query = pcl_correspondences[i].index_query;
-					int index_match = pcl_correspondences[i].index_match;
-
-					Eigen::Vector3f query_normal = cloudData_source_dynamic[index_query].getNormalVector3fMap();
-					Eigen::Vector3f match_normal = cloudData_target[index_match].getNormalVector3fMap();
+			searches.sampler.setParameters(correspondencesComputationParameters.sampling);
+			sourceIndices = &searches.sampler.sample(cloudData_source, NULL, correspondencesComputationData.iteration);
+			if (searches.sampler.isResampled()) warmStartSearch.reset();
+			pcl::copyPointCloud(cloudData_source, *sourceIndices, cloudData_source_dynamic);
+			transformCloudWithNormals(cloudData_source_dynamic, cloudData_source_dynamic, initialTransformation);
+		}
+		else transformCloudWithNormals(cloudData_source, cloudData_source_dynamic, initialTransformation);
 
-					if (query_normal.squaredNorm() == 0 || match_normal.squaredNorm() == 0) 
-						pcl_correspondences_temp_in_threads[tn].push_back(pcl_correspondences[i]);
-					else
-					{
-						query_normal.normalize();
-						match_normal.normalize();
-						if (query_normal.dot(match_normal) > NAthreshold)
-							pcl_correspondences_temp_in_threads[tn].push_back(pcl_correspondences[i]);
-					}
-				}
-			}
-			for (int i = 0; i < pcl_correspondences_temp_in_threads.size(); i++)
+		std::vector<int> &matches = correspondencesComputationData.matches;
+		std::vector<float> &sqrDistances = correspondencesComputationData.sqrDistances;
+		NearestSearch *search = &warmStartSearch;
+		switch (correspondencesComputationParameters.searchMethod)
+		{
+		case VOXELHASH_SEARCH:
 			{
-				pcl_correspondences_temp.insert(pcl_correspondences_temp.end(), pcl_correspondences_temp_in_threads[i].begin(), pcl_correspondences_temp_in_threads[i].end());
-				pcl_correspondences_temp_in_threads[i].clear();
+				// matches beyond the distance threshold are dropped below anyway, so a search bounded by it gives the same pairs,
+				// a threshold so large that the cells get crowded falls back to the KD-tree search below
+				if (searches.voxelHashSearch.setInputCloud(target->cloudData, correspondencesComputationParameters.distanceThreshold))
+					search = &searches.voxelHashSearch;
+				break;
 			}
-			pcl_correspondences.swap(pcl_correspondences_temp);
-
-			//std::cerr << pcl_correspondences.size() << std::endl;
-
-			if (correspondencesComputationParameters.boundaryTest)
+		case FLAT_KDTREE_SEARCH:
 			{
-				pcl_correspondences_temp.clear();
-				#pragma omp parallel for schedule (dynamic,1000) num_threads (_threads)
-				for (int i = 0; i < pcl_correspondences.size(); ++i)
-				{
-					int tn = omp_get_thread_num();
-					int index_match = pcl_correspondences[i].index_match;
-					if ((*boundaries_target)[index_match].boundary_point == 0)
-						pcl_correspondences_temp_in_threads[tn].push_back(pcl_correspondences[i]);
-				}
-				for (int i = 0; i < pcl_correspondences_temp_in_threads.size(); i++)
-				{
-					pcl_correspondences_temp.insert(pcl_correspondences_temp.end(), pcl_correspondences_temp_in_threads[i].begin(), pcl_correspondences_temp_in_threads[i].end());
-					pcl_correspondences_temp_in_threads[i].clear();
-				}
-				pcl_correspondences.swap(pcl_correspondences_temp);
+				searches.flatKdTree.setInputCloud(target->cloudData);
+				search = &searches.flatKdTree;
+				break;
 			}
-
-			//std::cerr << pcl_correspondences.size() << std::endl;
-
-			CorrespondenceComputationMethod method = correspondencesComputationParameters.method;
-			switch(method)
+		case PROJECTIVE_SEARCH:
 			{
-			case POINT_TO_POINT:
-				{
-					//Original ICP
-					for (int i = 0; i < pcl_correspondences.size(); ++i)
-					{
-						int query = pcl_correspondences[i].index_query;
-						int match = pcl_correspondences[i].index_match;
-
-						Correspondence correspondence_temp;
-						correspondence_temp.sourcePoint = cloudData_source_dynamic[query];
-						correspondence_temp.targetPoint = cloudData_target[match];
-						correspondences.push_back(correspondence_temp);
-
-						CorrespondenceIndex correspondenceIndex_temp;
-						correspondenceIndex_temp.sourceIndex = query;
-						correspondenceIndex_temp.targetIndex = match;
-						correspondenceIndices.push_back(correspondenceIndex_temp);
-					}
-					break;
-				}
-			case POINT_TO_PLANE:
-				{
-					//Point-Plane based ICP
-					for (int i = 0; i < pcl_correspondences.size(); ++i)
-					{
-						int query = pcl_correspondences[i].index_query;
-						int match = pcl_correspondences[i].index_match;
-
-						Correspondence correspondence_temp;
-						correspondence_temp.sourcePoint = cloudData_source_dynamic[query];
-
-						Eigen::Vector3f target_normal = cloudData_target[match].getNormalVector3fMap();
-						Eigen::Vector3f source_point = cloudData_source_dynamic[query].getVector3fMap();
-						Eigen::Vector3f target_point = cloudData_target[match].getVector3fMap();
-
-						if ( target_normal.squaredNorm() != 0)
-						{
-							target_normal.normalize();
-							target_point = source_point - (source_point - target_point).dot(target_normal) * target_normal;
-						}
-						correspondence_temp.targetPoint = cloudData_target[match];
-						correspondence_temp.targetPoint.getVector3fMap() = target_point;
-
-						correspondences.push_back(correspondence_temp);
-
-						CorrespondenceIndex correspondenceIndex_temp;
-						correspondenceIndex_temp.sourceIndex = query;
-						correspondenceIndex_temp.targetIndex = match;
-						correspondenceIndices.push_back(correspondenceIndex_temp);
-					}
-					break;
-				}
-			case POINT_TO_MLSSURFACE:
-				{
-					break;
-				}
+				// targets that are no organised pinhole images fall back to the KD-tree search below
+				if (searches.projectiveSearch.setInputCloud(target->cloudData))
+					search = &searches.projectiveSearch;
+				break;
 			}
+		default:
+			break;
 		}
-		else
+		if (search == &warmStartSearch)
 		{
-			pcl_correspondences_temp.clear();
-			for (int i = 0; i < cloudData_source_dynamic.size(); ++i)
-			{
-				PointType point = cloudData_source_dynamic[i];
-				if ( pcl_isnan(point.x) || pcl_isnan(point.y) || pcl_isnan(point.z) ) continue;
-				int K = 1;
-				std::vector<int> indices(K);
-				std::vector<float> distance2s(K);
-				if (tree_target->nearestKSearch(point, K, indices, distance2s) > 0)
-				{
-					pcl::Correspondence temp;
-					temp.index_query = i;
-					temp.index_match = indices[0];
-					//temp.distance = sqrtf(distance2s[0]);
-					temp.distance = distance2s[0];
-					pcl_correspondences_temp.push_back(temp);
-				}
-			}
-			pcl_correspondences.swap(pcl_correspondences_temp);
-
-			//std::cerr << pcl_correspondences.size() << std::endl;
-
-			float normalAngleThreshold = correspondencesComputationParameters.normalAngleThreshold;
-			float NAthreshold = cosf(normalAngleThreshold / 180.0f * M_PI);
-			float distanceThreshold = correspondencesComputationParameters.distanceThreshold;
-			float distanceThreshold2 = distanceThreshold * distanceThreshold;
-			pcl_correspondences_temp.clear();
-			for (int i = 0; i < pcl_correspondences.size(); ++i)
-			{
-				if (pcl_correspondences[i].distance < distanceThreshold2)
-				{
-					int index_query = pcl_correspondences[i].index_query;
-					int index_match = pcl_correspondences[i].index_match;
-
-					Eigen::Vector3f query_normal = cloudData_source_dynamic[index_query].getNormalVector3fMap();
-					Eigen::Vector3f match_normal = cloudData_target[index_match].getNormalVector3fMap();
-					if (query_normal.squaredNorm() == 0 || match_normal.squaredNorm() == 0)
-						pcl_correspondences_temp.push_back(pcl_correspondences[i]);
-					else
-					{
-						query_normal.normalize();
-						match_normal.normalize();
-						if (query_normal.dot(match_normal) > NAthreshold)
-							pcl_correspondences_temp.push_back(pcl_correspondences[i]);
-					}
+			// from the second call on, the matches of the previous call seed a walk over the neighbour table of the target,
+			// whose rows are unaffected by the rigid transformation of the registration data
+			warmStartSearch.setTarget(target->cloudData, tree_target);
+			warmStartSearch.setQueryNumber(cloudData_source_dynamic.size());
+			if (warmStartSearch.isWarm() && target->cloud && target->cloudDataVersion == target->cloud->getCloudDataVersion())
+				warmStartSearch.setNeighbourTable(target->cloud->getNeighbourTable(WarmStartSearch::neighbourNumber));
+		}
 
-				}
-			}
-			pcl_correspondences.swap(pcl_correspondences_temp);
+		int _threads = 1;
+		if ( correspondencesComputationParameters.use_mcpu )
+		{
+			_threads = omp_get_num_procs();
+			std::cout << _threads << " threads" << std::endl;
+		}
 
-			//std::cerr << pcl_correspondences.size() << std::endl;
+		search->nearest(cloudData_source_dynamic, matches, sqrDistances, _threads);
+		if (search == &warmStartSearch) warmStartSearch.setWarm();
 
-			if (correspondencesComputationParameters.boundaryTest)
-			{
-				pcl_correspondences_temp.clear();
-				for (int i = 0; i < pcl_correspondences.size(); ++i)
-				{
-					int index_match = pcl_correspondences[i].index_match;
-					if ((*boundaries_target)[index_match].boundary_point == 0)
-						pcl_correspondences_temp.push_back(pcl_correspondences[i]);
-				}
-				pcl_correspondences.swap(pcl_correspondences_temp);
-			}
+		CorrespondenceTests tests;
+		float distanceThreshold = correspondencesComputationParameters.distanceThreshold;
+		tests.sqrDistanceThreshold = distanceThreshold * distanceThreshold;
+		tests.cosAngleThreshold = cosf(correspondencesComputationParameters.normalAngleThreshold / 180.0f * M_PI);
+		tests.boundaries = boundaries_target.get();
 
-			//std::cerr << pcl_correspondences.size() << std::endl;
-
-			CorrespondenceComputationMethod method = correspondencesComputationParameters.method;
-			switch(method)
-			{
-			case POINT_TO_POINT:
-				{
-					//Original ICP
-					for (int i = 0; i < pcl_correspondences.size(); ++i)
-					{
-						int query = pcl_correspondences[i].index_query;
-						int match = pcl_correspondences[i].index_match;
-
-						Correspondence correspondence_temp;
-						correspondence_temp.sourcePoint = cloudData_source_dynamic[query];
-						correspondence_temp.targetPoint = cloudData_target[match];
-						correspondences.push_back(correspondence_temp);
-
-						CorrespondenceIndex correspondenceIndex_temp;
-						correspondenceIndex_temp.sourceIndex = query;
-						correspondenceIndex_temp.targetIndex = match;
-						correspondenceIndices.push_back(correspondenceIndex_temp);
-					}
-					break;
-				}
-			case POINT_TO_PLANE:
-				{
-					//Point-Plane based ICP
-					for (int i = 0; i < pcl_correspondences.size(); ++i)
-					{
-						int query = pcl_correspondences[i].index_query;
-						int match = pcl_correspondences[i].index_match;
-
-						Correspondence correspondence_temp;
-						correspondence_temp.sourcePoint = cloudData_source_dynamic[query];
-
-						Eigen::Vector3f target_normal = cloudData_target[match].getNormalVector3fMap();
-						Eigen::Vector3f source_point = cloudData_source_dynamic[query].getVector3fMap();
-						Eigen::Vector3f target_point = cloudData_target[match].getVector3fMap();
-
-						if ( target_normal.squaredNorm() != 0)
-						{
-							target_normal.normalize();
-							target_point = source_point - (source_point - target_point).dot(target_normal) * target_normal;
-						}
-						correspondence_temp.targetPoint = cloudData_target[match];
-						correspondence_temp.targetPoint.getVector3fMap() = target_point;
-
-						correspondences.push_back(correspondence_temp);
-
-						CorrespondenceIndex correspondenceIndex_temp;
-						correspondenceIndex_temp.sourceIndex = query;
-						correspondenceIndex_temp.targetIndex = match;
-						correspondenceIndices.push_back(correspondenceIndex_temp);
-					}
-					break;
-				}
-			case POINT_TO_MLSSURFACE:
-				{
-					break;
-				}
-			}
+		// the distance and angle tests always apply here, their thresholds default to values passing every pair
+		CorrespondenceComputationMethod method = correspondencesComputationParameters.method;
+		if (method == POINT_TO_POINT || method == POINT_TO_PLANE || method == SYMMETRIC_POINT_TO_PLANE || method == PLANE_TO_PLANE)
+		{
+			CorrespondencesCollector collector(cloudData_target, cloudData_source_dynamic, matches, sqrDistances, tests, _threads,
+				correspondencesComputationData.positions, correspondences, correspondenceIndices, sourceIndices);
+			dispatchCorrespondenceKernel(true, true, correspondencesComputationParameters.boundaryTest, method == POINT_TO_PLANE, collector);
 		}
 		inverseStartIndex = correspondenceIndices.size();
 	}
@@ -465,7 +485,7 @@ void PairwiseRegistration::preCorrespondences(RegistrationData *target, Registra
 		CloudData &cloudData_source = *source->cloudData;
 
 		CloudData &cloudData_source_dynamic = correspondencesComputationData.cloudData_source_dynamic;		
-		pcl::transformPointCloudWithNormals(cloudData_source, cloudData_source_dynamic, initialTransformation);
+		transformCloudWithNormals(cloudData_source, cloudData_source_dynamic, initialTransformation);
 
 		int point_pair_num = std::min(cloudData_target.size(), cloudData_source_dynamic.size());
 
@@ -499,30 +519,79 @@ Eigen::Matrix4f PairwiseRegistration::registAr(Correspondences &correspondences,
 	else
 	{
 
-		Eigen::Matrix<float, 3, Eigen::Dynamic> &cloud_src = pairwiseRegistrationComputationData.cloud_src;
-		Eigen::Matrix<float, 3, Eigen::Dynamic> &cloud_tgt = pairwiseRegistrationComputationData.cloud_tgt;
-
-		cloud_src.resize(Eigen::NoChange, correspondences.size());
-		cloud_tgt.resize(Eigen::NoChange, correspondences.size());
+		int size = static_cast<int>(correspondences.size());
+		int threads = omp_get_num_procs();
 
-		for (int i = 0; i < correspondences.size(); ++i)
+		// the pairs are in the frame of the current estimate, so their distances are the residuals it leaves; the plane
+		// solvers measure them along the target normal, point to plane pairs already lie on the tangent plane
+		const RobustParameters &robust = pairwiseRegistrationComputationParameters.robust;
+		bool alongNormal = pairwiseRegistrationComputationParameters.method == SYMMETRIC_ICP || 
+			pairwiseRegistrationComputationParameters.method == GENERALIZED_ICP;
+		std::vector<float> &weights = pairwiseRegistrationComputationData.weights;
+		if (isRobust(robust))
 		{
-			cloud_src(0, i) = correspondences[i].sourcePoint.x;
-			cloud_src(1, i) = correspondences[i].sourcePoint.y;
-			cloud_src(2, i) = correspondences[i].sourcePoint.z;
-
-			cloud_tgt(0, i) = correspondences[i].targetPoint.x;
-			cloud_tgt(1, i) = correspondences[i].targetPoint.y;
-			cloud_tgt(2, i) = correspondences[i].targetPoint.z;
+			std::vector<float> &residuals = pairwiseRegistrationComputationData.residuals;
+			residuals.resize(size);
+			weights.resize(size);
+			#pragma omp parallel for schedule (static) num_threads (threads) if (size >= transformParallelSize)
+			for (int i = 0; i < size; ++i)
+			{
+				Eigen::Vector3f difference = correspondences[i].targetPoint.getVector3fMap() - correspondences[i].sourcePoint.getVector3fMap();
+				Eigen::Vector3f normal = correspondences[i].targetPoint.getNormalVector3fMap();
+				float sqrNorm = normal.squaredNorm();
+				residuals[i] = alongNormal && sqrNorm > 0.0f ? std::abs(difference.dot(normal)) / std::sqrt(sqrNorm) : difference.norm();
+			}
+			computeRobustWeights(&residuals[0], size, robust, &weights[0], size >= transformParallelSize ? threads : 1);
 		}
+		else weights.assign(size, 1.0f);
+
+		// one pass over the pairs into per-thread moments about the first pair, nothing of size N is built
+		UmeyamaMoments moments(correspondences[0].sourcePoint.getVector3fMap().cast<double>(),
+			correspondences[0].targetPoint.getVector3fMap().cast<double>());
+		std::vector<UmeyamaMoments> &threadMoments = pairwiseRegistrationComputationData.threadMoments;
+		threadMoments.assign(threads, moments);
+		#pragma omp parallel for schedule (static) num_threads (threads) if (size >= transformParallelSize)
+		for (int i = 0; i < size; ++i)
+		{
+			threadMoments[omp_get_thread_num()].add(correspondences[i].sourcePoint.getVector3fMap(),
+				correspondences[i].targetPoint.getVector3fMap(), weights[i]);
+		}
+		for (int t = 0; t < threads; ++t) moments += threadMoments[t];
 
 		Eigen::Matrix4f transformation_matrix;
 		switch(pairwiseRegistrationComputationParameters.method)
 		{
 		case UMEYAMA:
 			{
-				transformation_matrix = pcl::umeyama (cloud_src, cloud_tgt, 
-					pairwiseRegistrationComputationParameters.allowScaling);
+				transformation_matrix = solveUmeyama(moments, pairwiseRegistrationComputationParameters.allowScaling);
+				break;
+			}
+		case SYMMETRIC_ICP:
+		case GENERALIZED_ICP:
+			{
+				// the linearised step about the centroids of the pairs, which the moments above give
+				if (!(moments.w > 0.0)) return Eigen::Matrix4f::Identity();
+				PlaneICPMoments planeMoments(moments.sourceReference + moments.sumSource / moments.w,
+					moments.targetReference + moments.sumTarget / moments.w);
+				PlaneICPMomentsVector &threadPlaneMoments = pairwiseRegistrationComputationData.threadPlaneMoments;
+				threadPlaneMoments.assign(threads, planeMoments);
+				bool symmetric = pairwiseRegistrationComputationParameters.method == SYMMETRIC_ICP;
+				#pragma omp parallel for schedule (static) num_threads (threads) if (size >= transformParallelSize)
+				for (int i = 0; i < size; ++i)
+				{
+					if (weights[i] == 0.0f) continue;
+					const PointType &sourcePoint = correspondences[i].sourcePoint;
+					const PointType &targetPoint = correspondences[i].targetPoint;
+					PlaneICPMoments &threadMoments = threadPlaneMoments[omp_get_thread_num()];
+					if (symmetric)
+						threadMoments.addSymmetric(sourcePoint.getVector3fMap(), sourcePoint.getNormalVector3fMap(),
+							targetPoint.getVector3fMap(), targetPoint.getNormalVector3fMap(), weights[i]);
+					else
+						threadMoments.addGeneralized(sourcePoint.getVector3fMap(), sourcePoint.getNormalVector3fMap(),
+							targetPoint.getVector3fMap(), targetPoint.getNormalVector3fMap(), weights[i]);
+				}
+				for (int t = 0; t < threads; ++t) planeMoments += threadPlaneMoments[t];
+				transformation_matrix = symmetric ? solveSymmetricICP(planeMoments) : solveGeneralizedICP(planeMoments);
 				break;
 			}
 		case SVD:
@@ -547,6 +616,7 @@ Eigen::Matrix4f PairwiseRegistration::icp(RegistrationData *target, Registration
 	Eigen::Matrix4f transformation_temp = initialTransformation;
 	for (int i = 0; i < iterationNumber; ++i)
 	{
+		correspondencesComputationData.iteration = i;
 		correspondences.clear();
 		preCorrespondences(target, source, transformation_temp, 
 			correspondencesComputationParameters, correspondences, 
@@ -557,6 +627,24 @@ Eigen::Matrix4f PairwiseRegistration::icp(RegistrationData *target, Registration
 	return transformation_temp;
 }
 
+void PairwiseRegistration::scoreTransformations(RegistrationData *target, RegistrationData *source, const Transformations &transformations,
+	const CorrespondencesComputationParameters &correspondencesComputationParameters, TransformationScores &scores)
+{
+	int number = static_cast<int>(transformations.size());
+	std::vector<double> sums(number, 0.0);
+	std::vector<int> counts(number, 0);
+	scoreDirection(target, source, transformations, false, correspondencesComputationParameters, sums, counts);
+	if (correspondencesComputationParameters.biDirectional)
+		scoreDirection(source, target, transformations, true, correspondencesComputationParameters, sums, counts);
+
+	scores.resize(number);
+	for (int k = 0; k < number; ++k)
+	{
+		scores[k].ovlNumber = counts[k];
+		scores[k].rmsError = counts[k] > 0 ? static_cast<float>(std::sqrt(sums[k] / counts[k])) : std::numeric_limits<float>::quiet_NaN();
+	}
+}
+
 void PairwiseRegistration::computeSquareErrors(Correspondences &correspondences, std::vector<float> &squareErrors_total, float &rmsError_total)
 {
 	squareErrors_total.clear();
@@ -25,19 +25,27 @@ void PairwiseRegistrationDialog::on_initializePushButton_clicked()
 	emit sendParameters(parameters);
 }
 
-void PairwiseRegistrationDialog::on_prePushButton_clicked()
+QVariantMap PairwiseRegistrationDialog::getCorrespondencesParameters()
 {
 	QVariantMap parameters;
-	parameters["target"] = targetComboBox->currentText();
-	parameters["source"] = sourceComboBox->currentText();
-	parameters["command"] = QString("Pre-Correspondences");
 	parameters["method"] = methodComboBox->currentIndex();
 	parameters["distanceThreshold"] = distanceDoubleSpinBox->value();
 	parameters["normalAngleThreshold"] = normalDoubleSpinBox->value();
 	parameters["boundaryTest"] = boundaryTestCheckBox->isChecked();
 	parameters["biDirectional"] = biDirectionalCheckBox->isChecked();
+	parameters["searchMethod"] = searchComboBox->currentIndex();
 	parameters["use_scpu"] = scpuRadioButton->isChecked();
 	parameters["use_mcpu"] = mcpuRadioButton->isChecked();
+	return parameters;
+}
+
+void PairwiseRegistrationDialog::on_prePushButton_clicked()
+{
+	QVariantMap parameters;
+	parameters["target"] = targetComboBox->currentText();
+	parameters["source"] = sourceComboBox->currentText();
+	parameters["command"] = QString("Pre-Correspondences");
+	parameters.unite(getCorrespondencesParameters());
 	emit sendParameters(parameters);
 }
 
@@ -52,8 +60,14 @@ void PairwiseRegistrationDialog::on_icpPushButton_clicked()
 	parameters["normalAngleThreshold"] = normalDoubleSpinBox->value();
 	parameters["boundaryTest"] = boundaryTestCheckBox->isChecked();
 	parameters["biDirectional"] = biDirectionalCheckBox->isChecked();
+	parameters["searchMethod"] = searchComboBox->currentIndex();
+	parameters["samplingMethod"] = samplingComboBox->currentIndex();
+	parameters["samplingRatio"] = samplingRatioDoubleSpinBox->value();
+	parameters["samplingRefresh"] = samplingRefreshSpinBox->value();
 	parameters["icpNumber"] = icpNumberSpinBox->value();
 	parameters["allowScaling"] = scalingCheckBox->isChecked();
+	parameters["overlapRatio"] = overlapRatioDoubleSpinBox->value();
+	parameters["robustKernel"] = robustKernelComboBox->currentIndex();
 	parameters["use_scpu"] = scpuRadioButton->isChecked();
 	parameters["use_mcpu"] = mcpuRadioButton->isChecked();
 	emit sendParameters(parameters);
@@ -77,6 +91,16 @@ void PairwiseRegistrationDialog::on_manualPushButton_clicked()
 	emit sendParameters(parameters);	
 }
 
+void PairwiseRegistrationDialog::on_coarsePushButton_clicked()
+{
+	QVariantMap parameters;
+	parameters["target"] = targetComboBox->currentText();
+	parameters["source"] = sourceComboBox->currentText();
+	parameters["command"] = QString("Coarse");
+	parameters["voxelSize"] = coarseVoxelDoubleSpinBox->value();
+	emit sendParameters(parameters);
+}
+
 void PairwiseRegistrationDialog::on_targetComboBox_currentIndexChanged(const QString &cloudName_target)
 {
 	QString cloudName_source = sourceComboBox->currentText();
@@ -1,7 +1,12 @@
+#include <QtCore/QDebug>
+#include <algorithm>
+
 #include <pcl/common/transforms.h>
 
 #include "../include/cloudvisualizer.h"
 #include "../include/pairwiseregistrationinteractor.h"
+#include "../include/bulktransform.h"
+#include "../include/coarsealignment.h"
 
 using namespace registar;
 
@@ -30,7 +35,7 @@ void PairwiseRegistrationInteractor::initializeTransformation(const Eigen::Matri
 	if(cloudVisualizer) cloudVisualizer->updateCloud(cloudData_target_temp, "target", 0, 0, 255);
 
 	CloudDataPtr cloudData_source_temp(new CloudData);
-	pcl::transformPointCloudWithNormals(*source->cloudData, *cloudData_source_temp, transformation);
+	transformCloudWithNormals(*source->cloudData, *cloudData_source_temp, transformation);
 	if(cloudVisualizer) cloudVisualizer->updateCloud(cloudData_source_temp, "source", 255, 0, 0);	
 }
 
@@ -46,15 +51,7 @@ void PairwiseRegistrationInteractor::process(QVariantMap parameters)
 
 	if (command == "Pre-Correspondences")
 	{
-		CorrespondencesComputationParameters correspondencesComputationParameters;
-
-		correspondencesComputationParameters.method = (CorrespondenceComputationMethod)parameters["method"].toInt();
-		correspondencesComputationParameters.distanceThreshold = parameters["distanceThreshold"].toFloat();
-		correspondencesComputationParameters.normalAngleThreshold = parameters["normalAngleThreshold"].toFloat();
-		correspondencesComputationParameters.boundaryTest = parameters["boundaryTest"].toBool();
-		correspondencesComputationParameters.biDirectional = parameters["biDirectional"].toBool();
-		correspondencesComputationParameters.use_scpu = parameters["use_scpu"].toBool();
-		correspondencesComputationParameters.use_mcpu = parameters["use_mcpu"].toBool();
+		CorrespondencesComputationParameters correspondencesComputationParameters = correspondencesComputationParametersFrom(parameters);
 
 		CorrespondencesComputationData correspondencesComputationData;
 		Correspondences correspondences;
@@ -76,13 +73,26 @@ void PairwiseRegistrationInteractor::process(QVariantMap parameters)
 		correspondencesComputationParameters.normalAngleThreshold = parameters["normalAngleThreshold"].toFloat();
 		correspondencesComputationParameters.boundaryTest = parameters["boundaryTest"].toBool();
 		correspondencesComputationParameters.biDirectional = parameters["biDirectional"].toBool();
+		correspondencesComputationParameters.searchMethod = (NearestNeighbourSearchMethod)parameters["searchMethod"].toInt();
+		correspondencesComputationParameters.sampling.method = (SamplingMethod)parameters["samplingMethod"].toInt();
+		correspondencesComputationParameters.sampling.ratio = parameters["samplingRatio"].toFloat();
+		correspondencesComputationParameters.sampling.refresh = parameters["samplingRefresh"].toUInt();
 		correspondencesComputationParameters.use_scpu = parameters["use_scpu"].toBool();
 		correspondencesComputationParameters.use_mcpu = parameters["use_mcpu"].toBool();
 
 		PairwiseRegistrationComputationParameters pairwiseRegistrationComputationParameters;
 
-		pairwiseRegistrationComputationParameters.method = UMEYAMA;
+		// the pairs of the matches themselves go to the solvers using both normals
+		switch (correspondencesComputationParameters.method)
+		{
+		case SYMMETRIC_POINT_TO_PLANE: pairwiseRegistrationComputationParameters.method = SYMMETRIC_ICP; break;
+		case PLANE_TO_PLANE: pairwiseRegistrationComputationParameters.method = GENERALIZED_ICP; break;
+		default: pairwiseRegistrationComputationParameters.method = UMEYAMA; break;
+		}
 		pairwiseRegistrationComputationParameters.allowScaling = parameters["allowScaling"].toBool();
+		pairwiseRegistrationComputationParameters.robust.overlapRatio = parameters["overlapRatio"].toFloat();
+		pairwiseRegistrationComputationParameters.robust.kernel = (RobustKernel)parameters["robustKernel"].toInt();
+		pairwiseRegistrationComputationParameters.robust.kernelWidth = 0.0f;
 		int iterationNumber = parameters["icpNumber"].toInt();
 
 		Eigen::Matrix4f transformation_temp = icp(target, source, transformation, 
@@ -90,6 +100,8 @@ void PairwiseRegistrationInteractor::process(QVariantMap parameters)
 
 		initializeTransformation(transformation_temp);
 
+		// the error map covers every point
+		correspondencesComputationParameters.sampling.method = NO_SAMPLING;
 		CorrespondencesComputationData correspondencesComputationData;
 		Correspondences correspondences;
 		CorrespondenceIndices correspondenceIndices;
@@ -101,6 +113,26 @@ void PairwiseRegistrationInteractor::process(QVariantMap parameters)
 		computeSquareErrors(correspondences, squareErrors_total, rmsError_total);		
 		renderErrorMap(correspondenceIndices, inverseStartIndex, squareErrors_total, false);
 	}
+	else if (command == "Coarse")
+	{
+		// a zero voxel size is estimated from the larger of the two clouds
+		float voxelSize = parameters["voxelSize"].toFloat();
+		if (voxelSize <= 0.0f) voxelSize = std::max(estimateCoarseVoxelSize(*target->cloudData), estimateCoarseVoxelSize(*source->cloudData));
+		CoarseAlignmentParameters coarseAlignmentParameters = defaultCoarseAlignmentParameters(voxelSize);
+
+		CoarseAlignmentFeatures targetFeatures, sourceFeatures;
+		targetFeatures.compute(*target->cloudData, coarseAlignmentParameters);
+		sourceFeatures.compute(*source->cloudData, coarseAlignmentParameters);
+		CoarseAlignmentResult result = coarseAlign(targetFeatures, sourceFeatures, coarseAlignmentParameters, transformation);
+
+		qDebug() << "Coarse Voxel Size : " << voxelSize;
+		qDebug() << "Coarse Inliers : " << result.inliers << " of " << result.matches << " in " << result.iterations << " iterations";
+		if (targetFeatures.missingNormals()) qWarning() << target->cloud->getCloudName() << " has no normals, estimate them before the coarse alignment";
+		if (sourceFeatures.missingNormals()) qWarning() << source->cloud->getCloudName() << " has no normals, estimate them before the coarse alignment";
+		if (!result.aligned) qWarning() << "Coarse alignment found nothing better than the current transformation";
+
+		initializeTransformation(result.transformation);
+	}
 	else if (command == "Export")
 	{
 		exportTransformation();
@@ -167,7 +199,7 @@ void PairwiseRegistrationInteractor::renderErrorMap(CorrespondenceIndices &corre
 	}
 
 	CloudDataPtr cloudData_source_temp(new CloudData);
-	pcl::transformPointCloudWithNormals(*source->cloudData, *cloudData_source_temp, transformation);
+	transformCloudWithNormals(*source->cloudData, *cloudData_source_temp, transformation);
 	if (mapping)
 	{
 		for (int i = 0; i < cloudData_source_temp->size(); ++i)
@@ -0,0 +1,57 @@
+#include <cmath>
+#include <limits>
+
+#include "../include/planeicp.h"
+
+using namespace registar;
+
+namespace
+{
+	// relative damping of the normal equations, enough to keep their unconstrained directions at zero
+	const double damping = 1e-9;
+
+	bool solveNormalEquations(const PlaneICPMoments &moments, Vector6d &x)
+	{
+		if (!(moments.w > 0.0)) return false;
+		Matrix6d ata = moments.ata;
+		ata.diagonal().array() += damping * ata.trace() + std::numeric_limits<double>::min();
+		x = ata.ldlt().solve(moments.atb);
+		return x.squaredNorm() < std::numeric_limits<double>::max();
+	}
+
+	Eigen::Matrix3d rotation(const Eigen::Vector3d &axis, double angle)
+	{
+		double norm = axis.norm();
+		if (!(norm > 0.0)) return Eigen::Matrix3d::Identity();
+		return Eigen::AngleAxisd(angle, axis / norm).toRotationMatrix();
+	}
+}
+
+Eigen::Matrix4f registar::solveSymmetricICP(const PlaneICPMoments &moments)
+{
+	Eigen::Matrix4f transformation = Eigen::Matrix4f::Identity();
+	Vector6d x;
+	if (!solveNormalEquations(moments, x)) return transformation;
+
+	// target reference, half rotation, translation scaled back, half rotation, source reference
+	double angle = std::atan(x.head<3>().norm());
+	Eigen::Matrix3d R = rotation(x.head<3>(), angle);
+	Eigen::Vector3d t = R * x.tail<3>() * std::cos(angle);
+	Eigen::Matrix3d RR = R * R;
+	transformation.block<3, 3>(0, 0) = RR.cast<float>();
+	transformation.block<3, 1>(0, 3) = (moments.targetReference + t - RR * moments.sourceReference).cast<float>();
+	return transformation;
+}
+
+Eigen::Matrix4f registar::solveGeneralizedICP(const PlaneICPMoments &moments)
+{
+	Eigen::Matrix4f transformation = Eigen::Matrix4f::Identity();
+	Vector6d x;
+	if (!solveNormalEquations(moments, x)) return transformation;
+
+	// the rotation is about the source reference
+	Eigen::Matrix3d R = rotation(x.head<3>(), x.head<3>().norm());
+	transformation.block<3, 3>(0, 0) = R.cast<float>();
+	transformation.block<3, 1>(0, 3) = (moments.sourceReference - R * moments.sourceReference + x.tail<3>()).cast<float>();
+	return transformation;
+}
@@ -0,0 +1,285 @@
+#include <omp.h>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <boost/random/mersenne_twister.hpp>
+#include <Eigen/StdVector>
+
+#include "../include/pointsampling.h"
+
+using namespace registar;
+
+namespace
+{
+	// cells per side of each of the six cube faces the normals are bucketed on
+	const int normalBucketResolution = 4;
+
+	// moves count random elements of values to its front
+	void partialShuffle(std::vector<int> &values, int count, boost::mt19937 &rng)
+	{
+		int size = static_cast<int>(values.size());
+		for (int i = 0; i < count && i < size - 1; ++i)
+		{
+			int j = i + static_cast<int>(rng() % static_cast<unsigned int>(size - i));
+			std::swap(values[i], values[j]);
+		}
+	}
+
+	inline bool validPoint(const PointType &point)
+	{
+		if ( !pcl_isfinite(point.x) || !pcl_isfinite(point.y) || !pcl_isfinite(point.z) ) return false;
+		if ( !pcl_isfinite(point.normal_x) || !pcl_isfinite(point.normal_y) || !pcl_isfinite(point.normal_z) ) return false;
+		return point.getNormalVector3fMap().squaredNorm() > 0.0f;
+	}
+
+	// the cube face the normal points at and the cell of the face, or -1 for points without a normal
+	int normalBucket(const PointType &point)
+	{
+		if (!validPoint(point)) return -1;
+		Eigen::Vector3f n = point.getNormalVector3fMap();
+		int axis;
+		n.cwiseAbs().maxCoeff(&axis);
+		float u = n[(axis + 1) % 3] / std::abs(n[axis]);
+		float v = n[(axis + 2) % 3] / std::abs(n[axis]);
+		int cu = std::min(normalBucketResolution - 1, static_cast<int>((u + 1.0f) * 0.5f * normalBucketResolution));
+		int cv = std::min(normalBucketResolution - 1, static_cast<int>((v + 1.0f) * 0.5f * normalBucketResolution));
+		int face = 2 * axis + (n[axis] < 0.0f ? 1 : 0);
+		return (face * normalBucketResolution + cu) * normalBucketResolution + cv;
+	}
+
+	struct ContributionGreater
+	{
+		explicit ContributionGreater(const float *contributions) : contributions(contributions) {}
+		inline bool operator()(int a, int b) const
+		{
+			return contributions[a] > contributions[b] || (contributions[a] == contributions[b] && a < b);
+		}
+		const float *contributions;
+	};
+
+	void uniformSampling(const std::vector<int> &candidates, int sampleSize, std::vector<int> &samples)
+	{
+		long long size = static_cast<long long>(candidates.size());
+		samples.resize(sampleSize);
+		for (int i = 0; i < sampleSize; ++i) samples[i] = candidates[static_cast<int>(i * size / sampleSize)];
+	}
+
+	void randomSampling(const std::vector<int> &candidates, int sampleSize, boost::mt19937 &rng, std::vector<int> &samples)
+	{
+		samples = candidates;
+		partialShuffle(samples, sampleSize, rng);
+		samples.resize(sampleSize);
+	}
+
+	void normalSpaceSampling(const CloudData &cloudData, const std::vector<int> &candidates, int sampleSize,
+		boost::mt19937 &rng, std::vector<int> &samples)
+	{
+		// counting sort of the candidates by bucket, the points without normals are left out
+		const int bucketNumber = 6 * normalBucketResolution * normalBucketResolution;
+		int size = static_cast<int>(candidates.size());
+		std::vector<int> buckets(size);
+		std::vector<int> offsets(bucketNumber + 1, 0);
+		for (int i = 0; i < size; ++i)
+		{
+			buckets[i] = normalBucket(cloudData[candidates[i]]);
+			if (buckets[i] >= 0) ++offsets[buckets[i] + 1];
+		}
+		for (int b = 0; b < bucketNumber; ++b) offsets[b + 1] += offsets[b];
+		std::vector<int> sorted(offsets[bucketNumber]);
+		std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+		for (int i = 0; i < size; ++i) if (buckets[i] >= 0) sorted[fill[buckets[i]]++] = candidates[i];
+
+		// every bucket is shuffled, then each round takes the next point of every bucket not yet exhausted
+		std::vector<int> bucket;
+		for (int b = 0; b < bucketNumber; ++b)
+		{
+			bucket.assign(sorted.begin() + offsets[b], sorted.begin() + offsets[b + 1]);
+			partialShuffle(bucket, static_cast<int>(bucket.size()), rng);
+			std::copy(bucket.begin(), bucket.end(), sorted.begin() + offsets[b]);
+		}
+		samples.clear();
+		sampleSize = std::min(sampleSize, static_cast<int>(sorted.size()));
+		for (int round = 0; static_cast<int>(samples.size()) < sampleSize; ++round)
+		{
+			for (int b = 0; b < bucketNumber && static_cast<int>(samples.size()) < sampleSize; ++b)
+			{
+				if (offsets[b] + round < offsets[b + 1]) samples.push_back(sorted[offsets[b] + round]);
+			}
+		}
+	}
+
+	void covarianceSampling(const CloudData &cloudData, const std::vector<int> &candidates, int sampleSize, std::vector<int> &samples)
+	{
+		std::vector<int> valid;
+		valid.reserve(candidates.size());
+		for (int i = 0; i < candidates.size(); ++i) if (validPoint(cloudData[candidates[i]])) valid.push_back(candidates[i]);
+		int size = static_cast<int>(valid.size());
+		if (sampleSize >= size)
+		{
+			samples.swap(valid);
+			return;
+		}
+
+		// positions about the centroid and in units of their mean distance to it, so rotations and translations
+		// are weighed alike
+		Eigen::Vector3d centroid = Eigen::Vector3d::Zero();
+		for (int i = 0; i < size; ++i) centroid += cloudData[valid[i]].getVector3fMap().cast<double>();
+		centroid /= size;
+		double scale = 0.0;
+		for (int i = 0; i < size; ++i) scale += (cloudData[valid[i]].getVector3fMap().cast<double>() - centroid).norm();
+		scale = scale > 0.0 ? size / scale : 1.0;
+
+		// the change of the point to plane distance of each point under the six motions, and their covariance
+		typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+		typedef Eigen::Matrix<float, 6, 1> Vector6f;
+		std::vector<float> rows(6 * size);
+		int threads = omp_get_num_procs();
+		std::vector<Matrix6d, Eigen::aligned_allocator<Matrix6d> > threadCovariances(threads, Matrix6d::Zero());
+		#pragma omp parallel for schedule (static) num_threads (threads)
+		for (int i = 0; i < size; ++i)
+		{
+			const PointType &point = cloudData[valid[i]];
+			Eigen::Vector3f p = ((point.getVector3fMap().cast<double>() - centroid) * scale).cast<float>();
+			Eigen::Vector3f n = point.getNormalVector3fMap().normalized();
+			Eigen::Map<Vector6f> row(&rows[6 * i]);
+			row.head<3>() = p.cross(n);
+			row.tail<3>() = n;
+			Eigen::Matrix<double, 6, 1> r = row.cast<double>();
+			threadCovariances[omp_get_thread_num()] += r * r.transpose();
+		}
+		Matrix6d covariance = Matrix6d::Zero();
+		for (int t = 0; t < threads; ++t) covariance += threadCovariances[t];
+		Eigen::SelfAdjointEigenSolver<Matrix6d> solver(covariance);
+		Eigen::Matrix<float, 6, 6> eigenvectors = solver.eigenvectors().cast<float>();
+
+		// squared contribution of each point to each eigenvector, and the points sorted by it per eigenvector
+		std::vector<float> contributions(6 * size);
+		#pragma omp parallel for schedule (dynamic,1000) num_threads (threads)
+		for (int i = 0; i < size; ++i)
+		{
+			Eigen::Map<const Vector6f> row(&rows[6 * i]);
+			for (int k = 0; k < 6; ++k)
+			{
+				float c = row.dot(eigenvectors.col(k));
+				contributions[k * size + i] = c * c;
+			}
+		}
+		std::vector<std::vector<int> > orders(6, std::vector<int>(size));
+		#pragma omp parallel for schedule (dynamic,1) num_threads (threads)
+		for (int k = 0; k < 6; ++k)
+		{
+			for (int i = 0; i < size; ++i) orders[k][i] = i;
+			std::sort(orders[k].begin(), orders[k].end(), ContributionGreater(&contributions[k * size]));
+		}
+
+		// each pick takes the strongest remaining point of the eigenvector with the smallest total so far
+		std::vector<char> selected(size, 0);
+		std::vector<int> cursors(6, 0);
+		double totals[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+		samples.clear();
+		while (static_cast<int>(samples.size()) < sampleSize)
+		{
+			int k = static_cast<int>(std::min_element(totals, totals + 6) - totals);
+			while (cursors[k] < size && selected[orders[k][cursors[k]]]) ++cursors[k];
+			if (cursors[k] == size)
+			{
+				totals[k] = std::numeric_limits<double>::infinity();
+				continue;
+			}
+			int i = orders[k][cursors[k]];
+			selected[i] = 1;
+			samples.push_back(valid[i]);
+			for (int l = 0; l < 6; ++l) totals[l] += contributions[l * size + i];
+		}
+	}
+}
+
+void registar::samplePoints(const CloudData &cloudData, const std::vector<int> *candidates, SamplingMethod method, int sampleSize,
+	unsigned int seed, std::vector<int> &samples)
+{
+	std::vector<int> allPoints;
+	if (!candidates)
+	{
+		allPoints.resize(cloudData.size());
+		for (int i = 0; i < allPoints.size(); ++i) allPoints[i] = i;
+		candidates = &allPoints;
+	}
+	int size = static_cast<int>(candidates->size());
+	sampleSize = std::max(0, std::min(sampleSize, size));
+	if (method == NO_SAMPLING || sampleSize == size)
+	{
+		samples = *candidates;
+		return;
+	}
+
+	boost::mt19937 rng(seed);
+	switch (method)
+	{
+	case UNIFORM_SAMPLING:
+		{
+			uniformSampling(*candidates, sampleSize, samples);
+			break;
+		}
+	case RANDOM_SAMPLING:
+		{
+			randomSampling(*candidates, sampleSize, rng, samples);
+			break;
+		}
+	case NORMAL_SPACE_SAMPLING:
+		{
+			normalSpaceSampling(cloudData, *candidates, sampleSize, rng, samples);
+			break;
+		}
+	case COVARIANCE_SAMPLING:
+		{
+			covarianceSampling(cloudData, *candidates, sampleSize, samples);
+			break;
+		}
+	default:
+		{
+			samples = *candidates;
+			break;
+		}
+	}
+	// queries in index order keep the memory locality of the cloud
+	std::sort(samples.begin(), samples.end());
+}
+
+PointSampler::PointSampler()
+{
+	parameters.method = NO_SAMPLING;
+	parameters.ratio = 1.0f;
+	parameters.refresh = 0;
+	reset();
+}
+
+void PointSampler::reset()
+{
+	cloudData = NULL;
+	candidateNumber = -1;
+	drawIteration = -1;
+	draws = 0;
+	resampled = false;
+	samples.clear();
+}
+
+const std::vector<int> &PointSampler::sample(const CloudData &cloudData, const std::vector<int> *candidates, int iteration)
+{
+	resampled = false;
+	if (parameters.method == NO_SAMPLING && candidates) return *candidates;
+
+	int number = candidates ? static_cast<int>(candidates->size()) : static_cast<int>(cloudData.size());
+	bool draw = &cloudData != this->cloudData || number != candidateNumber || drawIteration < 0 || iteration < drawIteration ||
+		(parameters.refresh > 0 && iteration - drawIteration >= static_cast<int>(parameters.refresh));
+	if (draw)
+	{
+		int sampleSize = static_cast<int>(std::ceil(parameters.ratio * number));
+		samplePoints(cloudData, candidates, parameters.method, sampleSize, draws, samples);
+		this->cloudData = &cloudData;
+		candidateNumber = number;
+		drawIteration = iteration;
+		++draws;
+		resampled = true;
+	}
+	return samples;
+}
@@ -0,0 +1,247 @@
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <omp.h>
+#include <Eigen/Sparse>
+#include <Eigen/SparseCholesky>
+
+#include "../include/posegraph.h"
+
+using namespace registar;
+
+namespace
+{
+	inline Eigen::Matrix3d skew(const Eigen::Vector3d &v)
+	{
+		Eigen::Matrix3d m;
+		m << 0.0, -v(2), v(1),
+			v(2), 0.0, -v(0),
+			-v(1), v(0), 0.0;
+		return m;
+	}
+
+	// sum of a x b given S = sum a * b^T
+	inline Eigen::Vector3d crossOfMoments(const Eigen::Matrix3d &S)
+	{
+		return Eigen::Vector3d(S(1, 2) - S(2, 1), S(2, 0) - S(0, 2), S(0, 1) - S(1, 0));
+	}
+}
+
+PoseGraph::PoseGraph(int vertexNumber)
+{
+	setVertexNumber(vertexNumber);
+}
+
+PoseGraph::~PoseGraph(){}
+
+void PoseGraph::setVertexNumber(int vertexNumber)
+{
+	poses.assign(vertexNumber, Eigen::Matrix4d::Identity());
+	edges.clear();
+}
+
+void PoseGraph::addEdge(int target, int source, const PoseGraphEdgeMoments &moments)
+{
+	if (moments.w <= 0.0) return;
+
+	Edge edge;
+	edge.target = target;
+	edge.source = source;
+	edge.w = moments.w;
+	edge.p_mean = moments.sp / moments.w;
+	edge.q_mean = moments.sq / moments.w;
+	edge.Cpp = moments.Spp - moments.w * edge.p_mean * edge.p_mean.transpose();
+	edge.Cqq = moments.Sqq - moments.w * edge.q_mean * edge.q_mean.transpose();
+	edge.Cpq = moments.Spq - moments.w * edge.p_mean * edge.q_mean.transpose();
+	edges.push_back(edge);
+}
+
+double PoseGraph::edgeError(const Edge &edge, const Poses &poses) const
+{
+	const Eigen::Matrix4d &X_t = poses[edge.target];
+	const Eigen::Matrix4d &X_s = poses[edge.source];
+	Eigen::Vector3d a_mean = X_t.block<3, 3>(0, 0) * edge.p_mean + X_t.block<3, 1>(0, 3);
+	Eigen::Vector3d b_mean = X_s.block<3, 3>(0, 0) * edge.q_mean + X_s.block<3, 1>(0, 3);
+	double cross = (X_t.block<3, 3>(0, 0) * edge.Cpq * X_s.block<3, 3>(0, 0).transpose()).trace();
+	return edge.w * (a_mean - b_mean).squaredNorm() + edge.Cpp.trace() + edge.Cqq.trace() - 2.0 * cross;
+}
+
+double PoseGraph::error(const Poses &poses) const
+{
+	int edgeNumber = static_cast<int>(edges.size());
+	double sum = 0.0;
+	#pragma omp parallel for reduction (+:sum) schedule (static) num_threads (omp_get_num_procs())
+	for (int e = 0; e < edgeNumber; ++e) sum += edgeError(edges[e], poses);
+	return sum;
+}
+
+double PoseGraph::error() const
+{
+	return error(poses);
+}
+
+double PoseGraph::totalWeight() const
+{
+	double sum = 0.0;
+	for (int e = 0; e < edges.size(); ++e) sum += edges[e].w;
+	return sum;
+}
+
+void PoseGraph::edgeSystem(const Edge &edge, Eigen::Matrix<double, 12, 12> &H, Eigen::Matrix<double, 12, 1> &g) const
+{
+	// left perturbation X <- [exp(omega), v] * X moves a world point a to a + omega x a + v,
+	// unknowns are ordered (omega_target, v_target, omega_source, v_source)
+	const Eigen::Matrix4d &X_t = poses[edge.target];
+	const Eigen::Matrix4d &X_s = poses[edge.source];
+	Eigen::Matrix3d R_t = X_t.block<3, 3>(0, 0);
+	Eigen::Matrix3d R_s = X_s.block<3, 3>(0, 0);
+	Eigen::Vector3d a_mean = R_t * edge.p_mean + X_t.block<3, 1>(0, 3);
+	Eigen::Vector3d b_mean = R_s * edge.q_mean + X_s.block<3, 1>(0, 3);
+
+	double w = edge.w;
+	Eigen::Vector3d sa = w * a_mean;
+	Eigen::Vector3d sb = w * b_mean;
+	Eigen::Matrix3d Saa = R_t * edge.Cpp * R_t.transpose() + w * a_mean * a_mean.transpose();
+	Eigen::Matrix3d Sbb = R_s * edge.Cqq * R_s.transpose() + w * b_mean * b_mean.transpose();
+	Eigen::Matrix3d Sab = R_t * edge.Cpq * R_s.transpose() + w * a_mean * b_mean.transpose();
+
+	Eigen::Matrix3d I = Eigen::Matrix3d::Identity();
+
+	H.block<3, 3>(0, 0) = Saa.trace() * I - Saa;
+	H.block<3, 3>(0, 3) = skew(sa);
+	H.block<3, 3>(3, 0) = -skew(sa);
+	H.block<3, 3>(3, 3) = w * I;
+
+	H.block<3, 3>(6, 6) = Sbb.trace() * I - Sbb;
+	H.block<3, 3>(6, 9) = skew(sb);
+	H.block<3, 3>(9, 6) = -skew(sb);
+	H.block<3, 3>(9, 9) = w * I;
+
+	// sum [a]x [b]x = sum (b * a^T - (a . b) I)
+	H.block<3, 3>(0, 6) = Sab.transpose() - Sab.trace() * I;
+	H.block<3, 3>(0, 9) = -skew(sa);
+	H.block<3, 3>(3, 6) = skew(sb);
+	H.block<3, 3>(3, 9) = -w * I;
+	H.block<6, 6>(6, 0) = H.block<6, 6>(0, 6).transpose();
+
+	// the centroid part of sum a x b is evaluated separately, a_mean x b_mean stays accurate when both are large
+	Eigen::Vector3d c = w * a_mean.cross(b_mean) + crossOfMoments(R_t * edge.Cpq * R_s.transpose());
+	Eigen::Vector3d r = w * (a_mean - b_mean);
+	g.block<3, 1>(0, 0) = -c;
+	g.block<3, 1>(3, 0) = r;
+	g.block<3, 1>(6, 0) = c;
+	g.block<3, 1>(9, 0) = -r;
+}
+
+int PoseGraph::optimize(const Parameters &parameters)
+{
+	int vertexNumber = getVertexNumber();
+	int edgeNumber = static_cast<int>(edges.size());
+	if (vertexNumber < 2 || edgeNumber == 0) return 0;
+
+	// the fixed vertex and vertices without edges carry no unknowns
+	std::vector<int> columns(vertexNumber, -1);
+	std::vector<bool> connected(vertexNumber, false);
+	for (int e = 0; e < edgeNumber; ++e)
+	{
+		connected[edges[e].target] = true;
+		connected[edges[e].source] = true;
+	}
+	int unknownNumber = 0;
+	for (int i = 0; i < vertexNumber; ++i)
+	{
+		if (i != parameters.fixedVertex && connected[i])
+		{
+			columns[i] = unknownNumber;
+			unknownNumber += 6;
+		}
+	}
+	if (unknownNumber == 0) return 0;
+
+	int threads = omp_get_num_procs();
+
+	std::vector<Eigen::Matrix<double, 12, 12>, Eigen::aligned_allocator<Eigen::Matrix<double, 12, 12> > > edgeHs(edgeNumber);
+	std::vector<Eigen::Matrix<double, 12, 1>, Eigen::aligned_allocator<Eigen::Matrix<double, 12, 1> > > edgeGs(edgeNumber);
+
+	double lambda = parameters.lambda_initial;
+	double currentError = error(poses);
+	int iter = 0;
+	for (; iter < parameters.iterationNum_max; ++iter)
+	{
+		#pragma omp parallel for schedule (dynamic,100) num_threads (threads)
+		for (int e = 0; e < edgeNumber; ++e) edgeSystem(edges[e], edgeHs[e], edgeGs[e]);
+
+		std::vector< Eigen::Triplet<double> > triplets;
+		triplets.reserve(edgeNumber * 144);
+		Eigen::VectorXd g = Eigen::VectorXd::Zero(unknownNumber);
+		for (int e = 0; e < edgeNumber; ++e)
+		{
+			int vertices[2] = {edges[e].target, edges[e].source};
+			for (int m = 0; m < 2; ++m)
+			{
+				int row = columns[vertices[m]];
+				if (row < 0) continue;
+				g.segment<6>(row) += edgeGs[e].segment<6>(6*m);
+				for (int n = 0; n < 2; ++n)
+				{
+					int col = columns[vertices[n]];
+					if (col < 0) continue;
+					for (int r = 0; r < 6; ++r)
+						for (int c = 0; c < 6; ++c)
+							triplets.push_back(Eigen::Triplet<double>(row + r, col + c, edgeHs[e](6*m + r, 6*n + c)));
+				}
+			}
+		}
+		Eigen::SparseMatrix<double> H(unknownNumber, unknownNumber);
+		H.setFromTriplets(triplets.begin(), triplets.end());
+		Eigen::VectorXd diagonal = H.diagonal();
+
+		bool accepted = false;
+		double newError = currentError;
+		while (!accepted && lambda < 1e10)
+		{
+			Eigen::SparseMatrix<double> H_damped = H;
+			for (int k = 0; k < unknownNumber; ++k) H_damped.coeffRef(k, k) += lambda * diagonal(k) + 1e-12;
+
+			Eigen::SimplicialLDLT< Eigen::SparseMatrix<double> > solver(H_damped);
+			if (solver.info() != Eigen::Success)
+			{
+				lambda *= 10.0;
+				continue;
+			}
+			Eigen::VectorXd delta = solver.solve(-g);
+
+			Poses newPoses = poses;
+			for (int i = 0; i < vertexNumber; ++i)
+			{
+				if (columns[i] < 0) continue;
+				Eigen::Vector3d omega = delta.segment<3>(columns[i]);
+				Eigen::Vector3d v = delta.segment<3>(columns[i] + 3);
+				double angle = omega.norm();
+				Eigen::Matrix3d dR = angle > 0.0 ? Eigen::AngleAxisd(angle, omega / angle).toRotationMatrix() : Eigen::Matrix3d::Identity();
+				newPoses[i].block<3, 3>(0, 0) = dR * poses[i].block<3, 3>(0, 0);
+				newPoses[i].block<3, 1>(0, 3) = dR * poses[i].block<3, 1>(0, 3) + v;
+			}
+
+			newError = error(newPoses);
+			if (newError <= currentError)
+			{
+				poses.swap(newPoses);
+				lambda = std::max(lambda * 0.1, 1e-12);
+				accepted = true;
+			}
+			else lambda *= 10.0;
+		}
+
+		// std::cout << "pose graph iter = " << iter << " error = " << newError << " lambda = " << lambda << std::endl;
+		if (!accepted) break;
+		bool converged = currentError - newError <= parameters.tolerance * currentError;
+		currentError = newError;
+		if (converged)
+		{
+			++iter;
+			break;
+		}
+	}
+	return iter;
+}
@@ -0,0 +1,194 @@
+#include <omp.h>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <Eigen/StdVector>
+
+#include "../include/projectivesearch.h"
+
+using namespace registar;
+
+namespace
+{
+	// mean reprojection error in pixels above which the grid is not taken for a pinhole image
+	const double maxReprojectionError = 0.5;
+
+	// bounds of the second smallest singular value of the projection system, relative to the largest and to the
+	// smallest, below which the projection is not fixed by the points
+	const double minRelativeSingularValue = 1e-3;
+	const double minNullSeparation = 4.0;
+
+	typedef Eigen::Matrix<double, 12, 12> Matrix12d;
+	typedef Eigen::Matrix<double, 12, 1> Vector12d;
+
+	inline bool finitePoint(const PointType &point)
+	{
+		return pcl_isfinite(point.x) && pcl_isfinite(point.y) && pcl_isfinite(point.z);
+	}
+}
+
+ProjectiveSearch::ProjectiveSearch(int window) : window(window), valid(false) {}
+
+ProjectiveSearch::~ProjectiveSearch(){}
+
+bool ProjectiveSearch::isOrganized(const CloudData &cloudData)
+{
+	return cloudData.height > 1 && static_cast<size_t>(cloudData.width) * cloudData.height == cloudData.size();
+}
+
+bool ProjectiveSearch::setInputCloud(CloudDataConstPtr cloudData)
+{
+	if (this->cloudData != cloudData)
+	{
+		this->cloudData = cloudData;
+		build();
+	}
+	return valid;
+}
+
+void ProjectiveSearch::build()
+{
+	valid = false;
+	if (!cloudData || !isOrganized(*cloudData)) return;
+
+	const CloudData &cloud = *cloudData;
+	int width = static_cast<int>(cloud.width);
+	int height = static_cast<int>(cloud.height);
+	int size = static_cast<int>(cloud.size());
+	int threads = omp_get_num_procs();
+
+	// positions about their centroid in units of their mean distance to it and pixels about the image centre in units
+	// of half the image, as for the normalised DLT of Hartley
+	std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > threadSums(threads, Eigen::Vector4d::Zero());
+	#pragma omp parallel for schedule (static) num_threads (threads)
+	for (int i = 0; i < size; ++i)
+	{
+		if (!finitePoint(cloud[i])) continue;
+		threadSums[omp_get_thread_num()] += Eigen::Vector4d(cloud[i].x, cloud[i].y, cloud[i].z, 1.0);
+	}
+	Eigen::Vector4d sum = Eigen::Vector4d::Zero();
+	for (int t = 0; t < threads; ++t) sum += threadSums[t];
+	if (sum(3) < 6.0) return;
+	Eigen::Vector3d centroid = sum.head<3>() / sum(3);
+
+	std::vector<double> threadDistances(threads, 0.0);
+	#pragma omp parallel for schedule (static) num_threads (threads)
+	for (int i = 0; i < size; ++i)
+	{
+		if (!finitePoint(cloud[i])) continue;
+		threadDistances[omp_get_thread_num()] += (cloud[i].getVector3fMap().cast<double>() - centroid).norm();
+	}
+	double distance = 0.0;
+	for (int t = 0; t < threads; ++t) distance += threadDistances[t];
+	if (!(distance > 0.0)) return;
+
+	Eigen::Matrix4d pointNormalization = Eigen::Matrix4d::Identity();
+	pointNormalization.topLeftCorner<3, 3>() *= sum(3) / distance;
+	pointNormalization.topRightCorner<3, 1>() = -centroid * sum(3) / distance;
+	Eigen::Matrix3d pixelNormalization = Eigen::Matrix3d::Identity();
+	double pixelScale = 2.0 / std::max(width, height);
+	pixelNormalization.topLeftCorner<2, 2>() *= pixelScale;
+	pixelNormalization.topRightCorner<2, 1>() = Eigen::Vector2d(-0.5 * width * pixelScale, -0.5 * height * pixelScale);
+
+	// each point gives two rows of the homogeneous system A p = 0, the normal matrices are summed per thread
+	std::vector<Matrix12d, Eigen::aligned_allocator<Matrix12d> > threadNormals(threads, Matrix12d::Zero());
+	#pragma omp parallel for schedule (static) num_threads (threads)
+	for (int i = 0; i < size; ++i)
+	{
+		if (!finitePoint(cloud[i])) continue;
+		Eigen::Vector4d X = pointNormalization * Eigen::Vector4d(cloud[i].x, cloud[i].y, cloud[i].z, 1.0);
+		double u = pixelScale * (i % width) + pixelNormalization(0, 2);
+		double v = pixelScale * (i / width) + pixelNormalization(1, 2);
+		Vector12d row1, row2;
+		row1 << X, Eigen::Vector4d::Zero(), -u * X;
+		row2 << Eigen::Vector4d::Zero(), X, -v * X;
+		Matrix12d &normal = threadNormals[omp_get_thread_num()];
+		normal.selfadjointView<Eigen::Upper>().rankUpdate(row1);
+		normal.selfadjointView<Eigen::Upper>().rankUpdate(row2);
+	}
+	Matrix12d normal = Matrix12d::Zero();
+	for (int t = 0; t < threads; ++t) normal += threadNormals[t];
+	normal = normal.selfadjointView<Eigen::Upper>();
+
+	// the solution is the eigenvector of the smallest eigenvalue, mapped back to pixels and positions. It must be the
+	// only null direction: the points of a planar target leave four, any of which projects the plane but not the
+	// queries off it, so the second smallest singular value of the system has to stand clear of zero and of the
+	// smallest, which noise lifts with it
+	Eigen::SelfAdjointEigenSolver<Matrix12d> solver(normal);
+	double smallest = std::sqrt(std::max(solver.eigenvalues()(0), 0.0));
+	double secondSmallest = std::sqrt(std::max(solver.eigenvalues()(1), 0.0));
+	double largest = std::sqrt(std::max(solver.eigenvalues()(11), 0.0));
+	if (!(secondSmallest > minRelativeSingularValue * largest) || !(secondSmallest > minNullSeparation * smallest)) return;
+	Vector12d p = solver.eigenvectors().col(0);
+	Eigen::Matrix<double, 3, 4> normalizedProjection;
+	normalizedProjection << p.segment<4>(0).transpose(), p.segment<4>(4).transpose(), p.segment<4>(8).transpose();
+	Eigen::Matrix<double, 3, 4> P = pixelNormalization.inverse() * normalizedProjection * pointNormalization;
+
+	// points in front of the camera have a positive depth
+	for (int i = 0; i < size; ++i)
+	{
+		if (!finitePoint(cloud[i])) continue;
+		if (P.row(2).dot(Eigen::Vector4d(cloud[i].x, cloud[i].y, cloud[i].z, 1.0)) < 0.0) P = -P;
+		break;
+	}
+
+	// laser scans on angular grids are organised too, but are no pinhole images
+	std::vector<double> threadErrors(threads, 0.0);
+	#pragma omp parallel for schedule (static) num_threads (threads)
+	for (int i = 0; i < size; ++i)
+	{
+		if (!finitePoint(cloud[i])) continue;
+		Eigen::Vector3d q = P * Eigen::Vector4d(cloud[i].x, cloud[i].y, cloud[i].z, 1.0);
+		double error = q.z() > 0.0 ? (q.head<2>() / q.z() - Eigen::Vector2d(i % width, i / width)).norm() : std::numeric_limits<double>::max();
+		threadErrors[omp_get_thread_num()] += std::min(error, static_cast<double>(std::max(width, height)));
+	}
+	double error = 0.0;
+	for (int t = 0; t < threads; ++t) error += threadErrors[t];
+	if (!(error / sum(3) <= maxReprojectionError)) return;
+
+	projection = P.cast<float>();
+	valid = true;
+}
+
+bool ProjectiveSearch::nearest(int queryIndex, const PointType &query, int &match, float &sqrDistance)
+{
+	return static_cast<const ProjectiveSearch*>(this)->nearest(query, match, sqrDistance);
+}
+
+bool ProjectiveSearch::nearest(const PointType &query, int &match, float &sqrDistance) const
+{
+	if (!valid) return false;
+
+	Eigen::Vector3f position = query.getVector3fMap();
+	Eigen::Vector3f q = projection.leftCols<3>() * position + projection.col(3);
+	if (!(q.z() > 0.0f)) return false;
+	float u = q.x() / q.z();
+	float v = q.y() / q.z();
+	int width = static_cast<int>(cloudData->width);
+	int height = static_cast<int>(cloudData->height);
+	if ( !(u > -window - 1.0f && u < width + window && v > -window - 1.0f && v < height + window) ) return false;
+
+	int column = static_cast<int>(floorf(u + 0.5f));
+	int row = static_cast<int>(floorf(v + 0.5f));
+	int rowEnd = std::min(height - 1, row + window);
+	int columnEnd = std::min(width - 1, column + window);
+
+	match = -1;
+	sqrDistance = std::numeric_limits<float>::max();
+	for (int r = std::max(0, row - window); r <= rowEnd; ++r)
+	{
+		for (int c = std::max(0, column - window); c <= columnEnd; ++c)
+		{
+			int index = r * width + c;
+			const PointType &point = (*cloudData)[index];
+			if (!finitePoint(point)) continue;
+			float distance2 = (point.getVector3fMap() - position).squaredNorm();
+			if (distance2 < sqrDistance)
+			{
+				sqrDistance = distance2;
+				match = index;
+			}
+		}
+	}
+	return match >= 0;
+}
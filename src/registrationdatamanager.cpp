@@ -2,18 +2,28 @@
 #include <pcl/common/transforms.h>
 
 #include "../include/registrationdatamanager.h"
+#include "../include/bulktransform.h"
 
 using namespace registar;
 
 RegistrationData::RegistrationData(Cloud *cloud, const QString &dataName, QObject *parent) : QObject(parent)
 {
 	this->cloud = cloud;
+	this->cloudDataVersion = cloud->getCloudDataVersion();
 
-	cloudData.reset(new CloudData);
-	pcl::transformPointCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getTransformation());
-
-	kdTree.reset(new KdTree);
-	kdTree->setInputCloud(cloudData);
+	// the data and index of the cloud are borrowed while the registration frame is the data frame itself
+	if (cloud->getTransformation().isIdentity())
+	{
+		cloudData = cloud->getCloudData();
+		kdTree = cloud->getKdTree();
+	}
+	else
+	{
+		cloudData.reset(new CloudData);
+		transformCloudWithNormals(*cloud->getCloudData(), *cloudData, cloud->getTransformation());
+		kdTree.reset(new KdTree);
+		kdTree->setInputCloud(cloudData);
+	}
 
 	boundaries = cloud->getBoundaries();
 
@@ -0,0 +1,106 @@
+#include <omp.h>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include "../include/robustweights.h"
+
+using namespace registar;
+
+namespace
+{
+	const int quantileBinNumber = 4096;
+
+	// widths giving 95% efficiency on normally distributed residuals
+	float defaultKernelWidth(RobustKernel kernel)
+	{
+		switch (kernel)
+		{
+		case HUBER_KERNEL: return 1.345f;
+		case TUKEY_KERNEL: return 4.685f;
+		case CAUCHY_KERNEL: return 2.385f;
+		default: return 1.0f;
+		}
+	}
+
+	inline float kernelWeight(RobustKernel kernel, float u)
+	{
+		switch (kernel)
+		{
+		case HUBER_KERNEL: return u <= 1.0f ? 1.0f : 1.0f / u;
+		case TUKEY_KERNEL:
+			{
+				if (u >= 1.0f) return 0.0f;
+				float a = 1.0f - u * u;
+				return a * a;
+			}
+		case CAUCHY_KERNEL: return 1.0f / (1.0f + u * u);
+		default: return 1.0f;
+		}
+	}
+}
+
+float registar::parallelQuantile(const float *values, int number, float q, int threads)
+{
+	if (number <= 0) return 0.0f;
+	int rank = std::min(number - 1, std::max(0, static_cast<int>(q * (number - 1) + 0.5f)));
+
+	std::vector<float> threadMinima(threads, std::numeric_limits<float>::max());
+	std::vector<float> threadMaxima(threads, -std::numeric_limits<float>::max());
+	#pragma omp parallel for schedule (static) num_threads (threads)
+	for (int i = 0; i < number; ++i)
+	{
+		int t = omp_get_thread_num();
+		threadMinima[t] = std::min(threadMinima[t], values[i]);
+		threadMaxima[t] = std::max(threadMaxima[t], values[i]);
+	}
+	float minimum = *std::min_element(threadMinima.begin(), threadMinima.end());
+	float maximum = *std::max_element(threadMaxima.begin(), threadMaxima.end());
+	if (!(minimum < maximum)) return minimum;
+
+	// one histogram per thread, summed into the first
+	float binScale = quantileBinNumber / (maximum - minimum);
+	std::vector<int> histograms(threads * quantileBinNumber, 0);
+	#pragma omp parallel for schedule (static) num_threads (threads)
+	for (int i = 0; i < number; ++i)
+	{
+		int bin = std::min(quantileBinNumber - 1, static_cast<int>((values[i] - minimum) * binScale));
+		++histograms[omp_get_thread_num() * quantileBinNumber + bin];
+	}
+	for (int t = 1; t < threads; ++t)
+		for (int b = 0; b < quantileBinNumber; ++b) histograms[b] += histograms[t * quantileBinNumber + b];
+
+	int bin = 0, below = 0;
+	while (below + histograms[bin] <= rank) below += histograms[bin++];
+
+	std::vector<float> candidates;
+	candidates.reserve(histograms[bin]);
+	for (int i = 0; i < number; ++i)
+	{
+		if (std::min(quantileBinNumber - 1, static_cast<int>((values[i] - minimum) * binScale)) == bin) candidates.push_back(values[i]);
+	}
+	std::nth_element(candidates.begin(), candidates.begin() + (rank - below), candidates.end());
+	return candidates[rank - below];
+}
+
+float registar::computeRobustWeights(const float *residuals, int number, const RobustParameters &parameters, float *weights, int threads)
+{
+	if (number <= 0) return 0.0f;
+
+	float overlapRatio = std::min(1.0f, std::max(0.0f, parameters.overlapRatio));
+	float threshold = overlapRatio < 1.0f ? parallelQuantile(residuals, number, overlapRatio, threads) : std::numeric_limits<float>::max();
+	float scale = 1.4826f * parallelQuantile(residuals, number, 0.5f * overlapRatio, threads);
+	float width = parameters.kernelWidth > 0.0f ? parameters.kernelWidth : defaultKernelWidth(parameters.kernel);
+	float inverseWidth = scale > 0.0f ? 1.0f / (width * scale) : 0.0f;
+
+	// a zero scale means at least half of the kept pairs fit exactly, the others are then all down weighted alike
+	#pragma omp parallel for schedule (static) num_threads (threads)
+	for (int i = 0; i < number; ++i)
+	{
+		if (residuals[i] > threshold) weights[i] = 0.0f;
+		else if (inverseWidth > 0.0f) weights[i] = kernelWeight(parameters.kernel, residuals[i] * inverseWidth);
+		else weights[i] = residuals[i] > 0.0f ? kernelWeight(parameters.kernel, std::numeric_limits<float>::max()) : 1.0f;
+	}
+	return scale;
+}
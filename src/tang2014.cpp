@@ -58,6 +58,11 @@ namespace registar {
 		gr_para.doInitialPairRegistration = pcl::console::find_switch(argc, argv, "--ipr");
 		gr_para.doIncrementalLoopRefine = pcl::console::find_switch(argc, argv, "--il");
 		gr_para.doGlobalRefine = pcl::console::find_switch(argc, argv, "--gr");
+		gr_para.doPoseGraphRefine = pcl::console::find_switch(argc, argv, "--pg");
+
+		gr_para.checkpointPath = "";
+		pcl::console::parse_argument(argc, argv, "--checkpoint", gr_para.checkpointPath);
+		gr_para.resume = pcl::console::find_switch(argc, argv, "--resume");
 
 		int gi_max, gi_min;
 		pcl::console::parse_argument(argc, argv, "--gi_max", gi_max);
@@ -69,6 +74,15 @@ namespace registar {
 		pcl::console::parse_argument(argc, argv, "--pi_num", pi_num);
 		gr_para.pairIterationNum = pi_num;
 
+		// --coarse takes the keypoint spacing of the coarse alignment starting each link
+		gr_para.coarseVoxelSize = 0.0f;
+		pcl::console::parse_argument(argc, argv, "--coarse", gr_para.coarseVoxelSize);
+
+		// --cache_gb bounds the memory of the searches over the scans, the scans themselves are held by the caller
+		float cacheGB = 0.0f;
+		pcl::console::parse_argument(argc, argv, "--cache_gb", cacheGB);
+		gr_para.sc_para.budget = cacheGB * 1073741824.0;
+
 		tang2014::PairRegistration::Parameters pr_para;
 		pr_para.mMethod = tang2014::PairRegistration::POINT_TO_PLANE;
 		pr_para.sMethod = tang2014::PairRegistration::UMEYAMA;
@@ -89,6 +103,43 @@ namespace registar {
 		pr_para.distThreshold = distThreshold;
 		pr_para.angleThreshold = angleThreshold;
 
+		pr_para.activeSet = pcl::console::find_switch(argc, argv, "--active");
+		pr_para.activeSetMargin = 2.0f;
+		pr_para.activeSetRefresh = 10;
+		pcl::console::parse_argument(argc, argv, "--active_margin", pr_para.activeSetMargin);
+		pcl::console::parse_argument(argc, argv, "--active_refresh", pr_para.activeSetRefresh);
+		pr_para.warmStart = pcl::console::find_switch(argc, argv, "--warm");
+		pr_para.voxelHash = pcl::console::find_switch(argc, argv, "--voxel_hash");
+		pr_para.flatKdTree = pcl::console::find_switch(argc, argv, "--flat_kdtree");
+		// --sampling takes a registar::SamplingMethod, 1 uniform, 2 random, 3 normal space, 4 covariance
+		int sampling = 0;
+		pcl::console::parse_argument(argc, argv, "--sampling", sampling);
+		pr_para.sampling.method = static_cast<registar::SamplingMethod>(sampling);
+		pr_para.sampling.ratio = 0.1f;
+		pr_para.sampling.refresh = 10;
+		pcl::console::parse_argument(argc, argv, "--sample_ratio", pr_para.sampling.ratio);
+		pcl::console::parse_argument(argc, argv, "--sample_refresh", pr_para.sampling.refresh);
+		// --kernel takes a registar::RobustKernel, 1 Huber, 2 Tukey, 3 Cauchy; --overlap is the ratio of pairs trimmed ICP keeps
+		int kernel = 0;
+		pcl::console::parse_argument(argc, argv, "--kernel", kernel);
+		pr_para.robust.kernel = static_cast<registar::RobustKernel>(kernel);
+		pr_para.robust.kernelWidth = 0.0f;
+		pr_para.robust.overlapRatio = 1.0f;
+		pcl::console::parse_argument(argc, argv, "--kernel_width", pr_para.robust.kernelWidth);
+		pcl::console::parse_argument(argc, argv, "--overlap", pr_para.robust.overlapRatio);
+		// --solver takes a PairRegistration::SolveMethod, 0 Umeyama, 2 symmetric ICP, 3 generalized ICP; the last two match
+		// the points themselves
+		int solver = 0;
+		pcl::console::parse_argument(argc, argv, "--solver", solver);
+		if (!tang2014::PairRegistration::isImplementedSolver(solver))
+		{
+			// the scans keep their transformations
+			std::cerr << "--solver " << solver << " is not a solver, use 0 Umeyama, 2 symmetric ICP or 3 generalized ICP" << std::endl;
+			return tang2014::Transformations(scanPtrs.size(), tang2014::Transformation::Identity());
+		}
+		pr_para.sMethod = static_cast<tang2014::PairRegistration::SolveMethod>(solver);
+		if (tang2014::PairRegistration::isPlaneSolver(pr_para.sMethod)) pr_para.mMethod = tang2014::PairRegistration::POINT_TO_POINT;
+
 		gr_para.pr_para = pr_para;
 
 		globalRegistration.setParameters(gr_para);
@@ -0,0 +1,56 @@
+#include <omp.h>
+#include <Eigen/SVD>
+
+#include "../include/umeyama.h"
+
+using namespace registar;
+
+Eigen::Matrix4f registar::solveUmeyama(const UmeyamaMoments &moments, bool withScaling)
+{
+	Eigen::Matrix4f transformation = Eigen::Matrix4f::Identity();
+	if (!(moments.w > 0.0)) return transformation;
+
+	// centroids and covariances about the reference pair, which they do not depend on
+	Eigen::Vector3d sourceMean = moments.sumSource / moments.w;
+	Eigen::Vector3d targetMean = moments.sumTarget / moments.w;
+	Eigen::Matrix3d covariance = moments.sumTargetSource / moments.w - targetMean * sourceMean.transpose();
+
+	Eigen::JacobiSVD<Eigen::Matrix3d> svd(covariance, Eigen::ComputeFullU | Eigen::ComputeFullV);
+	Eigen::Vector3d S = Eigen::Vector3d::Ones();
+	if (svd.matrixU().determinant() * svd.matrixV().determinant() < 0.0) S(2) = -1.0;
+	Eigen::Matrix3d R = svd.matrixU() * S.asDiagonal() * svd.matrixV().transpose();
+
+	double scale = 1.0;
+	if (withScaling)
+	{
+		double sourceVariance = moments.sumSourceSquared / moments.w - sourceMean.squaredNorm();
+		if (sourceVariance > 0.0) scale = svd.singularValues().dot(S) / sourceVariance;
+	}
+
+	Eigen::Vector3d t = (moments.targetReference + targetMean) - scale * R * (moments.sourceReference + sourceMean);
+	transformation.block<3, 3>(0, 0) = (scale * R).cast<float>();
+	transformation.block<3, 1>(0, 3) = t.cast<float>();
+	return transformation;
+}
+
+UmeyamaMoments registar::accumulateUmeyamaMoments(const float *sourcePositions, const float *targetPositions, const float *weights, int number)
+{
+	if (number <= 0) return UmeyamaMoments();
+
+	Eigen::Vector3d sourceReference = Eigen::Map<const Eigen::Vector3f>(sourcePositions).cast<double>();
+	Eigen::Vector3d targetReference = Eigen::Map<const Eigen::Vector3f>(targetPositions).cast<double>();
+
+	// each thread sums its own moments
+	int threads = omp_get_num_procs();
+	std::vector<UmeyamaMoments> threadMoments(threads, UmeyamaMoments(sourceReference, targetReference));
+	#pragma omp parallel for schedule (static) num_threads (threads)
+	for (int i = 0; i < number; ++i)
+	{
+		threadMoments[omp_get_thread_num()].add(Eigen::Map<const Eigen::Vector3f>(sourcePositions + 3 * i),
+			Eigen::Map<const Eigen::Vector3f>(targetPositions + 3 * i), weights ? weights[i] : 1.0);
+	}
+
+	UmeyamaMoments moments(sourceReference, targetReference);
+	for (int t = 0; t < threads; ++t) moments += threadMoments[t];
+	return moments;
+}
@@ -0,0 +1,204 @@
+#include <omp.h>
+#include <cmath>
+#include <algorithm>
+
+#include "../include/voxelhashsearch.h"
+
+using namespace registar;
+
+namespace
+{
+	// 21 bits per axis, cells that wrap onto the same key only add candidates, they never hide one
+	const unsigned long long axisMask = 0x1fffffULL;
+
+	// mean number of points in the cell of a point above which a KD-tree query is cheaper than scanning the cells
+	const double maxCellPoints = 64.0;
+
+	inline unsigned long long mixKey(unsigned long long key)
+	{
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		return key;
+	}
+}
+
+VoxelHashSearch::VoxelHashSearch() : radius(0.0f), inverseCellSize(0.0f), valid(false), cellMask(0) {}
+
+VoxelHashSearch::~VoxelHashSearch(){}
+
+bool VoxelHashSearch::setInputCloud(CloudDataConstPtr cloudData, float radius)
+{
+	if (this->cloudData == cloudData && this->radius == radius) return valid;
+	this->cloudData = cloudData;
+	this->radius = radius;
+	build();
+	return valid;
+}
+
+inline unsigned long long VoxelHashSearch::cellKey(int x, int y, int z) const
+{
+	return ((static_cast<unsigned long long>(x) & axisMask) << 42) |
+		((static_cast<unsigned long long>(y) & axisMask) << 21) |
+		(static_cast<unsigned long long>(z) & axisMask);
+}
+
+inline const VoxelHashSearch::Cell *VoxelHashSearch::findCell(unsigned long long key) const
+{
+	for (unsigned long long slot = mixKey(key) & cellMask; ; slot = (slot + 1) & cellMask)
+	{
+		const Cell &cell = cells[slot];
+		if (cell.begin < 0) return NULL;
+		if (cell.key == key) return &cell;
+	}
+}
+
+void VoxelHashSearch::build()
+{
+	xs.clear();
+	ys.clear();
+	zs.clear();
+	pointIndices.clear();
+	cells.clear();
+	valid = false;
+	if (!cloudData || !(radius > 0.0f)) return;
+
+	// slightly larger cells keep points at the radius inside the 27 cells despite rounding
+	inverseCellSize = 1.0f / (radius * 1.0001f);
+
+	int size = static_cast<int>(cloudData->size());
+	std::vector<std::pair<unsigned long long, int> > keys(size);
+
+	int threads = omp_get_num_procs();
+	#pragma omp parallel for schedule (dynamic,1000) num_threads (threads)
+	for (int i = 0; i < size; ++i)
+	{
+		const PointType &point = (*cloudData)[i];
+		if ( !pcl_isfinite(point.x) || !pcl_isfinite(point.y) || !pcl_isfinite(point.z) )
+		{
+			keys[i] = std::make_pair(0ULL, -1);
+			continue;
+		}
+		int x = static_cast<int>(floorf(point.x * inverseCellSize));
+		int y = static_cast<int>(floorf(point.y * inverseCellSize));
+		int z = static_cast<int>(floorf(point.z * inverseCellSize));
+		keys[i] = std::make_pair(cellKey(x, y, z), i);
+	}
+	std::sort(keys.begin(), keys.end());
+
+	xs.reserve(size);
+	ys.reserve(size);
+	zs.reserve(size);
+	pointIndices.reserve(size);
+	std::vector<Cell> cellList;
+	for (int i = 0; i < size; ++i)
+	{
+		if (keys[i].second < 0) continue;
+		const PointType &point = (*cloudData)[keys[i].second];
+		int position = static_cast<int>(pointIndices.size());
+		if (cellList.empty() || cellList.back().key != keys[i].first)
+		{
+			Cell cell;
+			cell.key = keys[i].first;
+			cell.begin = position;
+			cell.end = position;
+			cellList.push_back(cell);
+		}
+		cellList.back().end = position + 1;
+		xs.push_back(point.x);
+		ys.push_back(point.y);
+		zs.push_back(point.z);
+		pointIndices.push_back(keys[i].second);
+	}
+
+	// each cell weighted by its points, as the queries fall where the points are
+	double cellPoints = 0.0;
+	for (int i = 0; i < cellList.size(); ++i) cellPoints += static_cast<double>(cellList[i].end - cellList[i].begin) * (cellList[i].end - cellList[i].begin);
+	if (!pointIndices.empty() && cellPoints > maxCellPoints * pointIndices.size())
+	{
+		std::vector<float>().swap(xs);
+		std::vector<float>().swap(ys);
+		std::vector<float>().swap(zs);
+		std::vector<int>().swap(pointIndices);
+		return;
+	}
+	valid = true;
+
+	unsigned long long tableSize = 16;
+	while (tableSize < 2 * cellList.size()) tableSize <<= 1;
+	cellMask = tableSize - 1;
+	Cell empty;
+	empty.key = 0;
+	empty.begin = -1;
+	empty.end = -1;
+	cells.assign(static_cast<size_t>(tableSize), empty);
+	for (int i = 0; i < cellList.size(); ++i)
+	{
+		unsigned long long slot = mixKey(cellList[i].key) & cellMask;
+		while (cells[slot].begin >= 0) slot = (slot + 1) & cellMask;
+		cells[slot] = cellList[i];
+	}
+}
+
+bool VoxelHashSearch::nearest(int queryIndex, const PointType &query, int &match, float &sqrDistance)
+{
+	return nearest(query, match, sqrDistance);
+}
+
+bool VoxelHashSearch::nearest(const PointType &query, int &match, float &sqrDistance) const
+{
+	if (cells.empty()) return false;
+	if ( !pcl_isfinite(query.x) || !pcl_isfinite(query.y) || !pcl_isfinite(query.z) ) return false;
+
+	float cellSize = 1.0f / inverseCellSize;
+	float q[3] = {query.x, query.y, query.z};
+	int c[3];
+	// distance from the query to the lower and upper neighbour cell along each axis, shrunk a little against rounding
+	float gap[3][3];
+	for (int a = 0; a < 3; ++a)
+	{
+		c[a] = static_cast<int>(floorf(q[a] * inverseCellSize));
+		float offset = q[a] - c[a] * cellSize;
+		gap[a][0] = std::max(0.0f, offset - 1e-4f * cellSize);
+		gap[a][1] = 0.0f;
+		gap[a][2] = std::max(0.0f, cellSize - offset - 1e-4f * cellSize);
+	}
+
+	float best = radius * radius;
+	int best_index = -1;
+	for (int dx = 0; dx < 3; ++dx)
+	{
+		// the centre cell first, it most likely holds the match and tightens the bound for the others
+		int ix = (dx + 1) % 3;
+		for (int dy = 0; dy < 3; ++dy)
+		{
+			int iy = (dy + 1) % 3;
+			for (int dz = 0; dz < 3; ++dz)
+			{
+				int iz = (dz + 1) % 3;
+				float bound = gap[0][ix] * gap[0][ix] + gap[1][iy] * gap[1][iy] + gap[2][iz] * gap[2][iz];
+				if (bound >= best) continue;
+
+				const Cell *cell = findCell(cellKey(c[0] + ix - 1, c[1] + iy - 1, c[2] + iz - 1));
+				if (!cell) continue;
+
+				int n = cell->end - cell->begin;
+				Eigen::Map<const Eigen::ArrayXf> x(&xs[cell->begin], n);
+				Eigen::Map<const Eigen::ArrayXf> y(&ys[cell->begin], n);
+				Eigen::Map<const Eigen::ArrayXf> z(&zs[cell->begin], n);
+				int j;
+				float d = ((x - q[0]).square() + (y - q[1]).square() + (z - q[2]).square()).minCoeff(&j);
+				if (d < best)
+				{
+					best = d;
+					best_index = pointIndices[cell->begin + j];
+				}
+			}
+		}
+	}
+
+	if (best_index < 0) return false;
+	match = best_index;
+	sqrDistance = best;
+	return true;
+}
@@ -0,0 +1,84 @@
+#include "../include/warmstartsearch.h"
+
+using namespace registar;
+
+WarmStartSearch::WarmStartSearch() : maxSteps(32), warm(false) {}
+
+WarmStartSearch::~WarmStartSearch(){}
+
+void WarmStartSearch::setTarget(CloudDataConstPtr cloudData, KdTreePtr tree, NeighbourTableConstPtr neighbourTable)
+{
+	if (this->cloudData != cloudData) reset();
+	this->cloudData = cloudData;
+	this->tree = tree;
+	this->neighbourTable = neighbourTable;
+}
+
+void WarmStartSearch::setQueryNumber(int queryNumber)
+{
+	if (previousMatches.size() != queryNumber)
+	{
+		previousMatches.assign(queryNumber, -1);
+		warm = false;
+	}
+}
+
+void WarmStartSearch::reset()
+{
+	previousMatches.assign(previousMatches.size(), -1);
+	warm = false;
+}
+
+bool WarmStartSearch::nearest(int queryIndex, const PointType &query, int &match, float &sqrDistance)
+{
+	const CloudData &target = *cloudData;
+	Eigen::Vector3f q = query.getVector3fMap();
+
+	int current = previousMatches[queryIndex];
+	if (neighbourTable && neighbourTable->size() == target.size() && current >= 0)
+	{
+		float current_sqrDistance = (target[current].getVector3fMap() - q).squaredNorm();
+		for (int step = 0; step < maxSteps; ++step)
+		{
+			int n = neighbourTable->getNeighbourNumber(current);
+			const int *row_indices = neighbourTable->getIndices(current);
+			int best = current;
+			float best_sqrDistance = current_sqrDistance;
+			for (int j = 0; j < n; ++j)
+			{
+				float d = (target[row_indices[j]].getVector3fMap() - q).squaredNorm();
+				if (d < best_sqrDistance)
+				{
+					best = row_indices[j];
+					best_sqrDistance = d;
+				}
+			}
+			if (best == current)
+			{
+				// a local minimum, exact if no point within twice the distance is missing from the row
+				if (neighbourTable->coversRadius(current, 2.0f * sqrtf(current_sqrDistance)))
+				{
+					match = current;
+					sqrDistance = current_sqrDistance;
+					previousMatches[queryIndex] = match;
+					return true;
+				}
+				break;
+			}
+			current = best;
+			current_sqrDistance = best_sqrDistance;
+		}
+	}
+
+	std::vector<int> indices(1);
+	std::vector<float> sqrDistances(1);
+	if (tree->nearestKSearch(query, 1, indices, sqrDistances) > 0)
+	{
+		match = indices[0];
+		sqrDistance = sqrDistances[0];
+		previousMatches[queryIndex] = match;
+		return true;
+	}
+	previousMatches[queryIndex] = -1;
+	return false;
+}